@@ -0,0 +1,243 @@
+// Compression codecs on the payloads that dominate RPC bandwidth.
+//
+// For each codec this build has (and "none" as the baseline) it measures
+// the size ratio and compress/decompress throughput of whole frames as the
+// server would send them:
+//
+//   fs.read       one reply carrying the source files under --corpus
+//   block.get     one reply carrying a block with a long build log
+//   block.output  a stream of small output notifications, compressed with
+//                 one context for the stream ("stream") and with a fresh
+//                 context per message ("fresh"), to show what reusing the
+//                 context is worth
+//
+// The report is JSON, on stdout or in --json FILE.
+//
+//   compression_bench [--corpus DIR] [--notifications N] [--min-ms N]
+//                     [--json FILE]
+
+#include "si/rpc/compression.hpp"
+#include "si/rpc/encoding.hpp"
+#include "si/shell/block.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using namespace si::rpc;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+constexpr WireFormat kFormat{WireEncoding::Json, Framing::LengthPrefixed};
+
+struct Options {
+  std::string corpus =
+      (std::filesystem::path(__FILE__).parent_path().parent_path() / "src")
+          .string();
+  int notifications = 5000;
+  int min_ms = 300;
+  std::string json_path;
+};
+
+// Deterministic stand-in for terminal output
+class Lines {
+public:
+  std::string next() {
+    seed_ = seed_ * 1103515245 + 12345;
+    unsigned r = seed_ >> 8;
+    switch (r % 4) {
+    case 0:
+      return "[" + std::to_string(r % 100) +
+             "%] Building CXX object src/rpc/CMakeFiles/rpc_server.dir/" +
+             kNames[r % 6] + ".cpp.o\r\n";
+    case 1:
+      return "-rw-r--r--  1 dev staff " + std::to_string(r % 99991) +
+             " Oct " + std::to_string(r % 28 + 1) + " 12:" +
+             std::to_string(r % 50 + 10) + " " + kNames[r % 6] + ".hpp\r\n";
+    case 2:
+      return "\x1b[32mPASS\x1b[0m tests/" + std::string(kNames[r % 6]) +
+             " (" + std::to_string(r % 900) + " ms)\r\n";
+    default:
+      return "warning: unused variable 'tmp" + std::to_string(r % 1000) +
+             "' [-Wunused-variable]\r\n";
+    }
+  }
+
+private:
+  static constexpr const char *kNames[] = {
+      "server", "encoding", "outbound", "event_loop", "worker_pool", "shm"};
+  uint32_t seed_ = 7;
+};
+
+std::string read_corpus(const std::string &dir) {
+  std::string text;
+  std::error_code ec;
+  for (auto it = std::filesystem::recursive_directory_iterator(dir, ec);
+       !ec && it != std::filesystem::recursive_directory_iterator();
+       it.increment(ec)) {
+    if (!it->is_regular_file())
+      continue;
+    std::ifstream file(it->path(), std::ios::binary);
+    text.append(std::istreambuf_iterator<char>(file),
+                std::istreambuf_iterator<char>());
+    if (text.size() > 10 * 1024 * 1024)
+      break;
+  }
+  return text;
+}
+
+std::vector<std::string> make_block_output(int count) {
+  Lines lines;
+  std::vector<std::string> frames;
+  for (int i = 0; i < count; i++) {
+    std::string data;
+    int n = 10 + i % 30;
+    for (int j = 0; j < n; j++)
+      data += lines.next();
+    frames.push_back(encode_notification(
+        "block.output",
+        {{"block_id", "6f1d0c2e-5d3a-4d7c-9a51-0b8e7c3f2a19"},
+         {"data", data},
+         {"type", "stdout"},
+         {"seq_start", i},
+         {"seq_end", i}},
+        kFormat, true));
+  }
+  return frames;
+}
+
+std::string make_block_get() {
+  Lines lines;
+  si::shell::Block block;
+  block.id = "6f1d0c2e-5d3a-4d7c-9a51-0b8e7c3f2a19";
+  block.command = "cmake --build build -j8";
+  for (int i = 0; i < 4000; i++) {
+    std::string data;
+    for (int j = 0; j < 8; j++)
+      data += lines.next();
+    block.add_output(data, "stdout");
+  }
+  return encode_response(1, nlohmann::json(block), kFormat);
+}
+
+// Compress and decompress `frames` as one stream (or one context per frame)
+// until min_ms have passed; report per-pass averages
+nlohmann::json measure(Compression compression,
+                       const std::vector<std::string> &frames,
+                       bool fresh_context, int min_ms) {
+  size_t in_bytes = 0;
+  for (const auto &frame : frames)
+    in_bytes += frame.size();
+  if (compression == Compression::None)
+    return {{"bytes_in", in_bytes}, {"bytes_out", in_bytes}, {"ratio", 1.0}};
+
+  std::vector<std::string> compressed(frames.size());
+  size_t out_bytes = 0;
+  int passes = 0;
+  auto start = Clock::now();
+  do {
+    auto compressor = Compressor::create(compression);
+    out_bytes = 0;
+    for (size_t i = 0; i < frames.size(); i++) {
+      if (fresh_context && i > 0)
+        compressor = Compressor::create(compression);
+      compressed[i] = compress_frame(*compressor, frames[i]);
+      out_bytes += compressed[i].size();
+    }
+    passes++;
+  } while (Clock::now() - start < std::chrono::milliseconds(min_ms));
+  double compress_s =
+      std::chrono::duration<double>(Clock::now() - start).count() / passes;
+
+  passes = 0;
+  bool intact = true;
+  std::string out;
+  start = Clock::now();
+  do {
+    auto decompressor = Decompressor::create(compression);
+    for (size_t i = 0; i < frames.size(); i++) {
+      if (fresh_context && i > 0)
+        decompressor = Decompressor::create(compression);
+      out.clear();
+      const auto &frame = compressed[i];
+      intact &= decompressor->decompress(frame.data() + kFrameHeaderSize,
+                                         frame.size() - kFrameHeaderSize, out,
+                                         64 * 1024 * 1024) &&
+                out.size() + kFrameHeaderSize == frames[i].size();
+    }
+    passes++;
+  } while (Clock::now() - start < std::chrono::milliseconds(min_ms));
+  double decompress_s =
+      std::chrono::duration<double>(Clock::now() - start).count() / passes;
+
+  double mb = in_bytes / 1e6;
+  return {{"bytes_in", in_bytes},
+          {"bytes_out", out_bytes},
+          {"ratio", double(out_bytes) / in_bytes},
+          {"compress_mb_s", mb / compress_s},
+          {"decompress_mb_s", mb / decompress_s},
+          {"intact", intact}};
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (std::strcmp(argv[i], "--corpus") == 0)
+      options.corpus = argv[i + 1];
+    else if (std::strcmp(argv[i], "--notifications") == 0)
+      options.notifications = std::atoi(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--min-ms") == 0)
+      options.min_ms = std::atoi(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--json") == 0)
+      options.json_path = argv[i + 1];
+  }
+
+  std::string corpus = read_corpus(options.corpus);
+  if (corpus.empty()) {
+    std::fprintf(stderr, "nothing to read under %s\n", options.corpus.c_str());
+    return 1;
+  }
+  std::vector<std::string> fs_read = {encode_response(1, corpus, kFormat)};
+  std::vector<std::string> block_get = {make_block_get()};
+  auto block_output = make_block_output(options.notifications);
+
+  std::vector<std::string> codecs = {"none"};
+  for (const auto &name : available_compressions())
+    codecs.push_back(name);
+
+  nlohmann::json results = nlohmann::json::object();
+  for (const auto &name : codecs) {
+    Compression compression;
+    parse_compression(name, compression);
+    std::fprintf(stderr, "%s...\n", name.c_str());
+    results[name] = {
+        {"fs.read", measure(compression, fs_read, false, options.min_ms)},
+        {"block.get", measure(compression, block_get, false, options.min_ms)},
+        {"block.output",
+         {{"stream",
+           measure(compression, block_output, false, options.min_ms)},
+          {"fresh",
+           measure(compression, block_output, true, options.min_ms)}}}};
+  }
+
+  nlohmann::json report = {
+      {"config",
+       {{"corpus", options.corpus},
+        {"corpus_bytes", corpus.size()},
+        {"notifications", options.notifications}}},
+      {"codecs", results}};
+  if (options.json_path.empty()) {
+    std::printf("%s\n", report.dump(2).c_str());
+  } else {
+    std::ofstream(options.json_path) << report.dump(2) << "\n";
+  }
+  return 0;
+}
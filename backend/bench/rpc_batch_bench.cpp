@@ -0,0 +1,214 @@
+// Cold-start restore benchmark: one request per round trip vs. batches.
+//
+// Simulates what the frontend does when it restores a window:
+// session.list, then block.list and session.get_config for every session,
+// then settings.get per category. Handlers sleep for --latency-us to stand
+// in for disk access.
+//
+//   rpc_batch_bench [--sessions N] [--iterations N] [--latency-us N]
+
+#include "si/foundation/logging.hpp"
+#include "si/rpc/server.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace si::rpc;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+const char *kCategories[] = {"general", "appearance", "ai",
+                             "terminal", "keybindings", "privacy"};
+
+class Client {
+public:
+  explicit Client(const std::string &path) {
+    fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    if (connect(fd_, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+      close(fd_);
+      fd_ = -1;
+    }
+  }
+  ~Client() {
+    if (fd_ >= 0)
+      close(fd_);
+  }
+
+  bool ok() const { return fd_ >= 0; }
+  int round_trips() const { return round_trips_; }
+
+  // Send one message and wait for its reply line
+  nlohmann::json call(const nlohmann::json &message) {
+    std::string line = message.dump() + "\n";
+    send(fd_, line.data(), line.size(), 0);
+    round_trips_++;
+
+    size_t pos;
+    while ((pos = buf_.find('\n')) == std::string::npos) {
+      char tmp[65536];
+      ssize_t n = recv(fd_, tmp, sizeof(tmp), 0);
+      if (n <= 0)
+        return nullptr;
+      buf_.append(tmp, n);
+    }
+    auto reply = nlohmann::json::parse(buf_.substr(0, pos));
+    buf_.erase(0, pos + 1);
+    return reply;
+  }
+
+private:
+  int fd_ = -1;
+  int round_trips_ = 0;
+  std::string buf_;
+};
+
+nlohmann::json request(const std::string &method, nlohmann::json params,
+                       int id) {
+  return {{"jsonrpc", "2.0"},
+          {"method", method},
+          {"params", std::move(params)},
+          {"id", id}};
+}
+
+std::vector<nlohmann::json> restore_calls(const nlohmann::json &sessions) {
+  std::vector<nlohmann::json> calls;
+  int id = 2;
+  for (const auto &s : sessions) {
+    calls.push_back(request("block.list", {{"session_id", s["id"]}}, id++));
+    calls.push_back(
+        request("session.get_config", {{"session_id", s["id"]}}, id++));
+  }
+  for (const char *category : kCategories)
+    calls.push_back(request("settings.get", {{"category", category}}, id++));
+  return calls;
+}
+
+// Returns the number of round trips
+int restore_sequential(Client &client) {
+  auto sessions = client.call(request("session.list", {}, 1))["result"];
+  for (const auto &call : restore_calls(sessions))
+    client.call(call);
+  return client.round_trips();
+}
+
+int restore_batched(Client &client) {
+  auto sessions = client.call(request("session.list", {}, 1))["result"];
+  auto calls = restore_calls(sessions);
+  client.call(nlohmann::json(calls));
+  return client.round_trips();
+}
+
+void register_handlers(int sessions, int latency_us) {
+  auto &rpc = RpcServer::instance();
+  auto disk = [latency_us]() {
+    std::this_thread::sleep_for(std::chrono::microseconds(latency_us));
+  };
+
+  rpc.register_method(
+      "session.list",
+      [sessions](const nlohmann::json &) {
+        auto list = nlohmann::json::array();
+        for (int i = 0; i < sessions; i++)
+          list.push_back({{"id", "session-" + std::to_string(i)},
+                          {"name", "Session " + std::to_string(i)}});
+        return list;
+      },
+      MethodClass::Inline);
+  rpc.register_method("block.list", [disk](const nlohmann::json &) {
+    disk();
+    return nlohmann::json::array();
+  });
+  rpc.register_method(
+      "session.get_config",
+      [](const nlohmann::json &) {
+        return nlohmann::json{{"cwd", "/home/user"}, {"shell", "/bin/bash"}};
+      },
+      MethodClass::Inline);
+  rpc.register_method("settings.get", [disk](const nlohmann::json &) {
+    disk();
+    return nlohmann::json::object();
+  });
+}
+
+struct Result {
+  int round_trips = 0;
+  std::vector<double> ms;
+};
+
+void report(const char *mode, Result &r) {
+  std::sort(r.ms.begin(), r.ms.end());
+  double sum = 0;
+  for (double v : r.ms)
+    sum += v;
+  std::printf("%-10s round_trips=%-4d mean=%.3fms p50=%.3fms p95=%.3fms\n",
+              mode, r.round_trips, sum / r.ms.size(), r.ms[r.ms.size() / 2],
+              r.ms[r.ms.size() * 95 / 100]);
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+  int sessions = 8;
+  int iterations = 200;
+  int latency_us = 200;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (std::strcmp(argv[i], "--sessions") == 0)
+      sessions = std::atoi(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--iterations") == 0)
+      iterations = std::atoi(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--latency-us") == 0)
+      latency_us = std::atoi(argv[i + 1]);
+  }
+
+  si::foundation::Logger::instance().init("rpc_batch_bench.log",
+                                          si::foundation::Logger::Level::Warn,
+                                          si::foundation::Logger::Level::Warn);
+  register_handlers(sessions, latency_us);
+
+  auto &rpc = RpcServer::instance();
+  std::string path = "/tmp/si_bench_" + std::to_string(getpid()) + ".sock";
+  if (!rpc.start(path)) {
+    std::fprintf(stderr, "failed to start RPC server on %s\n", path.c_str());
+    return 1;
+  }
+
+  std::printf("sessions=%d iterations=%d latency_us=%d\n", sessions,
+              iterations, latency_us);
+
+  Result sequential, batched;
+  for (int i = 0; i < iterations; i++) {
+    for (auto *result : {&sequential, &batched}) {
+      Client client(path);
+      if (!client.ok()) {
+        std::fprintf(stderr, "failed to connect\n");
+        rpc.stop();
+        return 1;
+      }
+      auto begin = Clock::now();
+      result->round_trips = result == &sequential ? restore_sequential(client)
+                                                  : restore_batched(client);
+      result->ms.push_back(
+          std::chrono::duration<double, std::milli>(Clock::now() - begin)
+              .count());
+    }
+  }
+
+  report("sequential", sequential);
+  report("batched", batched);
+
+  rpc.stop();
+  return 0;
+}
@@ -0,0 +1,481 @@
+// RPC server load generator and latency benchmark.
+//
+// Opens --clients Unix-socket connections, each replaying a weighted mix of
+// methods one request at a time for --duration-s seconds. A client lists
+// and reads the config of one session of its own and runs its commands in
+// a second one, so block.list stays small while command output streams in.
+// It runs at most one block.execute at a time and at most --commands in
+// total: every command's output stays in the server's memory.
+//
+// Without --socket the server runs in-process with the real API bindings
+// and a scratch HOME. A probe thread then appends a timestamp to a block of
+// each client every --probe-ms; how long that takes to arrive as a
+// block.output notification is the notification latency.
+//
+// The report is JSON, on stdout or in --json FILE, for comparing builds:
+//
+//   si_rpc_bench [--clients N] [--duration-s N] [--output-bytes N]
+//                [--commands N] [--probe-ms N] [--socket PATH]
+//                [--mix block.list=30,settings.get=30,...] [--json FILE]
+
+#include "si/foundation/logging.hpp"
+#include "si/rpc/api_bindings.hpp"
+#include "si/rpc/method_stats.hpp"
+#include "si/rpc/server.hpp"
+#include "si/shell/block_manager.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <poll.h>
+#include <random>
+#include <set>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace si::rpc;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+const char *kCategories[] = {"general", "appearance", "ai", "terminal"};
+constexpr int kReplyTimeoutMs = 30000;
+constexpr auto kDrainTimeout = std::chrono::seconds(120);
+
+uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             Clock::now().time_since_epoch())
+      .count();
+}
+
+struct Options {
+  int clients = 4;
+  int duration_s = 10;
+  uint64_t output_bytes = 100 * 1024 * 1024;
+  int commands = 2;
+  int probe_ms = 10;
+  std::string socket;
+  std::string json_path;
+  std::vector<std::pair<std::string, int>> mix = {{"block.list", 30},
+                                                  {"session.get_config", 30},
+                                                  {"settings.get", 30},
+                                                  {"block.execute", 10}};
+};
+
+// "method=weight,..."; returns false if malformed
+bool parse_mix(const std::string &spec,
+               std::vector<std::pair<std::string, int>> &mix) {
+  mix.clear();
+  size_t start = 0;
+  while (start < spec.size()) {
+    size_t end = spec.find(',', start);
+    if (end == std::string::npos)
+      end = spec.size();
+    std::string item = spec.substr(start, end - start);
+    size_t eq = item.find('=');
+    if (eq == 0 || eq == std::string::npos)
+      return false;
+    int weight = std::atoi(item.c_str() + eq + 1);
+    if (weight < 0)
+      return false;
+    mix.emplace_back(item.substr(0, eq), weight);
+    start = end + 1;
+  }
+  return !mix.empty();
+}
+
+struct MethodResult {
+  LatencyHistogram latency;
+  std::atomic<uint64_t> errors{0};
+};
+
+// Shared by every client thread; recording never takes a lock
+struct Results {
+  std::map<std::string, MethodResult> methods; // filled before clients start
+  LatencyHistogram requests;
+  LatencyHistogram notifications; // probe output to block.output arrival
+  std::atomic<uint64_t> failed_requests{0};
+  std::atomic<uint64_t> output_notifications{0};
+  std::atomic<uint64_t> output_bytes{0};
+  std::atomic<uint64_t> commands_started{0};
+  std::atomic<uint64_t> commands_completed{0};
+};
+
+class Client {
+public:
+  Client(const std::string &path, Results &results,
+         const std::string &probe_block)
+      : results_(results), probe_block_(probe_block) {
+    fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    if (connect(fd_, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+      close(fd_);
+      fd_ = -1;
+    }
+  }
+  ~Client() {
+    if (fd_ >= 0)
+      close(fd_);
+  }
+
+  bool ok() const { return fd_ >= 0; }
+  bool command_running() const { return !running_.empty(); }
+
+  // Send one request and wait for its reply, handling the notifications
+  // that arrive first. Null if the connection failed or timed out.
+  nlohmann::json call(const std::string &method, nlohmann::json params) {
+    int id = next_id_++;
+    std::string line = nlohmann::json{{"jsonrpc", "2.0"},
+                                      {"method", method},
+                                      {"params", std::move(params)},
+                                      {"id", id}}
+                           .dump() +
+                       "\n";
+    if (send(fd_, line.data(), line.size(), MSG_NOSIGNAL) !=
+        static_cast<ssize_t>(line.size()))
+      return nullptr;
+
+    nlohmann::json message;
+    while (read_message(message, kReplyTimeoutMs)) {
+      auto it = message.find("id");
+      if (it != message.end() && *it == id)
+        return message;
+      on_notification(message);
+    }
+    return nullptr;
+  }
+
+  // Called with the block.execute reply
+  void command_started(const std::string &block_id) {
+    results_.commands_started.fetch_add(1, std::memory_order_relaxed);
+    // Its block.complete may have come in before the reply
+    if (completed_early_.erase(block_id) == 0)
+      running_ = block_id;
+  }
+
+  // Handle notifications until the running command completes
+  void drain(Clock::time_point deadline) {
+    nlohmann::json message;
+    while (command_running()) {
+      auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - Clock::now());
+      if (left.count() <= 0 ||
+          !read_message(message, static_cast<int>(left.count())))
+        return;
+      on_notification(message);
+    }
+  }
+
+private:
+  bool read_message(nlohmann::json &message, int timeout_ms) {
+    while (true) {
+      size_t pos = buf_.find('\n', start_);
+      if (pos != std::string::npos) {
+        message =
+            nlohmann::json::parse(buf_.data() + start_, buf_.data() + pos);
+        start_ = pos + 1;
+        return true;
+      }
+      if (start_ > 0) {
+        buf_.erase(0, start_);
+        start_ = 0;
+      }
+      struct pollfd pfd = {fd_, POLLIN, 0};
+      if (poll(&pfd, 1, timeout_ms) <= 0)
+        return false;
+      char tmp[65536];
+      ssize_t n = recv(fd_, tmp, sizeof(tmp), 0);
+      if (n <= 0)
+        return false;
+      buf_.append(tmp, n);
+    }
+  }
+
+  void on_notification(const nlohmann::json &message) {
+    const std::string method = message.value("method", "");
+    const auto &params = message["params"];
+    if (method == "block.output") {
+      const auto &data = params["data"].get_ref<const std::string &>();
+      if (params["block_id"] == probe_block_) {
+        uint64_t arrived = now_ns();
+        for (size_t pos = data.find("probe:"); pos != std::string::npos;
+             pos = data.find("probe:", pos + 1)) {
+          uint64_t sent = std::strtoull(data.c_str() + pos + 6, nullptr, 10);
+          results_.notifications.record(arrived - sent);
+        }
+        return;
+      }
+      results_.output_notifications.fetch_add(1, std::memory_order_relaxed);
+      results_.output_bytes.fetch_add(data.size(), std::memory_order_relaxed);
+    } else if (method == "block.complete") {
+      std::string block_id = params.value("block_id", "");
+      if (block_id == probe_block_)
+        return;
+      results_.commands_completed.fetch_add(1, std::memory_order_relaxed);
+      if (block_id == running_)
+        running_.clear();
+      else
+        completed_early_.insert(block_id);
+    }
+  }
+
+  int fd_ = -1;
+  int next_id_ = 1;
+  std::string buf_;
+  size_t start_ = 0; // first unread byte of buf_
+  Results &results_;
+  std::string probe_block_;
+  std::string running_; // block of the command in flight
+  std::set<std::string> completed_early_;
+};
+
+nlohmann::json make_params(const std::string &method, int index,
+                           const Options &options, std::mt19937 &rng) {
+  std::string session = "bench-" + std::to_string(index);
+  if (method == "block.list" || method == "session.get_config")
+    return {{"session_id", session}};
+  if (method == "settings.get")
+    return {{"category", kCategories[rng() % 4]}};
+  if (method == "block.execute")
+    return {{"session_id", session + "-run"},
+            {"command",
+             "yes | head -c " + std::to_string(options.output_bytes)}};
+  return nlohmann::json::object();
+}
+
+void run_client(int index, const std::string &path, const Options &options,
+                const std::string &probe_block, Clock::time_point end,
+                Results &results) {
+  Client client(path, results, probe_block);
+  if (!client.ok()) {
+    std::fprintf(stderr, "client %d: failed to connect\n", index);
+    return;
+  }
+  std::string session = "bench-" + std::to_string(index);
+  client.call("rpc.subscribe", {{"session_id", session}});
+  client.call("rpc.subscribe", {{"session_id", session + "-run"}});
+
+  // block.execute is skipped while a command runs or once --commands ran
+  std::vector<double> weights, idle_weights;
+  for (const auto &[method, weight] : options.mix) {
+    weights.push_back(weight);
+    idle_weights.push_back(method == "block.execute" ? 0 : weight);
+  }
+  bool only_commands = true;
+  for (double w : idle_weights)
+    only_commands = only_commands && w == 0;
+  std::discrete_distribution<size_t> pick(weights.begin(), weights.end());
+  std::discrete_distribution<size_t> pick_idle(idle_weights.begin(),
+                                               idle_weights.end());
+  std::mt19937 rng(static_cast<unsigned>(index));
+  int commands = 0;
+
+  while (Clock::now() < end) {
+    bool may_execute = !client.command_running() && commands < options.commands;
+    if (!may_execute && only_commands) {
+      client.drain(end);
+      if (client.command_running())
+        break;
+      continue;
+    }
+    const auto &method =
+        options.mix[may_execute ? pick(rng) : pick_idle(rng)].first;
+    auto params = make_params(method, index, options, rng);
+
+    uint64_t begin = now_ns();
+    auto reply = client.call(method, std::move(params));
+    uint64_t latency = now_ns() - begin;
+    if (reply.is_null()) {
+      results.failed_requests.fetch_add(1, std::memory_order_relaxed);
+      std::fprintf(stderr, "client %d: no reply to %s\n", index,
+                   method.c_str());
+      return;
+    }
+    auto &result = results.methods.at(method);
+    result.latency.record(latency);
+    results.requests.record(latency);
+    if (reply.contains("error")) {
+      result.errors.fetch_add(1, std::memory_order_relaxed);
+    } else if (method == "block.execute") {
+      commands++;
+      client.command_started(reply["result"].value("block_id", ""));
+    }
+  }
+  client.drain(Clock::now() + kDrainTimeout);
+  if (client.command_running())
+    std::fprintf(stderr, "client %d: command still running\n", index);
+}
+
+nlohmann::json histogram_json(const LatencyHistogram &histogram) {
+  auto s = histogram.snapshot();
+  auto us = [](uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+  return {{"count", s.count},
+          {"mean_us", s.count ? us(s.sum_ns) / s.count : 0.0},
+          {"p50_us", us(s.percentile(50))},
+          {"p99_us", us(s.percentile(99))},
+          {"p999_us", us(s.percentile(99.9))},
+          {"max_us", us(s.max_ns)}};
+}
+
+// Point HOME and the XDG directories at a scratch directory so the
+// in-process server does not touch the user's sessions or settings
+std::filesystem::path make_scratch_home() {
+  char dir[] = "/tmp/si_rpc_bench_XXXXXX";
+  if (!mkdtemp(dir))
+    return {};
+  for (const char *var :
+       {"HOME", "XDG_CONFIG_HOME", "XDG_CACHE_HOME", "XDG_DATA_HOME"})
+    setenv(var, dir, 1);
+  return dir;
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (std::strcmp(argv[i], "--clients") == 0)
+      options.clients = std::atoi(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--duration-s") == 0)
+      options.duration_s = std::atoi(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--output-bytes") == 0)
+      options.output_bytes = std::strtoull(argv[i + 1], nullptr, 10);
+    else if (std::strcmp(argv[i], "--commands") == 0)
+      options.commands = std::atoi(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--probe-ms") == 0)
+      options.probe_ms = std::atoi(argv[i + 1]);
+    else if (std::strcmp(argv[i], "--socket") == 0)
+      options.socket = argv[i + 1];
+    else if (std::strcmp(argv[i], "--json") == 0)
+      options.json_path = argv[i + 1];
+    else if (std::strcmp(argv[i], "--mix") == 0 &&
+             !parse_mix(argv[i + 1], options.mix)) {
+      std::fprintf(stderr, "bad --mix: %s\n", argv[i + 1]);
+      return 1;
+    }
+  }
+  options.clients = std::max(options.clients, 1);
+  options.probe_ms = std::max(options.probe_ms, 1);
+
+  bool in_process = options.socket.empty();
+  std::filesystem::path scratch;
+  if (in_process) {
+    scratch = make_scratch_home();
+    if (scratch.empty()) {
+      std::fprintf(stderr, "failed to create a scratch HOME\n");
+      return 1;
+    }
+  }
+  si::foundation::Logger::instance().init(
+      in_process ? (scratch / "si.log").string() : "si_rpc_bench.log",
+      si::foundation::Logger::Level::Warn, si::foundation::Logger::Level::Warn);
+
+  auto &rpc = RpcServer::instance();
+  auto &blocks = si::shell::BlockManager::instance();
+  std::string path = options.socket;
+  std::vector<std::string> probe_blocks(options.clients);
+  if (in_process) {
+    register_api_bindings();
+    path = (scratch / "si.sock").string();
+    if (!rpc.start(path)) {
+      std::fprintf(stderr, "failed to start RPC server on %s\n", path.c_str());
+      return 1;
+    }
+    for (int i = 0; i < options.clients; i++)
+      probe_blocks[i] =
+          blocks.create_block("bench-" + std::to_string(i), "probe");
+  }
+
+  Results results;
+  for (const auto &[method, weight] : options.mix)
+    results.methods[method];
+
+  std::atomic<bool> probing{in_process};
+  std::thread probe([&] {
+    while (probing.load()) {
+      for (const auto &block_id : probe_blocks)
+        blocks.append_output(block_id,
+                             "probe:" + std::to_string(now_ns()) + "\n");
+      std::this_thread::sleep_for(std::chrono::milliseconds(options.probe_ms));
+    }
+  });
+
+  std::fprintf(stderr, "clients=%d duration_s=%d output_bytes=%llu%s\n",
+               options.clients, options.duration_s,
+               static_cast<unsigned long long>(options.output_bytes),
+               in_process ? " (in-process server)" : "");
+  auto begin = Clock::now();
+  auto end = begin + std::chrono::seconds(options.duration_s);
+  std::vector<std::thread> clients;
+  for (int i = 0; i < options.clients; i++)
+    clients.emplace_back(run_client, i, std::cref(path), std::cref(options),
+                         std::cref(probe_blocks[i]), end, std::ref(results));
+  for (auto &t : clients)
+    t.join();
+  double elapsed_s =
+      std::chrono::duration<double>(Clock::now() - begin).count();
+  probing = false;
+  probe.join();
+
+  // Requests stop at the end of the run; output is counted until the last
+  // command completed
+  auto requests = results.requests.snapshot();
+  uint64_t errors = 0;
+  nlohmann::json methods = nlohmann::json::object();
+  for (auto &[method, result] : results.methods) {
+    methods[method] = histogram_json(result.latency);
+    methods[method]["errors"] = result.errors.load();
+    errors += result.errors.load();
+  }
+  uint64_t output_bytes = results.output_bytes.load();
+  nlohmann::json report = {
+      {"config",
+       {{"clients", options.clients},
+        {"duration_s", options.duration_s},
+        {"output_bytes", options.output_bytes},
+        {"commands", options.commands},
+        {"mix", options.mix},
+        {"in_process", in_process}}},
+      {"elapsed_s", elapsed_s},
+      {"requests",
+       {{"count", requests.count},
+        {"errors", errors},
+        {"failed", results.failed_requests.load()},
+        {"per_s", requests.count / static_cast<double>(options.duration_s)},
+        {"latency", histogram_json(results.requests)}}},
+      {"methods", methods},
+      {"notifications",
+       in_process ? histogram_json(results.notifications) : nullptr},
+      {"output",
+       {{"commands_started", results.commands_started.load()},
+        {"commands_completed", results.commands_completed.load()},
+        {"notifications", results.output_notifications.load()},
+        {"bytes", output_bytes},
+        {"bytes_per_s", output_bytes / elapsed_s}}}};
+
+  if (options.json_path.empty()) {
+    std::printf("%s\n", report.dump(2).c_str());
+  } else {
+    std::ofstream(options.json_path) << report.dump(2) << "\n";
+  }
+
+  if (in_process) {
+    for (const auto &block_id : probe_blocks)
+      blocks.complete_block(block_id, 0);
+    rpc.stop();
+    std::error_code ec;
+    std::filesystem::remove_all(scratch, ec);
+  }
+  return results.failed_requests.load() == 0 ? 0 : 1;
+}
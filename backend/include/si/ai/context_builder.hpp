@@ -1,5 +1,6 @@
 #pragma once
 
+#include <mutex>
 #include <si/nlohmann/json.hpp>
 #include <string>
 #include <vector>
@@ -31,6 +32,8 @@ public:
 private:
   ContextBuilder() = default;
 
+  // RPC handlers run concurrently, so guard the shared cwd/session
+  std::mutex mutex_;
   std::string current_cwd_ = ".";
   std::string session_id_ = "default";
 };
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "si/foundation/cancellation.hpp"
 #include <functional>
 #include <memory>
 #include <optional>
@@ -17,6 +18,9 @@ struct CompletionRequest {
   int max_tokens = 2048;
   int timeout_seconds = 30;
   std::vector<std::string> stop_sequences;
+  // Aborts the request (and its HTTP connection) when cancelled; also caps
+  // the provider's timeouts at the deadline
+  std::shared_ptr<foundation::CancellationToken> cancel;
 };
 
 /**
@@ -27,6 +31,7 @@ struct CompletionResponse {
   int tokens_used = 0;
   float latency_ms = 0.0f;
   bool success = false;
+  bool cancelled = false;
   std::string error_message;
 };
 
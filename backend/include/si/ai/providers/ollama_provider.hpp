@@ -36,7 +36,8 @@ private:
   bool check_model_exists();
   std::string make_request(const std::string &endpoint,
                            const std::string &json_body, bool stream = false,
-                           TokenCallback callback = nullptr);
+                           TokenCallback callback = nullptr,
+                           foundation::CancellationToken *cancel = nullptr);
 };
 
 } // namespace si::ai
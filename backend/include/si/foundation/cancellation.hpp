@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace si::foundation {
+
+/**
+ * Cancellation signal for one unit of work, with an optional deadline.
+ *
+ * The requester calls cancel(); the worker polls is_cancelled() or
+ * registers callbacks that abort blocking I/O (e.g. shut a socket down).
+ * Passing the deadline also counts as cancelled; blocking calls should cap
+ * their own timeouts with remaining().
+ */
+class CancellationToken {
+public:
+  using Clock = std::chrono::steady_clock;
+  using Callback = std::function<void()>;
+
+  CancellationToken() = default;
+  explicit CancellationToken(Clock::time_point deadline);
+
+  CancellationToken(const CancellationToken &) = delete;
+  CancellationToken &operator=(const CancellationToken &) = delete;
+
+  // Runs the registered callbacks once, on the calling thread
+  void cancel();
+
+  // cancel() was called or the deadline has passed
+  bool is_cancelled() const;
+  bool deadline_exceeded() const;
+
+  bool has_deadline() const { return deadline_ != Clock::time_point::max(); }
+  Clock::time_point deadline() const { return deadline_; }
+
+  // Time left before the deadline, at most `cap`; zero once cancelled
+  std::chrono::milliseconds remaining(std::chrono::milliseconds cap) const;
+
+  // Call `callback` on cancel(), or right away if already cancelled.
+  // Returns an id for remove_callback.
+  size_t on_cancel(Callback callback);
+
+  // Unregister a callback. If cancel() is running it on another thread,
+  // waits for it to return, so whatever it captured can then be destroyed.
+  void remove_callback(size_t id);
+
+private:
+  const Clock::time_point deadline_ = Clock::time_point::max();
+  std::atomic<bool> cancelled_{false};
+
+  std::mutex mutex_;
+  std::condition_variable callbacks_done_;
+  std::map<size_t, Callback> callbacks_;
+  size_t next_id_ = 1;
+  bool running_callbacks_ = false;
+  std::thread::id cancelling_thread_;
+};
+
+// remaining() for an optional token
+inline std::chrono::milliseconds time_left(const CancellationToken *token,
+                                           std::chrono::milliseconds cap) {
+  return token ? token->remaining(cap) : cap;
+}
+
+/**
+ * Registers a cancel callback for the lifetime of a scope. A null token
+ * makes this a no-op.
+ */
+class CancellationCallback {
+public:
+  CancellationCallback(CancellationToken *token,
+                       CancellationToken::Callback callback);
+  ~CancellationCallback();
+
+  CancellationCallback(const CancellationCallback &) = delete;
+  CancellationCallback &operator=(const CancellationCallback &) = delete;
+
+private:
+  CancellationToken *token_;
+  size_t id_ = 0;
+};
+
+} // namespace si::foundation
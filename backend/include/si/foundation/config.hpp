@@ -4,6 +4,7 @@
 #include <memory>
 #include <optional>
 #include <string>
+#include <vector>
 
 namespace si::foundation {
 
@@ -53,6 +54,28 @@ public:
   bool get_explain_before_run() const;
   bool get_dry_run_available() const;
 
+  // RPC server settings
+  int get_rpc_max_queue_kb() const;
+  std::string get_rpc_slow_client_policy() const;
+  int get_rpc_max_frame_mb() const;
+  int get_rpc_compress_min_bytes() const;
+  // Per-client requests per second and burst for a method class ("inline",
+  // "blocking", "ai", "control"); 0 means unlimited
+  double get_rpc_rate_limit(const std::string &method_class,
+                            double fallback) const;
+  double get_rpc_rate_burst(const std::string &method_class,
+                            double fallback) const;
+  int get_rpc_shed_queue_per_thread() const;
+  int get_rpc_output_window_ms() const;
+  int get_rpc_output_max_kb() const;
+  int get_rpc_stats_log_interval_s() const;
+  int get_rpc_http_port() const; // 0 disables the HTTP transport
+  std::string get_rpc_http_host() const;
+  std::vector<std::string> get_rpc_http_allowed_origins() const;
+
+  // Block persistence: "log" (sessions.json plus a change log) or "sqlite"
+  std::string get_blocks_store() const;
+
   // Path settings
   std::filesystem::path get_history_file() const;
   std::filesystem::path get_cache_dir() const;
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string_view>
+
+namespace si::foundation {
+
+/**
+ * Whether `text` is well-formed UTF-8 (no overlong forms, surrogates or
+ * code points past U+10FFFF), i.e. whether it can be sent as a JSON string.
+ * ASCII is checked eight bytes at a time.
+ */
+bool is_valid_utf8(std::string_view text);
+
+} // namespace si::foundation
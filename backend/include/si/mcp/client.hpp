@@ -1,5 +1,6 @@
 #pragma once
 
+#include "si/foundation/cancellation.hpp"
 #include "transport.hpp"
 #include "types.hpp"
 #include <future>
@@ -30,17 +31,23 @@ public:
   std::vector<Tool> list_tools();
 
   /**
-   * Call a specific tool
+   * Call a specific tool. Cancelling `cancel` (or reaching its deadline)
+   * abandons the call and tells the server with notifications/cancelled.
    */
   ToolResult call_tool(const std::string &name,
-                       const nlohmann::json &arguments);
+                       const nlohmann::json &arguments,
+                       foundation::CancellationToken *cancel = nullptr);
 
 private:
   // Handles incoming JSON-RPC messages
   void handle_message(const std::string &msg);
 
   // Sends a request and waits for response (blocking)
-  nlohmann::json call(const std::string &method, const nlohmann::json &params);
+  nlohmann::json call(const std::string &method, const nlohmann::json &params,
+                      foundation::CancellationToken *cancel = nullptr);
+
+  // Forget a pending request and tell the server to stop working on it
+  void abandon(int id, const std::string &reason);
 
   std::unique_ptr<Transport> transport_;
   int next_id_ = 1;
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <chrono>
+
+namespace si::rpc {
+
+// Sustained requests per second and the burst allowed on top; a rate of 0
+// means no limit
+struct RateLimit {
+  double rate = 0;
+  double burst = 0;
+};
+
+/**
+ * Token bucket: holds up to `burst` tokens, refilled at `rate` per second.
+ * Not thread-safe.
+ */
+class TokenBucket {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  TokenBucket() = default;
+  explicit TokenBucket(RateLimit limit, Clock::time_point now = Clock::now())
+      : limit_(limit), tokens_(limit.burst), updated_(now) {}
+
+  // Take a token. If none is left, false with the wait until one will be.
+  bool take(Clock::time_point now, std::chrono::milliseconds &retry_after);
+
+private:
+  RateLimit limit_;
+  double tokens_ = 0;
+  Clock::time_point updated_;
+};
+
+} // namespace si::rpc
@@ -2,16 +2,114 @@
 
 #include "si/ai/context_builder.hpp"
 #include "si/ai/gateway.hpp"
+#include "si/rpc/handoff.hpp"
+#include "si/rpc/output_coalescer.hpp"
+#include "si/rpc/remote_nodes.hpp"
+#include "si/rpc/response_cache.hpp"
 #include "si/rpc/server.hpp"
 #include "si/settings/settings_manager.hpp"
 #include "si/shell/block_manager.hpp"
 #include "si/shell/executor.hpp"
 #include "si/shell/workflow_engine.hpp"
+#include "si/si.hpp"
+#include <algorithm>
+#include <chrono>
+#include <csignal>
 #include <filesystem>
 #include <fstream>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <unistd.h>
 
 namespace si::rpc {
 
+/**
+ * Batches block output into block.output notifications, and into
+ * block.output_ready doorbells for clients reading a shared-memory ring
+ */
+inline OutputCoalescer &block_output_coalescer() {
+  static OutputCoalescer coalescer([](OutputCoalescer::Output &&out) {
+    auto &rpc = RpcServer::instance();
+    // The data is moved, not copied, into the params; each wire format
+    // then serializes it once for all subscribers
+    rpc.publish("block.output",
+                {{"block_id", out.block_id},
+                 {"data", std::move(out.data)},
+                 {"type", out.type},
+                 {"seq_start", out.seq_start},
+                 {"seq_end", out.seq_end}},
+                {out.session_id, out.block_id, kTopicOutput});
+    if (!rpc.shm_channels().empty()) {
+      rpc.publish("block.output_ready",
+                  {{"block_id", out.block_id},
+                   {"session_id", out.session_id},
+                   {"seq_start", out.seq_start},
+                   {"seq_end", out.seq_end}},
+                  {out.session_id, out.block_id, kTopicOutputReady});
+    }
+  });
+  return coalescer;
+}
+
+/**
+ * Results of block.list, session.list, workflow.list and settings.get
+ */
+inline ResponseCache &list_response_cache() {
+  static ResponseCache cache;
+  return cache;
+}
+
+/**
+ * Version as handed to clients: the collection's counter offset by the
+ * server's start time, so a version kept across a restart cannot match
+ */
+inline uint64_t client_version(uint64_t version) {
+  static const uint64_t epoch =
+      static_cast<uint64_t>(
+          std::chrono::duration_cast<std::chrono::milliseconds>(
+              std::chrono::system_clock::now().time_since_epoch())
+              .count())
+      << 20;
+  return epoch + version;
+}
+
+/**
+ * Reply to a list-style method from the cache. A client that sends
+ * if_version gets {"data", "version"}, or {"not_modified": true,
+ * "version"} if its copy is current; others get the bare result as before.
+ * `version` must be read before `build` reads the collection.
+ */
+inline nlohmann::json reply_cached(const std::string &key, uint64_t version,
+                                   const nlohmann::json &p, CallContext &ctx,
+                                   const ResponseCache::Builder &build) {
+  version = client_version(version);
+  bool versioned = p.contains("if_version");
+  if (versioned) {
+    const auto &known = p["if_version"];
+    if (!known.is_null() && !known.is_number_unsigned())
+      throw std::invalid_argument("if_version must be an unsigned integer");
+    if (known == version)
+      return nlohmann::json{{"not_modified", true}, {"version", version}};
+  }
+  ctx.cached_reply = {list_response_cache().get(key, version, build),
+                      versioned};
+  return nullptr;
+}
+
+/**
+ * Forward a control call (block.input, block.kill, block.resize) for a
+ * block that runs on an agent; nullopt if the block is local
+ */
+inline std::optional<nlohmann::json>
+forward_to_node(const std::string &method, const nlohmann::json &p) {
+  std::string block_id = p.at("block_id").get<std::string>();
+  auto node = RemoteNodes::instance().owner(block_id);
+  if (!node)
+    return std::nullopt;
+  return node->control(block_id, method, p);
+}
+
 /**
  * Registers all Core API methods with the RPC Server
  */
@@ -21,24 +119,34 @@ inline void register_api_bindings() {
   auto &workflows = si::shell::WorkflowEngine::instance();
   static si::shell::CommandExecutor executor;
 
-  // Set up notifications
+  // Set up notifications, routed to the clients subscribed to the block or
+  // its session. Output goes through the coalescer so floods become a few
+  // large notifications. Shared-memory rings get each chunk right away, on
+  // the executor's thread, before their doorbell can go out.
   blocks.set_update_callback([](const std::string &block_id,
+                                const std::string &session_id,
                                 const si::shell::OutputChunk &chunk) {
-    RpcServer::instance().broadcast(
-        "block.output",
-        {{"block_id", block_id}, {"data", chunk.data}, {"type", chunk.type}});
+    RpcServer::instance().shm_channels().write(session_id, block_id,
+                                               chunk.type, chunk.data,
+                                               chunk.seq);
+    block_output_coalescer().append(session_id, block_id, chunk.type,
+                                    chunk.data, chunk.seq);
   });
 
   blocks.set_complete_callback([](const std::string &block_id,
                                   const std::string &session_id,
                                   int exit_code) {
-    RpcServer::instance().broadcast(
-        "block.complete", {
-                              {"block_id", block_id},
-                              {"session_id", session_id},
-                              {"exit_code", exit_code},
-                              {"duration_ms", 0} // TODO: Track duration
-                          });
+    // Output still held back goes out before the completion
+    block_output_coalescer().finish(block_id);
+    RpcServer::instance().publish(
+        "block.complete",
+        {
+            {"block_id", block_id},
+            {"session_id", session_id},
+            {"exit_code", exit_code},
+            {"duration_ms", 0} // TODO: Track duration
+        },
+        {session_id, block_id, kTopicComplete});
   });
 
   // Block API
@@ -53,9 +161,24 @@ inline void register_api_bindings() {
     std::string session_id = p.value("session_id", "default");
     std::string command = p.at("command").get<std::string>();
 
-    auto &ctx = blocks.get_session_context(session_id);
-    std::string cwd = p.value("cwd", ctx.cwd);
-    std::string shell = ctx.shell;
+    // On an agent: the local block mirrors the remote one. cwd, if given,
+    // is a path on the node; cd does not change the local session.
+    std::string node_name = p.value("node", "");
+    if (!node_name.empty()) {
+      auto node = RemoteNodes::instance().find(node_name);
+      if (!node)
+        throw std::invalid_argument("Unknown node: " + node_name);
+      std::string remote_cwd = p.value("cwd", "");
+      std::string block_id =
+          blocks.create_block(session_id, command, remote_cwd);
+      node->execute(block_id, command, remote_cwd, p.value("cols", 80),
+                    p.value("rows", 24));
+      return nlohmann::json{{"block_id", block_id}, {"node", node_name}};
+    }
+
+    auto session_config = blocks.get_session_config_copy(session_id);
+    std::string cwd = p.value("cwd", session_config.first);
+    std::string shell = session_config.second;
 
     // Track the final CWD - will be updated if this is a cd command
     std::string final_cwd = cwd;
@@ -120,6 +243,60 @@ inline void register_api_bindings() {
         {"session_config", {{"cwd", final_cwd}, {"shell", shell}}}};
   });
 
+  // Control lane: keystrokes, signals and window sizes for a running
+  // block. They run on their own pool and their replies skip queued
+  // traffic, so a large transfer on the connection does not delay them.
+  rpc.register_method(
+      "block.input",
+      [](const nlohmann::json &p) {
+        if (auto result = forward_to_node("block.input", p))
+          return *result;
+        if (!si::shell::BlockProcesses::instance().write_input(
+                p.at("block_id").get<std::string>(),
+                p.at("data").get<std::string>()))
+          throw std::runtime_error("Block is not running");
+        return nlohmann::json{{"success", true}};
+      },
+      MethodClass::Control);
+
+  rpc.register_method(
+      "block.kill",
+      [](const nlohmann::json &p) {
+        static const std::map<std::string, int> signals = {
+            {"INT", SIGINT}, {"TERM", SIGTERM}, {"KILL", SIGKILL},
+            {"HUP", SIGHUP}, {"QUIT", SIGQUIT}, {"STOP", SIGSTOP},
+            {"CONT", SIGCONT}};
+        std::string name = p.value("signal", "TERM");
+        if (name.rfind("SIG", 0) == 0)
+          name = name.substr(3);
+        auto it = signals.find(name);
+        if (it == signals.end())
+          throw std::invalid_argument("Unknown signal: " + name);
+        if (auto result = forward_to_node("block.kill", p))
+          return *result;
+        if (!si::shell::BlockProcesses::instance().send_signal(
+                p.at("block_id").get<std::string>(), it->second))
+          throw std::runtime_error("Block is not running");
+        return nlohmann::json{{"success", true}};
+      },
+      MethodClass::Control);
+
+  rpc.register_method(
+      "block.resize",
+      [](const nlohmann::json &p) {
+        int cols = p.at("cols").get<int>();
+        int rows = p.at("rows").get<int>();
+        if (cols <= 0 || rows <= 0 || cols > 0xffff || rows > 0xffff)
+          throw std::invalid_argument("cols and rows must be 1-65535");
+        if (auto result = forward_to_node("block.resize", p))
+          return *result;
+        if (!si::shell::BlockProcesses::instance().resize(
+                p.at("block_id").get<std::string>(), cols, rows))
+          throw std::runtime_error("Block is not running");
+        return nlohmann::json{{"success", true}};
+      },
+      MethodClass::Control);
+
   rpc.register_method("block.get", [&](const nlohmann::json &p) {
     auto block = blocks.get_block(p.at("block_id").get<std::string>());
     if (block)
@@ -127,6 +304,150 @@ inline void register_api_bindings() {
     throw std::runtime_error("Block not found");
   });
 
+  // Resume a block's output stream after a reconnect: replay the chunks
+  // from since_seq on, then deliver live output with nothing lost or
+  // repeated in between. Output the client got before this call carries
+  // its seq_start/seq_end, so it can tell what it already has.
+  rpc.register_method(
+      "block.subscribe", [&](const nlohmann::json &p, CallContext &ctx) {
+        if (ctx.client_id == 0)
+          throw std::runtime_error("block.subscribe needs a socket client");
+        std::string block_id = p.at("block_id").get<std::string>();
+        uint64_t since_seq = p.value("since_seq", uint64_t{0});
+        uint8_t topics = kTopicAll;
+        if (p.contains("events"))
+          topics = parse_topics(p["events"].get<std::vector<std::string>>());
+
+        // Live output of the block goes past this client until the replay
+        // (which covers it) is queued and its subscription is in place
+        auto &subscriptions = rpc.subscriptions();
+        subscriptions.hold_output(ctx.client_id, block_id);
+        bool held = true;
+        auto release = [&]() {
+          if (held)
+            subscriptions.release_output(ctx.client_id, block_id);
+          held = false;
+        };
+
+        nlohmann::json result;
+        auto resume = [&](std::optional<uint64_t> received) {
+          auto tail = blocks.get_output_since(block_id, since_seq);
+          if (!tail) {
+            release();
+            return;
+          }
+          // Chunks of a running block that the coalescer has not received
+          // yet will reach the client live. A coalescer with nothing for
+          // the block (a new image after an upgrade) has sent none of them.
+          uint64_t next_seq = tail->next_seq;
+          if (tail->state == si::shell::BlockState::RUNNING && received)
+            next_seq = *received;
+          size_t count = 0;
+          if (next_seq > since_seq)
+            count = std::min<size_t>(next_seq - since_seq, tail->chunks.size());
+
+          // Same shape as live output: adjacent chunks of a type merged
+          constexpr size_t kReplayBytes = 64 * 1024;
+          OutputCoalescer::Output out;
+          bool has_out = false;
+          auto send = [&]() {
+            if (!has_out)
+              return;
+            rpc.notify(ctx.client_id, "block.output",
+                       {{"block_id", block_id},
+                        {"data", out.data},
+                        {"type", out.type},
+                        {"seq_start", out.seq_start},
+                        {"seq_end", out.seq_end}});
+            has_out = false;
+          };
+          for (size_t i = 0; i < count; i++) {
+            const auto &chunk = tail->chunks[i];
+            if (has_out &&
+                (out.type != chunk.type || out.data.size() >= kReplayBytes))
+              send();
+            if (has_out) {
+              out.data += chunk.data;
+              out.seq_end = chunk.seq;
+            } else {
+              out = {tail->session_id, block_id, chunk.type,
+                     chunk.data,       chunk.seq, chunk.seq};
+              has_out = true;
+            }
+          }
+          send();
+
+          // Before the barrier lets the block's next output through
+          subscriptions.subscribe_block(ctx.client_id, block_id, topics);
+          release();
+          result = {{"block_id", block_id},
+                    {"replayed", count},
+                    {"next_seq", std::max(next_seq, since_seq)},
+                    {"state", static_cast<int>(tail->state)},
+                    {"exit_code", tail->exit_code}};
+        };
+        try {
+          block_output_coalescer().barrier(block_id, resume);
+        } catch (...) {
+          release();
+          throw;
+        }
+        if (result.is_null())
+          throw std::runtime_error("Block not found");
+        return result;
+      });
+
+  // Agents (sicore --agent) that block.execute can run commands on
+  rpc.register_method("node.add", [](const nlohmann::json &p) {
+    NodeOptions options;
+    options.name = p.at("name").get<std::string>();
+    if (!parse_host_port(p.at("address").get<std::string>(), options.host,
+                         options.port))
+      throw std::invalid_argument("address must be host:port");
+    options.token = p.value("token", "");
+    options.max_concurrent = p.value("max_concurrent", size_t{4});
+    if (options.name.empty() || options.max_concurrent == 0)
+      throw std::invalid_argument("name and max_concurrent are required");
+    RemoteNodes::instance().add(options);
+    return nlohmann::json{{"success", true}};
+  });
+
+  rpc.register_method("node.remove", [](const nlohmann::json &p) {
+    bool found =
+        RemoteNodes::instance().remove(p.at("name").get<std::string>());
+    return nlohmann::json{{"success", found}};
+  });
+
+  rpc.register_method(
+      "node.list",
+      [](const nlohmann::json &) { return RemoteNodes::instance().list(); },
+      MethodClass::Inline);
+
+  // Server process. The upgrade starts once the reply is queued; the
+  // connection carries on with the new binary.
+  rpc.register_method(
+      "server.info",
+      [](const nlohmann::json &) {
+        return nlohmann::json{{"version", si::VERSION},
+                               {"pid", getpid()},
+                               {"upgrades", Handoff::instance().upgrades()}};
+      },
+      MethodClass::Inline);
+
+  rpc.register_method(
+      "server.upgrade",
+      [](const nlohmann::json &p, CallContext &ctx) {
+        // A stream client's transport does not survive the exec
+        if (ctx.transport == Transport::Http)
+          throw std::runtime_error("server.upgrade needs a socket connection");
+        auto &handoff = Handoff::instance();
+        std::string binary = p.value("binary", handoff.executable());
+        if (!handoff.request(binary))
+          throw std::invalid_argument("Not an executable file: " + binary);
+        return nlohmann::json{{"success", true}, {"binary", binary}};
+      },
+      MethodClass::Inline);
+
   // Session API
   rpc.register_method("session.create", [&](const nlohmann::json &p) {
     std::string name = p.value("name", "New Session");
@@ -134,14 +455,21 @@ inline void register_api_bindings() {
     return nlohmann::json{{"session_id", id}, {"name", name}};
   });
 
-  rpc.register_method("session.list", [&](const nlohmann::json &p) {
-    auto sessions = blocks.list_sessions();
-    nlohmann::json list = nlohmann::json::array();
-    for (const auto &s : sessions) {
-      list.push_back({{"id", s.first}, {"name", s.second}});
-    }
-    return nlohmann::json(list);
-  });
+  // Inline: a cache miss copies the names under a shared lock
+  rpc.register_method(
+      "session.list",
+      [&](const nlohmann::json &p, CallContext &ctx) {
+        return reply_cached(
+            "session.list", blocks.sessions_version(), p, ctx, [&]() {
+              auto sessions = blocks.list_sessions();
+              nlohmann::json list = nlohmann::json::array();
+              for (const auto &s : sessions) {
+                list.push_back({{"id", s.first}, {"name", s.second}});
+              }
+              return list;
+            });
+      },
+      MethodClass::Inline);
 
   rpc.register_method("session.delete", [&](const nlohmann::json &p) {
     std::string session_id = p.at("session_id").get<std::string>();
@@ -156,26 +484,37 @@ inline void register_api_bindings() {
     return nlohmann::json{{"success", true}};
   });
 
-  rpc.register_method("block.list", [&](const nlohmann::json &p) {
-    auto list = blocks.list_blocks(p.value("session_id", "default"));
-    return nlohmann::json(list);
-  });
+  rpc.register_method(
+      "block.list", [&](const nlohmann::json &p, CallContext &ctx) {
+        std::string session_id = p.value("session_id", "default");
+        return reply_cached("block.list:" + session_id,
+                            blocks.blocks_version(session_id), p, ctx, [&]() {
+                              return nlohmann::json(
+                                  blocks.list_blocks(session_id));
+                            });
+      });
 
   // Session Config API
-  rpc.register_method("session.get_config", [&](const nlohmann::json &p) {
-    std::string session_id = p.value("session_id", "default");
-    try {
-      // CRITICAL FIX: Use thread-safe copy helper to avoid race conditions
-      auto [cwd_copy, shell_copy] = blocks.get_session_config_copy(session_id);
-      // SI_LOG_INFO("[session.get_config] returning cwd={}, shell={}",
-      // cwd_copy, shell_copy); // Removed spam
-      return nlohmann::json{{"cwd", cwd_copy}, {"shell", shell_copy}};
-    } catch (...) {
-      // Fallback if session deleted or invalid
-      return nlohmann::json{{"cwd", "."}, {"shell", "/bin/bash"}};
-    }
-  });
+  // Inline: a shared lock, and an unknown session is not created
+  rpc.register_method(
+      "session.get_config",
+      [&](const nlohmann::json &p) {
+        std::string session_id = p.value("session_id", "default");
+        try {
+          // CRITICAL FIX: Use thread-safe copy helper to avoid race conditions
+          auto [cwd_copy, shell_copy] =
+              blocks.get_session_config_copy(session_id);
+          // SI_LOG_INFO("[session.get_config] returning cwd={}, shell={}",
+          // cwd_copy, shell_copy); // Removed spam
+          return nlohmann::json{{"cwd", cwd_copy}, {"shell", shell_copy}};
+        } catch (...) {
+          // Fallback if session deleted or invalid
+          return nlohmann::json{{"cwd", "."}, {"shell", "/bin/bash"}};
+        }
+      },
+      MethodClass::Inline);
 
+  // Blocking: takes the session lock exclusively and logs the change
   rpc.register_method("session.set_config", [&](const nlohmann::json &p) {
     std::string session_id = p.value("session_id", "default");
     if (p.contains("cwd")) {
@@ -283,18 +622,31 @@ inline void register_api_bindings() {
     return nlohmann::json{{"workflow_id", id}};
   });
 
-  rpc.register_method("workflow.get", [&](const nlohmann::json &p) {
-    auto w = workflows.get_workflow(p.at("workflow_id").get<std::string>());
-    if (w)
-      return nlohmann::json(*w);
-    throw std::runtime_error("Workflow not found");
-  });
-
-  rpc.register_method("workflow.list", [&](const nlohmann::json &p) {
-    auto list = workflows.list_workflows(p.value("tag", ""));
-    return nlohmann::json(list);
-  });
-
+  // Inline, as is workflow.list: copies out of a map under the engine's
+  // lock, which is never held for anything slower
+  rpc.register_method(
+      "workflow.get",
+      [&](const nlohmann::json &p) {
+        auto w = workflows.get_workflow(p.at("workflow_id").get<std::string>());
+        if (w)
+          return nlohmann::json(*w);
+        throw std::runtime_error("Workflow not found");
+      },
+      MethodClass::Inline);
+
+  rpc.register_method(
+      "workflow.list",
+      [&](const nlohmann::json &p, CallContext &ctx) {
+        std::string tag = p.value("tag", "");
+        return reply_cached("workflow.list:" + tag, workflows.version(), p,
+                            ctx, [&]() {
+                              return nlohmann::json(
+                                  workflows.list_workflows(tag));
+                            });
+      },
+      MethodClass::Inline);
+
+  // Blocking: builds a regex per parameter, so its cost is the caller's
   rpc.register_method("workflow.render", [&](const nlohmann::json &p) {
     std::string cmd = workflows.render_command(
         p.at("workflow_id").get<std::string>(),
@@ -312,62 +664,74 @@ inline void register_api_bindings() {
     return ctx_builder.build_context();
   });
 
-  rpc.register_method("ai.generate_command", [](const nlohmann::json &p) {
-    auto &gateway = si::ai::AIGateway::instance();
-    auto &ctx_builder = si::ai::ContextBuilder::instance();
-
-    std::string user_prompt = p.at("prompt").get<std::string>();
-    nlohmann::json context = ctx_builder.build_context();
-
-    si::ai::CompletionRequest req;
-    // Combine system prompt and user prompt into single prompt
-    req.prompt = ctx_builder.get_command_generation_prompt() +
-                 "\n\nContext: " + context.dump() +
-                 "\n\nRequest: " + user_prompt;
-    req.max_tokens = 256;
-    req.temperature = 0.3f;
-
-    auto resp = gateway.complete(req);
-
-    return nlohmann::json{{"command", resp.content}, {"success", resp.success}};
-  });
-
-  rpc.register_method("ai.analyze_error", [](const nlohmann::json &p) {
-    auto &gateway = si::ai::AIGateway::instance();
-    auto &ctx_builder = si::ai::ContextBuilder::instance();
-    auto &blocks = si::shell::BlockManager::instance();
-
-    std::string block_id = p.at("block_id").get<std::string>();
-    auto block_opt = blocks.get_block(block_id);
-    if (!block_opt)
-      throw std::runtime_error("Block not found");
+  rpc.register_method(
+      "ai.generate_command",
+      [](const nlohmann::json &p, CallContext &ctx) {
+        auto &gateway = si::ai::AIGateway::instance();
+        auto &ctx_builder = si::ai::ContextBuilder::instance();
+
+        std::string user_prompt = p.at("prompt").get<std::string>();
+        nlohmann::json context = ctx_builder.build_context();
+
+        si::ai::CompletionRequest req;
+        // Combine system prompt and user prompt into single prompt
+        req.prompt = ctx_builder.get_command_generation_prompt() +
+                     "\n\nContext: " + context.dump() +
+                     "\n\nRequest: " + user_prompt;
+        req.max_tokens = 256;
+        req.temperature = 0.3f;
+        req.cancel = ctx.cancel;
+
+        auto resp = gateway.complete(req);
+
+        return nlohmann::json{{"command", resp.content},
+                              {"success", resp.success}};
+      },
+      MethodClass::AI);
+
+  rpc.register_method(
+      "ai.analyze_error",
+      [](const nlohmann::json &p, CallContext &ctx) {
+        auto &gateway = si::ai::AIGateway::instance();
+        auto &ctx_builder = si::ai::ContextBuilder::instance();
+        auto &blocks = si::shell::BlockManager::instance();
+
+        std::string block_id = p.at("block_id").get<std::string>();
+        auto block_opt = blocks.get_block(block_id);
+        if (!block_opt)
+          throw std::runtime_error("Block not found");
+
+        auto &block = *block_opt;
+        std::string output;
+        for (const auto &chunk : block.output_chunks) {
+          output += chunk.data;
+        }
 
-    auto &block = *block_opt;
-    std::string output;
-    for (const auto &chunk : block.output_chunks) {
-      output += chunk.data;
-    }
+        si::ai::CompletionRequest req;
+        req.prompt = ctx_builder.get_error_analysis_prompt() +
+                     "\n\nCommand: " + block.command +
+                     "\nExit Code: " + std::to_string(block.exit_code) +
+                     "\nOutput:\n" + output;
+        req.max_tokens = 512;
+        req.cancel = ctx.cancel;
 
-    si::ai::CompletionRequest req;
-    req.prompt = ctx_builder.get_error_analysis_prompt() +
-                 "\n\nCommand: " + block.command +
-                 "\nExit Code: " + std::to_string(block.exit_code) +
-                 "\nOutput:\n" + output;
-    req.max_tokens = 512;
+        auto resp = gateway.complete(req);
 
-    auto resp = gateway.complete(req);
-
-    return nlohmann::json{{"analysis", resp.content},
-                          {"success", resp.success}};
-  });
+        return nlohmann::json{{"analysis", resp.content},
+                              {"success", resp.success}};
+      },
+      MethodClass::AI);
 
   // Settings API
   auto &settings = si::settings::SettingsManager::instance();
 
-  rpc.register_method("settings.get", [&](const nlohmann::json &p) {
-    std::string category = p.at("category").get<std::string>();
-    return settings.get_category(category);
-  });
+  rpc.register_method(
+      "settings.get", [&](const nlohmann::json &p, CallContext &ctx) {
+        std::string category = p.at("category").get<std::string>();
+        return reply_cached("settings.get:" + category, settings.version(),
+                            p, ctx,
+                            [&]() { return settings.get_category(category); });
+      });
 
   rpc.register_method("settings.set", [&](const nlohmann::json &p) {
     std::string category = p.at("category").get<std::string>();
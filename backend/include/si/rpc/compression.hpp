@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace si::rpc {
+
+/**
+ * Payload compression of a client connection, negotiated with session.init.
+ *
+ * Deflate is zlib's raw deflate and needs zlib at build time. Lz is a
+ * built-in LZ77 codec, always available: cheaper on CPU, larger output.
+ * Both keep their context (a 32 or 64 KiB window of earlier payloads)
+ * from one message to the next, so repeated keys and prompts cost a few
+ * bytes after their first appearance.
+ */
+enum class Compression : uint8_t { None, Deflate, Lz };
+
+// Set in a length-prefixed frame header when the payload is compressed
+constexpr uint32_t kCompressedFrameFlag = 0x80000000u;
+
+// Parse "deflate", "lz" or "none"; returns false if unknown
+bool parse_compression(const std::string &name, Compression &compression);
+const char *to_string(Compression compression);
+
+// Whether this build has the codec
+bool compression_available(Compression compression);
+
+// Names of the codecs this build has, in order of preference
+std::vector<std::string> available_compressions();
+
+/**
+ * Compressing side of a stream. Messages must be decompressed in the order
+ * they were compressed, each exactly once.
+ */
+class Compressor {
+public:
+  // Null for Compression::None or a codec this build lacks
+  static std::unique_ptr<Compressor> create(Compression compression);
+
+  virtual ~Compressor() = default;
+
+  // Compress one message, appending it to `out`
+  virtual void compress(const char *data, size_t size, std::string &out) = 0;
+};
+
+class Decompressor {
+public:
+  static std::unique_ptr<Decompressor> create(Compression compression);
+
+  virtual ~Decompressor() = default;
+
+  // Decompress one message, appending it to `out`. Returns false if the
+  // input is malformed or inflates to more than `max_size` bytes; the
+  // stream cannot be used after that.
+  virtual bool decompress(const char *data, size_t size, std::string &out,
+                          size_t max_size) = 0;
+
+  // The recent output later messages may refer back to. A new decompressor
+  // given it carries on the stream (hot upgrade).
+  virtual std::string window() = 0;
+  virtual void set_window(const std::string &window) = 0;
+};
+
+// Compress the payload of a length-prefixed frame into a flagged frame
+std::string compress_frame(Compressor &compressor, std::string_view frame);
+
+} // namespace si::rpc
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "si/rpc/admission.hpp"
+#include "si/rpc/compression.hpp"
+#include "si/rpc/encoding.hpp"
+#include "si/rpc/frame_decoder.hpp"
+#include "si/rpc/outbound.hpp"
+#include "si/rpc/server.hpp"
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace si::rpc {
+
+/**
+ * State for one connected RPC client.
+ *
+ * The fd and inbound buffer are only touched from the event loop thread.
+ * The outbound queue is filled from any thread and drained by the loop.
+ *
+ * Stream clients (HTTP) have no fd: their transport drains the queue with
+ * RpcServer::read_stream, woken through out_ready.
+ */
+struct Connection {
+  uint64_t id = 0;
+  int fd = -1;
+  bool stream = false;
+  // Accepted on the TCP listener; requests are refused until rpc.auth
+  // succeeds (loop thread only)
+  bool tcp = false;
+  bool authenticated = false;
+
+  // Inbound bytes not yet consumed as complete messages (loop thread only)
+  FrameDecoder decoder;
+  WireEncoding in_encoding = WireEncoding::Json;
+  // Negotiated compression of inbound frames, and where they inflate to
+  std::unique_ptr<Decompressor> decompressor;
+  std::string inflated;
+
+  // Requests handed to workers whose replies are not queued yet. A client
+  // that half-closes is kept open until these drain.
+  std::atomic<int> inflight{0};
+  std::atomic<bool> read_closed{false};
+
+  // Rate limits by method class, and share of the handler pools relative
+  // to other clients (session.init weight)
+  std::mutex admission_mutex;
+  std::array<TokenBucket, kMethodClassCount> buckets;
+  std::atomic<unsigned> weight{1};
+  std::atomic<uint64_t> refused{0};
+
+  // Outbound frames waiting for the socket to become writable
+  std::mutex out_mutex;
+  OutboundQueue out;
+  WireFormat format; // of outgoing frames
+  Compression compression = Compression::None; // negotiated, both ways
+  // Descriptors to send with the next write (SCM_RIGHTS), owned until sent
+  std::vector<int> pending_fds;
+  bool flush_pending = false;
+  bool closed = false;
+  std::condition_variable out_ready; // stream clients only
+};
+
+} // namespace si::rpc
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <si/nlohmann/json.hpp>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace si::rpc {
+
+/**
+ * Wire encoding of a client connection, negotiated with session.init.
+ *
+ * Json is the default. The binary encodings carry block.output data as a
+ * raw byte string instead of an escaped JSON string.
+ */
+enum class WireEncoding : uint8_t { Json, Cbor, MsgPack };
+
+/**
+ * How messages are delimited. Length-prefixed frames are a 4-byte
+ * big-endian payload length followed by the payload. Binary encodings are
+ * always length-prefixed; JSON may use either.
+ */
+enum class Framing : uint8_t { Newline, LengthPrefixed };
+
+struct WireFormat {
+  WireEncoding encoding = WireEncoding::Json;
+  Framing framing = Framing::Newline;
+
+  // Dense index for per-format caches (see kWireFormatCount)
+  size_t index() const {
+    return encoding == WireEncoding::Json
+               ? static_cast<size_t>(framing)
+               : static_cast<size_t>(encoding) + 1;
+  }
+};
+
+constexpr size_t kWireFormatCount = 4;
+constexpr size_t kFrameHeaderSize = 4;
+
+// Parse "json", "cbor" or "msgpack"; returns false if unknown
+bool parse_wire_encoding(const std::string &name, WireEncoding &encoding);
+const char *to_string(WireEncoding encoding);
+const char *to_string(Framing framing);
+
+// Serialize a message as one complete frame for the wire
+std::string encode_message(const nlohmann::json &message, WireFormat format);
+
+// Serialize one value without framing (JSON text, CBOR or MessagePack)
+std::string encode_value(const nlohmann::json &value, WireEncoding encoding);
+
+// Serialize a map from members whose values were already serialized with
+// encode_value, in the given order. Lets a cached result be wrapped without
+// being serialized again. Keys must not need escaping.
+std::string encode_object(
+    std::initializer_list<std::pair<const char *, std::string_view>> members,
+    WireEncoding encoding);
+
+// Serialize a success response {"id", "jsonrpc", "result"} as one frame
+// straight from its parts, without building the response object
+std::string encode_response(const nlohmann::json &id,
+                            const nlohmann::json &result, WireFormat format);
+
+// Same, splicing in a result already serialized with encode_value
+std::string splice_response(const nlohmann::json &id, std::string_view result,
+                            WireFormat format);
+
+// Serialize a notification {"jsonrpc", "method", "params"} as one frame
+// without building the message object. `method` must not need escaping.
+// For `output` (block.output), a string params.data is written straight
+// from params: as a byte string in the binary encodings, and through a
+// run-copying escaper in JSON. Large frames are serialized in place at
+// about their final size.
+std::string encode_notification(const std::string &method,
+                                const nlohmann::json &params,
+                                WireFormat format, bool output = false);
+
+// Decode one frame payload (without the newline or length header).
+// Throws nlohmann::json::parse_error on malformed input.
+nlohmann::json decode_message(const char *data, size_t size,
+                              WireEncoding encoding);
+
+// Payload length from a length-prefixed frame header
+inline uint32_t read_frame_length(const char *header) {
+  auto *p = reinterpret_cast<const unsigned char *>(header);
+  return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) |
+         (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+} // namespace si::rpc
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace si::rpc {
+
+/**
+ * Single-threaded epoll reactor.
+ *
+ * All registered fds are serviced from the thread that calls run(). Other
+ * threads hand work to the loop with post(), which wakes it via an eventfd.
+ */
+class EventLoop {
+public:
+  using IoCallback = std::function<void(uint32_t events)>;
+  using Task = std::function<void()>;
+
+  EventLoop();
+  ~EventLoop();
+
+  EventLoop(const EventLoop &) = delete;
+  EventLoop &operator=(const EventLoop &) = delete;
+
+  // Create the epoll instance and wakeup eventfd
+  bool open();
+
+  // Register / update / unregister an fd (loop thread only once running)
+  bool add(int fd, uint32_t events, IoCallback cb);
+  bool modify(int fd, uint32_t events);
+  void remove(int fd);
+
+  // Queue a task to run on the loop thread (thread-safe)
+  void post(Task task);
+
+  // Run a task on the loop thread every `interval` (timerfd). Returns an id
+  // for remove_timer, or -1 on failure. Loop thread only once running.
+  int add_timer(std::chrono::milliseconds interval, Task task);
+  void remove_timer(int timer_id);
+
+  // Run until stop() is called
+  void run();
+  void stop();
+
+  bool in_loop_thread() const;
+
+private:
+  void wakeup();
+  void drain_tasks();
+
+  int epoll_fd_ = -1;
+  int wake_fd_ = -1;
+  std::atomic<bool> stopped_{false};
+  std::thread::id loop_thread_;
+
+  // Held by pointer so run() can call them in place; a callback removed or
+  // replaced while events are dispatched is retired until the batch ends
+  std::map<int, std::unique_ptr<IoCallback>> callbacks_;
+  std::vector<std::unique_ptr<IoCallback>> retired_;
+  std::set<int> timers_; // timerfds owned by the loop
+
+  std::vector<Task> pending_;
+  std::mutex pending_mutex_;
+};
+
+} // namespace si::rpc
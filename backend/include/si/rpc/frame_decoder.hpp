@@ -0,0 +1,64 @@
+#pragma once
+
+#include "si/rpc/compression.hpp"
+#include "si/rpc/encoding.hpp"
+#include "si/rpc/ring_buffer.hpp"
+#include <cstddef>
+#include <string>
+
+namespace si::rpc {
+
+/**
+ * Splits a connection's inbound byte stream into messages.
+ *
+ * Bytes are read straight into the ring buffer; next() hands out each
+ * complete frame as a pointer into that buffer, so a payload is parsed
+ * where it landed instead of being copied out first. The newline scanner
+ * only looks at bytes it has not seen before. Once a length header has
+ * arrived the buffer is grown to hold the whole frame, so large payloads
+ * stream in without repeated reallocation.
+ */
+class FrameDecoder {
+public:
+  enum class Status {
+    Frame,    // a complete frame is available
+    NeedMore, // wait for more bytes
+    TooLarge  // the frame exceeds max_frame_bytes; the stream is unusable
+  };
+
+  explicit FrameDecoder(size_t max_frame_bytes = 64 * 1024 * 1024);
+
+  RingBuffer &buffer() { return buffer_; }
+
+  Framing framing() const { return framing_; }
+  // Applies to the bytes after the current frame
+  void set_framing(Framing framing);
+
+  // Accept length headers flagged with kCompressedFrameFlag (negotiated
+  // compression); compressed() tells whether the last frame had it
+  void set_compressed_frames(bool accept) { accept_compressed_ = accept; }
+  bool compressed() const { return compressed_; }
+
+  void set_max_frame_bytes(size_t bytes) { max_frame_bytes_ = bytes; }
+  size_t max_frame_bytes() const { return max_frame_bytes_; }
+
+  // Find the next frame. On Frame, `data`/`size` describe the payload
+  // (without delimiter or header) until the next call.
+  Status next(const char *&data, size_t &size);
+
+  // Bytes received but not yet handed out as frames, and putting them back
+  // into a new decoder (hot upgrade)
+  std::string take_unread();
+  void restore(const std::string &bytes);
+
+private:
+  RingBuffer buffer_;
+  Framing framing_ = Framing::Newline;
+  size_t max_frame_bytes_;
+  size_t scan_pos_ = 0; // readable bytes already searched for '\n'
+  size_t pending_ = 0;  // bytes of the frame last returned, consumed lazily
+  bool accept_compressed_ = false;
+  bool compressed_ = false;
+};
+
+} // namespace si::rpc
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <si/nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+namespace si::rpc {
+
+/**
+ * Hot upgrade: replace the running binary without dropping clients or
+ * commands (server.upgrade, sicore --upgrade).
+ *
+ * pack() detaches everything the server holds. Block readers stop, leaving
+ * unread output in the terminals; agents are disconnected without failing
+ * their blocks; output held by the coalescer is queued to the clients; the
+ * RPC server hands over its sockets and each client's state. Blocks and
+ * their output are saved to disk as on shutdown, so the new image continues
+ * their sequence numbers. The rest of the state goes into a memfd, which is
+ * passed with every descriptor over a socketpair.
+ *
+ * upgrade() then execs the new binary in place with --handoff-fd naming the
+ * other end of the pair. Keeping the pid keeps the commands children of the
+ * server, so the new image reaps them. If the exec fails, the process
+ * resumes from the pair itself.
+ */
+class Handoff {
+public:
+  static Handoff &instance();
+
+  // How this process was started, repeated by the exec
+  void set_command_line(int argc, char **argv);
+  // The binary this process runs
+  const std::string &executable() const { return executable_; }
+
+  // Ask the main loop to upgrade to `binary` (empty: this one). False if it
+  // is not an executable file.
+  bool request(const std::string &binary);
+  bool requested() const { return requested_; }
+
+  // Detach the server and pack it into a socket: the end to resume from,
+  // or -1 if that failed (the server then carries on as it was)
+  int pack();
+
+  // Take over what pack() put into `fd` (closes it): in the new image, or
+  // here if the exec failed. False if the server is not serving after it.
+  bool resume(int fd);
+
+  // pack() and exec the requested binary. Returns only if the exec failed,
+  // once the server has resumed.
+  void upgrade();
+
+  // Upgrades this server has been through since it was started
+  int upgrades() const { return upgrades_; }
+
+private:
+  Handoff() = default;
+
+  // Collect the state of every component, with its descriptors
+  nlohmann::json detach(std::vector<int> &fds);
+  // Put it back to work; false if the RPC server could not start
+  bool adopt(const nlohmann::json &state, const std::vector<int> &fds);
+
+  std::vector<std::string> argv_;
+  std::string executable_;
+  std::mutex mutex_;
+  std::string binary_; // requested
+  std::atomic<bool> requested_{false};
+  std::atomic<int> upgrades_{0};
+};
+
+} // namespace si::rpc
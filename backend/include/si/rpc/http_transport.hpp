@@ -0,0 +1,75 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace httplib {
+class Server;
+class Request;
+} // namespace httplib
+
+namespace si::rpc {
+
+class RpcServer;
+
+struct HttpTransportOptions {
+  // Loopback only by default: the API can run shell commands
+  std::string host = "127.0.0.1";
+  int port = 0; // 0 picks a free port (see HttpTransport::port)
+  // Browser origins allowed to call the API (CORS). Requests carrying any
+  // other Origin header are refused.
+  std::vector<std::string> allowed_origins;
+  // Blank line sent on an idle event stream, to notice dead peers
+  std::chrono::milliseconds keepalive{15000};
+  size_t max_body_bytes = 64 * 1024 * 1024;
+};
+
+/**
+ * JSON-RPC over HTTP, for browser dashboards and remote editors.
+ *
+ * GET /events opens a stream client and keeps the response open, pushing
+ * its notifications as newline-delimited JSON (chunked). The client id is
+ * returned in the X-SI-Client header. POST /rpc runs a request or batch
+ * and answers with its reply; with an X-SI-Client header it runs as that
+ * client, so its subscriptions and cancellations apply to the stream.
+ * Without one it is a one-off call that gets no notifications.
+ *
+ * Requests go through the RpcServer's dispatcher and pools, and streams
+ * share its subscriptions and slow-client policy, so the RpcServer must be
+ * started first.
+ */
+class HttpTransport {
+public:
+  explicit HttpTransport(RpcServer &rpc);
+  ~HttpTransport();
+
+  HttpTransport(const HttpTransport &) = delete;
+  HttpTransport &operator=(const HttpTransport &) = delete;
+
+  bool start(const HttpTransportOptions &options);
+  void stop();
+
+  // Bound port, once started
+  int port() const { return port_; }
+
+private:
+  // Host and Origin checks against DNS rebinding and cross-site requests
+  bool allowed(const httplib::Request &req) const;
+
+  RpcServer &rpc_;
+  HttpTransportOptions options_;
+  std::unique_ptr<httplib::Server> server_;
+  std::thread thread_;
+  int port_ = 0;
+
+  std::set<uint64_t> streams_; // open event streams, closed on stop()
+  std::mutex streams_mutex_;
+};
+
+} // namespace si::rpc
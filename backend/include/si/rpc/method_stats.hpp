@@ -0,0 +1,66 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <si/nlohmann/json.hpp>
+
+namespace si::rpc {
+
+/**
+ * Lock-free log-linear latency histogram (HDR-style), in nanoseconds.
+ *
+ * Values below 16 get exact buckets; above that every power of two is split
+ * into 16 sub-buckets, so a reported percentile is within 1/16 (6.25%) of
+ * the true value. Recording is a couple of relaxed atomic adds.
+ */
+class LatencyHistogram {
+public:
+  static constexpr int kSubBucketBits = 4;
+  static constexpr uint64_t kSubBuckets = 1 << kSubBucketBits;
+  static constexpr int kMaxExponent = 42; // values clamp at ~73 minutes
+  static constexpr size_t kBuckets =
+      (kMaxExponent - kSubBucketBits + 2) * kSubBuckets;
+
+  void record(uint64_t ns);
+
+  struct Snapshot {
+    uint64_t count = 0;
+    uint64_t sum_ns = 0;
+    uint64_t max_ns = 0;
+    std::array<uint64_t, kBuckets> buckets{};
+
+    // Upper bound of the bucket holding the p-th percentile (0..100)
+    uint64_t percentile(double p) const;
+  };
+  Snapshot snapshot() const;
+
+  static size_t bucket_for(uint64_t ns);
+  static uint64_t bucket_upper_bound(size_t index);
+
+private:
+  std::array<std::atomic<uint64_t>, kBuckets> buckets_{};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> sum_ns_{0};
+  std::atomic<uint64_t> max_ns_{0};
+};
+
+/**
+ * Counters for one RPC method. Updated with relaxed atomics from whichever
+ * thread handles the call, so recording never takes a lock.
+ */
+struct MethodStats {
+  std::atomic<uint64_t> calls{0};
+  std::atomic<uint64_t> errors{0};
+  std::atomic<int64_t> in_flight{0};
+  std::atomic<uint64_t> rejected{0}; // refused by admission control
+  std::atomic<uint64_t> bytes_in{0};
+  std::atomic<uint64_t> bytes_out{0};
+  LatencyHistogram queue_wait; // dispatch until a worker picks the call up
+  LatencyHistogram handler;    // time inside the handler
+
+  nlohmann::json to_json() const;
+};
+
+} // namespace si::rpc
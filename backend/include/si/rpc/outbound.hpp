@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <si/nlohmann/json.hpp>
+#include <string>
+#include <sys/uio.h>
+#include <vector>
+
+namespace si::rpc {
+
+/**
+ * What to do with notifications for a client whose outbound queue is full.
+ * Responses to requests are never dropped.
+ */
+enum class SlowClientPolicy {
+  DropAndResync, // Drop them, then send rpc.resync once the queue drains
+  Coalesce,      // Hold them back, merging block.output per block
+  Disconnect     // Close the connection
+};
+
+// Parse "drop", "coalesce" or "disconnect"; returns false if unknown
+bool parse_slow_client_policy(const std::string &name,
+                              SlowClientPolicy &policy);
+const char *to_string(SlowClientPolicy policy);
+
+struct OutboundOptions {
+  // Notifications are held back once this many bytes are queued for a
+  // client. Delivery resumes when the queue falls below half of it.
+  size_t max_queue_bytes = 4 * 1024 * 1024;
+  SlowClientPolicy slow_client_policy = SlowClientPolicy::Coalesce;
+};
+
+struct ClientQueueStats {
+  uint64_t client_id = 0;
+  size_t queued_bytes = 0;
+  size_t queued_frames = 0;
+  size_t parked_bytes = 0; // held back under the Coalesce policy
+  uint64_t dropped_bytes = 0;
+  uint64_t dropped_frames = 0;
+  uint64_t coalesced_frames = 0;
+};
+
+struct OutboundStats {
+  std::vector<ClientQueueStats> clients;
+  uint64_t dropped_bytes = 0;
+  uint64_t dropped_frames = 0;
+  uint64_t coalesced_frames = 0;
+  uint64_t resyncs = 0;
+  uint64_t slow_client_disconnects = 0;
+};
+
+// A serialized message, shared by every client it is sent to
+using Frame = std::shared_ptr<const std::string>;
+
+/**
+ * Bounded outbound queue for one client. Not thread-safe: the owning
+ * Connection's out_mutex must be held for every call.
+ */
+class OutboundQueue {
+public:
+  enum class Admit { Queued, Parked, Coalesced, Dropped, Disconnect };
+
+  // Turns a held-back notification into a frame when it is finally sent
+  using Encoder =
+      std::function<Frame(const std::string &method, const nlohmann::json &)>;
+
+  // Rewrites frames as they join the queue, in queue order (compression
+  // with a streaming context). Priority replies and frames queued before
+  // it was set are left alone.
+  using Filter = std::function<Frame(Frame)>;
+  void set_filter(Filter filter) { filter_ = std::move(filter); }
+
+  // Replies are always queued, whatever the budget
+  void push_response(Frame frame);
+
+  // A reply that goes ahead of everything queued, except the frame being
+  // written and earlier priority replies
+  void push_priority(Frame frame);
+
+  // Apply the slow-client policy when the queue is over budget
+  Admit push_notification(const std::string &method,
+                          const nlohmann::json &params, Frame frame,
+                          const OutboundOptions &options);
+
+  // Describe the pending bytes as iovecs (returns the number filled)
+  size_t fill_iov(struct iovec *iov, size_t max_iov) const;
+
+  // Drop `bytes` that were written to the socket
+  void consume(size_t bytes);
+
+  // Once below the low watermark, queue the resync notice and any parked
+  // notifications. Returns true if a resync notice was queued.
+  bool refill(const OutboundOptions &options, const Encoder &encode);
+
+  // The unwritten bytes of every queued frame, in order; the frames are
+  // dropped (hot upgrade: the new process writes the bytes first)
+  std::string take_bytes();
+
+  bool empty() const { return frames_.empty(); }
+  void clear();
+
+  ClientQueueStats stats() const;
+
+private:
+  struct Parked {
+    std::string method;
+    nlohmann::json params;
+    size_t size;
+  };
+
+  void park(const std::string &method, const nlohmann::json &params,
+            size_t size);
+
+  void append(Frame frame);
+
+  Filter filter_;
+  std::deque<Frame> frames_;
+  size_t offset_ = 0;       // bytes of frames_.front() already written
+  size_t priority_end_ = 0; // frames_ before this index are priority ones
+  size_t queued_bytes_ = 0;
+
+  std::deque<Parked> parked_;
+  size_t parked_bytes_ = 0;
+  // block_id -> index in parked_ of the newest block.output for that block,
+  // if nothing else for the block was parked after it
+  std::map<std::string, size_t> mergeable_;
+  size_t parked_base_ = 0; // index of parked_.front()
+
+  bool needs_resync_ = false;
+  uint64_t dropped_bytes_ = 0;
+  uint64_t dropped_frames_ = 0;
+  uint64_t coalesced_frames_ = 0;
+};
+
+} // namespace si::rpc
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+namespace si::rpc {
+
+struct CoalescerOptions {
+  // How long to gather output after a chunk was sent before sending again.
+  // Zero disables coalescing.
+  std::chrono::milliseconds window{8};
+  // Send as soon as this many bytes are waiting
+  size_t max_bytes = 64 * 1024;
+};
+
+/**
+ * Merges a block's output chunks into fewer block.output notifications.
+ *
+ * The first chunk after a quiet period is sent at once, so interactive
+ * echo sees no added latency. Chunks arriving within the window after it
+ * are merged (adjacent chunks of the same type only) and sent when the
+ * window ends, when max_bytes is reached, or when the block completes.
+ * A window that ends with nothing to send closes and the block is idle
+ * again.
+ *
+ * The sink is called without internal locks held, in seq order per block.
+ */
+class OutputCoalescer {
+public:
+  struct Output {
+    std::string session_id;
+    std::string block_id;
+    std::string type;
+    std::string data;
+    uint64_t seq_start = 0; // first and last chunk merged into data
+    uint64_t seq_end = 0;
+  };
+  // Gets the output to keep: its strings may be moved from
+  using Sink = std::function<void(Output &&output)>;
+
+  explicit OutputCoalescer(Sink sink, CoalescerOptions options = {});
+  ~OutputCoalescer();
+
+  OutputCoalescer(const OutputCoalescer &) = delete;
+  OutputCoalescer &operator=(const OutputCoalescer &) = delete;
+
+  void set_options(const CoalescerOptions &options);
+
+  void append(const std::string &session_id, const std::string &block_id,
+              const std::string &type, const std::string &data,
+              uint64_t seq);
+
+  // Send whatever is pending for a block and forget it (block completion)
+  void finish(const std::string &block_id);
+
+  // Send whatever is pending for every block and forget them all
+  void finish_all();
+
+  // Send what is pending for a block, then call `fn` with the seq after the
+  // last chunk received, or nullopt if none was received since the block
+  // started or finished. The block's output is held back until `fn`
+  // returns, so whatever `fn` sends goes out before anything appended
+  // later (resuming a stream without gaps).
+  void barrier(const std::string &block_id,
+               const std::function<void(std::optional<uint64_t>)> &fn);
+
+  struct Stats {
+    uint64_t chunks_in = 0;
+    uint64_t notifications_out = 0;
+  };
+  Stats stats() const;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct BlockState {
+    std::mutex emit_mutex; // keeps sink calls for the block in order
+    Output pending;
+    bool has_pending = false;
+    bool window_open = false;
+    Clock::time_point deadline;
+    std::optional<uint64_t> next_seq; // after the last chunk received
+  };
+
+  // Take the block's pending output and hand it to the sink. Takes
+  // emit_mutex then mutex_, so output leaves in the order it was taken.
+  void emit(const std::shared_ptr<BlockState> &state);
+  void emit_locked(BlockState &state); // emit_mutex held
+
+  void timer_loop();
+
+  Sink sink_;
+  CoalescerOptions options_;
+  std::map<std::string, std::shared_ptr<BlockState>> blocks_;
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::thread timer_;
+  bool stopping_ = false;
+  Stats stats_;
+};
+
+} // namespace si::rpc
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <si/nlohmann/json.hpp>
+#include <string>
+#include <thread>
+
+namespace si::rpc {
+
+struct NodeOptions {
+  std::string name;
+  std::string host;
+  int port = 0;
+  std::string token; // sent with rpc.auth
+  size_t max_concurrent = 4;
+  std::chrono::milliseconds max_backoff{5000}; // between reconnect attempts
+};
+
+// Parse "host:port" or "[v6]:port"; false if malformed
+bool parse_host_port(const std::string &address, std::string &host,
+                     int &port);
+
+/**
+ * Connection to one agent (sicore --agent), shared by all the blocks run
+ * on it. Requests are matched to replies by id; the agent's block.output
+ * and block.complete for them are mirrored into local blocks, so clients
+ * see remote commands like local ones.
+ *
+ * At most max_concurrent commands run at once; the rest wait in order.
+ * After a disconnect the node reconnects with backoff and resumes each
+ * running block with block.subscribe from the last sequence number
+ * received. A command whose block.execute was in flight when the
+ * connection dropped is reported as failed.
+ */
+class RemoteNode {
+public:
+  explicit RemoteNode(NodeOptions options);
+  // Take over a node that detach() handed on from the process before a hot
+  // upgrade: its running blocks are resumed once connected
+  RemoteNode(NodeOptions options, const nlohmann::json &state);
+  ~RemoteNode();
+
+  RemoteNode(const RemoteNode &) = delete;
+  RemoteNode &operator=(const RemoteNode &) = delete;
+
+  const NodeOptions &options() const { return options_; }
+
+  // Run `command` on the agent with its output going to the local block
+  // `block_id`, which must exist and be running. Returns at once.
+  void execute(const std::string &block_id, const std::string &command,
+               const std::string &cwd, int cols, int rows);
+
+  // Forward block.input, block.kill or block.resize for a local block.
+  // Throws std::runtime_error with the agent's message on failure.
+  nlohmann::json control(const std::string &block_id,
+                         const std::string &method, nlohmann::json params);
+
+  // The local block runs (or waits to run) on this node
+  bool owns(const std::string &block_id);
+
+  // {name, address, connected, running, queued, max_concurrent}
+  nlohmann::json status();
+
+  // Disconnect without failing the blocks: returns the agent session, the
+  // running blocks and the queue for the constructor above. A command whose
+  // block.execute is in flight fails as on a disconnect.
+  nlohmann::json detach();
+
+private:
+  using ReplyHandler = std::function<void(const nlohmann::json &response)>;
+
+  struct Job {
+    std::string block_id;
+    std::string command;
+    std::string cwd;
+    int cols;
+    int rows;
+  };
+
+  // A command started on the agent
+  struct Running {
+    std::string block_id;  // local
+    std::string remote_id; // empty until block.execute replies
+    uint64_t next_seq = 0; // first output chunk not received yet
+    bool resuming = false; // block.subscribe sent, not answered yet
+  };
+
+  void run();
+  void stop();
+  bool connect_once();
+  bool handshake();
+  void read_loop();
+  void on_disconnect();
+
+  // Send a request; `on_reply` runs on the connection thread. False if not
+  // connected.
+  bool send_request(const std::string &method, nlohmann::json params,
+                    ReplyHandler on_reply);
+  bool write_line(const std::string &line);
+
+  void on_message(const nlohmann::json &message);
+  void on_output(const nlohmann::json &params);
+  void on_complete(const std::string &remote_id, int exit_code);
+  // Replay a block's output from since_seq and follow it from there
+  void resume_block(const std::string &remote_id, uint64_t since_seq);
+
+  // Start queued jobs while there are free slots
+  void pump();
+  void start_job(const Job &job);
+  void fail_block(const std::string &block_id, const std::string &message);
+
+  NodeOptions options_;
+  std::string session_id_; // agent session holding this node's blocks
+
+  std::mutex mutex_;
+  std::deque<Job> queue_;
+  std::map<std::string, Running> running_;          // by local block id
+  std::map<std::string, std::string> by_remote_;    // remote -> local id
+  std::map<std::string, std::deque<nlohmann::json>> early_; // by remote id
+  std::map<int64_t, ReplyHandler> pending_;
+  int64_t next_id_ = 1;
+  bool connected_ = false;
+
+  std::mutex write_mutex_;
+  int fd_ = -1;
+  std::string in_buf_;
+
+  std::atomic<bool> stopping_{false};
+  std::mutex stop_mutex_;
+  std::condition_variable stop_cv_;
+  std::thread thread_;
+};
+
+/**
+ * Agents this server can dispatch blocks to, by name
+ */
+class RemoteNodes {
+public:
+  static RemoteNodes &instance();
+
+  // Connect to a node, replacing one of the same name
+  void add(const NodeOptions &options);
+  bool remove(const std::string &name);
+  void clear();
+
+  std::shared_ptr<RemoteNode> find(const std::string &name);
+  // The node running a local block, or null
+  std::shared_ptr<RemoteNode> owner(const std::string &block_id);
+  nlohmann::json list();
+
+  // Hot upgrade: every node's options and detach() state, and the nodes
+  // rebuilt from that in the new process
+  nlohmann::json detach();
+  void adopt(const nlohmann::json &nodes);
+
+private:
+  std::mutex mutex_;
+  std::map<std::string, std::shared_ptr<RemoteNode>> nodes_;
+};
+
+} // namespace si::rpc
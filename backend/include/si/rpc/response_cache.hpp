@@ -0,0 +1,81 @@
+#pragma once
+
+#include "si/rpc/encoding.hpp"
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <si/nlohmann/json.hpp>
+#include <string>
+
+namespace si::rpc {
+
+/**
+ * A method result built at one version of its source collection. Each wire
+ * encoding is serialized at most once, on first use, and shared by every
+ * reply that carries the result.
+ */
+class CachedResult {
+public:
+  CachedResult(uint64_t version, nlohmann::json value);
+
+  uint64_t version() const { return version_; }
+  const nlohmann::json &value() const { return value_; }
+
+  // The result in `encoding`; `versioned` wraps it as
+  // {"data": result, "version": version}
+  const std::string &encoded(WireEncoding encoding, bool versioned) const;
+
+  // A copy as a JSON value, for replies that cannot be spliced (batches)
+  nlohmann::json to_json(bool versioned) const;
+
+private:
+  struct Encoded {
+    std::once_flag once;
+    std::string bytes;
+  };
+
+  const uint64_t version_;
+  const nlohmann::json value_;
+  mutable std::array<Encoded, 6> encoded_; // 3 encodings, bare or versioned
+};
+
+/**
+ * What a handler serves from a ResponseCache (see CallContext)
+ */
+struct CachedReply {
+  std::shared_ptr<const CachedResult> result;
+  bool versioned = false;
+
+  explicit operator bool() const { return result != nullptr; }
+};
+
+/**
+ * Results of list-style methods by key (method and parameters), each valid
+ * for one version of the collection it was built from.
+ */
+class ResponseCache {
+public:
+  using Builder = std::function<nlohmann::json()>;
+
+  explicit ResponseCache(size_t max_entries = 256);
+
+  // The entry for `key` if it was built at `version`; otherwise build,
+  // store and return a new one. Read the version before the data `build`
+  // returns, so a result is never tagged newer than what it contains.
+  std::shared_ptr<const CachedResult> get(const std::string &key,
+                                          uint64_t version,
+                                          const Builder &build);
+
+  size_t size();
+  void clear();
+
+private:
+  std::map<std::string, std::shared_ptr<const CachedResult>> entries_;
+  std::mutex mutex_;
+  size_t max_entries_;
+};
+
+} // namespace si::rpc
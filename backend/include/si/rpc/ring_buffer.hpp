@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <sys/uio.h>
+#include <vector>
+
+namespace si::rpc {
+
+/**
+ * Growable byte ring used as a connection's inbound buffer.
+ *
+ * recv() writes straight into the free space (see write_regions) and
+ * consumed bytes are released by moving the head, so nothing is shifted
+ * per message. Capacity is always a power of two.
+ */
+class RingBuffer {
+public:
+  explicit RingBuffer(size_t initial_capacity = 16 * 1024);
+
+  size_t size() const { return size_; }
+  size_t capacity() const { return buf_.size(); }
+  bool empty() const { return size_ == 0; }
+
+  // Describe at least `min_free` bytes of free space as up to two iovecs,
+  // growing the buffer if needed. Returns the number of iovecs filled.
+  size_t write_regions(struct iovec iov[2], size_t min_free);
+
+  // Mark `bytes` written into the regions returned by write_regions
+  void commit(size_t bytes);
+
+  // Make room for at least `bytes` readable bytes without further growth
+  void reserve(size_t bytes);
+
+  // Pointer to the first `len` readable bytes, rotating the buffer once if
+  // they wrap around its end. Valid until the next non-const call.
+  const char *contiguous(size_t len);
+
+  // Byte at readable offset `pos`
+  char at(size_t pos) const { return buf_[(head_ + pos) & mask()]; }
+
+  // Offset of the first `c` at or after readable offset `from`, or npos
+  size_t find(char c, size_t from) const;
+
+  // Release `bytes` from the front. Once empty, a buffer that grew for a
+  // large message shrinks back to its initial capacity.
+  void consume(size_t bytes);
+
+  static constexpr size_t npos = std::string::npos;
+
+private:
+  size_t mask() const { return buf_.size() - 1; }
+  void grow(size_t min_capacity);
+
+  std::vector<char> buf_;
+  size_t head_ = 0; // offset of the first readable byte
+  size_t size_ = 0; // readable bytes
+  size_t initial_capacity_;
+};
+
+} // namespace si::rpc
@@ -1,44 +1,385 @@
 #pragma once
 
+#include "si/foundation/cancellation.hpp"
+#include "si/rpc/admission.hpp"
+#include "si/rpc/compression.hpp"
+#include "si/rpc/encoding.hpp"
+#include "si/rpc/method_stats.hpp"
+#include "si/rpc/outbound.hpp"
+#include "si/rpc/response_cache.hpp"
+#include "si/rpc/shm_channel.hpp"
+#include "si/rpc/subscriptions.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <optional>
+#include <shared_mutex>
 #include <si/nlohmann/json.hpp>
 #include <string>
+#include <thread>
+#include <vector>
 
 namespace si::rpc {
 
+class EventLoop;
+class WorkerPool;
+struct Connection;
+
+// How a request reached the server
+enum class Transport {
+  Direct, // handle_request
+  Unix,   // the Unix socket
+  Http,   // a stream client of HttpTransport
+  Tcp     // a remote controller on the agent listener (listen_tcp)
+};
+
+// Who is calling a method. client_id is 0 for requests that did not arrive
+// from a connected client (handle_request).
+struct CallContext {
+  uint64_t client_id = 0;
+  Transport transport = Transport::Direct;
+  // Set by session.init: the connection switches to this format once the
+  // reply has been queued
+  std::optional<WireFormat> switch_format;
+  Compression switch_compression = Compression::None; // with switch_format
+  // Cancelled by $/cancelRequest or the client disconnecting; expires at
+  // the request's deadline_ms. Long-running handlers pass it on (AI, MCP).
+  std::shared_ptr<foundation::CancellationToken> cancel;
+  // Descriptors to pass with the reply (SCM_RIGHTS); the server owns and
+  // closes them. Only single requests on a socket can pass descriptors.
+  std::vector<int> pass_fds;
+  // Set by handlers serving a cached result; the handler's return value is
+  // then ignored and the result's pre-serialized bytes go into the reply
+  CachedReply cached_reply;
+};
+
 using RpcHandler = std::function<nlohmann::json(const nlohmann::json &params)>;
+using RpcContextHandler = std::function<nlohmann::json(
+    const nlohmann::json &params, CallContext &context)>;
+
+/**
+ * Execution class of a method. Each class has its own concurrency limit so
+ * that slow methods (AI, disk) cannot starve cheap ones.
+ */
+enum class MethodClass {
+  Inline,   // Fast, non-blocking: runs directly on the event loop thread
+  Blocking, // Disk, filesystem or process work: runs on the blocking pool
+  AI,       // LLM calls: runs on the small AI pool
+  Control   // Keystrokes, signals, resizes: own pool, one at a time per
+            // client, replies sent first
+};
+
+constexpr size_t kMethodClassCount = 4;
+
+// "inline", "blocking", "ai" or "control"
+const char *to_string(MethodClass method_class);
+
+/**
+ * Admission control, applied to each request before it is queued.
+ *
+ * Every client has a token bucket per method class; a request over its
+ * client's rate is refused with -32005 and the wait in data.retry_after_ms.
+ * When a pool's backlog reaches shed_queue_per_thread per handler thread,
+ * Blocking and AI requests from clients holding at least their share of
+ * that backlog are refused the same way; a client's share grows with its
+ * weight. Inline and Control requests are never shed. Within a pool,
+ * clients are served in weighted fair order (session.init weight), so one
+ * busy client cannot push out the others.
+ */
+struct AdmissionOptions {
+  // Indexed by MethodClass
+  std::array<RateLimit, kMethodClassCount> rates = {
+      RateLimit{2000, 4000}, RateLimit{500, 1000}, RateLimit{5, 20},
+      RateLimit{}};
+  size_t shed_queue_per_thread = 32; // 0 disables shedding
+};
 
 class RpcServer {
 public:
   static RpcServer &instance();
 
   // Register a method handler
-  void register_method(const std::string &method_name, RpcHandler handler);
+  void register_method(const std::string &method_name, RpcHandler handler,
+                       MethodClass method_class = MethodClass::Blocking);
+  // Register a handler that needs to know which client is calling
+  void register_method(const std::string &method_name,
+                       RpcContextHandler handler,
+                       MethodClass method_class = MethodClass::Blocking);
 
-  // Process a single JSON-RPC request string, return response string
+  // Process a JSON-RPC request string (a single request or a batch), return
+  // the response string. Returns an empty string for notifications (requests
+  // without an id) and for batches made only of notifications.
   std::string handle_request(const std::string &request_str);
 
+  // Clients on a transport other than the Unix socket (HttpTransport). They
+  // share the method table, subscriptions and slow-client policy with
+  // socket clients; notifications for them are pulled with read_stream().
+  // Needs a started server.
+  uint64_t open_stream();
+  void close_stream(uint64_t client_id);
+  bool is_connected(uint64_t client_id);
+
+  // Wait up to `timeout` for notifications queued for a stream client and
+  // append them to `out` as frames. Returns false once the client is
+  // closed (including by the slow-client policy).
+  bool read_stream(uint64_t client_id, std::string &out,
+                   std::chrono::milliseconds timeout);
+
+  // Process a request (or batch) from a stream client on the pools of its
+  // method classes, like a socket request. Blocks until the reply is ready
+  // and returns it serialized, or an empty string if there is none.
+  std::string handle_stream_request(uint64_t client_id,
+                                    const std::string &request_str);
+
   // Broadcast a notification to all connected clients
   void broadcast(const std::string &method, const nlohmann::json &params);
 
-  // Start the server on a Unix Domain Socket
+  // Send a block notification to the clients subscribed to its session or
+  // block. Clients that never subscribed receive everything.
+  void publish(const std::string &method, const nlohmann::json &params,
+               const EventScope &scope);
+
+  // Send a notification to one client; false if it is not connected
+  bool notify(uint64_t client_id, const std::string &method,
+              const nlohmann::json &params);
+
+  // Start the server on a Unix Domain Socket. An empty path starts it with
+  // no socket, for an agent that only listens on TCP.
   bool start(const std::string &socket_path);
   void stop();
 
+  // Also accept controllers over TCP (agent mode); needs a started server.
+  // A connection must send rpc.auth {token} before anything else. An empty
+  // token is only allowed on a loopback address. Port 0 picks a free port.
+  // Shared memory and descriptor passing are not available over TCP.
+  bool listen_tcp(const std::string &host, int port,
+                  const std::string &token);
+  int tcp_port() const { return tcp_port_; }
+
+  // Hot upgrade (see handoff.hpp). Stop serving and hand over the listening
+  // sockets and every socket client with its negotiated format, unread
+  // input and unsent output. Running requests are cancelled first, so
+  // their replies go out with the rest; stream clients are closed. The
+  // descriptors are appended to `fds` for the caller to pass on and close.
+  // The socket file is left in place.
+  nlohmann::json detach(std::vector<int> &fds);
+  // Serve again from what detach() returned, in this process or a new image
+  bool start_inherited(const nlohmann::json &state,
+                       const std::vector<int> &fds);
+
+  // Handler threads for a method class; takes effect on the next start().
+  // Inline methods always run on the event loop thread.
+  void set_class_concurrency(MethodClass method_class, size_t threads);
+
+  // Per-client queue budget and slow-client policy; set before start()
+  void set_outbound_options(const OutboundOptions &options);
+
+  // Rate limits and load shedding; set before start()
+  void set_admission_options(const AdmissionOptions &options);
+
+  // Largest inbound message accepted; a client that sends a bigger one gets
+  // an error and is disconnected. Set before start().
+  void set_max_frame_bytes(size_t bytes);
+
+  // Frames smaller than this are sent uncompressed on connections that
+  // negotiated compression. Set before start().
+  void set_compress_min_bytes(size_t bytes);
+
+  // Queue depth and drop counters, per client and in total
+  OutboundStats outbound_stats();
+
+  // Shared-memory output rings opened with rpc.shm.open
+  ShmChannelTable &shm_channels() { return shm_channels_; }
+
+  // Routing table behind publish(), for methods that subscribe the caller
+  SubscriptionTable &subscriptions() { return subscriptions_; }
+
+  // Per-method counters and latency percentiles, as returned by rpc.stats.
+  // An empty name returns every method.
+  nlohmann::json method_stats(const std::string &method_name = "");
+
+  // Log method stats periodically (0 disables); set before start()
+  void set_stats_log_interval(std::chrono::seconds interval);
+
 private:
-  RpcServer() = default;
+  RpcServer();
+
+  // session.init, rpc.subscribe, rpc.unsubscribe, rpc.stats,
+  // $/cancelRequest, rpc.shm.open, rpc.shm.close
+  void register_builtin_methods();
+
+  struct MethodEntry {
+    RpcContextHandler handler;
+    MethodClass method_class;
+    std::shared_ptr<MethodStats> stats; // kept across re-registration
+  };
+
+  // A parsed request resolved against the method table
+  struct Call {
+    nlohmann::json id;
+    nlohmann::json params;
+    CallContext context;
+    std::shared_ptr<const MethodEntry> entry;
+    std::chrono::steady_clock::time_point queued_at; // for queue wait
+    std::string cancel_key; // id.dump(), while registered in active_calls_
+    // Set by invoke(call, true) when the reply is to be encoded straight from
+    // `result` (or context.cached_reply) rather than a response object
+    bool reply_direct = false;
+    nlohmann::json result;
+  };
+
+  // Validate a parsed request and look up its method. On failure returns the
+  // error response to send instead. A successful call stays cancellable
+  // until invoke() or drop_call() retires it.
+  std::optional<nlohmann::json> prepare_call(nlohmann::json &request,
+                                             Call &call);
+
+  // Run a handler (no locks held), record its stats and build its response.
+  // Returns null for notifications. With `direct`, a successful result is
+  // left in the call (reply_direct) for queue_send to encode, and null is
+  // returned as well.
+  nlohmann::json invoke(Call &call, bool direct = false);
+
+  // Retire a prepared call that will never run (shutdown, refused)
+  void drop_call(Call &call);
+
+  // Charge a prepared call to its client's rate limit and check the load of
+  // its pool. If it is refused, the call is dropped and the error response
+  // returned (null for a notification).
+  std::optional<nlohmann::json> admit(Connection &conn, Call &call);
+
+  // Start a client's token buckets (connections, stream clients)
+  void init_admission(Connection &conn);
+
+  void untrack_call(Call &call);
+
+  // Cancel a client's request by id; false if it is not running or queued
+  bool cancel_call(uint64_t client_id, const nlohmann::json &id);
+
+  // Route one request frame from a socket client to the right executor
+  void dispatch(const std::shared_ptr<Connection> &conn, const char *data,
+                size_t size);
+
+  // Run the calls of a batch concurrently on their class pools. `done` gets
+  // the array of replies in request order, or null if there is nothing to
+  // send, from whichever thread finishes the last call.
+  void run_batch(nlohmann::json &requests, const CallContext &context,
+                 std::function<void(nlohmann::json)> done);
+
+  // Answer a TCP client's request until it has sent the right rpc.auth
+  nlohmann::json authenticate(const std::shared_ptr<Connection> &conn,
+                              const nlohmann::json &request);
+
+  // Event loop callbacks (loop thread only)
+  void on_accept(int listen_fd, bool tcp);
+  void on_client_event(const std::shared_ptr<Connection> &conn,
+                       uint32_t events);
+  bool read_client(const std::shared_ptr<Connection> &conn);
+  void flush_client(const std::shared_ptr<Connection> &conn);
+  // Have queued frames written: by the loop, or by a stream's reader
+  void schedule_flush(const std::shared_ptr<Connection> &conn);
+  // out_mutex held. False if anything is left; `failed` if the send broke.
+  bool write_pending(const std::shared_ptr<Connection> &conn, bool &failed);
+  void close_client(const std::shared_ptr<Connection> &conn);
+
+  // One notification serialized at most once per wire format, shared by
+  // every client using that format
+  struct NotificationFrames {
+    const std::string &method;
+    const nlohmann::json &params;
+    std::array<Frame, kWireFormatCount> frames;
+
+    const Frame &get(WireFormat format);
+  };
+
+  // Queue a reply for a client in its format and make sure the loop will
+  // flush it: `message`, or the direct reply of a call. Replies to Control
+  // calls go ahead of frames already queued. Returns the encoded size.
+  size_t queue_send(const std::shared_ptr<Connection> &conn,
+                    const nlohmann::json &message,
+                    const Call *direct = nullptr);
+
+  // Queue a notification, applying the slow-client policy
+  void queue_notification(const std::shared_ptr<Connection> &conn,
+                          NotificationFrames &notification);
+
+  // Serialize a notification for the wire
+  static Frame encode_notification(const std::string &method,
+                                   const nlohmann::json &params,
+                                   WireFormat format);
+
+  // Queue a handler's reply (if any) and retire the in-flight request.
+  // Returns the bytes queued.
+  size_t finish_request(const std::shared_ptr<Connection> &conn,
+                        const nlohmann::json &response,
+                        const Call *direct = nullptr);
+
+  void log_method_stats();
+
+  // Apply a negotiated format and compression to both directions (loop
+  // thread only)
+  void switch_format(const std::shared_ptr<Connection> &conn,
+                     WireFormat format, Compression compression);
+  // Compress frames queued from now on (out_mutex held)
+  void compress_output(Connection &conn, Compression compression);
+
+  // Event loop, handler pools and listeners of a started server
+  bool start_loop();
+  // Serve a connected socket client
+  void add_client(const std::shared_ptr<Connection> &conn);
+
+  // Split newly read bytes into frames and dispatch them. Returns the error
+  // for a frame that cannot be handled (too large, bad compression), after
+  // which the stream is unusable; null if all is well.
+  const char *dispatch_frames(const std::shared_ptr<Connection> &conn);
+
+  // Read-mostly method table: handlers are looked up under a shared lock and
+  // invoked with no lock held
+  std::map<std::string, std::shared_ptr<const MethodEntry>> methods_;
+  mutable std::shared_mutex methods_mutex_;
+
+  std::map<uint64_t, std::shared_ptr<Connection>> clients_; // by client id
+  std::mutex clients_mutex_;
+  uint64_t next_client_id_ = 1;
+
+  SubscriptionTable subscriptions_;
+  ShmChannelTable shm_channels_;
+
+  // Cancellation tokens of queued and running requests, by client and id
+  std::map<std::pair<uint64_t, std::string>,
+           std::shared_ptr<foundation::CancellationToken>>
+      active_calls_;
+  std::mutex active_calls_mutex_;
+
+  OutboundOptions outbound_options_;
+  size_t max_frame_bytes_ = 64 * 1024 * 1024;
+  size_t compress_min_bytes_ = 1024;
+  std::chrono::seconds stats_log_interval_{0};
+  OutboundStats retired_stats_; // totals of closed clients (clients_mutex_)
+  std::atomic<uint64_t> resyncs_{0};
+  std::atomic<uint64_t> slow_client_disconnects_{0};
 
-  void accept_loop();
-  void remove_client(int fd);
+  AdmissionOptions admission_options_;
+  // Requests refused by admit(), indexed by MethodClass
+  std::array<std::atomic<uint64_t>, kMethodClassCount> throttled_{};
+  std::array<std::atomic<uint64_t>, kMethodClassCount> shed_{};
 
-  std::map<std::string, RpcHandler> methods_;
-  std::vector<int> clients_;
-  std::mutex mutex_;
+  std::unique_ptr<EventLoop> loop_;
+  // Indexed by MethodClass
+  std::array<std::unique_ptr<WorkerPool>, kMethodClassCount> pools_;
+  std::array<size_t, kMethodClassCount> class_threads_ = {0, 8, 2, 2};
+  std::thread loop_thread_;
 
+  std::string socket_path_;
   int server_fd_ = -1;
-  bool running_ = false;
+  int tcp_fd_ = -1;
+  int tcp_port_ = 0;
+  std::string tcp_token_;
+  std::atomic<bool> running_{false};
 };
 
 } // namespace si::rpc
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <si/nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+namespace si::rpc {
+
+/**
+ * Shared-memory layout of a block output ring (version 1).
+ *
+ * The memfd starts with a ShmRingHeader; the data area follows at
+ * kShmDataOffset. Records are 8-byte aligned and never wrap: when one does
+ * not fit before the end, the writer fills the rest with a padding record
+ * (or, if fewer than sizeof(ShmRecordHeader) bytes are left, nothing) and
+ * starts again at offset 0.
+ *
+ * `head` counts bytes ever written; a record at absolute position p lives
+ * at data offset p % capacity. Integers are in host byte order. The
+ * writer never waits: a reader that falls more than `capacity` bytes
+ * behind has lost data and must resync from block.get.
+ */
+struct ShmRingHeader {
+  uint32_t magic;   // kShmMagic
+  uint32_t version; // 1
+  uint64_t capacity;
+  std::atomic<uint64_t> head; // published with release ordering
+  // Where head will be once the write in progress is done. A reader that
+  // copied a record at p checks reserve - p <= capacity afterwards; if not,
+  // the writer may have overwritten it meanwhile.
+  std::atomic<uint64_t> reserve;
+};
+
+enum ShmRecordKind : uint8_t {
+  kShmRecordOutput = 0,  // block output chunk
+  kShmRecordPadding = 1, // skip to the start of the data area
+  kShmRecordSkipped = 2, // chunk too large for the ring: fetch via block.get
+};
+
+struct ShmRecordHeader {
+  uint32_t size; // whole record, header and padding included
+  uint8_t kind;  // ShmRecordKind
+  uint8_t block_id_len;
+  uint8_t type_len;
+  uint8_t reserved;
+  uint64_t seq;      // OutputChunk::seq
+  uint32_t data_len; // then block_id, type and data follow
+  uint32_t reserved2;
+};
+
+constexpr uint32_t kShmMagic = 0x42524953; // "SIRB"
+constexpr size_t kShmDataOffset = 64;
+static_assert(sizeof(ShmRingHeader) <= kShmDataOffset);
+static_assert(sizeof(ShmRecordHeader) == 24);
+
+/**
+ * Writer side of a memfd-backed single-producer ring. Writes are
+ * serialized by the caller.
+ */
+class ShmRing {
+public:
+  // Capacity is rounded up to a power of two. Returns null (and logs) if
+  // the kernel has no memfd support or the mapping fails.
+  static std::unique_ptr<ShmRing> create(size_t capacity);
+  // Map a ring made by another process (hot upgrade), taking ownership of
+  // the descriptor. Null if it is not a ring.
+  static std::unique_ptr<ShmRing> adopt(int fd);
+  ~ShmRing();
+
+  ShmRing(const ShmRing &) = delete;
+  ShmRing &operator=(const ShmRing &) = delete;
+
+  // Append one output chunk and publish it. Chunks larger than half the
+  // ring become a kShmRecordSkipped marker.
+  void write(const std::string &block_id, const std::string &type,
+             const std::string &data, uint64_t seq);
+
+  // A new read-only descriptor for the client; the caller owns it
+  int dup_reader_fd() const;
+  // The writable descriptor, owned by the ring
+  int fd() const { return fd_; }
+
+  size_t capacity() const { return capacity_; }
+  uint64_t head() const;
+
+private:
+  ShmRing(int fd, char *base, size_t capacity);
+
+  int fd_;
+  char *base_;
+  size_t capacity_;
+};
+
+/**
+ * Reader side, as a local client would use it (and the tests do)
+ */
+class ShmRingReader {
+public:
+  struct Record {
+    ShmRecordKind kind;
+    std::string block_id;
+    std::string type;
+    std::string data;
+    uint64_t seq;
+  };
+
+  enum class Status { Record, Empty, Overrun };
+
+  // Maps the fd read-only; valid() is false on failure
+  explicit ShmRingReader(int fd);
+  ~ShmRingReader();
+
+  ShmRingReader(const ShmRingReader &) = delete;
+  ShmRingReader &operator=(const ShmRingReader &) = delete;
+
+  bool valid() const { return base_ != nullptr; }
+
+  // Next output or skipped record. After Overrun the reader has jumped to
+  // the current head.
+  Status next(Record &record);
+
+private:
+  const char *base_ = nullptr;
+  size_t mapped_ = 0;
+  size_t capacity_ = 0;
+  uint64_t tail_ = 0;
+};
+
+/**
+ * Rings opened by clients with rpc.shm.open, each covering a session or a
+ * single block. Output is copied into every matching ring as it arrives.
+ */
+class ShmChannelTable {
+public:
+  struct Channel {
+    uint64_t id;
+    uint64_t client_id;
+    std::string session_id;
+    std::string block_id;
+    std::unique_ptr<ShmRing> ring;
+    std::mutex write_mutex; // one producer at a time
+  };
+
+  std::shared_ptr<Channel> open(uint64_t client_id,
+                                const std::string &session_id,
+                                const std::string &block_id, size_t capacity);
+
+  // Returns the closed channel so its scope can be unsubscribed, or null
+  std::shared_ptr<Channel> close(uint64_t client_id, uint64_t channel_id);
+  void remove_client(uint64_t client_id);
+
+  void write(const std::string &session_id, const std::string &block_id,
+             const std::string &type, const std::string &data, uint64_t seq);
+
+  bool empty() const { return count_.load(std::memory_order_relaxed) == 0; }
+
+  // Hot upgrade: every channel, with a duplicate of its ring's descriptor
+  // appended to `fds`, and the channels rebuilt from that in a new process
+  nlohmann::json snapshot(std::vector<int> &fds) const;
+  void restore(const nlohmann::json &snapshot, const std::vector<int> &fds);
+
+private:
+  std::map<uint64_t, std::shared_ptr<Channel>> channels_;
+  mutable std::shared_mutex mutex_;
+  std::atomic<size_t> count_{0};
+  uint64_t next_id_ = 1;
+};
+
+} // namespace si::rpc
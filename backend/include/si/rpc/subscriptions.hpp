@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <si/nlohmann/json.hpp>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace si::rpc {
+
+// Kinds of block events a client can subscribe to (bitmask)
+enum EventTopic : uint8_t {
+  kTopicOutput = 1 << 0,   // block.output
+  kTopicComplete = 1 << 1, // block.complete
+  kTopicAll = kTopicOutput | kTopicComplete,
+  // Opt-in only, never sent to clients without subscriptions
+  kTopicOutputReady = 1 << 2, // block.output_ready (shared-memory doorbell)
+};
+
+// Parse ["output", "complete", "output_ready"]; unknown names throw
+// std::invalid_argument
+uint8_t parse_topics(const std::vector<std::string> &names);
+
+// Where a block event came from
+struct EventScope {
+  std::string session_id;
+  std::string block_id;
+  EventTopic topic;
+};
+
+/**
+ * Server-side routing table for block notifications.
+ *
+ * A client that never subscribed receives every event (legacy behaviour),
+ * except opt-in topics.
+ * Once it subscribes to anything it only receives events for the sessions
+ * and blocks it asked for, filtered by topic.
+ */
+class SubscriptionTable {
+public:
+  using ClientSet = std::unordered_set<uint64_t>;
+
+  struct Route {
+    ClientSet recipients; // explicit subscribers
+    ClientSet held;       // output withheld from these clients
+    // Clients with any subscription, shared with the table; null if none
+    std::shared_ptr<const ClientSet> filtered;
+    bool opt_in = false; // topic outside kTopicAll
+
+    bool wants(uint64_t client_id) const {
+      if (!held.empty() && held.count(client_id))
+        return false;
+      if (!recipients.empty() && recipients.count(client_id))
+        return true;
+      return !opt_in && (!filtered || filtered->count(client_id) == 0);
+    }
+  };
+
+  void subscribe_session(uint64_t client_id, const std::string &session_id,
+                         uint8_t topics);
+  void subscribe_block(uint64_t client_id, const std::string &block_id,
+                       uint8_t topics);
+
+  // Remove the given topics; the entry goes away once no topic is left
+  void unsubscribe_session(uint64_t client_id, const std::string &session_id,
+                           uint8_t topics);
+  void unsubscribe_block(uint64_t client_id, const std::string &block_id,
+                         uint8_t topics);
+
+  void remove_client(uint64_t client_id);
+
+  // Withhold a block's output from a client while it is being replayed to
+  // it (block.subscribe); every hold must be released
+  void hold_output(uint64_t client_id, const std::string &block_id);
+  void release_output(uint64_t client_id, const std::string &block_id);
+
+  // Every subscription as [client, "session"|"block", key, topics], and
+  // adding them back (hot upgrade)
+  nlohmann::json snapshot() const;
+  void restore(const nlohmann::json &snapshot);
+
+  Route route(const EventScope &scope) const;
+
+private:
+  using TopicMap = std::map<std::string, std::map<uint64_t, uint8_t>>;
+
+  static void add(TopicMap &map, const std::string &key, uint64_t client_id,
+                  uint8_t topics);
+  static void remove(TopicMap &map, const std::string &key,
+                     uint64_t client_id, uint8_t topics);
+  static void collect(const TopicMap &map, const std::string &key,
+                      EventTopic topic, ClientSet &out);
+  // Rebuild filtered_ after entries_ changed
+  void update_filtered();
+
+  TopicMap sessions_; // session_id -> client -> topics
+  TopicMap blocks_;   // block_id -> client -> topics
+  std::map<uint64_t, size_t> entries_; // client -> number of subscriptions
+  // Keys of entries_, copied on change so routing only shares a pointer
+  std::shared_ptr<const ClientSet> filtered_;
+  std::map<std::string, std::map<uint64_t, size_t>> held_; // block -> client
+  mutable std::shared_mutex mutex_;
+};
+
+} // namespace si::rpc
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace si::rpc {
+
+/**
+ * Fixed-size thread pool used to run RPC handlers off the event loop.
+ *
+ * Tasks are queued per flow (an RPC client) and picked by start-time fair
+ * queuing: each flow gets a share of the threads in proportion to its
+ * weight, however many tasks it has queued, and tasks of one flow start in
+ * the order they were submitted. A serial pool also runs them one at a
+ * time, so each finishes before the next of its flow starts.
+ */
+class WorkerPool {
+public:
+  using Task = std::function<void()>;
+
+  WorkerPool(std::string name, size_t threads, bool serial = false);
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  void start();
+
+  // Stop accepting work, finish queued tasks and join all threads
+  void stop();
+
+  // Queue a task. Returns false if the pool is stopped.
+  bool submit(Task task, uint64_t flow = 0, unsigned weight = 1);
+
+  size_t size() const { return thread_count_; }
+
+  // Tasks waiting for a thread: in total, for one flow, and the number of
+  // flows that have any
+  size_t queued();
+  size_t queued(uint64_t flow);
+  size_t flows();
+
+  // Whether the backlog has reached `limit` tasks and `flow` holds at
+  // least its weighted share of it; one consistent look at the queues
+  bool over_share(uint64_t flow, size_t limit);
+
+private:
+  struct Flow {
+    std::deque<std::pair<double, Task>> tasks; // with their start tags
+    double finish = 0; // virtual time at which the last task is served
+    unsigned weight = 1; // 0 while it has nothing queued
+    bool running = false; // serial pools: a task of the flow is running
+  };
+
+  void worker_loop();
+  // Serial pools: the flow's running task is done; queue its next one
+  void finish(uint64_t flow);
+
+  std::string name_;
+  size_t thread_count_;
+  bool serial_;
+  std::vector<std::thread> threads_;
+
+  std::map<uint64_t, Flow> flows_;
+  std::set<std::pair<double, uint64_t>> ready_; // head start tag, flow
+  double virtual_time_ = 0; // start tag of the task picked last
+  size_t queued_ = 0;
+  size_t weights_ = 0; // sum over the flows with queued tasks
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopping_ = false;
+};
+
+} // namespace si::rpc
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <filesystem>
 #include <fstream>
 #include <map>
@@ -25,6 +27,9 @@ public:
   // Reset category to defaults (if we have them)
   void reset_category(const std::string &category);
 
+  // Moves whenever any category is set or reset, for caching reads
+  uint64_t version() const { return version_.load(std::memory_order_acquire); }
+
 private:
   SettingsManager();
   ~SettingsManager() = default;
@@ -34,6 +39,7 @@ private:
 
   std::mutex mutex_;
   std::map<std::string, nlohmann::json> cache_;
+  std::atomic<uint64_t> version_{1};
 };
 
 } // namespace si::settings
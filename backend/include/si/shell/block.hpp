@@ -1,6 +1,7 @@
 #pragma once
 
 #include <chrono>
+#include <cstdint>
 #include <map>
 #include <si/nlohmann/json.hpp>
 #include <string>
@@ -14,6 +15,7 @@ struct OutputChunk {
   std::string data;
   std::string type;  // "stdout", "stderr", "html", "json"
   int64_t timestamp; // ms since epoch
+  uint64_t seq = 0;  // index in the block's output, from 0
 };
 
 struct Block {
@@ -37,18 +39,22 @@ struct Block {
     auto ts = std::chrono::duration_cast<std::chrono::milliseconds>(
                   now.time_since_epoch())
                   .count();
-    output_chunks.push_back({data, type, ts});
+    output_chunks.push_back({data, type, ts, output_chunks.size()});
   }
 };
 
 // JSON Serialization
 inline void to_json(nlohmann::json &j, const OutputChunk &c) {
-  j = nlohmann::json{{"data", c.data}, {"type", c.type}, {"ts", c.timestamp}};
+  j = nlohmann::json{{"data", c.data},
+                     {"type", c.type},
+                     {"ts", c.timestamp},
+                     {"seq", c.seq}};
 }
 inline void from_json(const nlohmann::json &j, OutputChunk &c) {
   j.at("data").get_to(c.data);
   j.at("type").get_to(c.type);
   j.at("ts").get_to(c.timestamp);
+  c.seq = j.value("seq", uint64_t{0});
 }
 
 inline void to_json(nlohmann::json &j, const Block &b) {
@@ -75,8 +81,11 @@ inline void from_json(const nlohmann::json &j, Block &b) {
   j.at("end_time").get_to(b.end_time);
   j.at("exit_code").get_to(b.exit_code);
   b.state = static_cast<BlockState>(j.at("state").get<int>());
-  if (j.contains("output_chunks"))
+  if (j.contains("output_chunks")) {
     j.at("output_chunks").get_to(b.output_chunks);
+    for (size_t i = 0; i < b.output_chunks.size(); i++)
+      b.output_chunks[i].seq = i; // older files have no seq
+  }
   if (j.contains("metadata"))
     j.at("metadata").get_to(b.metadata);
 }
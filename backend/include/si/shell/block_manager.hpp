@@ -1,11 +1,20 @@
 #pragma once
 
 #include "si/shell/block.hpp"
+#include "si/shell/block_store.hpp"
+#include "si/shell/chunk_list.hpp"
+#include "si/shell/session_log.hpp"
+#include <atomic>
+#include <cstdint>
+#include <deque>
 #include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <si/nlohmann/json.hpp>
 #include <optional>
+#include <set>
+#include <shared_mutex>
 #include <string>
 #include <vector>
 
@@ -37,7 +46,8 @@ public:
   void set_session_shell(const std::string &session_id,
                          const std::string &shell);
 
-  // Thread-safe: Returns a COPY of cwd and shell while holding the lock
+  // Thread-safe: Returns a COPY of cwd and shell under a shared lock; the
+  // defaults for an unknown session, which is not created
   std::pair<std::string, std::string>
   get_session_config_copy(const std::string &session_id);
 
@@ -56,12 +66,34 @@ public:
   // Get a specific block
   std::optional<Block> get_block(const std::string &block_id);
 
+  // A block's output from chunk `since_seq` on, without copying the rest
+  struct OutputTail {
+    std::string session_id;
+    BlockState state;
+    int exit_code;
+    uint64_t next_seq; // number of chunks the block has
+    std::vector<OutputChunk> chunks;
+  };
+  std::optional<OutputTail> get_output_since(const std::string &block_id,
+                                             uint64_t since_seq);
+
   // List blocks for a session
   std::vector<Block> list_blocks(const std::string &session_id);
 
+  // Change counters for caching list results. sessions_version() moves
+  // whenever list_sessions() may return something new; blocks_version()
+  // whenever a block of the session is created, gets output or completes.
+  // Versions are never reused, and 0 means the session never had blocks.
+  uint64_t sessions_version() const {
+    return sessions_version_.load(std::memory_order_acquire);
+  }
+  uint64_t blocks_version(const std::string &session_id);
+
   // Callbacks for API events
-  using BlockUpdateCallback = std::function<void(const std::string &block_id,
-                                                 const OutputChunk &chunk)>;
+  using BlockUpdateCallback =
+      std::function<void(const std::string &block_id,
+                         const std::string &session_id,
+                         const OutputChunk &chunk)>;
   using BlockCompleteCallback =
       std::function<void(const std::string &block_id,
                          const std::string &session_id, int exit_code)>;
@@ -69,7 +101,12 @@ public:
   void set_update_callback(BlockUpdateCallback cb);
   void set_complete_callback(BlockCompleteCallback cb);
 
-  // Persistence
+  // Persistence. Every change is recorded as it happens, in a log on top of
+  // a snapshot or, with [blocks] store = "sqlite", in a BlockStore. With the
+  // store only running blocks (and finished ones the store has not
+  // committed yet) are kept in memory; the rest are read back from it.
+  // save_sessions() waits until every change is on disk (folding the log
+  // into a snapshot); load_sessions() reads everything back.
   void save_sessions();
   void load_sessions();
 
@@ -79,15 +116,78 @@ private:
   // Generates UUID
   std::string generate_uuid();
 
-  std::map<std::string, Block> blocks_;            // block_id -> Block
+  // A block in memory. `info` is the block without its output: it is
+  // replaced (std::atomic_store) rather than changed, so readers take it
+  // without a lock. Output goes to the append-only `output`, whose writers
+  // serialize on `write_mutex` and wait for no other block.
+  struct Entry {
+    std::shared_ptr<const Block> info;
+    ChunkList output;
+    std::mutex write_mutex;
+  };
+  using BlockList = std::vector<std::shared_ptr<const Entry>>;
+
+  // A session's blocks by start_time, as an immutable list create_block
+  // replaces, and the version of what list_blocks() returns for it
+  struct SessionBlocks {
+    std::shared_ptr<const BlockList> blocks = std::make_shared<BlockList>();
+    std::atomic<uint64_t> version{0};
+  };
+
+  // The block as of now, output included (no lock needed)
+  static Block copy_block(const Entry &entry);
+
+  // Exclusive for changes to the maps below; append_output() and readers
+  // only hold it shared, for the lookup, and copy blocks after releasing it
+  std::shared_mutex mutex_;
+  std::map<std::string, std::shared_ptr<Entry>> blocks_; // block_id -> Entry
   std::map<std::string, SessionContext> sessions_; // session_id -> Context
-  std::mutex mutex_;
+  std::set<std::string> sessions_with_blocks_;
+  // session_id -> blocks; without a store only, or just for the version
+  std::map<std::string, SessionBlocks> session_blocks_;
+
+  std::atomic<uint64_t> sessions_version_{0};
+  std::atomic<uint64_t> next_version_{1};
+
+  // These expect mutex_ to be held exclusively, except
+  // bump_blocks_version(), which may be called with it shared
+  void bump_sessions_version();
+  void bump_blocks_version(const std::string &session_id);
+  // sessions_[id], noting and recording a new (listable) session
+  SessionContext &session_entry(const std::string &session_id);
+  // Add to blocks_ (not to the session's list)
+  std::shared_ptr<Entry> add_entry(Block block);
 
   BlockUpdateCallback update_cb_;
   BlockCompleteCallback complete_cb_;
 
-  // Internal save without lock
-  void save_sessions_internal();
+  // These expect mutex_ to be held exclusively. snapshot_internal() only
+  // takes the session list; the returned builder serializes the blocks
+  // later, without the lock (see SessionLog::snapshot)
+  SessionLog::Builder snapshot_internal();
+  void restore_snapshot(const nlohmann::json &j);
+  void apply_record(const nlohmann::json &record);
+  // Record a change, folding the log into a snapshot when it has grown
+  // enough
+  void log_internal(nlohmann::json record);
+  // Record a change with mutex_ held shared, which keeps a snapshot from
+  // being taken halfway through it; compact_log() folds the log afterwards
+  void record_change(nlohmann::json record);
+  void compact_log();
+  void log_session(const std::string &session_id);
+  // Copy what the session log holds into a new store (constructor)
+  void import_into_store();
+
+  // With a store, a finished block stays in blocks_ until the store has
+  // committed its completion, so reads never wait for the store's writer:
+  // (store_->queued() after the completion, block_id), oldest first
+  std::deque<std::pair<uint64_t, std::string>> retiring_;
+  // Drop the blocks whose completion is committed (mutex_ exclusive)
+  void retire_committed();
+
+  // One of these
+  std::unique_ptr<SessionLog> log_;
+  std::unique_ptr<BlockStore> store_;
 };
 
 } // namespace si::shell
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "si/shell/block.hpp"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <si/nlohmann/json.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct sqlite3_stmt;
+
+namespace si::shell {
+
+/**
+ * SQLite database of sessions, blocks and their output, used instead of
+ * the session log when [blocks] store = "sqlite".
+ *
+ * It takes the same change records as SessionLog. A writer thread applies
+ * everything queued since its last pass in one transaction, with prepared
+ * statements on a connection of its own. The database is in WAL mode, so
+ * reads run on a second connection without waiting for the writer; they
+ * see committed changes only. To see your own, flush() first, or keep what
+ * is not committed yet at hand until written() reaches queued().
+ *
+ * Blocks are indexed by (session_id, start_time) and by state, and output
+ * is stored one row per chunk under (block_id, seq), so listing a session,
+ * finding the running blocks at startup or reading a block's tail do not
+ * scan the rest.
+ */
+class BlockStore {
+public:
+  explicit BlockStore(std::filesystem::path db_path);
+  // Applies whatever is still queued
+  ~BlockStore();
+
+  BlockStore(const BlockStore &) = delete;
+  BlockStore &operator=(const BlockStore &) = delete;
+
+  // Open or create the database; false (and logged) if that failed
+  bool open();
+  // The database was created by open()
+  bool created() const { return created_; }
+
+  void append(nlohmann::json record);
+  // Wait until everything queued so far is committed
+  void flush();
+  // Records appended so far, and how many of them are committed
+  uint64_t queued();
+  uint64_t written();
+
+  struct SessionRow {
+    std::string id;
+    std::string name;
+    std::string cwd;
+    std::string shell;
+  };
+  std::vector<SessionRow> sessions();
+  // Sessions that have at least one block
+  std::vector<std::string> sessions_with_blocks();
+
+  // With their output
+  std::vector<Block> blocks_in_state(BlockState state);
+  std::vector<Block> session_blocks(const std::string &session_id);
+  // With its output from chunk `since_seq` on
+  std::optional<Block> block(const std::string &block_id,
+                             uint64_t since_seq = 0);
+  // Number of output chunks the block has
+  uint64_t output_count(const std::string &block_id);
+
+private:
+  struct Impl;
+
+  void writer_loop();
+  // Apply one record in the writer's transaction
+  void apply(const nlohmann::json &record);
+  // Fill in output_chunks from seq `since_seq` on (read_mutex_ held)
+  void read_output(Block &block, uint64_t since_seq);
+  // Blocks from a prepared query (read_mutex_ held)
+  std::vector<Block> read_blocks(sqlite3_stmt *stmt);
+
+  std::filesystem::path db_path_;
+  std::unique_ptr<Impl> impl_;
+  bool created_ = false;
+
+  std::mutex read_mutex_; // the reading connection and its statements
+
+  std::mutex mutex_;
+  std::condition_variable queued_cv_;
+  std::condition_variable written_cv_;
+  std::deque<nlohmann::json> queue_;
+  uint64_t queued_ = 0;
+  uint64_t written_ = 0;
+  bool stopping_ = false;
+  std::thread writer_;
+};
+
+} // namespace si::shell
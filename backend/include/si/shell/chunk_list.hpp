@@ -0,0 +1,99 @@
+#pragma once
+
+#include "si/shell/block.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace si::shell {
+
+/**
+ * Append-only list of a block's output chunks that readers traverse without
+ * locking.
+ *
+ * Chunks live in segments of 8, 16, 32, ... that are never moved or freed
+ * while the list exists. push_back() fills in the slot before publishing the
+ * new size with a release store, so a reader that loads size() sees every
+ * chunk below it complete. Only one push_back() may run at a time.
+ */
+class ChunkList {
+public:
+  ChunkList() = default;
+  ~ChunkList() {
+    Segment *s = head_.load(std::memory_order_relaxed);
+    while (s) {
+      Segment *next = s->next.load(std::memory_order_relaxed);
+      delete s;
+      s = next;
+    }
+  }
+
+  ChunkList(const ChunkList &) = delete;
+  ChunkList &operator=(const ChunkList &) = delete;
+
+  // Stores `chunk` with its seq set to its index; returns that index
+  uint64_t push_back(OutputChunk chunk) {
+    uint64_t n = size_.load(std::memory_order_relaxed);
+    auto [segment, offset] = locate(n);
+    if (offset == 0) {
+      auto *s = new Segment(kFirst << segment);
+      if (tail_)
+        tail_->next.store(s, std::memory_order_release);
+      else
+        head_.store(s, std::memory_order_release);
+      tail_ = s;
+    }
+    chunk.seq = n;
+    tail_->chunks[offset] = std::move(chunk);
+    size_.store(n + 1, std::memory_order_release);
+    return n;
+  }
+
+  uint64_t size() const { return size_.load(std::memory_order_acquire); }
+
+  // Chunks [from, to), with `to` at most a size() seen before
+  std::vector<OutputChunk> copy(uint64_t from, uint64_t to) const {
+    std::vector<OutputChunk> out;
+    if (from >= to)
+      return out;
+    out.reserve(to - from);
+    auto [segment, offset] = locate(from);
+    const Segment *s = head_.load(std::memory_order_acquire);
+    for (; segment > 0; segment--)
+      s = s->next.load(std::memory_order_acquire);
+    for (uint64_t i = from; i < to; i++, offset++) {
+      if (offset == s->capacity) {
+        s = s->next.load(std::memory_order_acquire);
+        offset = 0;
+      }
+      out.push_back(s->chunks[offset]);
+    }
+    return out;
+  }
+
+private:
+  static constexpr uint64_t kFirst = 8;
+
+  struct Segment {
+    explicit Segment(uint64_t n)
+        : capacity(n), chunks(std::make_unique<OutputChunk[]>(n)) {}
+    uint64_t capacity;
+    std::unique_ptr<OutputChunk[]> chunks;
+    std::atomic<Segment *> next{nullptr};
+  };
+
+  // Segment k starts at kFirst * (2^k - 1)
+  static std::pair<uint64_t, uint64_t> locate(uint64_t index) {
+    uint64_t m = index / kFirst + 1;
+    uint64_t segment = 63 - __builtin_clzll(m);
+    return {segment, index - kFirst * ((uint64_t{1} << segment) - 1)};
+  }
+
+  std::atomic<Segment *> head_{nullptr};
+  Segment *tail_ = nullptr; // the writer's
+  std::atomic<uint64_t> size_{0};
+};
+
+} // namespace si::shell
@@ -1,7 +1,13 @@
 #pragma once
+#include <condition_variable>
 #include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <si/nlohmann/json.hpp>
 #include <string>
+#include <sys/types.h>
 #include <vector>
 
 namespace si::shell {
@@ -16,11 +22,94 @@ struct ExecutionResult {
   bool success = false;
 };
 
+/**
+ * @brief Processes of running blocks, by block id
+ *
+ * Lets clients type into a block, signal it or resize its terminal while
+ * it runs. Entries are removed before the process is reaped, so a signal
+ * never reaches a recycled pid.
+ */
+class BlockProcesses {
+public:
+  static BlockProcesses &instance();
+
+  // Each returns false if the block has no running process.
+  // write_input never waits for the child: what its terminal cannot take
+  // now is queued for the block's reader to write (up to kMaxQueuedInput,
+  // beyond which it throws).
+  bool write_input(const std::string &block_id, const std::string &data);
+  // Signals the block's whole process group
+  bool send_signal(const std::string &block_id, int signal);
+  bool resize(const std::string &block_id, int cols, int rows);
+
+  bool is_running(const std::string &block_id);
+
+  /**
+   * Hot upgrade: stop every block's reader once it has handed on the
+   * output read so far, leaving the rest in the terminal. Returns
+   * {block_id, pid, fd} for each running block, fd indexing its terminal
+   * in `fds`; the table is left empty. Blocks launched from now on are
+   * held back for take_deferred().
+   */
+  nlohmann::json detach(std::vector<int> &fds);
+  // Launches held back since detach(): {block_id, command, cwd, shell,
+  // cols, rows} each
+  nlohmann::json take_deferred();
+  // Launch blocks normally again (after resuming)
+  void resume();
+
+private:
+  friend class CommandExecutor;
+
+  static constexpr size_t kMaxQueuedInput = 1024 * 1024;
+
+  struct Process {
+    pid_t pid;
+    int master_fd;     // non-blocking
+    int input_fd = -1; // eventfd: input was queued for the reader
+    std::mutex mutex;  // held while the fd is used; closed under it
+    bool closed = false;
+    std::string input; // what the terminal could not take yet
+    ~Process();
+  };
+
+  BlockProcesses();
+
+  // Count a block's reader in; false (and the launch held back) while
+  // detached
+  bool begin(const std::string &block_id, const nlohmann::json &launch);
+  void end();
+  // The reader should stop and leave the process running
+  bool detaching();
+  // Readable while detaching
+  int wake_fd() const { return wake_fd_; }
+
+  std::shared_ptr<Process> add(const std::string &block_id, pid_t pid,
+                               int master_fd);
+  // Write queued input while the terminal takes it (the reader, on POLLOUT)
+  void flush_input(Process &process);
+  // Call before closing the fd and reaping the process
+  void remove(const std::string &block_id);
+  std::shared_ptr<Process> find(const std::string &block_id);
+
+  std::mutex mutex_;
+  std::map<std::string, std::shared_ptr<Process>> processes_;
+  int wake_fd_ = -1;
+  bool detaching_ = false;
+  size_t readers_ = 0;
+  std::condition_variable parked_cv_;
+  nlohmann::json deferred_ = nlohmann::json::array();
+};
+
 /**
  * @brief Handles shell command execution with output capture
  */
 class CommandExecutor {
 public:
+  // Returned by execute_to_block and resume_to_block when the block was
+  // handed to the process taking over in a hot upgrade
+  static constexpr int kHandedOff = -2;
+
   CommandExecutor();
   ~CommandExecutor();
 
@@ -38,13 +127,16 @@ public:
    * @param shell Shell to use (default "/bin/bash")
    * @param on_stdout Callback for stdout chunks
    * @param on_stderr Callback for stderr chunks
+   * @param block_id If set, the process is listed in BlockProcesses while
+   * it runs
    * @return The exit code of the process
    */
   int execute_stream(const std::string &command, const std::string &cwd,
                      const std::string &shell,
                      std::function<void(const std::string &)> on_stdout,
                      std::function<void(const std::string &)> on_stderr,
-                     int cols = 80, int rows = 24);
+                     int cols = 80, int rows = 24,
+                     const std::string &block_id = "");
 
   /**
    * @brief Execute a command and stream output into a Block via BlockManager
@@ -61,10 +153,28 @@ public:
                        const std::string &shell = "/bin/bash", int cols = 80,
                        int rows = 24);
 
+  /**
+   * @brief Follow a block whose process was started before a hot upgrade
+   * @param block_id The block to write output to
+   * @param pid The block's process, a child of this one
+   * @param master_fd The process's terminal; owned from here on
+   * @return Exit code
+   */
+  int resume_to_block(const std::string &block_id, pid_t pid,
+                      int master_fd);
+
   /**
    * @brief Simple execution that prints to terminal (like system())
    */
   int run(const std::string &command);
+
+private:
+  // Read the terminal until the process exits, then reap it. With a
+  // block id the process is listed in BlockProcesses meanwhile, and the
+  // reader stops early (kHandedOff) if the block is detached.
+  int follow(pid_t pid, int master_fd,
+             const std::function<void(const std::string &)> &on_output,
+             const std::string &block_id);
 };
 
 } // namespace si::shell
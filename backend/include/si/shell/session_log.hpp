@@ -0,0 +1,124 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <si/nlohmann/json.hpp>
+#include <thread>
+
+namespace si::shell {
+
+struct SessionLogOptions {
+  // The log is folded into a snapshot once it is this large, or as large
+  // as the last snapshot if that is bigger
+  size_t compact_bytes = 4 * 1024 * 1024;
+  // fdatasync every group commit
+  bool sync = true;
+};
+
+/**
+ * Append-only log of BlockManager mutations, on top of a JSON snapshot.
+ *
+ * append() only queues the record: a writer thread encodes everything
+ * queued since its last pass and commits it with one write (and one
+ * fdatasync), so the cost to the caller does not depend on how many
+ * sessions and blocks there are. Each record is a 4-byte little-endian
+ * length, a CRC-32 of the payload and the payload as CBOR.
+ *
+ * snapshot() queues the whole state, or a function the writer calls to
+ * build it: the writer replaces the snapshot file with it (write, fsync,
+ * rename) and empties the log. Records are numbered and the snapshot notes
+ * the last one it contains, so records that outlive a crash between the
+ * rename and the truncation are skipped on recovery.
+ *
+ * The log belongs to one process at a time (flock on the log file). Any
+ * other process that opens it only reads: recover() leaves a torn tail
+ * alone, and appends and snapshots are dropped.
+ */
+class SessionLog {
+public:
+  SessionLog(std::filesystem::path log_path,
+             std::filesystem::path snapshot_path,
+             SessionLogOptions options = {});
+  // Commits whatever is still queued
+  ~SessionLog();
+
+  SessionLog(const SessionLog &) = delete;
+  SessionLog &operator=(const SessionLog &) = delete;
+
+  // Pass the snapshot, if there is one, to `restore`, then every record
+  // logged after it to `apply`, in order. A torn record at the end, from a
+  // crash mid-write, is cut off. Call with nothing queued. Returns the
+  // number of records applied.
+  size_t recover(
+      const std::function<void(const nlohmann::json &snapshot)> &restore,
+      const std::function<void(const nlohmann::json &record)> &apply);
+
+  void append(nlohmann::json record);
+
+  // `state` holds everything appended so far: it becomes the snapshot and
+  // the log starts over
+  void snapshot(nlohmann::json state);
+  // The same, with the state built on the writer thread. It must hold at
+  // least everything appended before this call; records appended later
+  // may be in it too, so replaying them has to be harmless.
+  using Builder = std::function<nlohmann::json()>;
+  void snapshot(Builder build);
+
+  // This process holds the log's lock and may write to it
+  bool owner() const { return owner_; }
+
+  // The log has grown enough to be worth a snapshot, and none is queued
+  bool wants_snapshot() const;
+
+  // Wait until everything queued so far is on disk
+  void flush();
+
+  struct Stats {
+    uint64_t records = 0;   // appended
+    uint64_t commits = 0;   // group commits written
+    uint64_t snapshots = 0; // snapshots written
+    uint64_t log_bytes = 0; // current size of the log
+  };
+  Stats stats() const;
+
+private:
+  struct Entry {
+    nlohmann::json value;
+    Builder build; // snapshot only
+    bool snapshot = false;
+  };
+
+  void writer_loop();
+  void open_log();
+  // Append `bytes` to the log; false (and logged) on failure
+  bool commit(const std::string &bytes);
+  void write_snapshot(const nlohmann::json &state);
+
+  std::filesystem::path log_path_;
+  std::filesystem::path snapshot_path_;
+  SessionLogOptions options_;
+  int fd_ = -1;
+  bool owner_ = false;
+
+  mutable std::mutex mutex_;
+  std::condition_variable queued_cv_;  // the writer waits for entries
+  std::condition_variable written_cv_; // flush() waits for the writer
+  std::deque<Entry> queue_;
+  uint64_t next_record_ = 1;
+  uint64_t queued_ = 0;  // entries ever queued
+  uint64_t written_ = 0; // entries the writer is done with
+  bool snapshot_queued_ = false;
+  bool stopping_ = false;
+
+  std::atomic<uint64_t> log_bytes_{0};
+  std::atomic<uint64_t> snapshot_bytes_{0};
+  Stats stats_;
+  std::thread writer_;
+};
+
+} // namespace si::shell
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "si/shell/workflow.hpp"
+#include <atomic>
+#include <cstdint>
 #include <map>
 #include <mutex>
 #include <optional>
@@ -17,6 +19,9 @@ public:
   std::optional<Workflow> get_workflow(const std::string &id);
   std::vector<Workflow> list_workflows(const std::string &tag_filter = "");
 
+  // Moves on every change to the workflow set, for caching list results
+  uint64_t version() const { return version_.load(std::memory_order_acquire); }
+
   // Core Logic
   std::string render_command(const std::string &workflow_id,
                              const std::map<std::string, std::string> &params);
@@ -29,6 +34,7 @@ private:
 
   std::map<std::string, Workflow> workflows_;
   std::mutex mutex_;
+  std::atomic<uint64_t> version_{1};
 };
 
 } // namespace si::shell
@@ -16,8 +16,15 @@ ContextBuilder &ContextBuilder::instance() {
 nlohmann::json ContextBuilder::build_context() {
   nlohmann::json ctx;
 
+  std::string cwd, session_id;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cwd = current_cwd_;
+    session_id = session_id_;
+  }
+
   // Current directory
-  ctx["cwd"] = current_cwd_;
+  ctx["cwd"] = cwd;
 
   // OS info
   ctx["os"] = si::foundation::Platform::get_os_name();
@@ -46,7 +53,7 @@ nlohmann::json ContextBuilder::build_context() {
 
   // Recent commands (last 5)
   auto &bm = si::shell::BlockManager::instance();
-  auto blocks = bm.list_blocks(session_id_);
+  auto blocks = bm.list_blocks(session_id);
   nlohmann::json recent = nlohmann::json::array();
   int count = 0;
   for (auto it = blocks.rbegin(); it != blocks.rend() && count < 5;
@@ -81,9 +88,13 @@ Given a command and its error output, provide:
 Be concise. If suggesting a command, format it in a code block.)";
 }
 
-void ContextBuilder::set_cwd(const std::string &cwd) { current_cwd_ = cwd; }
+void ContextBuilder::set_cwd(const std::string &cwd) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  current_cwd_ = cwd;
+}
 
 void ContextBuilder::set_session_id(const std::string &session_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
   session_id_ = session_id;
 }
 
@@ -212,6 +212,8 @@ CompletionResponse AIGateway::complete(const CompletionRequest &request) {
   if (response.success) {
     SI_LOG_DEBUG("Completion successful: {} tokens, {:.2f}ms",
                  response.tokens_used, response.latency_ms);
+  } else if (response.cancelled) {
+    SI_LOG_DEBUG("Completion cancelled after {:.2f}ms", response.latency_ms);
   } else {
     SI_LOG_ERROR("Completion failed: {}", response.error_message);
   }
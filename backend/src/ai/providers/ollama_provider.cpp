@@ -72,7 +72,15 @@ CompletionResponse OllamaProvider::complete(const CompletionRequest &request) {
   }
 
   // Make request
-  std::string result = make_request("/api/generate", req_json.dump());
+  std::string result = make_request("/api/generate", req_json.dump(), false,
+                                    nullptr, request.cancel.get());
+
+  if (request.cancel && request.cancel->is_cancelled()) {
+    response.success = false;
+    response.cancelled = true;
+    response.error_message = "Request cancelled";
+    return response;
+  }
 
   if (result.empty()) {
     response.success = false;
@@ -121,11 +129,12 @@ CompletionResponse OllamaProvider::stream(const CompletionRequest &request,
                      {"num_predict", request.max_tokens}}}};
 
   // Make streaming request
-  std::string full_response =
-      make_request("/api/generate", req_json.dump(), true, callback);
+  std::string full_response = make_request(
+      "/api/generate", req_json.dump(), true, callback, request.cancel.get());
 
   response.content = full_response;
-  response.success = !full_response.empty();
+  response.cancelled = request.cancel && request.cancel->is_cancelled();
+  response.success = !full_response.empty() && !response.cancelled;
 
   auto end = std::chrono::high_resolution_clock::now();
   response.latency_ms =
@@ -183,13 +192,23 @@ bool OllamaProvider::check_model_exists() {
   }
 }
 
-std::string OllamaProvider::make_request(const std::string &endpoint,
-                                         const std::string &json_body,
-                                         bool stream, TokenCallback callback) {
+std::string
+OllamaProvider::make_request(const std::string &endpoint,
+                             const std::string &json_body, bool stream,
+                             TokenCallback callback,
+                             foundation::CancellationToken *cancel) {
   try {
     httplib::Client client(host_);
-    client.set_connection_timeout(30, 0);
-    client.set_read_timeout(60, 0);
+    client.set_connection_timeout(
+        foundation::time_left(cancel, std::chrono::seconds(30)));
+    client.set_read_timeout(
+        foundation::time_left(cancel, std::chrono::seconds(60)));
+
+    // Cancelling shuts the socket down, which ends a blocked read at once
+    foundation::CancellationCallback stop_on_cancel(
+        cancel, [&client]() { client.stop(); });
+    if (cancel && cancel->is_cancelled())
+      return "";
 
     httplib::Headers headers = {{"Content-Type", "application/json"}};
 
@@ -215,7 +234,7 @@ std::string OllamaProvider::make_request(const std::string &endpoint,
                           // Ignore malformed chunks
                         }
 
-                        return true;
+                        return !(cancel && cancel->is_cancelled());
                       });
 
       return full_response;
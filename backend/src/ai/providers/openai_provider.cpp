@@ -63,7 +63,15 @@ CompletionResponse OpenAIProvider::complete(const CompletionRequest &request) {
     req_json["stop"] = request.stop_sequences;
   }
 
-  std::string result = make_request("/v1/chat/completions", req_json.dump());
+  std::string result = make_request("/v1/chat/completions", req_json.dump(),
+                                    false, nullptr, request.cancel.get());
+
+  if (request.cancel && request.cancel->is_cancelled()) {
+    response.success = false;
+    response.cancelled = true;
+    response.error_message = "Request cancelled";
+    return response;
+  }
 
   if (result.empty()) {
     response.success = false;
@@ -135,10 +143,12 @@ CompletionResponse OpenAIProvider::stream(const CompletionRequest &request,
       {"stream", true}};
 
   std::string full_response =
-      make_request("/v1/chat/completions", req_json.dump(), true, callback);
+      make_request("/v1/chat/completions", req_json.dump(), true, callback,
+                   request.cancel.get());
 
   response.content = full_response;
-  response.success = !full_response.empty();
+  response.cancelled = request.cancel && request.cancel->is_cancelled();
+  response.success = !full_response.empty() && !response.cancelled;
 
   auto end = std::chrono::high_resolution_clock::now();
   response.latency_ms =
@@ -153,9 +163,18 @@ template <typename ClientType>
 std::string run_request(ClientType &client, const std::string &endpoint,
                         const httplib::Headers &headers,
                         const std::string &json_body, bool stream,
-                        TokenCallback callback) {
-  client.set_connection_timeout(30, 0);
-  client.set_read_timeout(60, 0);
+                        TokenCallback callback,
+                        foundation::CancellationToken *cancel) {
+  client.set_connection_timeout(
+      foundation::time_left(cancel, std::chrono::seconds(30)));
+  client.set_read_timeout(
+      foundation::time_left(cancel, std::chrono::seconds(60)));
+
+  // Cancelling shuts the socket down, which ends a blocked read at once
+  foundation::CancellationCallback stop_on_cancel(
+      cancel, [&client]() { client.stop(); });
+  if (cancel && cancel->is_cancelled())
+    return "";
 
   if (stream && callback) {
     std::string full_response;
@@ -190,7 +209,7 @@ std::string run_request(ClientType &client, const std::string &endpoint,
               }
             }
           }
-          return true;
+          return !(cancel && cancel->is_cancelled());
         });
     return full_response;
   } else {
@@ -205,9 +224,11 @@ std::string run_request(ClientType &client, const std::string &endpoint,
   return "";
 }
 
-std::string OpenAIProvider::make_request(const std::string &endpoint,
-                                         const std::string &json_body,
-                                         bool stream, TokenCallback callback) {
+std::string
+OpenAIProvider::make_request(const std::string &endpoint,
+                             const std::string &json_body, bool stream,
+                             TokenCallback callback,
+                             foundation::CancellationToken *cancel) {
   try {
     httplib::Headers headers = {{"Content-Type", "application/json"},
                                 {"Authorization", "Bearer " + api_key_}};
@@ -222,7 +243,7 @@ std::string OpenAIProvider::make_request(const std::string &endpoint,
         host.pop_back();
       httplib::SSLClient client(host.c_str());
       return run_request(client, endpoint, headers, json_body, stream,
-                         callback);
+                         callback, cancel);
     } else {
       if (host.find("http://") == 0)
         host = host.substr(7);
@@ -230,7 +251,7 @@ std::string OpenAIProvider::make_request(const std::string &endpoint,
         host.pop_back();
       httplib::Client client(base_url_.c_str()); // Client can take full URL
       return run_request(client, endpoint, headers, json_body, stream,
-                         callback);
+                         callback, cancel);
     }
 
   } catch (const std::exception &e) {
@@ -0,0 +1,87 @@
+#include "si/foundation/cancellation.hpp"
+#include <algorithm>
+
+namespace si::foundation {
+
+CancellationToken::CancellationToken(Clock::time_point deadline)
+    : deadline_(deadline) {}
+
+void CancellationToken::cancel() {
+  std::map<size_t, Callback> callbacks;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (cancelled_.exchange(true))
+      return;
+    callbacks.swap(callbacks_);
+    running_callbacks_ = true;
+    cancelling_thread_ = std::this_thread::get_id();
+  }
+
+  for (auto &[id, callback] : callbacks)
+    callback();
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_callbacks_ = false;
+  }
+  callbacks_done_.notify_all();
+}
+
+bool CancellationToken::is_cancelled() const {
+  return cancelled_.load(std::memory_order_acquire) || deadline_exceeded();
+}
+
+bool CancellationToken::deadline_exceeded() const {
+  return has_deadline() && Clock::now() >= deadline_;
+}
+
+std::chrono::milliseconds
+CancellationToken::remaining(std::chrono::milliseconds cap) const {
+  if (cancelled_.load(std::memory_order_acquire))
+    return std::chrono::milliseconds(0);
+  if (!has_deadline())
+    return cap;
+  auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+      deadline_ - Clock::now());
+  if (left.count() < 0)
+    return std::chrono::milliseconds(0);
+  return std::min(left, cap);
+}
+
+size_t CancellationToken::on_cancel(Callback callback) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!cancelled_.load(std::memory_order_relaxed)) {
+      size_t id = next_id_++;
+      callbacks_.emplace(id, std::move(callback));
+      return id;
+    }
+  }
+  callback();
+  return 0;
+}
+
+void CancellationToken::remove_callback(size_t id) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (callbacks_.erase(id) > 0)
+    return;
+  // Already taken by cancel(): wait until it is done with it (unless we
+  // are inside one of the callbacks)
+  if (cancelling_thread_ == std::this_thread::get_id())
+    return;
+  callbacks_done_.wait(lock, [this]() { return !running_callbacks_; });
+}
+
+CancellationCallback::CancellationCallback(
+    CancellationToken *token, CancellationToken::Callback callback)
+    : token_(token) {
+  if (token_)
+    id_ = token_->on_cancel(std::move(callback));
+}
+
+CancellationCallback::~CancellationCallback() {
+  if (token_)
+    token_->remove_callback(id_);
+}
+
+} // namespace si::foundation
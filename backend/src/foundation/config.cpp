@@ -206,6 +206,114 @@ bool Config::get_dry_run_available() const {
   return true;
 }
 
+int Config::get_rpc_max_queue_kb() const {
+  if (pimpl_->loaded) {
+    return pimpl_->config["rpc"]["max_queue_kb"].value_or(4096);
+  }
+  return 4096;
+}
+
+std::string Config::get_rpc_slow_client_policy() const {
+  if (pimpl_->loaded) {
+    return pimpl_->config["rpc"]["slow_client_policy"].value_or("coalesce");
+  }
+  return "coalesce";
+}
+
+int Config::get_rpc_max_frame_mb() const {
+  if (pimpl_->loaded) {
+    return pimpl_->config["rpc"]["max_frame_mb"].value_or(64);
+  }
+  return 64;
+}
+
+int Config::get_rpc_compress_min_bytes() const {
+  if (pimpl_->loaded) {
+    return pimpl_->config["rpc"]["compress_min_bytes"].value_or(1024);
+  }
+  return 1024;
+}
+
+double Config::get_rpc_rate_limit(const std::string &method_class,
+                                  double fallback) const {
+  if (pimpl_->loaded) {
+    return pimpl_->config["rpc"]["rate_limit_" + method_class].value_or(
+        fallback);
+  }
+  return fallback;
+}
+
+double Config::get_rpc_rate_burst(const std::string &method_class,
+                                  double fallback) const {
+  if (pimpl_->loaded) {
+    return pimpl_->config["rpc"]["rate_burst_" + method_class].value_or(
+        fallback);
+  }
+  return fallback;
+}
+
+int Config::get_rpc_shed_queue_per_thread() const {
+  if (pimpl_->loaded) {
+    return pimpl_->config["rpc"]["shed_queue_per_thread"].value_or(32);
+  }
+  return 32;
+}
+
+int Config::get_rpc_output_window_ms() const {
+  if (pimpl_->loaded) {
+    return pimpl_->config["rpc"]["output_window_ms"].value_or(8);
+  }
+  return 8;
+}
+
+int Config::get_rpc_output_max_kb() const {
+  if (pimpl_->loaded) {
+    return pimpl_->config["rpc"]["output_max_kb"].value_or(64);
+  }
+  return 64;
+}
+
+int Config::get_rpc_stats_log_interval_s() const {
+  if (pimpl_->loaded) {
+    return pimpl_->config["rpc"]["stats_log_interval_s"].value_or(0);
+  }
+  return 0;
+}
+
+int Config::get_rpc_http_port() const {
+  if (pimpl_->loaded) {
+    return pimpl_->config["rpc"]["http_port"].value_or(0);
+  }
+  return 0;
+}
+
+std::string Config::get_rpc_http_host() const {
+  if (pimpl_->loaded) {
+    return pimpl_->config["rpc"]["http_host"].value_or("127.0.0.1");
+  }
+  return "127.0.0.1";
+}
+
+std::vector<std::string> Config::get_rpc_http_allowed_origins() const {
+  std::vector<std::string> origins;
+  if (pimpl_->loaded) {
+    if (auto *list = pimpl_->config["rpc"]["http_allowed_origins"].as_array()) {
+      for (const auto &origin : *list) {
+        if (auto value = origin.value<std::string>())
+          origins.push_back(*value);
+      }
+    }
+  }
+  return origins;
+}
+
+std::string Config::get_blocks_store() const {
+  if (pimpl_->loaded) {
+    return pimpl_->config["blocks"]["store"].value_or("log");
+  }
+  return "log";
+}
+
 std::filesystem::path Config::get_history_file() const {
   if (pimpl_->loaded) {
     auto path =
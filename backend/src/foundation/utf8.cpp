@@ -0,0 +1,65 @@
+#include "si/foundation/utf8.hpp"
+#include <cstdint>
+#include <cstring>
+
+namespace si::foundation {
+
+bool is_valid_utf8(std::string_view text) {
+  const auto *p = reinterpret_cast<const unsigned char *>(text.data());
+  const auto *end = p + text.size();
+
+  while (p < end) {
+    // Skip ASCII a word at a time
+    while (end - p >= 8) {
+      uint64_t word;
+      memcpy(&word, p, sizeof(word));
+      if (word & 0x8080808080808080ULL)
+        break;
+      p += 8;
+    }
+    if (p == end)
+      break;
+    if (*p < 0x80) {
+      p++;
+      continue;
+    }
+
+    // Lead byte: number of continuation bytes, and the range allowed for
+    // the first of them (Unicode table 3-7)
+    size_t count;
+    unsigned char low = 0x80, high = 0xbf;
+    unsigned char lead = *p;
+    if (lead >= 0xc2 && lead <= 0xdf) {
+      count = 1;
+    } else if (lead == 0xe0) {
+      count = 2;
+      low = 0xa0;
+    } else if (lead == 0xed) {
+      count = 2;
+      high = 0x9f; // surrogates
+    } else if (lead >= 0xe1 && lead <= 0xef) {
+      count = 2;
+    } else if (lead == 0xf0) {
+      count = 3;
+      low = 0x90;
+    } else if (lead >= 0xf1 && lead <= 0xf3) {
+      count = 3;
+    } else if (lead == 0xf4) {
+      count = 3;
+      high = 0x8f; // past U+10FFFF
+    } else {
+      return false;
+    }
+
+    if (static_cast<size_t>(end - p) <= count || p[1] < low || p[1] > high)
+      return false;
+    for (size_t i = 2; i <= count; i++) {
+      if (p[i] < 0x80 || p[i] > 0xbf)
+        return false;
+    }
+    p += count + 1;
+  }
+  return true;
+}
+
+} // namespace si::foundation
@@ -4,61 +4,255 @@
 #include "si/foundation/platform.hpp"
 #include "si/foundation/signals.hpp"
 #include "si/rpc/api_bindings.hpp"
+#include "si/rpc/handoff.hpp"
+#include "si/rpc/http_transport.hpp"
 #include "si/rpc/server.hpp"
 #include "si/session/history.hpp"
 #include "si/shell/interactive_shell.hpp"
 #include "si/si.hpp"
+#include <chrono>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 using namespace si;
 using namespace si::foundation;
 
+namespace {
+
+// sicore --upgrade: have the server on `socket_path` exec this binary, then
+// wait on the same connection until the new image answers
+int request_upgrade(const std::string &socket_path) {
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    std::cerr << "Cannot connect to " << socket_path << "\n";
+    return 1;
+  }
+
+  std::string buffer;
+  int next_id = 1;
+  // The reply to one request, skipping notifications; null on failure
+  auto call = [&](const std::string &method, const nlohmann::json &params) {
+    int id = next_id++;
+    std::string line = nlohmann::json{{"jsonrpc", "2.0"},
+                                      {"method", method},
+                                      {"params", params},
+                                      {"id", id}}
+                           .dump() +
+                       "\n";
+    if (send(fd, line.data(), line.size(), MSG_NOSIGNAL) !=
+        static_cast<ssize_t>(line.size()))
+      return nlohmann::json();
+    while (true) {
+      size_t pos;
+      while ((pos = buffer.find('\n')) != std::string::npos) {
+        auto message =
+            nlohmann::json::parse(buffer.substr(0, pos), nullptr, false);
+        buffer.erase(0, pos + 1);
+        if (message.is_object() && message.value("id", 0) == id)
+          return message;
+      }
+      struct pollfd pfd = {fd, POLLIN, 0};
+      char chunk[4096];
+      if (poll(&pfd, 1, 10000) <= 0)
+        return nlohmann::json();
+      ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+      if (n <= 0)
+        return nlohmann::json();
+      buffer.append(chunk, n);
+    }
+  };
+
+  auto before = call("server.info", nlohmann::json::object());
+  auto reply = call("server.upgrade",
+                    {{"binary", si::rpc::Handoff::instance().executable()}});
+  if (!before.contains("result") || !reply.contains("result")) {
+    const auto &failed = before.contains("result") ? reply : before;
+    std::cerr << "Upgrade refused: "
+              << (failed.contains("error") ? failed["error"].dump()
+                                           : "no reply")
+              << "\n";
+    close(fd);
+    return 1;
+  }
+  int upgrades = before["result"].value("upgrades", 0);
+  for (int attempt = 0; attempt < 100; attempt++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    auto info = call("server.info", nlohmann::json::object());
+    if (!info.contains("result"))
+      break;
+    if (info["result"].value("upgrades", 0) > upgrades) {
+      std::cout << "sicore (pid " << info["result"]["pid"]
+                << ") is now running " << info["result"]["version"].dump()
+                << " from " << reply["result"]["binary"].dump() << "\n";
+      close(fd);
+      return 0;
+    }
+  }
+  std::cerr << "The server did not come back from the upgrade\n";
+  close(fd);
+  return 1;
+}
+
+} // namespace
+
 int main(int argc, char **argv) {
   try {
+    si::rpc::Handoff::instance().set_command_line(argc, argv);
     Logger::instance().init((Platform::get_cache_dir() / "si.log").string(),
                             Logger::Level::Info, Logger::Level::Debug);
     SI_LOG_INFO("SI v{} starting...", VERSION);
 
-    Config::instance().load_default();
-    si::ai::AIGateway::instance().initialize();
-    si::session::HistoryManager::instance().initialize();
-
-    // Register RPC API bindings
-    si::rpc::register_api_bindings();
-
-    // Check for --server mode (headless RPC server only)
+    // Check for --server mode (headless RPC server only), or --agent mode
+    // (runs commands for another sicore over TCP)
     bool server_mode = false;
+    bool agent_mode = false;
+    bool upgrade_mode = false;
+    int handoff_fd = -1; // left by the image this one replaced
     std::string socket_path = "si.sock";
+    std::string listen_address = "127.0.0.1:7411";
+    const char *token_env = std::getenv("SI_AGENT_TOKEN");
+    std::string agent_token = token_env ? token_env : "";
     for (int i = 1; i < argc; ++i) {
       std::string arg = argv[i];
       if (arg == "--server") {
         server_mode = true;
+      } else if (arg == "--agent") {
+        agent_mode = true;
+      } else if (arg == "--upgrade") {
+        upgrade_mode = true;
+      } else if (arg == "--handoff-fd" && i + 1 < argc) {
+        handoff_fd = std::atoi(argv[++i]);
       } else if (arg == "--socket" && i + 1 < argc) {
         socket_path = argv[++i];
+      } else if (arg == "--listen" && i + 1 < argc) {
+        listen_address = argv[++i];
+      } else if (arg == "--token" && i + 1 < argc) {
+        agent_token = argv[++i];
       }
     }
 
+    // The upgrade client only talks to the running server; creating any
+    // singleton here would open (and possibly recover) the server's files
+    if (upgrade_mode)
+      return request_upgrade(socket_path);
+
+    Config::instance().load_default();
+    si::ai::AIGateway::instance().initialize();
+    si::session::HistoryManager::instance().initialize();
+
+    // Register RPC API bindings
+    si::rpc::register_api_bindings();
+
     SignalHandler::instance().register_shutdown_handlers([](int sig) {
       SI_LOG_INFO("Signal {}, shutting down...", sig);
       SignalHandler::instance().request_shutdown();
     });
 
-    if (server_mode) {
+    if (server_mode || agent_mode) {
       // Headless server mode - start RPC server and wait
-      SI_LOG_INFO("Starting in server mode on {}", socket_path);
-      std::cout << "SI Backend Server starting on " << socket_path << std::endl;
+      if (agent_mode) {
+        SI_LOG_INFO("Starting in agent mode on {}", listen_address);
+        std::cout << "SI Agent starting on " << listen_address << std::endl;
+      } else {
+        SI_LOG_INFO("Starting in server mode on {}", socket_path);
+        std::cout << "SI Backend Server starting on " << socket_path
+                  << std::endl;
+      }
+
+      auto &config = Config::instance();
+      si::rpc::OutboundOptions outbound;
+      outbound.max_queue_bytes =
+          static_cast<size_t>(config.get_rpc_max_queue_kb()) * 1024;
+      if (!si::rpc::parse_slow_client_policy(
+              config.get_rpc_slow_client_policy(),
+              outbound.slow_client_policy)) {
+        SI_LOG_WARN("Unknown rpc.slow_client_policy '{}', using coalesce",
+                    config.get_rpc_slow_client_policy());
+      }
+      si::rpc::RpcServer::instance().set_outbound_options(outbound);
+      si::rpc::RpcServer::instance().set_max_frame_bytes(
+          static_cast<size_t>(config.get_rpc_max_frame_mb()) * 1024 * 1024);
+      si::rpc::RpcServer::instance().set_compress_min_bytes(
+          static_cast<size_t>(config.get_rpc_compress_min_bytes()));
+      si::rpc::AdmissionOptions admission;
+      for (size_t i = 0; i < si::rpc::kMethodClassCount; i++) {
+        const char *name =
+            si::rpc::to_string(static_cast<si::rpc::MethodClass>(i));
+        auto &rate = admission.rates[i];
+        rate.rate = config.get_rpc_rate_limit(name, rate.rate);
+        rate.burst = config.get_rpc_rate_burst(name, rate.burst);
+      }
+      admission.shed_queue_per_thread =
+          static_cast<size_t>(config.get_rpc_shed_queue_per_thread());
+      si::rpc::RpcServer::instance().set_admission_options(admission);
+      si::rpc::RpcServer::instance().set_stats_log_interval(
+          std::chrono::seconds(config.get_rpc_stats_log_interval_s()));
 
-      if (!si::rpc::RpcServer::instance().start(socket_path)) {
+      si::rpc::CoalescerOptions coalescing;
+      coalescing.window =
+          std::chrono::milliseconds(config.get_rpc_output_window_ms());
+      coalescing.max_bytes =
+          static_cast<size_t>(config.get_rpc_output_max_kb()) * 1024;
+      si::rpc::block_output_coalescer().set_options(coalescing);
+
+      // After an upgrade the sockets, clients and commands are inherited.
+      // An agent only listens on TCP.
+      bool inherited = handoff_fd >= 0 &&
+                       si::rpc::Handoff::instance().resume(handoff_fd);
+      if (!inherited &&
+          !si::rpc::RpcServer::instance().start(agent_mode ? ""
+                                                           : socket_path)) {
         std::cerr << "Failed to start RPC server\n";
         return 1;
       }
+      if (agent_mode && !inherited) {
+        std::string host;
+        int port = 0;
+        if (!si::rpc::parse_host_port(listen_address, host, port) ||
+            !si::rpc::RpcServer::instance().listen_tcp(host, port,
+                                                       agent_token)) {
+          std::cerr << "Failed to listen on " << listen_address << "\n";
+          si::rpc::RpcServer::instance().stop();
+          return 1;
+        }
+      }
+
+      si::rpc::HttpTransport http(si::rpc::RpcServer::instance());
+      si::rpc::HttpTransportOptions http_options;
+      bool http_enabled = !agent_mode && config.get_rpc_http_port() > 0;
+      if (http_enabled) {
+        http_options.host = config.get_rpc_http_host();
+        http_options.port = config.get_rpc_http_port();
+        http_options.allowed_origins = config.get_rpc_http_allowed_origins();
+        if (!http.start(http_options))
+          std::cerr << "Failed to start HTTP transport\n";
+      }
 
-      // Wait for shutdown signal
+      // Wait for shutdown signal, or for server.upgrade
+      auto &handoff = si::rpc::Handoff::instance();
       while (!SignalHandler::instance().shutdown_requested()) {
+        if (handoff.requested()) {
+          http.stop();
+          si::session::HistoryManager::instance().shutdown();
+          handoff.upgrade(); // returns only if the exec failed
+          si::session::HistoryManager::instance().initialize();
+          if (http_enabled)
+            http.start(http_options);
+        }
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
       }
 
+      http.stop();
+      si::rpc::RemoteNodes::instance().clear();
       si::rpc::RpcServer::instance().stop();
     } else {
       // Interactive shell mode
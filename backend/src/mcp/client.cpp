@@ -64,7 +64,8 @@ std::vector<Tool> Client::list_tools() {
 }
 
 ToolResult Client::call_tool(const std::string &name,
-                             const nlohmann::json &arguments) {
+                             const nlohmann::json &arguments,
+                             foundation::CancellationToken *cancel) {
   ToolResult result;
   if (!initialized_) {
     result.is_error = true;
@@ -74,7 +75,7 @@ ToolResult Client::call_tool(const std::string &name,
   nlohmann::json params = {{"name", name}, {"arguments", arguments}};
 
   try {
-    auto res_json = call("tools/call", params);
+    auto res_json = call("tools/call", params, cancel);
 
     if (res_json.contains("content")) {
       // According to spec, content is list of content items
@@ -97,7 +98,8 @@ ToolResult Client::call_tool(const std::string &name,
 }
 
 nlohmann::json Client::call(const std::string &method,
-                            const nlohmann::json &params) {
+                            const nlohmann::json &params,
+                            foundation::CancellationToken *cancel) {
   int id;
   std::future<nlohmann::json> future;
 
@@ -118,15 +120,28 @@ nlohmann::json Client::call(const std::string &method,
     throw std::runtime_error("Failed to send request");
   }
 
-  // Blocking wait (with timeout ideally, but simple for now)
-  if (future.wait_for(std::chrono::seconds(10)) ==
-      std::future_status::timeout) {
+  // Blocking wait, cut short by cancellation or the token's deadline.
+  // Cancelling completes the pending promise with a marker.
+  foundation::CancellationCallback wake_on_cancel(cancel, [this, id]() {
     std::lock_guard<std::mutex> lock(mutex_);
-    pending_requests_.erase(id);
+    auto it = pending_requests_.find(id);
+    if (it != pending_requests_.end()) {
+      it->second->promise.set_value({{"cancelled", true}});
+      pending_requests_.erase(it);
+    }
+  });
+
+  auto timeout = foundation::time_left(cancel, std::chrono::seconds(10));
+  if (future.wait_for(timeout) == std::future_status::timeout) {
+    abandon(id, "Request timed out");
     throw std::runtime_error("Request timed out");
   }
 
   auto response = future.get();
+  if (response.contains("cancelled")) {
+    abandon(id, "Request cancelled");
+    throw std::runtime_error("Request cancelled");
+  }
 
   if (response.contains("error")) {
     std::string msg = "Unknown error";
@@ -143,6 +158,17 @@ nlohmann::json Client::call(const std::string &method,
   return nlohmann::json::object(); // fallback
 }
 
+void Client::abandon(int id, const std::string &reason) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_requests_.erase(id);
+  }
+  nlohmann::json notif = {{"jsonrpc", "2.0"},
+                          {"method", "notifications/cancelled"},
+                          {"params", {{"requestId", id}, {"reason", reason}}}};
+  transport_->send(notif.dump());
+}
+
 void Client::handle_message(const std::string &msg) {
   try {
     auto j = nlohmann::json::parse(msg);
@@ -0,0 +1,25 @@
+#include "si/rpc/admission.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace si::rpc {
+
+bool TokenBucket::take(Clock::time_point now,
+                       std::chrono::milliseconds &retry_after) {
+  if (limit_.rate <= 0)
+    return true;
+  double elapsed = std::chrono::duration<double>(now - updated_).count();
+  if (elapsed > 0) {
+    tokens_ = std::min(limit_.burst, tokens_ + elapsed * limit_.rate);
+    updated_ = now;
+  }
+  if (tokens_ >= 1) {
+    tokens_ -= 1;
+    return true;
+  }
+  retry_after = std::chrono::milliseconds(static_cast<int64_t>(
+      std::ceil((1 - tokens_) / limit_.rate * 1000)));
+  return false;
+}
+
+} // namespace si::rpc
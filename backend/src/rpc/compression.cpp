@@ -0,0 +1,364 @@
+#include "si/rpc/compression.hpp"
+#include "si/rpc/encoding.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef SI_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace si::rpc {
+
+namespace {
+
+// Lz: LZ4-style sequences of literals then a match, with matches reaching
+// back into earlier messages of the stream
+//
+//   token     u8: literal count (high nibble), match length - 4 (low)
+//   [count]   255-bytes plus remainder when a nibble is 15
+//   literals
+//   offset    u16 little-endian, 1..kLzWindow back from here
+//   [length]
+//
+// The last sequence of a message has literals only.
+constexpr size_t kLzWindow = 65535;
+constexpr size_t kLzMinMatch = 4;
+constexpr int kLzHashBits = 14;
+
+inline uint32_t load32(const unsigned char *p) {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint32_t lz_hash(uint32_t sequence) {
+  return (sequence * 2654435761u) >> (32 - kLzHashBits);
+}
+
+void put_length(std::string &out, size_t length) {
+  while (length >= 255) {
+    out.push_back(static_cast<char>(255));
+    length -= 255;
+  }
+  out.push_back(static_cast<char>(length));
+}
+
+class LzCompressor : public Compressor {
+public:
+  LzCompressor() : table_(size_t{1} << kLzHashBits, 0) {}
+
+  void compress(const char *data, size_t size, std::string &out) override {
+    size_t start = history_.size();
+    history_.append(data, size);
+    auto *b = reinterpret_cast<const unsigned char *>(history_.data());
+    size_t end = history_.size();
+
+    size_t anchor = start;
+    size_t pos = start;
+    size_t misses = 0;
+    while (pos + kLzMinMatch <= end) {
+      uint32_t sequence = load32(b + pos);
+      uint32_t &slot = table_[lz_hash(sequence)];
+      // Positions are kept modulo 2^32 from the start of the stream
+      uint32_t here = static_cast<uint32_t>(base_ + pos);
+      uint32_t distance = here - slot;
+      slot = here;
+      if (distance == 0 || distance > kLzWindow || distance > pos ||
+          load32(b + pos - distance) != sequence) {
+        // Skip faster through data that does not compress
+        pos += 1 + (misses++ >> 6);
+        continue;
+      }
+      misses = 0;
+
+      size_t match = pos - distance;
+      size_t length = kLzMinMatch;
+      while (pos + length < end && b[pos + length] == b[match + length])
+        length++;
+      while (pos > anchor && match > 0 && b[pos - 1] == b[match - 1]) {
+        pos--;
+        match--;
+        length++;
+      }
+      emit(out, b + anchor, pos - anchor, distance, length);
+      pos += length;
+      anchor = pos;
+    }
+    emit(out, b + anchor, end - anchor, 0, 0);
+
+    if (history_.size() > kLzWindow) {
+      size_t drop = history_.size() - kLzWindow;
+      history_.erase(0, drop);
+      base_ += drop;
+    }
+  }
+
+private:
+  static void emit(std::string &out, const unsigned char *literals,
+                   size_t count, size_t distance, size_t length) {
+    size_t extra = length ? length - kLzMinMatch : 0;
+    out.push_back(static_cast<char>((std::min<size_t>(count, 15) << 4) |
+                                    std::min<size_t>(extra, 15)));
+    if (count >= 15)
+      put_length(out, count - 15);
+    out.append(reinterpret_cast<const char *>(literals), count);
+    if (!length)
+      return;
+    out.push_back(static_cast<char>(distance & 0xff));
+    out.push_back(static_cast<char>(distance >> 8));
+    if (extra >= 15)
+      put_length(out, extra - 15);
+  }
+
+  std::string history_; // the window, then the message being compressed
+  uint64_t base_ = 0;   // stream position of history_[0]
+  std::vector<uint32_t> table_;
+};
+
+class LzDecompressor : public Decompressor {
+public:
+  bool decompress(const char *data, size_t size, std::string &out,
+                  size_t max_size) override {
+    auto *in = reinterpret_cast<const unsigned char *>(data);
+    auto *in_end = in + size;
+    size_t start = history_.size();
+
+    auto get_length = [&](size_t &length) {
+      unsigned char byte;
+      do {
+        if (in == in_end)
+          return false;
+        byte = *in++;
+        length += byte;
+      } while (byte == 255 && length <= max_size);
+      return true;
+    };
+
+    while (in < in_end) {
+      unsigned char token = *in++;
+      size_t count = token >> 4;
+      if (count == 15 && !get_length(count))
+        return false;
+      if (count > static_cast<size_t>(in_end - in) ||
+          history_.size() - start + count > max_size)
+        return false;
+      history_.append(reinterpret_cast<const char *>(in), count);
+      in += count;
+      if (in == in_end)
+        break;
+
+      if (in_end - in < 2)
+        return false;
+      size_t distance = in[0] | (size_t{in[1]} << 8);
+      in += 2;
+      size_t length = (token & 0x0f) + kLzMinMatch;
+      if ((token & 0x0f) == 15 && !get_length(length))
+        return false;
+      if (distance == 0 || distance > history_.size() ||
+          history_.size() - start + length > max_size)
+        return false;
+      // Byte by byte: a match may overlap the bytes it produces
+      size_t from = history_.size() - distance;
+      history_.resize(history_.size() + length);
+      char *p = &history_[0];
+      for (size_t i = 0; i < length; i++)
+        p[from + distance + i] = p[from + i];
+    }
+
+    out.append(history_, start, std::string::npos);
+    if (history_.size() > kLzWindow)
+      history_.erase(0, history_.size() - kLzWindow);
+    return true;
+  }
+
+  std::string window() override { return history_; }
+  void set_window(const std::string &window) override { history_ = window; }
+
+private:
+  std::string history_;
+};
+
+#ifdef SI_HAVE_ZLIB
+
+// Raw deflate, each message ended with a sync flush so it can be inflated
+// on its own while the window carries over
+class DeflateCompressor : public Compressor {
+public:
+  DeflateCompressor() {
+    std::memset(&stream_, 0, sizeof(stream_));
+    if (deflateInit2(&stream_, Z_BEST_SPEED, Z_DEFLATED, -15, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+      throw std::runtime_error("deflateInit2 failed");
+  }
+  ~DeflateCompressor() override { deflateEnd(&stream_); }
+
+  void compress(const char *data, size_t size, std::string &out) override {
+    stream_.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    stream_.avail_in = static_cast<uInt>(size);
+    // deflateBound leaves room for the flush marker: one pass as a rule
+    size_t chunk = deflateBound(&stream_, static_cast<uLong>(size)) + 16;
+    do {
+      size_t have = out.size();
+      out.resize(have + chunk);
+      stream_.next_out = reinterpret_cast<Bytef *>(&out[have]);
+      stream_.avail_out = static_cast<uInt>(chunk);
+      deflate(&stream_, Z_SYNC_FLUSH);
+      out.resize(out.size() - stream_.avail_out);
+      chunk = 64 * 1024;
+    } while (stream_.avail_out == 0);
+  }
+
+private:
+  z_stream stream_;
+};
+
+class DeflateDecompressor : public Decompressor {
+public:
+  DeflateDecompressor() {
+    std::memset(&stream_, 0, sizeof(stream_));
+    if (inflateInit2(&stream_, -15) != Z_OK)
+      throw std::runtime_error("inflateInit2 failed");
+  }
+  ~DeflateDecompressor() override { inflateEnd(&stream_); }
+
+  bool decompress(const char *data, size_t size, std::string &out,
+                  size_t max_size) override {
+    stream_.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    stream_.avail_in = static_cast<uInt>(size);
+    size_t start = out.size();
+    size_t chunk = std::max<size_t>(size * 4, 4096);
+    while (true) {
+      size_t produced = out.size() - start;
+      // One byte past the limit tells an oversized message apart
+      chunk = std::min(chunk, max_size + 1 - produced);
+      size_t have = out.size();
+      out.resize(have + chunk);
+      stream_.next_out = reinterpret_cast<Bytef *>(&out[have]);
+      stream_.avail_out = static_cast<uInt>(chunk);
+      int rc = inflate(&stream_, Z_SYNC_FLUSH);
+      out.resize(out.size() - stream_.avail_out);
+      if (rc != Z_OK && rc != Z_BUF_ERROR)
+        return false;
+      if (out.size() - start > max_size)
+        return false;
+      if (stream_.avail_out != 0 || (rc == Z_BUF_ERROR && !stream_.avail_in))
+        return stream_.avail_in == 0;
+      chunk *= 2;
+    }
+  }
+
+  std::string window() override {
+    std::string window(32 * 1024, '\0');
+    uInt size = static_cast<uInt>(window.size());
+    if (inflateGetDictionary(&stream_, reinterpret_cast<Bytef *>(&window[0]),
+                             &size) != Z_OK)
+      size = 0;
+    window.resize(size);
+    return window;
+  }
+
+  // A raw stream takes a dictionary at any point
+  void set_window(const std::string &window) override {
+    if (!window.empty())
+      inflateSetDictionary(&stream_,
+                           reinterpret_cast<const Bytef *>(window.data()),
+                           static_cast<uInt>(window.size()));
+  }
+
+private:
+  z_stream stream_;
+};
+
+#endif
+
+} // namespace
+
+bool parse_compression(const std::string &name, Compression &compression) {
+  if (name == "deflate") {
+    compression = Compression::Deflate;
+  } else if (name == "lz") {
+    compression = Compression::Lz;
+  } else if (name == "none") {
+    compression = Compression::None;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char *to_string(Compression compression) {
+  switch (compression) {
+  case Compression::None:
+    return "none";
+  case Compression::Deflate:
+    return "deflate";
+  case Compression::Lz:
+    return "lz";
+  }
+  return "unknown";
+}
+
+bool compression_available(Compression compression) {
+#ifndef SI_HAVE_ZLIB
+  if (compression == Compression::Deflate)
+    return false;
+#endif
+  return true;
+}
+
+std::vector<std::string> available_compressions() {
+  std::vector<std::string> names;
+  for (auto compression : {Compression::Deflate, Compression::Lz}) {
+    if (compression_available(compression))
+      names.push_back(to_string(compression));
+  }
+  return names;
+}
+
+std::unique_ptr<Compressor> Compressor::create(Compression compression) {
+  switch (compression) {
+  case Compression::None:
+    return nullptr;
+  case Compression::Deflate:
+#ifdef SI_HAVE_ZLIB
+    return std::make_unique<DeflateCompressor>();
+#else
+    return nullptr;
+#endif
+  case Compression::Lz:
+    return std::make_unique<LzCompressor>();
+  }
+  return nullptr;
+}
+
+std::unique_ptr<Decompressor> Decompressor::create(Compression compression) {
+  switch (compression) {
+  case Compression::None:
+    return nullptr;
+  case Compression::Deflate:
+#ifdef SI_HAVE_ZLIB
+    return std::make_unique<DeflateDecompressor>();
+#else
+    return nullptr;
+#endif
+  case Compression::Lz:
+    return std::make_unique<LzDecompressor>();
+  }
+  return nullptr;
+}
+
+std::string compress_frame(Compressor &compressor, std::string_view frame) {
+  std::string out(kFrameHeaderSize, '\0');
+  compressor.compress(frame.data() + kFrameHeaderSize,
+                      frame.size() - kFrameHeaderSize, out);
+  uint32_t length = static_cast<uint32_t>(out.size() - kFrameHeaderSize) |
+                    kCompressedFrameFlag;
+  out[0] = static_cast<char>((length >> 24) & 0xff);
+  out[1] = static_cast<char>((length >> 16) & 0xff);
+  out[2] = static_cast<char>((length >> 8) & 0xff);
+  out[3] = static_cast<char>(length & 0xff);
+  return out;
+}
+
+} // namespace si::rpc
@@ -0,0 +1,445 @@
+#include "si/rpc/encoding.hpp"
+#include "si/foundation/utf8.hpp"
+#include <cstring>
+
+namespace si::rpc {
+
+namespace {
+constexpr size_t kScratchKeep = 1024 * 1024;
+constexpr size_t kDirectSize = 16 * 1024;
+
+// Serialization buffer. By default the calling thread's scratch, which keeps
+// its capacity from one message to the next so a steady stream of replies
+// is serialized without growing a fresh string each time; take() copies the
+// message out at its final size. A message expected to be large gets a
+// string of its own, reserved up front, and so does one that outgrew
+// kScratchKeep: those are handed over without a copy.
+class Scratch {
+public:
+  explicit Scratch(size_t expected = 0)
+      : buffer_(expected >= kDirectSize ? own_ : thread_buffer()) {
+    buffer_.clear();
+    buffer_.reserve(expected);
+  }
+
+  std::string &buffer() { return buffer_; }
+
+  std::string take() {
+    if (&buffer_ != &own_ && buffer_.capacity() <= kScratchKeep)
+      return buffer_;
+    std::string out = std::move(buffer_);
+    buffer_ = std::string();
+    return out;
+  }
+
+private:
+  static std::string &thread_buffer() {
+    thread_local std::string buffer;
+    return buffer;
+  }
+
+  std::string own_;
+  std::string &buffer_;
+};
+
+void write_frame_length(std::string &frame) {
+  uint32_t length = static_cast<uint32_t>(frame.size() - kFrameHeaderSize);
+  frame[0] = static_cast<char>((length >> 24) & 0xff);
+  frame[1] = static_cast<char>((length >> 16) & 0xff);
+  frame[2] = static_cast<char>((length >> 8) & 0xff);
+  frame[3] = static_cast<char>(length & 0xff);
+}
+
+// Append a value without framing
+void append_value(std::string &out, const nlohmann::json &value,
+                  WireEncoding encoding) {
+  switch (encoding) {
+  case WireEncoding::Json: {
+    // What dump() does, minus its temporary string
+    nlohmann::detail::serializer<nlohmann::json> serializer(
+        nlohmann::detail::output_adapter<char>(out), ' ');
+    serializer.dump(value, false, false, 0);
+    break;
+  }
+  case WireEncoding::Cbor:
+    nlohmann::json::to_cbor(value, out);
+    break;
+  case WireEncoding::MsgPack:
+    nlohmann::json::to_msgpack(value, out);
+    break;
+  }
+}
+
+void append_big_endian(std::string &out, uint64_t value, int bytes) {
+  for (int i = bytes - 1; i >= 0; i--)
+    out += static_cast<char>((value >> (i * 8)) & 0xff);
+}
+
+// CBOR head: major type and length, in the shortest form
+void append_cbor_head(std::string &out, uint8_t major, uint64_t length) {
+  major <<= 5;
+  if (length < 24) {
+    out += static_cast<char>(major | length);
+  } else if (length <= 0xff) {
+    out += static_cast<char>(major | 24);
+    append_big_endian(out, length, 1);
+  } else if (length <= 0xffff) {
+    out += static_cast<char>(major | 25);
+    append_big_endian(out, length, 2);
+  } else if (length <= 0xffffffff) {
+    out += static_cast<char>(major | 26);
+    append_big_endian(out, length, 4);
+  } else {
+    out += static_cast<char>(major | 27);
+    append_big_endian(out, length, 8);
+  }
+}
+
+// MessagePack head with an 8, 16 or 32-bit length
+void append_msgpack_head(std::string &out, uint8_t code8, uint8_t code16,
+                         uint8_t code32, uint64_t length) {
+  if (code8 && length <= 0xff) {
+    out += static_cast<char>(code8);
+    append_big_endian(out, length, 1);
+  } else if (length <= 0xffff) {
+    out += static_cast<char>(code16);
+    append_big_endian(out, length, 2);
+  } else {
+    out += static_cast<char>(code32);
+    append_big_endian(out, length, 4);
+  }
+}
+
+// Raw bytes as a byte string (binary encodings only)
+void append_binary(std::string &out, std::string_view data,
+                   WireEncoding encoding) {
+  if (encoding == WireEncoding::Cbor)
+    append_cbor_head(out, 2, data.size());
+  else
+    append_msgpack_head(out, 0xc4, 0xc5, 0xc6, data.size());
+  out += data;
+}
+
+// A string that needs no escaping in JSON: a key or method name
+void append_name(std::string &out, std::string_view name,
+                 WireEncoding encoding) {
+  switch (encoding) {
+  case WireEncoding::Json:
+    out += '"';
+    out += name;
+    out += '"';
+    return;
+  case WireEncoding::Cbor:
+    append_cbor_head(out, 3, name.size());
+    break;
+  case WireEncoding::MsgPack:
+    if (name.size() < 32)
+      out += static_cast<char>(0xa0 | name.size()); // fixstr
+    else
+      append_msgpack_head(out, 0xd9, 0xda, 0xdb, name.size());
+    break;
+  }
+  out += name;
+}
+
+// Map header (binary encodings only)
+void append_map_head(std::string &out, size_t count, WireEncoding encoding) {
+  if (encoding == WireEncoding::Cbor)
+    append_cbor_head(out, 5, count);
+  else if (count < 16)
+    out += static_cast<char>(0x80 | count); // fixmap
+  else
+    append_msgpack_head(out, 0, 0xde, 0xdf, count);
+}
+
+void begin_frame(std::string &out, WireFormat format) {
+  if (format.framing == Framing::LengthPrefixed)
+    out.assign(kFrameHeaderSize, '\0');
+}
+
+void end_frame(std::string &out, WireFormat format) {
+  if (format.framing == Framing::LengthPrefixed)
+    write_frame_length(out);
+  else
+    out += '\n';
+}
+
+// Everything of a response up to its result: {"id":..,"jsonrpc":"2.0",
+// "result":
+void begin_response(std::string &out, const nlohmann::json &id,
+                    WireEncoding encoding) {
+  if (encoding == WireEncoding::Json) {
+    out += "{\"id\":";
+  } else {
+    append_map_head(out, 3, encoding);
+    append_name(out, "id", encoding);
+  }
+  append_value(out, id, encoding);
+  if (encoding == WireEncoding::Json) {
+    out += ",\"jsonrpc\":\"2.0\",\"result\":";
+    return;
+  }
+  append_name(out, "jsonrpc", encoding);
+  append_name(out, "2.0", encoding);
+  append_name(out, "result", encoding);
+}
+
+// The message object around params: {"jsonrpc":"2.0","method":..,"params":
+void begin_notification(std::string &out, std::string_view method,
+                        WireEncoding encoding) {
+  if (encoding == WireEncoding::Json) {
+    out += "{\"jsonrpc\":\"2.0\",\"method\":";
+    append_name(out, method, encoding);
+    out += ",\"params\":";
+    return;
+  }
+  append_map_head(out, 3, encoding);
+  append_name(out, "jsonrpc", encoding);
+  append_name(out, "2.0", encoding);
+  append_name(out, "method", encoding);
+  append_name(out, method, encoding);
+  append_name(out, "params", encoding);
+}
+
+// Close the object opened by begin_response or begin_notification
+void end_message(std::string &out, WireEncoding encoding) {
+  if (encoding == WireEncoding::Json)
+    out += '}';
+}
+
+// A JSON string escaped as dump() does it. `text` must be valid UTF-8.
+// Runs that need no escaping, nearly all of terminal output, are copied
+// whole.
+void append_json_string(std::string &out, std::string_view text) {
+  static const char hex[] = "0123456789abcdef";
+  constexpr uint64_t ones = 0x0101010101010101ULL;
+  constexpr uint64_t highs = 0x8080808080808080ULL;
+  out += '"';
+  size_t run = 0;
+  for (size_t i = 0; i < text.size(); i++) {
+    // Skip eight bytes at a time while none is a control character, a
+    // quote or a backslash
+    while (text.size() - i >= 8) {
+      uint64_t word;
+      memcpy(&word, text.data() + i, sizeof(word));
+      uint64_t quote = word ^ (ones * '"');
+      uint64_t backslash = word ^ (ones * '\\');
+      uint64_t special = ((word - ones * 0x20) & ~word) |
+                         ((quote - ones) & ~quote) |
+                         ((backslash - ones) & ~backslash);
+      if (special & highs)
+        break;
+      i += 8;
+    }
+    if (i == text.size())
+      break;
+    auto c = static_cast<unsigned char>(text[i]);
+    if (c >= 0x20 && c != '"' && c != '\\')
+      continue;
+    out.append(text, run, i - run);
+    run = i + 1;
+    switch (c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\b':
+      out += "\\b";
+      break;
+    case '\f':
+      out += "\\f";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\r':
+      out += "\\r";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    default:
+      out += "\\u00";
+      out += hex[c >> 4];
+      out += hex[c & 0xf];
+    }
+  }
+  out.append(text, run, text.size() - run);
+  out += '"';
+}
+
+// Params whose string "data" member, if any, is raw output. It is written
+// straight from the params: as a byte string in the binary encodings, and
+// by the escaper above in JSON.
+void append_output_params(std::string &out, const nlohmann::json &params,
+                          WireEncoding encoding) {
+  if (!params.is_object()) {
+    append_value(out, params, encoding);
+    return;
+  }
+  bool json = encoding == WireEncoding::Json;
+  if (json)
+    out += '{';
+  else
+    append_map_head(out, params.size(), encoding);
+  bool first = true;
+  for (const auto &[key, value] : params.items()) {
+    if (json) {
+      if (!first)
+        out += ',';
+      append_json_string(out, key);
+      out += ':';
+    } else {
+      append_name(out, key, encoding);
+    }
+    first = false;
+
+    const auto *data = key == "data" && value.is_string()
+                           ? &value.get_ref<const std::string &>()
+                           : nullptr;
+    if (data && !json)
+      append_binary(out, *data, encoding);
+    else if (data && foundation::is_valid_utf8(*data))
+      append_json_string(out, *data);
+    else
+      append_value(out, value, encoding); // throws on bad UTF-8, as before
+  }
+  if (json)
+    out += '}';
+}
+
+// Expected size of output params: the data plus room for escapes (JSON)
+// and the other members
+size_t output_size_hint(const nlohmann::json &params, WireEncoding encoding) {
+  auto data = params.is_object() ? params.find("data") : params.end();
+  if (data == params.end() || !data->is_string())
+    return 0;
+  size_t size = data->get_ref<const std::string &>().size();
+  return size + (encoding == WireEncoding::Json ? size / 8 : 0) + 256;
+}
+} // anonymous namespace
+
+bool parse_wire_encoding(const std::string &name, WireEncoding &encoding) {
+  if (name == "json") {
+    encoding = WireEncoding::Json;
+  } else if (name == "cbor") {
+    encoding = WireEncoding::Cbor;
+  } else if (name == "msgpack") {
+    encoding = WireEncoding::MsgPack;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char *to_string(WireEncoding encoding) {
+  switch (encoding) {
+  case WireEncoding::Json:
+    return "json";
+  case WireEncoding::Cbor:
+    return "cbor";
+  case WireEncoding::MsgPack:
+    return "msgpack";
+  }
+  return "unknown";
+}
+
+const char *to_string(Framing framing) {
+  return framing == Framing::Newline ? "newline" : "length-prefixed";
+}
+
+std::string encode_message(const nlohmann::json &message, WireFormat format) {
+  Scratch scratch;
+  auto &out = scratch.buffer();
+  begin_frame(out, format);
+  append_value(out, message, format.encoding);
+  end_frame(out, format);
+  return scratch.take();
+}
+
+std::string encode_value(const nlohmann::json &value, WireEncoding encoding) {
+  Scratch scratch;
+  append_value(scratch.buffer(), value, encoding);
+  return scratch.take();
+}
+
+std::string encode_response(const nlohmann::json &id,
+                            const nlohmann::json &result, WireFormat format) {
+  Scratch scratch;
+  auto &out = scratch.buffer();
+  begin_frame(out, format);
+  begin_response(out, id, format.encoding);
+  append_value(out, result, format.encoding);
+  end_message(out, format.encoding);
+  end_frame(out, format);
+  return scratch.take();
+}
+
+std::string splice_response(const nlohmann::json &id, std::string_view result,
+                            WireFormat format) {
+  Scratch scratch(kFrameHeaderSize + result.size() + 64);
+  auto &out = scratch.buffer();
+  begin_frame(out, format);
+  begin_response(out, id, format.encoding);
+  out += result;
+  end_message(out, format.encoding);
+  end_frame(out, format);
+  return scratch.take();
+}
+
+std::string encode_notification(const std::string &method,
+                                const nlohmann::json &params,
+                                WireFormat format, bool output) {
+  Scratch scratch(output ? output_size_hint(params, format.encoding) : 0);
+  auto &out = scratch.buffer();
+  begin_frame(out, format);
+  begin_notification(out, method, format.encoding);
+  if (output)
+    append_output_params(out, params, format.encoding);
+  else
+    append_value(out, params, format.encoding);
+  end_message(out, format.encoding);
+  end_frame(out, format);
+  return scratch.take();
+}
+
+std::string encode_object(
+    std::initializer_list<std::pair<const char *, std::string_view>> members,
+    WireEncoding encoding) {
+  std::string out;
+  if (encoding == WireEncoding::Json) {
+    out += '{';
+    for (const auto &[key, value] : members) {
+      if (out.size() > 1)
+        out += ',';
+      append_name(out, key, encoding);
+      out += ':';
+      out += value;
+    }
+    out += '}';
+    return out;
+  }
+  append_map_head(out, members.size(), encoding);
+  for (const auto &[key, value] : members) {
+    append_name(out, key, encoding);
+    out += value;
+  }
+  return out;
+}
+
+nlohmann::json decode_message(const char *data, size_t size,
+                              WireEncoding encoding) {
+  switch (encoding) {
+  case WireEncoding::Cbor:
+    return nlohmann::json::from_cbor(data, data + size);
+  case WireEncoding::MsgPack:
+    return nlohmann::json::from_msgpack(data, data + size);
+  case WireEncoding::Json:
+    break;
+  }
+  return nlohmann::json::parse(data, data + size);
+}
+
+} // namespace si::rpc
@@ -0,0 +1,181 @@
+#include "si/rpc/event_loop.hpp"
+#include "si/foundation/logging.hpp"
+#include <cerrno>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace si::rpc {
+
+namespace {
+constexpr int kMaxEvents = 64;
+} // anonymous namespace
+
+EventLoop::EventLoop() = default;
+
+EventLoop::~EventLoop() {
+  for (int fd : timers_)
+    ::close(fd);
+  if (wake_fd_ >= 0)
+    ::close(wake_fd_);
+  if (epoll_fd_ >= 0)
+    ::close(epoll_fd_);
+}
+
+bool EventLoop::open() {
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0) {
+    SI_LOG_ERROR("EventLoop: epoll_create1 failed: {}", std::strerror(errno));
+    return false;
+  }
+
+  wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wake_fd_ < 0) {
+    SI_LOG_ERROR("EventLoop: eventfd failed: {}", std::strerror(errno));
+    return false;
+  }
+
+  return add(wake_fd_, EPOLLIN, [this](uint32_t) {
+    uint64_t value;
+    while (::read(wake_fd_, &value, sizeof(value)) > 0) {
+    }
+    drain_tasks();
+  });
+}
+
+bool EventLoop::add(int fd, uint32_t events, IoCallback cb) {
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.fd = fd;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    SI_LOG_ERROR("EventLoop: EPOLL_CTL_ADD failed for fd {}: {}", fd,
+                 std::strerror(errno));
+    return false;
+  }
+  auto &slot = callbacks_[fd];
+  if (slot)
+    retired_.push_back(std::move(slot));
+  slot = std::make_unique<IoCallback>(std::move(cb));
+  return true;
+}
+
+bool EventLoop::modify(int fd, uint32_t events) {
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.fd = fd;
+  return epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+void EventLoop::remove(int fd) {
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+  auto it = callbacks_.find(fd);
+  if (it == callbacks_.end())
+    return;
+  retired_.push_back(std::move(it->second));
+  callbacks_.erase(it);
+}
+
+int EventLoop::add_timer(std::chrono::milliseconds interval, Task task) {
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd < 0) {
+    SI_LOG_ERROR("EventLoop: timerfd_create failed: {}", std::strerror(errno));
+    return -1;
+  }
+
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  spec.it_interval.tv_sec = interval.count() / 1000;
+  spec.it_interval.tv_nsec = (interval.count() % 1000) * 1000000;
+  spec.it_value = spec.it_interval;
+  if (timerfd_settime(fd, 0, &spec, nullptr) < 0 ||
+      !add(fd, EPOLLIN, [fd, task = std::move(task)](uint32_t) {
+        uint64_t expirations;
+        if (::read(fd, &expirations, sizeof(expirations)) > 0)
+          task();
+      })) {
+    ::close(fd);
+    return -1;
+  }
+  timers_.insert(fd);
+  return fd;
+}
+
+void EventLoop::remove_timer(int timer_id) {
+  if (timers_.erase(timer_id) == 0)
+    return;
+  remove(timer_id);
+  ::close(timer_id);
+}
+
+void EventLoop::post(Task task) {
+  {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    pending_.push_back(std::move(task));
+  }
+  wakeup();
+}
+
+void EventLoop::wakeup() {
+  uint64_t one = 1;
+  ssize_t n = ::write(wake_fd_, &one, sizeof(one));
+  (void)n; // EAGAIN means a wakeup is already pending
+}
+
+void EventLoop::drain_tasks() {
+  std::vector<Task> tasks;
+  {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    tasks.swap(pending_);
+  }
+  for (auto &task : tasks) {
+    try {
+      task();
+    } catch (const std::exception &e) {
+      SI_LOG_ERROR("EventLoop: task threw: {}", e.what());
+    }
+  }
+}
+
+void EventLoop::run() {
+  loop_thread_ = std::this_thread::get_id();
+
+  struct epoll_event events[kMaxEvents];
+  while (!stopped_) {
+    int n = epoll_wait(epoll_fd_, events, kMaxEvents, -1);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      SI_LOG_ERROR("EventLoop: epoll_wait failed: {}", std::strerror(errno));
+      break;
+    }
+
+    for (int i = 0; i < n; ++i) {
+      // Callbacks may remove fds (including later ones in this batch), so
+      // look each one up again instead of caching iterators.
+      auto it = callbacks_.find(events[i].data.fd);
+      if (it == callbacks_.end())
+        continue;
+      (*it->second)(events[i].events);
+    }
+    retired_.clear();
+  }
+
+  // Run anything posted during shutdown so cleanup tasks are not lost
+  drain_tasks();
+}
+
+void EventLoop::stop() {
+  if (stopped_.exchange(true))
+    return;
+  wakeup();
+}
+
+bool EventLoop::in_loop_thread() const {
+  return std::this_thread::get_id() == loop_thread_;
+}
+
+} // namespace si::rpc
@@ -0,0 +1,91 @@
+#include "si/rpc/frame_decoder.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace si::rpc {
+
+FrameDecoder::FrameDecoder(size_t max_frame_bytes)
+    : max_frame_bytes_(max_frame_bytes) {}
+
+void FrameDecoder::set_framing(Framing framing) {
+  framing_ = framing;
+  scan_pos_ = 0;
+}
+
+FrameDecoder::Status FrameDecoder::next(const char *&data, size_t &size) {
+  // The previous frame has been handled by now
+  buffer_.consume(pending_);
+  pending_ = 0;
+
+  if (framing_ == Framing::Newline) {
+    while (true) {
+      size_t pos = buffer_.find('\n', scan_pos_);
+      if (pos == RingBuffer::npos) {
+        scan_pos_ = buffer_.size();
+        return scan_pos_ > max_frame_bytes_ ? Status::TooLarge
+                                            : Status::NeedMore;
+      }
+      scan_pos_ = 0;
+      if (pos == 0) {
+        buffer_.consume(1); // empty line
+        continue;
+      }
+      if (pos > max_frame_bytes_)
+        return Status::TooLarge;
+      data = buffer_.contiguous(pos + 1);
+      size = pos;
+      pending_ = pos + 1;
+      return Status::Frame;
+    }
+  }
+
+  if (buffer_.size() < kFrameHeaderSize)
+    return Status::NeedMore;
+  char header[kFrameHeaderSize];
+  for (size_t i = 0; i < kFrameHeaderSize; i++)
+    header[i] = buffer_.at(i);
+  size_t length = read_frame_length(header);
+  compressed_ = accept_compressed_ && (length & kCompressedFrameFlag);
+  if (compressed_)
+    length &= ~size_t{kCompressedFrameFlag};
+  if (length > max_frame_bytes_)
+    return Status::TooLarge;
+
+  size_t total = kFrameHeaderSize + length;
+  if (buffer_.size() < total) {
+    buffer_.reserve(total);
+    return Status::NeedMore;
+  }
+  data = buffer_.contiguous(total) + kFrameHeaderSize;
+  size = length;
+  pending_ = total;
+  return Status::Frame;
+}
+
+std::string FrameDecoder::take_unread() {
+  buffer_.consume(pending_);
+  pending_ = 0;
+  scan_pos_ = 0;
+  size_t size = buffer_.size();
+  std::string bytes(size ? buffer_.contiguous(size) : "", size);
+  buffer_.consume(size);
+  return bytes;
+}
+
+void FrameDecoder::restore(const std::string &bytes) {
+  size_t done = 0;
+  while (done < bytes.size()) {
+    struct iovec iov[2];
+    size_t count = buffer_.write_regions(iov, bytes.size() - done);
+    size_t written = 0;
+    for (size_t i = 0; i < count && done + written < bytes.size(); i++) {
+      size_t n = std::min(iov[i].iov_len, bytes.size() - done - written);
+      memcpy(iov[i].iov_base, bytes.data() + done + written, n);
+      written += n;
+    }
+    buffer_.commit(written);
+    done += written;
+  }
+}
+
+} // namespace si::rpc
@@ -0,0 +1,268 @@
+#include "si/rpc/handoff.hpp"
+#include "si/foundation/logging.hpp"
+#include "si/rpc/api_bindings.hpp"
+#include "si/rpc/remote_nodes.hpp"
+#include "si/rpc/server.hpp"
+#include "si/shell/block_manager.hpp"
+#include "si/shell/executor.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace si::rpc {
+
+namespace {
+// Descriptors per message; the kernel takes at most 253
+constexpr size_t kFdsPerMessage = 250;
+constexpr const char *kHandoffFlag = "--handoff-fd";
+
+bool send_fds(int sock, const void *data, size_t size, const int *fds,
+              size_t count) {
+  struct iovec iov = {const_cast<void *>(data), size};
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) *
+                                                  kFdsPerMessage)];
+  if (count > 0) {
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+  }
+  while (true) {
+    ssize_t n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    if (n >= 0)
+      return static_cast<size_t>(n) == size;
+    if (errno != EINTR)
+      return false;
+  }
+}
+
+// One message: its payload into `data`, its descriptors onto `fds`
+bool recv_fds(int sock, void *data, size_t size, std::vector<int> &fds) {
+  struct iovec iov = {data, size};
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) *
+                                                  kFdsPerMessage)];
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  ssize_t n;
+  do {
+    n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0 || (msg.msg_flags & MSG_CTRUNC))
+    return false;
+  for (auto *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+      continue;
+    size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    const auto *received = reinterpret_cast<const int *>(CMSG_DATA(cmsg));
+    fds.insert(fds.end(), received, received + count);
+  }
+  return static_cast<size_t>(n) == size;
+}
+} // anonymous namespace
+
+Handoff &Handoff::instance() {
+  static Handoff handoff;
+  return handoff;
+}
+
+void Handoff::set_command_line(int argc, char **argv) {
+  argv_.clear();
+  for (int i = 0; i < argc; i++) {
+    // A handoff descriptor is only good for one exec
+    if (std::strcmp(argv[i], kHandoffFlag) == 0 && i + 1 < argc) {
+      i++;
+      continue;
+    }
+    argv_.push_back(argv[i]);
+  }
+  char path[4096];
+  ssize_t n = readlink("/proc/self/exe", path, sizeof(path) - 1);
+  executable_ = n > 0 ? std::string(path, n) : argv_.at(0);
+}
+
+bool Handoff::request(const std::string &binary) {
+  std::string path = binary.empty() ? executable_ : binary;
+  struct stat st;
+  if (path.empty() || stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode) ||
+      access(path.c_str(), X_OK) != 0)
+    return false;
+  std::lock_guard<std::mutex> lock(mutex_);
+  binary_ = path;
+  requested_ = true;
+  return true;
+}
+
+nlohmann::json Handoff::detach(std::vector<int> &fds) {
+  auto &processes = si::shell::BlockProcesses::instance();
+  nlohmann::json state;
+  // Readers first: nothing appends output after this but the agents
+  state["blocks"] = processes.detach(fds);
+  state["nodes"] = RemoteNodes::instance().detach();
+  block_output_coalescer().finish_all();
+  state["rpc"] = RpcServer::instance().detach(fds);
+  // Launched while the clients were still being served
+  state["deferred"] = processes.take_deferred();
+  si::shell::BlockManager::instance().save_sessions();
+  return state;
+}
+
+bool Handoff::adopt(const nlohmann::json &state,
+                    const std::vector<int> &fds) {
+  upgrades_ = state.value("upgrades", 0);
+  auto &processes = si::shell::BlockProcesses::instance();
+  processes.resume();
+  bool serving = !state["rpc"].is_null() &&
+                 RpcServer::instance().start_inherited(state["rpc"], fds);
+  if (!serving)
+    SI_LOG_ERROR("RPC: Could not resume the server after the upgrade");
+  RemoteNodes::instance().adopt(state["nodes"]);
+
+  for (const auto &block : state["blocks"]) {
+    std::string block_id = block["block_id"];
+    pid_t pid = block["pid"];
+    int fd = fds.at(block["fd"].get<size_t>());
+    std::thread([block_id, pid, fd]() {
+      si::shell::CommandExecutor().resume_to_block(block_id, pid, fd);
+    }).detach();
+  }
+  for (const auto &launch : state["deferred"]) {
+    std::thread([launch]() {
+      si::shell::CommandExecutor().execute_to_block(
+          launch["block_id"], launch["command"], launch["cwd"],
+          launch["shell"], launch["cols"], launch["rows"]);
+    }).detach();
+  }
+  SI_LOG_INFO("RPC: Resumed {} running blocks after upgrade {}",
+              state["blocks"].size(), upgrades_.load());
+  return serving;
+}
+
+int Handoff::pack() {
+  std::vector<int> fds;
+  auto state = detach(fds);
+  state["upgrades"] = upgrades_.load() + 1;
+  auto cbor = nlohmann::json::to_cbor(state);
+
+  int memfd = memfd_create("si-handoff", MFD_CLOEXEC);
+  int pair[2] = {-1, -1};
+  bool sent =
+      memfd >= 0 &&
+      ::write(memfd, cbor.data(), cbor.size()) ==
+          static_cast<ssize_t>(cbor.size()) &&
+      socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) == 0;
+  if (sent) {
+    // The memfd and the count first, then the rest in batches
+    uint64_t count = fds.size();
+    sent = send_fds(pair[0], &count, sizeof(count), &memfd, 1);
+    for (size_t i = 0; sent && i < fds.size(); i += kFdsPerMessage) {
+      char batch = 0;
+      sent = send_fds(pair[0], &batch, 1, fds.data() + i,
+                      std::min(kFdsPerMessage, fds.size() - i));
+    }
+  }
+  if (memfd >= 0)
+    ::close(memfd);
+  if (pair[0] >= 0)
+    ::close(pair[0]);
+  if (!sent) {
+    SI_LOG_ERROR("RPC: Could not pack the server for upgrade: {}",
+                 std::strerror(errno));
+    if (pair[1] >= 0)
+      ::close(pair[1]);
+    state["upgrades"] = upgrades_.load();
+    adopt(state, fds);
+    return -1;
+  }
+  // The other end holds them now
+  for (int fd : fds)
+    ::close(fd);
+  SI_LOG_INFO("RPC: Packed {} descriptors and {} bytes of state", fds.size(),
+              cbor.size());
+  return pair[1];
+}
+
+bool Handoff::resume(int fd) {
+  uint64_t count = 0;
+  std::vector<int> memfd;
+  std::vector<int> fds;
+  bool ok = recv_fds(fd, &count, sizeof(count), memfd) && memfd.size() == 1;
+  while (ok && fds.size() < count) {
+    char batch;
+    ok = recv_fds(fd, &batch, 1, fds);
+  }
+  ::close(fd);
+
+  nlohmann::json state;
+  if (ok) {
+    struct stat st;
+    ok = fstat(memfd[0], &st) == 0 && st.st_size > 0;
+    void *data = ok ? mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE,
+                           memfd[0], 0)
+                    : MAP_FAILED;
+    if (data != MAP_FAILED) {
+      const auto *bytes = static_cast<const uint8_t *>(data);
+      state = nlohmann::json::from_cbor(bytes, bytes + st.st_size, true,
+                                        false);
+      munmap(data, st.st_size);
+    }
+    ok = state.is_object() && fds.size() == count;
+  }
+  for (int memory : memfd)
+    ::close(memory);
+  if (!ok) {
+    SI_LOG_ERROR("RPC: Unusable handoff, starting afresh");
+    for (int received : fds)
+      ::close(received);
+    return false;
+  }
+  return adopt(state, fds);
+}
+
+void Handoff::upgrade() {
+  std::string binary;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    binary = binary_;
+    requested_ = false;
+  }
+  SI_LOG_INFO("RPC: Upgrading to {}", binary);
+  int fd = pack();
+  if (fd < 0)
+    return;
+
+  std::vector<std::string> args = argv_;
+  args.push_back(kHandoffFlag);
+  args.push_back(std::to_string(fd));
+  std::vector<char *> argv;
+  for (auto &arg : args)
+    argv.push_back(arg.data());
+  argv.push_back(nullptr);
+  fcntl(fd, F_SETFD, 0); // the one descriptor the new image inherits
+  execv(binary.c_str(), argv.data());
+
+  SI_LOG_ERROR("RPC: Could not run {}: {}", binary, std::strerror(errno));
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  // Carry on as before
+  int upgrades = upgrades_.load();
+  resume(fd);
+  upgrades_ = upgrades;
+}
+
+} // namespace si::rpc
@@ -0,0 +1,179 @@
+#include "si/rpc/http_transport.hpp"
+#include "si/foundation/logging.hpp"
+#include "si/rpc/server.hpp"
+#include <algorithm>
+#include <chrono>
+#include <httplib.h>
+
+namespace si::rpc {
+
+namespace {
+constexpr const char *kClientHeader = "X-SI-Client";
+constexpr std::chrono::milliseconds kPollInterval{500};
+
+bool is_loopback(const std::string &host) {
+  return host == "localhost" || host == "127.0.0.1" || host == "::1" ||
+         host == "[::1]";
+}
+
+// "name:port" or "[v6]:port" without the port
+std::string host_name(const std::string &host) {
+  if (!host.empty() && host.front() == '[')
+    return host.substr(0, host.find(']') + 1);
+  return host.substr(0, host.find(':'));
+}
+} // anonymous namespace
+
+HttpTransport::HttpTransport(RpcServer &rpc) : rpc_(rpc) {}
+
+HttpTransport::~HttpTransport() { stop(); }
+
+bool HttpTransport::allowed(const httplib::Request &req) const {
+  // A page that rebinds its own name to 127.0.0.1 still sends that name
+  if (is_loopback(options_.host) && req.has_header("Host") &&
+      !is_loopback(host_name(req.get_header_value("Host"))))
+    return false;
+  if (!req.has_header("Origin"))
+    return true;
+  const auto &origins = options_.allowed_origins;
+  return std::find(origins.begin(), origins.end(),
+                   req.get_header_value("Origin")) != origins.end();
+}
+
+bool HttpTransport::start(const HttpTransportOptions &options) {
+  if (server_)
+    return true;
+  options_ = options;
+  server_ = std::make_unique<httplib::Server>();
+  server_->set_payload_max_length(options_.max_body_bytes);
+
+  server_->set_pre_routing_handler([this](const httplib::Request &req,
+                                          httplib::Response &res) {
+    if (!allowed(req)) {
+      SI_LOG_WARN("RPC: Refused HTTP request from origin '{}' for host '{}'",
+                  req.get_header_value("Origin"),
+                  req.get_header_value("Host"));
+      res.status = 403;
+      return httplib::Server::HandlerResponse::Handled;
+    }
+    if (req.has_header("Origin")) {
+      res.set_header("Access-Control-Allow-Origin",
+                     req.get_header_value("Origin"));
+      res.set_header("Access-Control-Allow-Headers",
+                     std::string("Content-Type, ") + kClientHeader);
+      res.set_header("Access-Control-Allow-Methods", "GET, POST");
+      res.set_header("Access-Control-Expose-Headers", kClientHeader);
+      res.set_header("Vary", "Origin");
+    }
+    return httplib::Server::HandlerResponse::Unhandled;
+  });
+
+  // CORS preflight; the headers were set above
+  server_->Options(".*", [](const httplib::Request &, httplib::Response &res) {
+    res.status = 204;
+  });
+
+  server_->Post("/rpc", [this](const httplib::Request &req,
+                               httplib::Response &res) {
+    uint64_t client_id = 0;
+    if (req.has_header(kClientHeader)) {
+      try {
+        client_id = std::stoull(req.get_header_value(kClientHeader));
+      } catch (const std::exception &) {
+        res.status = 400;
+        return;
+      }
+      if (!rpc_.is_connected(client_id)) {
+        res.status = 404;
+        res.set_content(R"({"error":"Unknown client"})", "application/json");
+        return;
+      }
+    }
+
+    std::string reply = rpc_.handle_stream_request(client_id, req.body);
+    if (reply.empty()) {
+      res.status = 204;
+      return;
+    }
+    res.set_content(reply, "application/json");
+  });
+
+  server_->Get("/events", [this](const httplib::Request &,
+                                 httplib::Response &res) {
+    uint64_t client_id = rpc_.open_stream();
+    {
+      std::lock_guard<std::mutex> lock(streams_mutex_);
+      streams_.insert(client_id);
+    }
+    res.set_header(kClientHeader, std::to_string(client_id));
+    res.set_chunked_content_provider(
+        "application/x-ndjson",
+        [this, client_id](size_t, httplib::DataSink &sink) {
+          std::string frames;
+          auto idle_since = std::chrono::steady_clock::now();
+          while (frames.empty()) {
+            if (!rpc_.read_stream(client_id, frames, kPollInterval)) {
+              sink.done();
+              return true;
+            }
+            if (!frames.empty())
+              break;
+            // A reader that hung up shows as a readable EOF
+            if (!sink.is_writable())
+              return false;
+            if (std::chrono::steady_clock::now() - idle_since >=
+                options_.keepalive)
+              frames = "\n"; // keeps proxies from timing the stream out
+          }
+          return sink.write(frames.data(), frames.size());
+        },
+        [this, client_id](bool) {
+          rpc_.close_stream(client_id);
+          std::lock_guard<std::mutex> lock(streams_mutex_);
+          streams_.erase(client_id);
+        });
+  });
+
+  if (options_.port == 0) {
+    port_ = server_->bind_to_any_port(options_.host);
+  } else if (server_->bind_to_port(options_.host, options_.port)) {
+    port_ = options_.port;
+  } else {
+    port_ = -1;
+  }
+  if (port_ < 0) {
+    SI_LOG_ERROR("RPC: Failed to bind HTTP transport to {}:{}",
+                 options_.host, options_.port);
+    server_.reset();
+    port_ = 0;
+    return false;
+  }
+
+  thread_ = std::thread([this]() { server_->listen_after_bind(); });
+  server_->wait_until_ready();
+  SI_LOG_INFO("RPC: HTTP transport listening on {}:{}", options_.host, port_);
+  return true;
+}
+
+void HttpTransport::stop() {
+  if (!server_)
+    return;
+
+  // End the event streams first: their handlers hold server threads
+  std::set<uint64_t> streams;
+  {
+    std::lock_guard<std::mutex> lock(streams_mutex_);
+    streams = streams_;
+  }
+  for (uint64_t client_id : streams)
+    rpc_.close_stream(client_id);
+
+  server_->stop();
+  if (thread_.joinable())
+    thread_.join();
+  server_.reset();
+  port_ = 0;
+  SI_LOG_INFO("RPC: HTTP transport stopped");
+}
+
+} // namespace si::rpc
@@ -0,0 +1,90 @@
+#include "si/rpc/method_stats.hpp"
+#include <algorithm>
+
+namespace si::rpc {
+
+size_t LatencyHistogram::bucket_for(uint64_t ns) {
+  if (ns < kSubBuckets)
+    return static_cast<size_t>(ns);
+  constexpr uint64_t kLimit = (uint64_t{1} << (kMaxExponent + 1)) - 1;
+  ns = std::min(ns, kLimit);
+  int exponent = 63 - __builtin_clzll(ns); // >= kSubBucketBits
+  uint64_t sub = (ns >> (exponent - kSubBucketBits)) & (kSubBuckets - 1);
+  return static_cast<size_t>((exponent - kSubBucketBits + 1) * kSubBuckets +
+                             sub);
+}
+
+uint64_t LatencyHistogram::bucket_upper_bound(size_t index) {
+  if (index < kSubBuckets)
+    return index;
+  int exponent = static_cast<int>(index / kSubBuckets) + kSubBucketBits - 1;
+  uint64_t sub = index % kSubBuckets;
+  int shift = exponent - kSubBucketBits;
+  return ((kSubBuckets + sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t ns) {
+  buckets_[bucket_for(ns)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_ns_.fetch_add(ns, std::memory_order_relaxed);
+  uint64_t max = max_ns_.load(std::memory_order_relaxed);
+  while (ns > max &&
+         !max_ns_.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+  }
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const {
+  Snapshot s;
+  for (size_t i = 0; i < kBuckets; i++)
+    s.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+  s.count = count_.load(std::memory_order_relaxed);
+  s.sum_ns = sum_ns_.load(std::memory_order_relaxed);
+  s.max_ns = max_ns_.load(std::memory_order_relaxed);
+  return s;
+}
+
+uint64_t LatencyHistogram::Snapshot::percentile(double p) const {
+  // Buckets are read one by one while calls are recorded, so use their own
+  // total rather than `count`
+  uint64_t total = 0;
+  for (uint64_t c : buckets)
+    total += c;
+  if (total == 0)
+    return 0;
+
+  auto rank = static_cast<uint64_t>(p / 100.0 * static_cast<double>(total));
+  rank = std::clamp<uint64_t>(rank, 1, total);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kBuckets; i++) {
+    seen += buckets[i];
+    if (seen >= rank)
+      return std::min(bucket_upper_bound(i), max_ns);
+  }
+  return max_ns;
+}
+
+namespace {
+nlohmann::json histogram_json(const LatencyHistogram &histogram) {
+  auto s = histogram.snapshot();
+  auto us = [](uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+  return {{"count", s.count},
+          {"mean_us", s.count ? us(s.sum_ns) / s.count : 0.0},
+          {"p50_us", us(s.percentile(50))},
+          {"p90_us", us(s.percentile(90))},
+          {"p99_us", us(s.percentile(99))},
+          {"max_us", us(s.max_ns)}};
+}
+} // anonymous namespace
+
+nlohmann::json MethodStats::to_json() const {
+  return {{"calls", calls.load(std::memory_order_relaxed)},
+          {"errors", errors.load(std::memory_order_relaxed)},
+          {"in_flight", in_flight.load(std::memory_order_relaxed)},
+          {"rejected", rejected.load(std::memory_order_relaxed)},
+          {"bytes_in", bytes_in.load(std::memory_order_relaxed)},
+          {"bytes_out", bytes_out.load(std::memory_order_relaxed)},
+          {"queue_wait", histogram_json(queue_wait)},
+          {"handler", histogram_json(handler)}};
+}
+
+} // namespace si::rpc
@@ -0,0 +1,233 @@
+#include "si/rpc/outbound.hpp"
+#include <algorithm>
+
+namespace si::rpc {
+
+bool parse_slow_client_policy(const std::string &name,
+                              SlowClientPolicy &policy) {
+  if (name == "drop") {
+    policy = SlowClientPolicy::DropAndResync;
+  } else if (name == "coalesce") {
+    policy = SlowClientPolicy::Coalesce;
+  } else if (name == "disconnect") {
+    policy = SlowClientPolicy::Disconnect;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char *to_string(SlowClientPolicy policy) {
+  switch (policy) {
+  case SlowClientPolicy::DropAndResync:
+    return "drop";
+  case SlowClientPolicy::Coalesce:
+    return "coalesce";
+  case SlowClientPolicy::Disconnect:
+    return "disconnect";
+  }
+  return "unknown";
+}
+
+void OutboundQueue::append(Frame frame) {
+  if (filter_)
+    frame = filter_(std::move(frame));
+  queued_bytes_ += frame->size();
+  frames_.push_back(std::move(frame));
+}
+
+void OutboundQueue::push_response(Frame frame) { append(std::move(frame)); }
+
+void OutboundQueue::push_priority(Frame frame) {
+  // A partly written frame must be finished first
+  size_t position = std::max(priority_end_, static_cast<size_t>(offset_ > 0));
+  queued_bytes_ += frame->size();
+  frames_.insert(frames_.begin() + position, std::move(frame));
+  priority_end_ = position + 1;
+}
+
+OutboundQueue::Admit
+OutboundQueue::push_notification(const std::string &method,
+                                 const nlohmann::json &params, Frame frame,
+                                 const OutboundOptions &options) {
+  size_t size = frame->size();
+  bool over_budget = needs_resync_ || !parked_.empty() ||
+                     queued_bytes_ + size > options.max_queue_bytes;
+  if (!over_budget) {
+    append(std::move(frame));
+    return Admit::Queued;
+  }
+
+  switch (options.slow_client_policy) {
+  case SlowClientPolicy::Disconnect:
+    dropped_frames_++;
+    dropped_bytes_ += size;
+    return Admit::Disconnect;
+
+  case SlowClientPolicy::DropAndResync:
+    dropped_frames_++;
+    dropped_bytes_ += size;
+    needs_resync_ = true;
+    return Admit::Dropped;
+
+  case SlowClientPolicy::Coalesce:
+    break;
+  }
+
+  // Already gave up on this backlog; the client will be told to resync
+  if (needs_resync_) {
+    dropped_frames_++;
+    dropped_bytes_ += size;
+    return Admit::Dropped;
+  }
+
+  Admit result = Admit::Parked;
+  std::string block_id;
+  auto block_it = params.find("block_id");
+  if (block_it != params.end() && block_it->is_string())
+    block_id = block_it->get<std::string>();
+
+  // Append to the newest held-back chunk of the same block and stream;
+  // stdout and stderr are never merged into one
+  Parked *target = nullptr;
+  auto merge_it = mergeable_.find(block_id);
+  if (method == "block.output" && merge_it != mergeable_.end() &&
+      merge_it->second >= parked_base_ && params.contains("data") &&
+      params["data"].is_string()) {
+    auto &candidate = parked_[merge_it->second - parked_base_];
+    if (candidate.params.value("type", "") == params.value("type", ""))
+      target = &candidate;
+  }
+
+  if (target) {
+    const auto &data = params["data"].get_ref<const std::string &>();
+    target->params["data"].get_ref<std::string &>() += data;
+    if (params.contains("seq_end"))
+      target->params["seq_end"] = params["seq_end"];
+    target->size += data.size();
+    parked_bytes_ += data.size();
+    coalesced_frames_++;
+    result = Admit::Coalesced;
+  } else {
+    park(method, params, size);
+    if (!block_id.empty()) {
+      if (method == "block.output")
+        mergeable_[block_id] = parked_base_ + parked_.size() - 1;
+      else
+        mergeable_.erase(block_id); // keep ordering around e.g. completion
+    }
+  }
+
+  if (parked_bytes_ > options.max_queue_bytes) {
+    // Too much held back: fall back to dropping and a resync
+    dropped_frames_ += parked_.size();
+    dropped_bytes_ += parked_bytes_;
+    parked_.clear();
+    parked_bytes_ = 0;
+    mergeable_.clear();
+    parked_base_ = 0;
+    needs_resync_ = true;
+    return Admit::Dropped;
+  }
+  return result;
+}
+
+void OutboundQueue::park(const std::string &method,
+                         const nlohmann::json &params, size_t size) {
+  parked_.push_back({method, params, size});
+  parked_bytes_ += size;
+}
+
+size_t OutboundQueue::fill_iov(struct iovec *iov, size_t max_iov) const {
+  size_t count = 0;
+  for (auto it = frames_.begin(); it != frames_.end() && count < max_iov;
+       ++it, ++count) {
+    size_t skip = (count == 0) ? offset_ : 0;
+    iov[count].iov_base = const_cast<char *>((*it)->data()) + skip;
+    iov[count].iov_len = (*it)->size() - skip;
+  }
+  return count;
+}
+
+void OutboundQueue::consume(size_t bytes) {
+  while (bytes > 0 && !frames_.empty()) {
+    size_t remaining = frames_.front()->size() - offset_;
+    if (bytes >= remaining) {
+      bytes -= remaining;
+      queued_bytes_ -= frames_.front()->size();
+      frames_.pop_front();
+      offset_ = 0;
+      if (priority_end_ > 0)
+        priority_end_--;
+    } else {
+      offset_ += bytes;
+      bytes = 0;
+    }
+  }
+}
+
+bool OutboundQueue::refill(const OutboundOptions &options,
+                           const Encoder &encode) {
+  if (queued_bytes_ >= options.max_queue_bytes / 2)
+    return false;
+
+  bool resynced = false;
+  if (needs_resync_) {
+    push_response(encode("rpc.resync", {{"dropped_frames", dropped_frames_},
+                                        {"dropped_bytes", dropped_bytes_}}));
+    needs_resync_ = false;
+    resynced = true;
+  }
+
+  while (!parked_.empty() && queued_bytes_ < options.max_queue_bytes) {
+    auto &front = parked_.front();
+    push_response(encode(front.method, front.params));
+    parked_bytes_ -= front.size;
+    parked_.pop_front();
+    parked_base_++;
+  }
+  if (parked_.empty()) {
+    mergeable_.clear();
+    parked_base_ = 0;
+  }
+  return resynced;
+}
+
+std::string OutboundQueue::take_bytes() {
+  std::string bytes;
+  size_t skip = offset_;
+  for (const auto &frame : frames_) {
+    bytes.append(*frame, skip, std::string::npos);
+    skip = 0;
+  }
+  frames_.clear();
+  offset_ = 0;
+  priority_end_ = 0;
+  queued_bytes_ = 0;
+  return bytes;
+}
+
+void OutboundQueue::clear() {
+  filter_ = nullptr;
+  frames_.clear();
+  offset_ = 0;
+  priority_end_ = 0;
+  queued_bytes_ = 0;
+  parked_.clear();
+  parked_bytes_ = 0;
+  mergeable_.clear();
+  parked_base_ = 0;
+}
+
+ClientQueueStats OutboundQueue::stats() const {
+  ClientQueueStats s;
+  s.queued_bytes = queued_bytes_ - offset_;
+  s.queued_frames = frames_.size();
+  s.parked_bytes = parked_bytes_;
+  s.dropped_bytes = dropped_bytes_;
+  s.dropped_frames = dropped_frames_;
+  s.coalesced_frames = coalesced_frames_;
+  return s;
+}
+
+} // namespace si::rpc
@@ -0,0 +1,195 @@
+#include "si/rpc/output_coalescer.hpp"
+#include <vector>
+
+namespace si::rpc {
+
+OutputCoalescer::OutputCoalescer(Sink sink, CoalescerOptions options)
+    : sink_(std::move(sink)), options_(options) {
+  timer_ = std::thread([this]() { timer_loop(); });
+}
+
+OutputCoalescer::~OutputCoalescer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  if (timer_.joinable())
+    timer_.join();
+}
+
+void OutputCoalescer::set_options(const CoalescerOptions &options) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  options_ = options;
+}
+
+void OutputCoalescer::append(const std::string &session_id,
+                             const std::string &block_id,
+                             const std::string &type, const std::string &data,
+                             uint64_t seq) {
+  std::shared_ptr<BlockState> state;
+  bool emit_now = false;
+  bool counted = false;
+  while (true) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!counted) {
+      stats_.chunks_in++;
+      counted = true;
+    }
+    auto &slot = blocks_[block_id];
+    if (!slot)
+      slot = std::make_shared<BlockState>();
+    state = slot;
+
+    // Only adjacent chunks of the same type merge: send the others first
+    if (state->has_pending && state->pending.type != type) {
+      lock.unlock();
+      emit(state);
+      continue;
+    }
+
+    state->next_seq = seq + 1;
+    if (state->has_pending) {
+      state->pending.data += data;
+      state->pending.seq_end = seq;
+    } else {
+      state->pending = {session_id, block_id, type, data, seq, seq};
+      state->has_pending = true;
+    }
+
+    if (options_.window.count() <= 0) {
+      emit_now = true;
+    } else if (!state->window_open) {
+      // Idle block: send right away and gather what follows
+      state->window_open = true;
+      state->deadline = Clock::now() + options_.window;
+      emit_now = true;
+      cv_.notify_one();
+    } else if (state->pending.data.size() >= options_.max_bytes) {
+      emit_now = true;
+    }
+    break;
+  }
+
+  if (emit_now)
+    emit(state);
+}
+
+void OutputCoalescer::finish(const std::string &block_id) {
+  std::shared_ptr<BlockState> state;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = blocks_.find(block_id);
+    if (it == blocks_.end())
+      return;
+    state = std::move(it->second);
+    blocks_.erase(it);
+  }
+  emit(state);
+}
+
+void OutputCoalescer::finish_all() {
+  std::map<std::string, std::shared_ptr<BlockState>> blocks;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    blocks.swap(blocks_);
+  }
+  for (auto &[block_id, state] : blocks)
+    emit(state);
+}
+
+OutputCoalescer::Stats OutputCoalescer::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void OutputCoalescer::barrier(
+    const std::string &block_id,
+    const std::function<void(std::optional<uint64_t>)> &fn) {
+  std::shared_ptr<BlockState> state;
+  {
+    // Chunks arriving meanwhile must queue up behind the barrier, so the
+    // block needs a state even if it has none yet
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto &slot = blocks_[block_id];
+    if (!slot)
+      slot = std::make_shared<BlockState>();
+    state = slot;
+  }
+
+  {
+    std::lock_guard<std::mutex> emit_lock(state->emit_mutex);
+    emit_locked(*state);
+    std::optional<uint64_t> next_seq;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      next_seq = state->next_seq;
+    }
+    fn(next_seq);
+  }
+
+  // Drop the state again if it was only made for the barrier
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = blocks_.find(block_id);
+  if (it != blocks_.end() && it->second == state && !state->next_seq)
+    blocks_.erase(it);
+}
+
+void OutputCoalescer::emit(const std::shared_ptr<BlockState> &state) {
+  std::lock_guard<std::mutex> emit_lock(state->emit_mutex);
+  emit_locked(*state);
+}
+
+void OutputCoalescer::emit_locked(BlockState &state) {
+  Output output;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!state.has_pending)
+      return;
+    output = std::move(state.pending);
+    state.pending = Output{};
+    state.has_pending = false;
+    stats_.notifications_out++;
+  }
+  sink_(std::move(output));
+}
+
+void OutputCoalescer::timer_loop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopping_) {
+    auto now = Clock::now();
+    auto next = Clock::time_point::max();
+    std::vector<std::shared_ptr<BlockState>> due;
+
+    for (auto &[block_id, state] : blocks_) {
+      if (!state->window_open)
+        continue;
+      if (state->deadline <= now) {
+        if (!state->has_pending) {
+          // Nothing arrived during the window: the block is idle again
+          state->window_open = false;
+          continue;
+        }
+        due.push_back(state);
+        state->deadline = now + options_.window;
+      }
+      if (state->deadline < next)
+        next = state->deadline;
+    }
+
+    if (!due.empty()) {
+      lock.unlock();
+      for (auto &state : due)
+        emit(state);
+      lock.lock();
+      continue;
+    }
+
+    if (next == Clock::time_point::max())
+      cv_.wait(lock);
+    else
+      cv_.wait_until(lock, next);
+  }
+}
+
+} // namespace si::rpc
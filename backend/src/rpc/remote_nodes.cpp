@@ -0,0 +1,722 @@
+#include "si/rpc/remote_nodes.hpp"
+#include "si/foundation/logging.hpp"
+#include "si/shell/block_manager.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <future>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <random>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+namespace si::rpc {
+
+namespace {
+constexpr auto kMinBackoff = std::chrono::milliseconds(100);
+constexpr int kConnectTimeoutMs = 5000;
+constexpr int kPollMs = 250;
+constexpr auto kControlTimeout = std::chrono::seconds(10);
+// Output that arrives before the block.execute reply naming its block
+constexpr size_t kMaxEarlyMessages = 1024;
+
+std::string random_suffix() {
+  std::random_device rd;
+  char buf[17];
+  snprintf(buf, sizeof(buf), "%08x%08x", rd(), rd());
+  return buf;
+}
+
+std::string error_message(const nlohmann::json &response) {
+  if (response.is_null())
+    return "connection to the node was lost";
+  const auto &error = response["error"];
+  return error.is_object() ? error.value("message", "error") : "error";
+}
+} // anonymous namespace
+
+bool parse_host_port(const std::string &address, std::string &host,
+                     int &port) {
+  size_t colon;
+  if (!address.empty() && address[0] == '[') {
+    size_t close = address.find(']');
+    if (close == std::string::npos || close + 1 >= address.size() ||
+        address[close + 1] != ':')
+      return false;
+    host = address.substr(1, close - 1);
+    colon = close + 1;
+  } else {
+    colon = address.rfind(':');
+    if (colon == std::string::npos)
+      return false;
+    host = address.substr(0, colon);
+  }
+  std::string digits = address.substr(colon + 1);
+  if (host.empty() || digits.empty() ||
+      digits.find_first_not_of("0123456789") != std::string::npos ||
+      digits.size() > 5)
+    return false;
+  port = std::stoi(digits);
+  return port > 0 && port <= 65535;
+}
+
+RemoteNode::RemoteNode(NodeOptions options)
+    : options_(std::move(options)),
+      session_id_("remote-" + random_suffix()) {
+  thread_ = std::thread([this]() { run(); });
+}
+
+RemoteNode::RemoteNode(NodeOptions options, const nlohmann::json &state)
+    : options_(std::move(options)),
+      session_id_(state.value("session_id", "remote-" + random_suffix())) {
+  for (const auto &entry : state.value("running", nlohmann::json::array())) {
+    std::string block_id = entry["block_id"];
+    std::string remote_id = entry["remote_id"];
+    running_[block_id] = {block_id, remote_id, entry["next_seq"], false};
+    by_remote_[remote_id] = block_id;
+  }
+  for (const auto &entry : state.value("queue", nlohmann::json::array()))
+    queue_.push_back({entry["block_id"], entry["command"], entry["cwd"],
+                      entry["cols"], entry["rows"]});
+  thread_ = std::thread([this]() { run(); });
+}
+
+RemoteNode::~RemoteNode() {
+  stop();
+
+  std::vector<std::string> orphaned;
+  for (auto &[block_id, running] : running_)
+    orphaned.push_back(block_id);
+  for (auto &job : queue_)
+    orphaned.push_back(job.block_id);
+  for (auto &block_id : orphaned)
+    fail_block(block_id, "node " + options_.name + " was removed");
+}
+
+void RemoteNode::stop() {
+  stopping_ = true;
+  stop_cv_.notify_all();
+  {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    if (fd_ >= 0)
+      shutdown(fd_, SHUT_RDWR);
+  }
+  if (thread_.joinable())
+    thread_.join();
+}
+
+nlohmann::json RemoteNode::detach() {
+  stop();
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto running = nlohmann::json::array();
+  for (const auto &[block_id, entry] : running_) {
+    if (!entry.remote_id.empty())
+      running.push_back({{"block_id", block_id},
+                         {"remote_id", entry.remote_id},
+                         {"next_seq", entry.next_seq}});
+  }
+  auto queue = nlohmann::json::array();
+  for (const auto &job : queue_)
+    queue.push_back({{"block_id", job.block_id},
+                     {"command", job.command},
+                     {"cwd", job.cwd},
+                     {"cols", job.cols},
+                     {"rows", job.rows}});
+  running_.clear();
+  by_remote_.clear();
+  queue_.clear();
+  return {{"session_id", session_id_},
+          {"running", std::move(running)},
+          {"queue", std::move(queue)}};
+}
+
+void RemoteNode::run() {
+  auto backoff = kMinBackoff;
+  while (!stopping_) {
+    if (connect_once()) {
+      if (handshake()) {
+        SI_LOG_INFO("RPC: Connected to node {} ({}:{})", options_.name,
+                    options_.host, options_.port);
+        backoff = kMinBackoff;
+        read_loop();
+        SI_LOG_WARN("RPC: Lost connection to node {}", options_.name);
+      }
+      on_disconnect();
+    }
+    std::unique_lock<std::mutex> lock(stop_mutex_);
+    stop_cv_.wait_for(lock, backoff, [this]() { return stopping_.load(); });
+    backoff = std::min(backoff * 2, options_.max_backoff);
+  }
+}
+
+bool RemoteNode::connect_once() {
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICSERV;
+  struct addrinfo *addrs = nullptr;
+  std::string service = std::to_string(options_.port);
+  if (getaddrinfo(options_.host.c_str(), service.c_str(), &hints, &addrs) !=
+      0)
+    return false;
+
+  int fd = -1;
+  for (auto *ai = addrs; ai && fd < 0 && !stopping_; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                ai->ai_protocol);
+    if (fd < 0)
+      continue;
+    int rc = ::connect(fd, ai->ai_addr, ai->ai_addrlen);
+    if (rc < 0 && errno == EINPROGRESS) {
+      // Wait in slices so removing the node is not held up
+      struct pollfd pfd = {fd, POLLOUT, 0};
+      for (int waited = 0; waited < kConnectTimeoutMs && !stopping_;
+           waited += kPollMs) {
+        rc = poll(&pfd, 1, kPollMs);
+        if (rc != 0)
+          break;
+      }
+      int error = 0;
+      socklen_t len = sizeof(error);
+      if (rc > 0 &&
+          getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) == 0 &&
+          error == 0)
+        rc = 0;
+      else
+        rc = -1;
+    }
+    if (rc < 0) {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(addrs);
+  if (fd < 0)
+    return false;
+
+  // Blocking from here on: writes come from several threads
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  std::lock_guard<std::mutex> lock(write_mutex_);
+  fd_ = fd;
+  return true;
+}
+
+bool RemoteNode::handshake() {
+  // Nothing else comes from the agent before rpc.auth is answered
+  nlohmann::json auth = {{"jsonrpc", "2.0"},
+                         {"method", "rpc.auth"},
+                         {"params", {{"token", options_.token}}},
+                         {"id", 0}};
+  if (!write_line(auth.dump() + "\n"))
+    return false;
+  while (in_buf_.find('\n') == std::string::npos) {
+    struct pollfd pfd = {fd_, POLLIN, 0};
+    if (poll(&pfd, 1, kConnectTimeoutMs) <= 0)
+      return false;
+    char tmp[4096];
+    ssize_t n = recv(fd_, tmp, sizeof(tmp), 0);
+    if (n <= 0)
+      return false;
+    in_buf_.append(tmp, n);
+  }
+  size_t pos = in_buf_.find('\n');
+  auto reply = nlohmann::json::parse(in_buf_.substr(0, pos), nullptr, false);
+  in_buf_.erase(0, pos + 1);
+  if (!reply.is_object() || !reply.contains("result")) {
+    SI_LOG_ERROR("RPC: Node {} refused the token: {}", options_.name,
+                 error_message(reply.is_object() ? reply : nullptr));
+    return false;
+  }
+
+  // Pick up running blocks where their output left off. Their live output
+  // follows the replay; the session subscription for new blocks comes
+  // after, so nothing arrives out of order.
+  std::vector<std::pair<std::string, uint64_t>> resume;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    connected_ = true;
+    for (auto &[block_id, running] : running_) {
+      if (!running.remote_id.empty()) {
+        running.resuming = true;
+        resume.emplace_back(running.remote_id, running.next_seq);
+      }
+    }
+  }
+  for (auto &[remote_id, since_seq] : resume)
+    resume_block(remote_id, since_seq);
+  send_request("rpc.subscribe", {{"session_id", session_id_}},
+               [](const nlohmann::json &) {});
+  pump();
+  return true;
+}
+
+void RemoteNode::read_loop() {
+  while (!stopping_) {
+    size_t pos;
+    while ((pos = in_buf_.find('\n')) != std::string::npos) {
+      auto message =
+          nlohmann::json::parse(in_buf_.data(), in_buf_.data() + pos, nullptr,
+                                false);
+      in_buf_.erase(0, pos + 1);
+      if (message.is_object())
+        on_message(message);
+    }
+
+    struct pollfd pfd = {fd_, POLLIN, 0};
+    int rc = poll(&pfd, 1, kPollMs);
+    if (rc == 0)
+      continue;
+    if (rc < 0 && errno == EINTR)
+      continue;
+    if (rc < 0)
+      return;
+    char tmp[65536];
+    ssize_t n = recv(fd_, tmp, sizeof(tmp), 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return;
+    in_buf_.append(tmp, n);
+  }
+}
+
+void RemoteNode::on_disconnect() {
+  {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    if (fd_ >= 0)
+      ::close(fd_);
+    fd_ = -1;
+  }
+  in_buf_.clear();
+
+  std::map<int64_t, ReplyHandler> pending;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    connected_ = false;
+    pending.swap(pending_);
+    for (auto &[block_id, running] : running_)
+      running.resuming = false;
+  }
+  // Requests that never got a reply see a null response
+  for (auto &[id, handler] : pending)
+    handler(nullptr);
+}
+
+bool RemoteNode::send_request(const std::string &method,
+                              nlohmann::json params, ReplyHandler on_reply) {
+  int64_t id;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!connected_)
+      return false;
+    id = next_id_++;
+    pending_[id] = std::move(on_reply);
+  }
+  nlohmann::json request = {{"jsonrpc", "2.0"},
+                            {"method", method},
+                            {"params", std::move(params)},
+                            {"id", id}};
+  if (write_line(request.dump() + "\n"))
+    return true;
+  // Unless on_disconnect already answered it with null
+  std::lock_guard<std::mutex> lock(mutex_);
+  return pending_.erase(id) == 0;
+}
+
+bool RemoteNode::write_line(const std::string &line) {
+  std::lock_guard<std::mutex> lock(write_mutex_);
+  if (fd_ < 0)
+    return false;
+  size_t written = 0;
+  while (written < line.size()) {
+    ssize_t n = send(fd_, line.data() + written, line.size() - written,
+                     MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      // Wake the reader so it reconnects
+      shutdown(fd_, SHUT_RDWR);
+      return false;
+    }
+    written += static_cast<size_t>(n);
+  }
+  return true;
+}
+
+void RemoteNode::on_message(const nlohmann::json &message) {
+  auto method = message.find("method");
+  if (method == message.end()) {
+    ReplyHandler handler;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = pending_.find(message.value("id", int64_t{-1}));
+      if (it == pending_.end())
+        return;
+      handler = std::move(it->second);
+      pending_.erase(it);
+    }
+    handler(message);
+    return;
+  }
+
+  const auto &params = message["params"];
+  if (!params.is_object() ||
+      (*method != "block.output" && *method != "block.complete"))
+    return;
+  std::string remote_id = params.value("block_id", "");
+  {
+    // Output can beat the block.execute reply that names its block
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!by_remote_.count(remote_id)) {
+      bool starting = false;
+      for (auto &[block_id, running] : running_)
+        starting = starting || running.remote_id.empty();
+      auto &early = early_[remote_id];
+      if (starting && early.size() < kMaxEarlyMessages)
+        early.push_back(message);
+      return;
+    }
+  }
+  if (*method == "block.output")
+    on_output(params);
+  else if (*method == "block.complete")
+    on_complete(remote_id, params.value("exit_code", -1));
+}
+
+void RemoteNode::on_output(const nlohmann::json &params) {
+  std::string remote_id = params.value("block_id", "");
+  uint64_t seq_start = params.value("seq_start", uint64_t{0});
+  uint64_t seq_end = params.value("seq_end", seq_start);
+  std::string block_id;
+  bool gap = false;
+  uint64_t since_seq = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = by_remote_.find(remote_id);
+    if (it == by_remote_.end())
+      return;
+    auto &running = running_[it->second];
+    if (seq_start < running.next_seq)
+      return; // already have it (replayed after a reconnect)
+    if (seq_start > running.next_seq) {
+      // Chunks went missing (the agent dropped them for a slow client):
+      // have them replayed rather than show output out of order
+      gap = !running.resuming;
+      running.resuming = true;
+      since_seq = running.next_seq;
+    } else {
+      running.next_seq = seq_end + 1;
+      block_id = running.block_id;
+    }
+  }
+  if (gap) {
+    resume_block(remote_id, since_seq);
+    return;
+  }
+  if (!block_id.empty())
+    si::shell::BlockManager::instance().append_output(
+        block_id, params.value("data", ""), params.value("type", "stdout"));
+}
+
+void RemoteNode::on_complete(const std::string &remote_id, int exit_code) {
+  std::string block_id;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = by_remote_.find(remote_id);
+    if (it == by_remote_.end())
+      return;
+    block_id = it->second;
+    by_remote_.erase(it);
+    running_.erase(block_id);
+  }
+  si::shell::BlockManager::instance().complete_block(block_id, exit_code);
+  pump();
+}
+
+void RemoteNode::resume_block(const std::string &remote_id,
+                              uint64_t since_seq) {
+  send_request(
+      "block.subscribe", {{"block_id", remote_id}, {"since_seq", since_seq}},
+      [this, remote_id](const nlohmann::json &response) {
+        std::string block_id;
+        bool finished = false;
+        int exit_code = -1;
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          auto it = by_remote_.find(remote_id);
+          if (it == by_remote_.end())
+            return;
+          running_[it->second].resuming = false;
+          if (response.is_null())
+            return; // tried again on the next connection
+          const auto &result = response["result"];
+          // Gone (the agent restarted) or finished while we were away
+          finished = !result.is_object() ||
+                     result.value("state", 0) !=
+                         static_cast<int>(si::shell::BlockState::RUNNING);
+          if (!finished)
+            return;
+          block_id = it->second;
+          if (result.is_object())
+            exit_code = result.value("exit_code", -1);
+          by_remote_.erase(it);
+          running_.erase(block_id);
+        }
+        if (!response["result"].is_object())
+          fail_block(block_id, "node " + options_.name +
+                                   " no longer has the block: " +
+                                   error_message(response));
+        else
+          si::shell::BlockManager::instance().complete_block(block_id,
+                                                             exit_code);
+        pump();
+      });
+}
+
+void RemoteNode::pump() {
+  std::vector<Job> jobs;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (connected_ && running_.size() < options_.max_concurrent &&
+           !queue_.empty()) {
+      Job job = std::move(queue_.front());
+      queue_.pop_front();
+      running_[job.block_id].block_id = job.block_id;
+      jobs.push_back(std::move(job));
+    }
+  }
+  for (const auto &job : jobs)
+    start_job(job);
+}
+
+void RemoteNode::start_job(const Job &job) {
+  nlohmann::json params = {{"session_id", session_id_},
+                           {"command", job.command},
+                           {"cols", job.cols},
+                           {"rows", job.rows}};
+  if (!job.cwd.empty())
+    params["cwd"] = job.cwd;
+
+  bool sent = send_request(
+      "block.execute", std::move(params),
+      [this, block_id = job.block_id](const nlohmann::json &response) {
+        std::deque<nlohmann::json> early;
+        bool failed = response.is_null() || !response["result"].is_object();
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          if (failed) {
+            running_.erase(block_id);
+          } else {
+            std::string remote_id =
+                response["result"].value("block_id", "");
+            running_[block_id].remote_id = remote_id;
+            by_remote_[remote_id] = block_id;
+            auto it = early_.find(remote_id);
+            if (it != early_.end()) {
+              early.swap(it->second);
+              early_.erase(it);
+            }
+          }
+          bool starting = false;
+          for (auto &[id, running] : running_)
+            starting = starting || running.remote_id.empty();
+          if (!starting)
+            early_.clear();
+        }
+        if (failed)
+          fail_block(block_id, "node " + options_.name + ": " +
+                                   error_message(response));
+        for (const auto &message : early)
+          on_message(message);
+        if (failed)
+          pump();
+      });
+  if (!sent) {
+    // Disconnected in the meantime: start it after reconnecting
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_.erase(job.block_id);
+    queue_.push_front(job);
+  }
+}
+
+void RemoteNode::fail_block(const std::string &block_id,
+                            const std::string &message) {
+  SI_LOG_WARN("RPC: Block {} failed remotely: {}", block_id, message);
+  auto &blocks = si::shell::BlockManager::instance();
+  blocks.append_output(block_id, "si: " + message + "\r\n", "stderr");
+  blocks.complete_block(block_id, -1);
+}
+
+void RemoteNode::execute(const std::string &block_id,
+                         const std::string &command, const std::string &cwd,
+                         int cols, int rows) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back({block_id, command, cwd, cols, rows});
+  }
+  pump();
+}
+
+nlohmann::json RemoteNode::control(const std::string &block_id,
+                                   const std::string &method,
+                                   nlohmann::json params) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = running_.find(block_id);
+    if (it == running_.end() || it->second.remote_id.empty()) {
+      // Killing a command that is still waiting for a slot cancels it
+      for (auto job = queue_.begin(); job != queue_.end(); ++job) {
+        if (job->block_id == block_id && method == "block.kill") {
+          queue_.erase(job);
+          lock.unlock();
+          fail_block(block_id, "cancelled before it started");
+          return {{"success", true}};
+        }
+      }
+      throw std::runtime_error("Block is not running");
+    }
+    params["block_id"] = it->second.remote_id;
+  }
+
+  auto reply = std::make_shared<std::promise<nlohmann::json>>();
+  auto result = reply->get_future();
+  if (!send_request(method, std::move(params),
+                    [reply](const nlohmann::json &response) {
+                      reply->set_value(response);
+                    }))
+    throw std::runtime_error("Node " + options_.name + " is not connected");
+  if (result.wait_for(kControlTimeout) != std::future_status::ready)
+    throw std::runtime_error("Node " + options_.name + " did not reply");
+  auto response = result.get();
+  if (response.is_null() || !response.contains("result"))
+    throw std::runtime_error(error_message(response));
+  return response["result"];
+}
+
+bool RemoteNode::owns(const std::string &block_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (running_.count(block_id))
+    return true;
+  for (const auto &job : queue_) {
+    if (job.block_id == block_id)
+      return true;
+  }
+  return false;
+}
+
+nlohmann::json RemoteNode::status() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return {{"name", options_.name},
+          {"address", options_.host + ":" + std::to_string(options_.port)},
+          {"connected", connected_},
+          {"running", running_.size()},
+          {"queued", queue_.size()},
+          {"max_concurrent", options_.max_concurrent}};
+}
+
+RemoteNodes &RemoteNodes::instance() {
+  static RemoteNodes nodes;
+  return nodes;
+}
+
+void RemoteNodes::add(const NodeOptions &options) {
+  auto node = std::make_shared<RemoteNode>(options);
+  std::shared_ptr<RemoteNode> old;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    old = std::move(nodes_[options.name]);
+    nodes_[options.name] = std::move(node);
+  }
+}
+
+bool RemoteNodes::remove(const std::string &name) {
+  std::shared_ptr<RemoteNode> node;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = nodes_.find(name);
+    if (it == nodes_.end())
+      return false;
+    node = std::move(it->second);
+    nodes_.erase(it);
+  }
+  return true;
+}
+
+void RemoteNodes::clear() {
+  std::map<std::string, std::shared_ptr<RemoteNode>> nodes;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    nodes.swap(nodes_);
+  }
+}
+
+nlohmann::json RemoteNodes::detach() {
+  std::map<std::string, std::shared_ptr<RemoteNode>> nodes;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    nodes.swap(nodes_);
+  }
+  auto all = nlohmann::json::array();
+  for (auto &[name, node] : nodes) {
+    const auto &options = node->options();
+    all.push_back({{"name", options.name},
+                   {"host", options.host},
+                   {"port", options.port},
+                   {"token", options.token},
+                   {"max_concurrent", options.max_concurrent},
+                   {"max_backoff_ms", options.max_backoff.count()},
+                   {"state", node->detach()}});
+  }
+  return all;
+}
+
+void RemoteNodes::adopt(const nlohmann::json &nodes) {
+  std::vector<std::shared_ptr<RemoteNode>> replaced;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto &entry : nodes) {
+    NodeOptions options;
+    options.name = entry["name"];
+    options.host = entry["host"];
+    options.port = entry["port"];
+    options.token = entry["token"];
+    options.max_concurrent = entry["max_concurrent"];
+    options.max_backoff =
+        std::chrono::milliseconds(entry["max_backoff_ms"].get<int64_t>());
+    auto &slot = nodes_[options.name];
+    replaced.push_back(std::move(slot));
+    slot = std::make_shared<RemoteNode>(options, entry["state"]);
+  }
+}
+
+std::shared_ptr<RemoteNode> RemoteNodes::find(const std::string &name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = nodes_.find(name);
+  return it != nodes_.end() ? it->second : nullptr;
+}
+
+std::shared_ptr<RemoteNode> RemoteNodes::owner(const std::string &block_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto &[name, node] : nodes_) {
+    if (node->owns(block_id))
+      return node;
+  }
+  return nullptr;
+}
+
+nlohmann::json RemoteNodes::list() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto list = nlohmann::json::array();
+  for (auto &[name, node] : nodes_)
+    list.push_back(node->status());
+  return list;
+}
+
+} // namespace si::rpc
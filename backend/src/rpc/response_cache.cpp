@@ -0,0 +1,69 @@
+#include "si/rpc/response_cache.hpp"
+
+namespace si::rpc {
+
+CachedResult::CachedResult(uint64_t version, nlohmann::json value)
+    : version_(version), value_(std::move(value)) {}
+
+const std::string &CachedResult::encoded(WireEncoding encoding,
+                                         bool versioned) const {
+  size_t index = static_cast<size_t>(encoding) * 2 + (versioned ? 1 : 0);
+  auto &slot = encoded_[index];
+  std::call_once(slot.once, [&]() {
+    if (!versioned) {
+      slot.bytes = encode_value(value_, encoding);
+      return;
+    }
+    slot.bytes = encode_object(
+        {{"data", encoded(encoding, false)},
+         {"version", encode_value(version_, encoding)}},
+        encoding);
+  });
+  return slot.bytes;
+}
+
+nlohmann::json CachedResult::to_json(bool versioned) const {
+  if (!versioned)
+    return value_;
+  return nlohmann::json{{"data", value_}, {"version", version_}};
+}
+
+ResponseCache::ResponseCache(size_t max_entries) : max_entries_(max_entries) {}
+
+std::shared_ptr<const CachedResult>
+ResponseCache::get(const std::string &key, uint64_t version,
+                   const Builder &build) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    if (it != entries_.end() && it->second->version() == version)
+      return it->second;
+  }
+
+  // Build without the lock; racing builders of the same key both succeed
+  auto result = std::make_shared<const CachedResult>(version, build());
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    // Keys of deleted sessions are never looked up again
+    if (entries_.size() >= max_entries_)
+      entries_.erase(entries_.begin());
+    entries_.emplace(key, result);
+  } else if (it->second->version() < version) {
+    it->second = result;
+  }
+  return result;
+}
+
+size_t ResponseCache::size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+void ResponseCache::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.clear();
+}
+
+} // namespace si::rpc
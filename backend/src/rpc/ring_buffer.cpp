@@ -0,0 +1,99 @@
+#include "si/rpc/ring_buffer.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace si::rpc {
+
+namespace {
+size_t round_up_pow2(size_t n) {
+  size_t cap = 1;
+  while (cap < n)
+    cap <<= 1;
+  return cap;
+}
+} // anonymous namespace
+
+RingBuffer::RingBuffer(size_t initial_capacity)
+    : buf_(round_up_pow2(std::max<size_t>(initial_capacity, 64))),
+      initial_capacity_(buf_.size()) {}
+
+size_t RingBuffer::write_regions(struct iovec iov[2], size_t min_free) {
+  if (buf_.size() - size_ < min_free)
+    grow(size_ + min_free);
+
+  size_t tail = (head_ + size_) & mask();
+  if (size_ > 0 && tail <= head_) {
+    // Free space is the gap between tail and head
+    iov[0].iov_base = &buf_[tail];
+    iov[0].iov_len = head_ - tail;
+    return 1;
+  }
+
+  iov[0].iov_base = &buf_[tail];
+  iov[0].iov_len = buf_.size() - tail;
+  if (head_ == 0)
+    return 1;
+  iov[1].iov_base = buf_.data();
+  iov[1].iov_len = head_;
+  return 2;
+}
+
+void RingBuffer::commit(size_t bytes) { size_ += bytes; }
+
+void RingBuffer::reserve(size_t bytes) {
+  if (bytes > buf_.size())
+    grow(bytes);
+}
+
+const char *RingBuffer::contiguous(size_t len) {
+  if (head_ + len > buf_.size()) {
+    // Wrapped: rotate once so the readable bytes start at offset 0
+    std::rotate(buf_.begin(), buf_.begin() + head_, buf_.end());
+    head_ = 0;
+  }
+  return &buf_[head_];
+}
+
+size_t RingBuffer::find(char c, size_t from) const {
+  if (from >= size_)
+    return npos;
+
+  // At most two segments: [head, end of storage) and the wrapped part
+  size_t first_len = std::min(size_, buf_.size() - head_);
+  if (from < first_len) {
+    const char *begin = &buf_[head_];
+    auto *hit = static_cast<const char *>(
+        std::memchr(begin + from, c, first_len - from));
+    if (hit)
+      return hit - begin;
+    from = first_len;
+  }
+  if (from >= size_)
+    return npos;
+  size_t offset = from - first_len;
+  auto *hit = static_cast<const char *>(
+      std::memchr(buf_.data() + offset, c, size_ - from));
+  return hit ? first_len + (hit - buf_.data()) : npos;
+}
+
+void RingBuffer::consume(size_t bytes) {
+  bytes = std::min(bytes, size_);
+  head_ = (head_ + bytes) & mask();
+  size_ -= bytes;
+  if (size_ == 0) {
+    head_ = 0;
+    if (buf_.size() > initial_capacity_)
+      std::vector<char>(initial_capacity_).swap(buf_);
+  }
+}
+
+void RingBuffer::grow(size_t min_capacity) {
+  std::vector<char> bigger(round_up_pow2(min_capacity));
+  size_t first_len = std::min(size_, buf_.size() - head_);
+  std::memcpy(bigger.data(), &buf_[head_], first_len);
+  std::memcpy(bigger.data() + first_len, buf_.data(), size_ - first_len);
+  buf_.swap(bigger);
+  head_ = 0;
+}
+
+} // namespace si::rpc
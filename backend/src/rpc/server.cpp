@@ -1,193 +1,1672 @@
 #include "si/rpc/server.hpp"
 #include "si/foundation/logging.hpp"
+#include "si/rpc/connection.hpp"
+#include "si/rpc/event_loop.hpp"
+#include "si/rpc/worker_pool.hpp"
 #include <algorithm>
+#include <cerrno>
+#include <climits>
 #include <cstring>
+#include <future>
+#include <limits>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdexcept>
+#include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
-#include <thread>
 #include <unistd.h>
 #include <vector>
 
 namespace si::rpc {
 
+namespace {
+// How much to grow a client's inbound buffer per recv() call
+constexpr size_t kReadChunk = 16 * 1024;
+// Upper bound on iovecs per writev() call
+constexpr size_t kMaxIov = 64;
+// Upper bound on descriptors passed per sendmsg() call
+constexpr size_t kMaxFds = 8;
+
+using Clock = std::chrono::steady_clock;
+
+// Suggested wait before retrying a request shed under load
+constexpr std::chrono::milliseconds kShedRetryAfter{250};
+constexpr unsigned kMaxClientWeight = 16;
+
+uint64_t elapsed_ns(Clock::time_point from, Clock::time_point to) {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(to - from)
+          .count());
+}
+
+nlohmann::json make_error(int code, const std::string &message,
+                          const nlohmann::json &id) {
+  return {{"jsonrpc", "2.0"},
+          {"error", {{"code", code}, {"message", message}}},
+          {"id", id}};
+}
+} // anonymous namespace
+
+const char *to_string(MethodClass method_class) {
+  switch (method_class) {
+  case MethodClass::Inline:
+    return "inline";
+  case MethodClass::Blocking:
+    return "blocking";
+  case MethodClass::AI:
+    return "ai";
+  case MethodClass::Control:
+    return "control";
+  }
+  return "unknown";
+}
+
 RpcServer &RpcServer::instance() {
   static RpcServer inst;
   return inst;
 }
 
+RpcServer::RpcServer() { register_builtin_methods(); }
+
+void RpcServer::register_builtin_methods() {
+  // Capability handshake: the client lists the encodings it accepts in order
+  // of preference and the server picks the first one it supports. JSON may
+  // also ask for length-prefixed framing. The reply is still sent in the old
+  // format; everything after it uses the new one. A weight (1-16) gives
+  // the client that many shares of the handler pools.
+  register_method(
+      "session.init",
+      [this](const nlohmann::json &p, CallContext &ctx) {
+        WireFormat format;
+        Compression compression = Compression::None;
+        unsigned weight = 1;
+        if (ctx.client_id != 0) {
+          if (p.contains("weight")) {
+            weight = std::clamp(p["weight"].get<unsigned>(), 1u,
+                                kMaxClientWeight);
+            std::lock_guard<std::mutex> lock(clients_mutex_);
+            auto it = clients_.find(ctx.client_id);
+            if (it != clients_.end())
+              it->second->weight = weight;
+          }
+          if (p.contains("encodings")) {
+            for (const auto &name :
+                 p["encodings"].get<std::vector<std::string>>()) {
+              if (parse_wire_encoding(name, format.encoding))
+                break;
+            }
+          }
+          // Only for socket clients: HTTP has its own content encodings
+          if (p.contains("compression") && ctx.transport != Transport::Http) {
+            for (const auto &name :
+                 p["compression"].get<std::vector<std::string>>()) {
+              if (parse_compression(name, compression) &&
+                  compression_available(compression))
+                break;
+              compression = Compression::None;
+            }
+          }
+          // Compressed frames are flagged in the length header
+          if (format.encoding != WireEncoding::Json ||
+              compression != Compression::None ||
+              p.value("framing", "newline") == "length-prefixed")
+            format.framing = Framing::LengthPrefixed;
+        }
+        ctx.switch_format = format;
+        ctx.switch_compression = compression;
+        return nlohmann::json{{"encoding", to_string(format.encoding)},
+                              {"framing", to_string(format.framing)},
+                              {"encodings", {"json", "cbor", "msgpack"}},
+                              {"compression", to_string(compression)},
+                              {"compressions", available_compressions()},
+                              {"compress_min_bytes", compress_min_bytes_},
+                              {"weight", weight}};
+      },
+      MethodClass::Inline);
+
+  // LSP-style: {id} of an earlier request on this connection. Usually sent
+  // as a notification; a queued request is answered at once, a running one
+  // when its handler returns (AI and MCP calls abort their I/O).
+  register_method(
+      "$/cancelRequest",
+      [this](const nlohmann::json &p, CallContext &ctx) {
+        if (!p.contains("id"))
+          throw std::invalid_argument("id is required");
+        bool found = cancel_call(ctx.client_id, p["id"]);
+        return nlohmann::json{{"success", found}};
+      },
+      MethodClass::Inline);
+
+  // Opt-in shared-memory data plane for local clients. Output for the
+  // session or block is copied into a memfd ring whose read-only fd comes
+  // with the reply; over the socket the client then gets block.output_ready
+  // doorbells instead of block.output.
+  register_method(
+      "rpc.shm.open",
+      [this](const nlohmann::json &p, CallContext &ctx) {
+        if (ctx.transport != Transport::Unix)
+          throw std::runtime_error(
+              "rpc.shm.open needs a local socket connection");
+        std::string session_id = p.value("session_id", "");
+        std::string block_id = p.value("block_id", "");
+        if (session_id.empty() == block_id.empty())
+          throw std::invalid_argument("Give one of session_id or block_id");
+        size_t size_kb = p.value("size_kb", size_t{1024});
+
+        auto channel = shm_channels_.open(ctx.client_id, session_id,
+                                          block_id, size_kb * 1024);
+        int fd = channel ? channel->ring->dup_reader_fd() : -1;
+        if (fd < 0) {
+          if (channel)
+            shm_channels_.close(ctx.client_id, channel->id);
+          throw std::runtime_error("Shared memory is not available");
+        }
+        ctx.pass_fds.push_back(fd);
+
+        uint8_t doorbell = kTopicOutputReady | kTopicComplete;
+        if (!block_id.empty()) {
+          subscriptions_.subscribe_block(ctx.client_id, block_id, doorbell);
+          subscriptions_.unsubscribe_block(ctx.client_id, block_id,
+                                           kTopicOutput);
+        } else {
+          subscriptions_.subscribe_session(ctx.client_id, session_id,
+                                           doorbell);
+          subscriptions_.unsubscribe_session(ctx.client_id, session_id,
+                                             kTopicOutput);
+        }
+        return nlohmann::json{{"channel_id", channel->id},
+                              {"size", channel->ring->capacity()},
+                              {"version", 1}};
+      },
+      MethodClass::Inline);
+
+  // Back to block.output over the socket for the channel's scope
+  register_method(
+      "rpc.shm.close",
+      [this](const nlohmann::json &p, CallContext &ctx) {
+        auto channel = shm_channels_.close(
+            ctx.client_id, p.at("channel_id").get<uint64_t>());
+        if (!channel)
+          return nlohmann::json{{"success", false}};
+        if (!channel->block_id.empty()) {
+          subscriptions_.subscribe_block(ctx.client_id, channel->block_id,
+                                         kTopicOutput);
+          subscriptions_.unsubscribe_block(ctx.client_id, channel->block_id,
+                                           kTopicOutputReady);
+        } else {
+          subscriptions_.subscribe_session(ctx.client_id, channel->session_id,
+                                           kTopicOutput);
+          subscriptions_.unsubscribe_session(
+              ctx.client_id, channel->session_id, kTopicOutputReady);
+        }
+        return nlohmann::json{{"success", true}};
+      },
+      MethodClass::Inline);
+
+  register_method(
+      "rpc.stats",
+      [this](const nlohmann::json &p, CallContext &) {
+        auto outbound = outbound_stats();
+        auto throttled = nlohmann::json::object();
+        auto shed = nlohmann::json::object();
+        auto queued = nlohmann::json::object();
+        for (size_t i = 0; i < kMethodClassCount; i++) {
+          const char *name = to_string(static_cast<MethodClass>(i));
+          throttled[name] = throttled_[i].load(std::memory_order_relaxed);
+          shed[name] = shed_[i].load(std::memory_order_relaxed);
+          if (pools_[i])
+            queued[name] = pools_[i]->queued();
+        }
+        return nlohmann::json{
+            {"methods", method_stats(p.value("method", ""))},
+            {"outbound",
+             {{"clients", outbound.clients.size()},
+              {"dropped_bytes", outbound.dropped_bytes},
+              {"dropped_frames", outbound.dropped_frames},
+              {"coalesced_frames", outbound.coalesced_frames},
+              {"resyncs", outbound.resyncs},
+              {"slow_client_disconnects", outbound.slow_client_disconnects}}},
+            {"admission",
+             {{"throttled", throttled}, {"shed", shed}, {"queued", queued}}}};
+      },
+      MethodClass::Inline);
+
+  // Both take {session_id?, block_id?, events?: ["output", "complete"]}
+  auto parse = [](const nlohmann::json &p, std::string &session_id,
+                  std::string &block_id) {
+    session_id = p.value("session_id", "");
+    block_id = p.value("block_id", "");
+    if (session_id.empty() && block_id.empty())
+      throw std::invalid_argument("session_id or block_id is required");
+    uint8_t topics = kTopicAll;
+    if (p.contains("events"))
+      topics = parse_topics(p["events"].get<std::vector<std::string>>());
+    if (topics == 0)
+      throw std::invalid_argument("events must not be empty");
+    return topics;
+  };
+
+  register_method(
+      "rpc.subscribe",
+      [this, parse](const nlohmann::json &p, CallContext &ctx) {
+        std::string session_id, block_id;
+        uint8_t topics = parse(p, session_id, block_id);
+        if (!session_id.empty())
+          subscriptions_.subscribe_session(ctx.client_id, session_id, topics);
+        if (!block_id.empty())
+          subscriptions_.subscribe_block(ctx.client_id, block_id, topics);
+        return nlohmann::json{{"success", true}};
+      },
+      MethodClass::Inline);
+
+  register_method(
+      "rpc.unsubscribe",
+      [this, parse](const nlohmann::json &p, CallContext &ctx) {
+        std::string session_id, block_id;
+        uint8_t topics = parse(p, session_id, block_id);
+        if (!session_id.empty())
+          subscriptions_.unsubscribe_session(ctx.client_id, session_id,
+                                             topics);
+        if (!block_id.empty())
+          subscriptions_.unsubscribe_block(ctx.client_id, block_id, topics);
+        return nlohmann::json{{"success", true}};
+      },
+      MethodClass::Inline);
+}
+
 void RpcServer::register_method(const std::string &method_name,
-                                RpcHandler handler) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  methods_[method_name] = handler;
+                                RpcHandler handler, MethodClass method_class) {
+  register_method(
+      method_name,
+      [handler = std::move(handler)](const nlohmann::json &params,
+                                     CallContext &) {
+        return handler(params);
+      },
+      method_class);
+}
+
+void RpcServer::register_method(const std::string &method_name,
+                                RpcContextHandler handler,
+                                MethodClass method_class) {
+  std::unique_lock<std::shared_mutex> lock(methods_mutex_);
+  auto &slot = methods_[method_name];
+  auto stats = slot ? slot->stats : std::make_shared<MethodStats>();
+  slot = std::make_shared<const MethodEntry>(
+      MethodEntry{std::move(handler), method_class, std::move(stats)});
   SI_LOG_INFO("RPC: Registered method '{}'", method_name);
 }
 
+void RpcServer::set_class_concurrency(MethodClass method_class,
+                                      size_t threads) {
+  class_threads_[static_cast<size_t>(method_class)] = threads > 0 ? threads : 1;
+}
+
+void RpcServer::set_outbound_options(const OutboundOptions &options) {
+  outbound_options_ = options;
+}
+
+void RpcServer::set_admission_options(const AdmissionOptions &options) {
+  admission_options_ = options;
+  // A bucket smaller than one token would refuse everything
+  for (auto &rate : admission_options_.rates)
+    rate.burst = std::max(rate.burst, 1.0);
+}
+
+void RpcServer::set_max_frame_bytes(size_t bytes) { max_frame_bytes_ = bytes; }
+
+void RpcServer::set_compress_min_bytes(size_t bytes) {
+  compress_min_bytes_ = bytes;
+}
+
+void RpcServer::set_stats_log_interval(std::chrono::seconds interval) {
+  stats_log_interval_ = interval;
+}
+
+nlohmann::json RpcServer::method_stats(const std::string &method_name) {
+  std::vector<std::pair<std::string, std::shared_ptr<MethodStats>>> all;
+  {
+    std::shared_lock<std::shared_mutex> lock(methods_mutex_);
+    for (const auto &[name, entry] : methods_) {
+      if (method_name.empty() || name == method_name)
+        all.emplace_back(name, entry->stats);
+    }
+  }
+
+  auto methods = nlohmann::json::object();
+  for (const auto &[name, stats] : all)
+    methods[name] = stats->to_json();
+  return methods;
+}
+
+void RpcServer::log_method_stats() {
+  const auto methods = method_stats();
+  for (auto it = methods.begin(); it != methods.end(); ++it) {
+    const auto &stats = it.value();
+    if (stats["calls"] == 0 && stats["in_flight"] == 0)
+      continue;
+    const auto &handler = stats["handler"];
+    SI_LOG_INFO("RPC stats: {} calls={} errors={} in_flight={} "
+                "handler p50={}us p99={}us max={}us queue p99={}us",
+                it.key(), stats["calls"].get<uint64_t>(),
+                stats["errors"].get<uint64_t>(),
+                stats["in_flight"].get<int64_t>(),
+                handler["p50_us"].get<double>(),
+                handler["p99_us"].get<double>(),
+                handler["max_us"].get<double>(),
+                stats["queue_wait"]["p99_us"].get<double>());
+  }
+}
+
+OutboundStats RpcServer::outbound_stats() {
+  std::lock_guard<std::mutex> lock(clients_mutex_);
+  OutboundStats stats = retired_stats_;
+  for (auto &[id, conn] : clients_) {
+    ClientQueueStats client;
+    {
+      std::lock_guard<std::mutex> out_lock(conn->out_mutex);
+      client = conn->out.stats();
+    }
+    client.client_id = conn->id;
+    stats.dropped_bytes += client.dropped_bytes;
+    stats.dropped_frames += client.dropped_frames;
+    stats.coalesced_frames += client.coalesced_frames;
+    stats.clients.push_back(client);
+  }
+  stats.resyncs = resyncs_;
+  stats.slow_client_disconnects = slow_client_disconnects_;
+  return stats;
+}
+
+std::optional<nlohmann::json>
+RpcServer::prepare_call(nlohmann::json &request, Call &call) {
+  // Check JSON-RPC version. Members are looked up once and compared in
+  // place: this runs for every request.
+  if (!request.is_object())
+    return make_error(-32600, "Invalid Request", nullptr);
+  auto version = request.find("jsonrpc");
+  auto method_it = request.find("method");
+  if (version == request.end() || !version->is_string() ||
+      version->get_ref<const std::string &>() != "2.0" ||
+      method_it == request.end() || !method_it->is_string()) {
+    return make_error(-32600, "Invalid Request", nullptr);
+  }
+
+  if (auto it = request.find("id"); it != request.end())
+    call.id = std::move(*it);
+  if (auto it = request.find("params"); it != request.end())
+    call.params = std::move(*it);
+  else
+    call.params = nlohmann::json::object();
+
+  // Optional time budget in ms, counted from now
+  auto deadline = foundation::CancellationToken::Clock::time_point::max();
+  if (auto it = request.find("deadline_ms"); it != request.end()) {
+    if (!it->is_number_unsigned())
+      return make_error(-32600, "Invalid deadline_ms", call.id);
+    deadline = foundation::CancellationToken::Clock::now() +
+               std::chrono::milliseconds(it->get<uint64_t>());
+  }
+
+  const auto &method = method_it->get_ref<const std::string &>();
+  {
+    std::shared_lock<std::shared_mutex> lock(methods_mutex_);
+    auto it = methods_.find(method);
+    if (it != methods_.end())
+      call.entry = it->second;
+  }
+  if (!call.entry) {
+    if (call.id.is_null())
+      return nlohmann::json(nullptr); // notifications are never answered
+    return make_error(-32601, "Method not found", call.id);
+  }
+
+  call.context.cancel =
+      std::make_shared<foundation::CancellationToken>(deadline);
+  // Inline calls run as soon as they are read and never wait, so there is
+  // nothing for $/cancelRequest to catch: skip the bookkeeping
+  if (!call.id.is_null() && call.entry->method_class != MethodClass::Inline) {
+    call.cancel_key = call.id.dump();
+    std::lock_guard<std::mutex> lock(active_calls_mutex_);
+    active_calls_[{call.context.client_id, call.cancel_key}] =
+        call.context.cancel;
+  }
+
+  call.entry->stats->in_flight.fetch_add(1, std::memory_order_relaxed);
+  call.queued_at = Clock::now();
+  return std::nullopt;
+}
+
+void RpcServer::untrack_call(Call &call) {
+  if (call.cancel_key.empty())
+    return;
+  std::lock_guard<std::mutex> lock(active_calls_mutex_);
+  auto it = active_calls_.find({call.context.client_id, call.cancel_key});
+  // A later request may have reused the id
+  if (it != active_calls_.end() && it->second == call.context.cancel)
+    active_calls_.erase(it);
+  call.cancel_key.clear();
+}
+
+void RpcServer::drop_call(Call &call) {
+  untrack_call(call);
+  call.entry->stats->in_flight.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void RpcServer::init_admission(Connection &conn) {
+  auto now = TokenBucket::Clock::now();
+  std::lock_guard<std::mutex> lock(conn.admission_mutex);
+  for (size_t i = 0; i < kMethodClassCount; i++)
+    conn.buckets[i] = TokenBucket(admission_options_.rates[i], now);
+}
+
+std::optional<nlohmann::json> RpcServer::admit(Connection &conn, Call &call) {
+  auto method_class = call.entry->method_class;
+  size_t index = static_cast<size_t>(method_class);
+  std::chrono::milliseconds retry_after{0};
+  const char *reason = nullptr;
+  {
+    // Both checks under one lock, so a client's concurrent requests cannot
+    // each pass on the other's behalf
+    std::lock_guard<std::mutex> lock(conn.admission_mutex);
+    auto &pool = pools_[index];
+    if (!conn.buckets[index].take(TokenBucket::Clock::now(), retry_after)) {
+      reason = "Rate limit exceeded";
+      throttled_[index].fetch_add(1, std::memory_order_relaxed);
+    } else if (pool && (method_class == MethodClass::Blocking ||
+                        method_class == MethodClass::AI)) {
+      // Under overload, refuse the clients holding more than their share of
+      // the backlog, weighted as the pool serves them; the others keep
+      // getting through
+      size_t limit = admission_options_.shed_queue_per_thread * pool->size();
+      if (limit && pool->over_share(conn.id, limit)) {
+        reason = "Server overloaded";
+        retry_after = kShedRetryAfter;
+        shed_[index].fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+  }
+  if (!reason)
+    return std::nullopt;
+
+  if (conn.refused.fetch_add(1, std::memory_order_relaxed) == 0)
+    SI_LOG_WARN("RPC: Refusing requests from client {} ({})", conn.id,
+                reason);
+  call.entry->stats->rejected.fetch_add(1, std::memory_order_relaxed);
+  drop_call(call);
+  if (call.id.is_null())
+    return nlohmann::json(nullptr);
+  auto error = make_error(-32005, reason, call.id);
+  error["error"]["data"] = {{"retry_after_ms", retry_after.count()}};
+  return error;
+}
+
+bool RpcServer::cancel_call(uint64_t client_id, const nlohmann::json &id) {
+  std::shared_ptr<foundation::CancellationToken> token;
+  {
+    std::lock_guard<std::mutex> lock(active_calls_mutex_);
+    auto it = active_calls_.find({client_id, id.dump()});
+    if (it == active_calls_.end())
+      return false;
+    token = it->second;
+  }
+  // Callbacks may touch sockets: run them without the lock
+  token->cancel();
+  return true;
+}
+
+nlohmann::json RpcServer::invoke(Call &call, bool direct) {
+  auto &stats = *call.entry->stats;
+  auto start = Clock::now();
+  stats.queue_wait.record(elapsed_ns(call.queued_at, start));
+
+  nlohmann::json response;
+  bool failed = false;
+  const auto &cancel = *call.context.cancel;
+  // Skip the handler if the request was cancelled or ran out of time while
+  // queued
+  if (!cancel.is_cancelled()) {
+    try {
+      auto result = call.entry->handler(call.params, call.context);
+      const auto &cached = call.context.cached_reply;
+      if (call.id.is_null()) {
+        // Notification: nothing to send
+      } else if (direct) {
+        call.result = std::move(result);
+        call.reply_direct = true;
+      } else {
+        if (cached)
+          result = cached.result->to_json(cached.versioned);
+        response = {{"jsonrpc", "2.0"},
+                    {"result", std::move(result)},
+                    {"id", call.id}};
+      }
+    } catch (const std::exception &e) {
+      failed = true;
+      call.context.cached_reply = {};
+      call.reply_direct = false;
+      if (!call.id.is_null())
+        response = make_error(-32000, e.what(), call.id);
+    }
+  }
+
+  // A cancelled request's result (or error) is discarded
+  if (cancel.is_cancelled()) {
+    failed = true;
+    call.context.cached_reply = {};
+    call.reply_direct = false;
+    if (call.id.is_null())
+      response = nullptr;
+    else if (cancel.deadline_exceeded())
+      response = make_error(-32001, "Deadline exceeded", call.id);
+    else
+      response = make_error(-32800, "Request cancelled", call.id);
+  }
+  untrack_call(call);
+
+  if (failed)
+    stats.errors.fetch_add(1, std::memory_order_relaxed);
+
+  stats.handler.record(elapsed_ns(start, Clock::now()));
+  stats.calls.fetch_add(1, std::memory_order_relaxed);
+  stats.in_flight.fetch_sub(1, std::memory_order_relaxed);
+  return response;
+}
+
 std::string RpcServer::handle_request(const std::string &request_str) {
   nlohmann::json response;
 
   try {
     auto request = nlohmann::json::parse(request_str);
 
-    // Check JSON-RPC version
-    if (!request.contains("jsonrpc") || request["jsonrpc"] != "2.0") {
-      response = {{"jsonrpc", "2.0"},
-                  {"error", {{"code", -32600}, {"message", "Invalid Request"}}},
-                  {"id", nullptr}};
-      return response.dump();
+    Call call;
+    if (request.is_array()) {
+      std::promise<nlohmann::json> batch_response;
+      auto result = batch_response.get_future();
+      run_batch(request, call.context, [&batch_response](nlohmann::json r) {
+        batch_response.set_value(std::move(r));
+      });
+      response = result.get();
+    } else if (auto error = prepare_call(request, call)) {
+      response = std::move(*error);
+    } else {
+      response = invoke(call);
     }
+  } catch (const nlohmann::json::parse_error &e) {
+    response = make_error(-32700, "Parse error", nullptr);
+  }
 
-    std::string method = request["method"].get<std::string>();
-    auto id = request.value("id", nlohmann::json(nullptr));
-    auto params = request.value("params", nlohmann::json::object());
+  // Notifications that succeeded get no reply
+  if (response.is_null())
+    return "";
+  return response.dump();
+}
 
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (methods_.count(method)) {
-      try {
-        auto result = methods_[method](params);
-        if (!id.is_null()) {
-          response = {{"jsonrpc", "2.0"}, {"result", result}, {"id", id}};
-        }
-      } catch (const std::exception &e) {
-        response = {{"jsonrpc", "2.0"},
-                    {"error", {{"code", -32000}, {"message", e.what()}}},
-                    {"id", id}};
-      }
-    } else {
-      response = {
-          {"jsonrpc", "2.0"},
-          {"error", {{"code", -32601}, {"message", "Method not found"}}},
-          {"id", id}};
+uint64_t RpcServer::open_stream() {
+  auto conn = std::make_shared<Connection>();
+  conn->stream = true;
+  init_admission(*conn);
+  std::lock_guard<std::mutex> lock(clients_mutex_);
+  conn->id = next_client_id_++;
+  clients_[conn->id] = conn;
+  SI_LOG_INFO("RPC: New stream client {}", conn->id);
+  return conn->id;
+}
+
+void RpcServer::close_stream(uint64_t client_id) {
+  std::shared_ptr<Connection> conn;
+  {
+    std::lock_guard<std::mutex> lock(clients_mutex_);
+    auto it = clients_.find(client_id);
+    if (it == clients_.end() || !it->second->stream)
+      return;
+    conn = it->second;
+  }
+  close_client(conn);
+}
+
+bool RpcServer::is_connected(uint64_t client_id) {
+  std::lock_guard<std::mutex> lock(clients_mutex_);
+  return clients_.count(client_id) > 0;
+}
+
+bool RpcServer::read_stream(uint64_t client_id, std::string &out,
+                            std::chrono::milliseconds timeout) {
+  std::shared_ptr<Connection> conn;
+  {
+    std::lock_guard<std::mutex> lock(clients_mutex_);
+    auto it = clients_.find(client_id);
+    if (it == clients_.end() || !it->second->stream)
+      return false;
+    conn = it->second;
+  }
+
+  auto encode = [&conn](const std::string &method,
+                        const nlohmann::json &params) {
+    return encode_notification(method, params, conn->format);
+  };
+  std::unique_lock<std::mutex> lock(conn->out_mutex);
+  auto ready = [&]() {
+    if (!conn->closed && conn->out.refill(outbound_options_, encode))
+      resyncs_++;
+    return conn->closed || !conn->out.empty();
+  };
+  conn->out_ready.wait_for(lock, timeout, ready);
+  if (conn->closed)
+    return false;
+
+  // Copy the frames out so the queue lock is not held while the transport
+  // writes them; what arrives meanwhile counts against the budget again
+  struct iovec iov[kMaxIov];
+  while (!conn->out.empty()) {
+    size_t count = conn->out.fill_iov(iov, kMaxIov);
+    size_t bytes = 0;
+    for (size_t i = 0; i < count; i++) {
+      out.append(static_cast<const char *>(iov[i].iov_base), iov[i].iov_len);
+      bytes += iov[i].iov_len;
     }
+    conn->out.consume(bytes);
+  }
+  conn->flush_pending = false;
+  return true;
+}
 
+std::string RpcServer::handle_stream_request(uint64_t client_id,
+                                             const std::string &request_str) {
+  nlohmann::json request;
+  try {
+    request = nlohmann::json::parse(request_str);
   } catch (const nlohmann::json::parse_error &e) {
-    response = {{"jsonrpc", "2.0"},
-                {"error", {{"code", -32700}, {"message", "Parse error"}}},
-                {"id", nullptr}};
+    return make_error(-32700, "Parse error", nullptr).dump();
   }
 
+  // A single request runs as a batch of one, so it goes to its class pool
+  bool single = !request.is_array();
+  if (single)
+    request = nlohmann::json::array({std::move(request)});
+
+  CallContext context;
+  context.client_id = client_id;
+  context.transport = Transport::Http;
+  std::promise<nlohmann::json> reply;
+  auto result = reply.get_future();
+  run_batch(request, context,
+            [&reply](nlohmann::json r) { reply.set_value(std::move(r)); });
+  auto response = result.get();
+
+  if (response.is_null())
+    return "";
+  if (single && response.is_array())
+    return response[0].dump();
   return response.dump();
 }
 
+void RpcServer::dispatch(const std::shared_ptr<Connection> &conn,
+                         const char *data, size_t size) {
+  auto call = std::make_shared<Call>();
+  call->context.client_id = conn->id;
+  call->context.transport = conn->tcp ? Transport::Tcp : Transport::Unix;
+  try {
+    auto request = decode_message(data, size, conn->in_encoding);
+    if (conn->tcp && !conn->authenticated) {
+      conn->inflight++;
+      finish_request(conn, authenticate(conn, request));
+      return;
+    }
+    if (request.is_array()) {
+      conn->inflight++;
+      run_batch(request, call->context, [this, conn](nlohmann::json r) {
+        finish_request(conn, r);
+      });
+      return;
+    }
+    auto error = prepare_call(request, *call);
+    if (!error)
+      error = admit(*conn, *call);
+    if (error) {
+      conn->inflight++;
+      finish_request(conn, *error);
+      return;
+    }
+  } catch (const nlohmann::json::parse_error &e) {
+    conn->inflight++;
+    finish_request(conn, make_error(-32700, "Parse error", nullptr));
+    return;
+  }
+
+  call->entry->stats->bytes_in.fetch_add(size, std::memory_order_relaxed);
+  auto run = [this, conn, call]() {
+    auto response = invoke(*call, true);
+    if (!call->context.pass_fds.empty()) {
+      std::lock_guard<std::mutex> lock(conn->out_mutex);
+      for (int fd : call->context.pass_fds) {
+        if (conn->closed)
+          ::close(fd);
+        else
+          conn->pending_fds.push_back(fd);
+      }
+    }
+    size_t sent = finish_request(conn, response, call.get());
+    call->entry->stats->bytes_out.fetch_add(sent, std::memory_order_relaxed);
+    if (call->context.switch_format)
+      switch_format(conn, *call->context.switch_format,
+                    call->context.switch_compression);
+  };
+
+  conn->inflight++;
+  auto method_class = call->entry->method_class;
+  if (method_class == MethodClass::Inline) {
+    run();
+    return;
+  }
+
+  if (!pools_[static_cast<size_t>(method_class)]->submit(
+          std::move(run), conn->id, conn->weight)) {
+    // Shutting down: drop the request
+    drop_call(*call);
+    conn->inflight--;
+  }
+}
+
+nlohmann::json RpcServer::authenticate(const std::shared_ptr<Connection> &conn,
+                                       const nlohmann::json &request) {
+  nlohmann::json id = nullptr;
+  if (request.is_object()) {
+    id = request.value("id", nlohmann::json(nullptr));
+    if (request.value("method", "") == "rpc.auth") {
+      std::string token;
+      auto params = request.find("params");
+      if (params != request.end() && params->is_object())
+        token = params->value("token", "");
+      // Compare in constant time
+      unsigned char diff = token.size() != tcp_token_.size();
+      for (size_t i = 0; i < token.size() && i < tcp_token_.size(); i++)
+        diff |= static_cast<unsigned char>(token[i] ^ tcp_token_[i]);
+      if (diff == 0) {
+        conn->authenticated = true;
+        return {{"jsonrpc", "2.0"},
+                {"result", {{"success", true}}},
+                {"id", id}};
+      }
+      SI_LOG_WARN("RPC: Client {} sent a wrong token", conn->id);
+      return make_error(-32002, "Invalid token", id);
+    }
+  }
+  return make_error(-32002, "Not authenticated: send rpc.auth first", id);
+}
+
+void RpcServer::run_batch(nlohmann::json &requests,
+                          const CallContext &context,
+                          std::function<void(nlohmann::json)> done) {
+  if (requests.empty()) {
+    done(make_error(-32600, "Invalid Request", nullptr));
+    return;
+  }
+
+  struct Batch {
+    std::vector<nlohmann::json> responses;
+    std::atomic<size_t> remaining;
+    std::function<void(nlohmann::json)> done;
+  };
+  auto batch = std::make_shared<Batch>();
+  batch->responses.resize(requests.size());
+  batch->remaining = requests.size();
+  batch->done = std::move(done);
+
+  // Each call owns its slot; the last one to finish assembles the reply
+  auto complete = [batch](size_t index, nlohmann::json response) {
+    batch->responses[index] = std::move(response);
+    if (batch->remaining.fetch_sub(1, std::memory_order_acq_rel) != 1)
+      return;
+    auto replies = nlohmann::json::array();
+    for (auto &r : batch->responses) {
+      if (!r.is_null())
+        replies.push_back(std::move(r));
+    }
+    batch->done(replies.empty() ? nlohmann::json(nullptr)
+                                : std::move(replies));
+  };
+
+  std::shared_ptr<Connection> conn;
+  if (context.client_id != 0) {
+    std::lock_guard<std::mutex> lock(clients_mutex_);
+    auto it = clients_.find(context.client_id);
+    if (it != clients_.end())
+      conn = it->second;
+  }
+
+  for (size_t i = 0; i < requests.size(); i++) {
+    auto call = std::make_shared<Call>();
+    call->context.client_id = context.client_id;
+    call->context.transport = context.transport;
+    auto error = prepare_call(requests[i], *call);
+    if (!error && conn)
+      error = admit(*conn, *call);
+    if (error) {
+      complete(i, std::move(*error));
+      continue;
+    }
+
+    // session.init and descriptor passing only work as a single request
+    auto run = [this, call, complete, i]() {
+      auto response = invoke(*call);
+      for (int fd : call->context.pass_fds)
+        ::close(fd);
+      complete(i, std::move(response));
+    };
+    auto method_class = call->entry->method_class;
+    auto &pool = pools_[static_cast<size_t>(method_class)];
+    if (method_class == MethodClass::Inline || !running_ || !pool) {
+      run();
+    } else if (!pool->submit(run, context.client_id,
+                             conn ? conn->weight.load() : 1)) {
+      drop_call(*call);
+      complete(i, call->id.is_null()
+                      ? nlohmann::json(nullptr)
+                      : make_error(-32000, "Server is shutting down",
+                                   call->id));
+    }
+  }
+}
+
 bool RpcServer::start(const std::string &socket_path) {
   if (running_)
     return true;
 
-  // Remove old socket file if exists
-  unlink(socket_path.c_str());
+  if (!socket_path.empty()) {
+    // Remove old socket file if exists
+    unlink(socket_path.c_str());
 
-  server_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
-  if (server_fd_ < 0) {
-    SI_LOG_ERROR("RPC: Failed to create socket");
-    return false;
+    server_fd_ =
+        socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server_fd_ < 0) {
+      SI_LOG_ERROR("RPC: Failed to create socket");
+      return false;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+
+    if (bind(server_fd_, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+      SI_LOG_ERROR("RPC: Failed to bind socket to {}", socket_path);
+      ::close(server_fd_);
+      server_fd_ = -1;
+      return false;
+    }
+
+    if (listen(server_fd_, 50) < 0) {
+      SI_LOG_ERROR("RPC: Failed to listen");
+      ::close(server_fd_);
+      server_fd_ = -1;
+      return false;
+    }
   }
 
-  struct sockaddr_un addr;
-  memset(&addr, 0, sizeof(addr));
-  addr.sun_family = AF_UNIX;
-  strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+  socket_path_ = socket_path;
+  if (!start_loop())
+    return false;
+  SI_LOG_INFO("RPC: Server started on {}", socket_path);
+  return true;
+}
 
-  if (bind(server_fd_, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-    SI_LOG_ERROR("RPC: Failed to bind socket to {}", socket_path);
-    ::close(server_fd_);
+bool RpcServer::start_loop() {
+  loop_ = std::make_unique<EventLoop>();
+  if (!loop_->open() ||
+      (server_fd_ >= 0 &&
+       !loop_->add(server_fd_, EPOLLIN,
+                   [this](uint32_t) { on_accept(server_fd_, false); })) ||
+      (tcp_fd_ >= 0 &&
+       !loop_->add(tcp_fd_, EPOLLIN,
+                   [this](uint32_t) { on_accept(tcp_fd_, true); }))) {
+    SI_LOG_ERROR("RPC: Failed to set up event loop");
+    loop_.reset();
+    if (server_fd_ >= 0)
+      ::close(server_fd_);
+    server_fd_ = -1;
+    if (tcp_fd_ >= 0)
+      ::close(tcp_fd_);
+    tcp_fd_ = -1;
     return false;
   }
 
-  if (listen(server_fd_, 50) < 0) {
-    SI_LOG_ERROR("RPC: Failed to listen");
-    ::close(server_fd_);
-    return false;
+  pools_[static_cast<size_t>(MethodClass::Blocking)] =
+      std::make_unique<WorkerPool>(
+          "rpc-blocking",
+          class_threads_[static_cast<size_t>(MethodClass::Blocking)]);
+  pools_[static_cast<size_t>(MethodClass::AI)] = std::make_unique<WorkerPool>(
+      "rpc-ai", class_threads_[static_cast<size_t>(MethodClass::AI)]);
+  // Control calls never queue behind file transfers or AI requests, and
+  // a client's run one at a time: keystrokes reach the terminal in order
+  pools_[static_cast<size_t>(MethodClass::Control)] =
+      std::make_unique<WorkerPool>(
+          "rpc-control",
+          class_threads_[static_cast<size_t>(MethodClass::Control)], true);
+  for (auto &pool : pools_) {
+    if (pool)
+      pool->start();
+  }
+
+  if (stats_log_interval_.count() > 0) {
+    loop_->add_timer(stats_log_interval_, [this]() { log_method_stats(); });
   }
 
   running_ = true;
-  SI_LOG_INFO("RPC: Server started on {}", socket_path);
+  loop_thread_ = std::thread([this]() { loop_->run(); });
+  return true;
+}
+
+bool RpcServer::listen_tcp(const std::string &host, int port,
+                           const std::string &token) {
+  if (!running_ || tcp_fd_ >= 0)
+    return false;
+
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+  struct addrinfo *addrs = nullptr;
+  std::string service = std::to_string(port);
+  int rc = getaddrinfo(host.empty() ? nullptr : host.c_str(), service.c_str(),
+                       &hints, &addrs);
+  if (rc != 0) {
+    SI_LOG_ERROR("RPC: Cannot resolve {}: {}", host, gai_strerror(rc));
+    return false;
+  }
 
-  // Start accept loop in background thread
-  std::thread([this]() { this->accept_loop(); }).detach();
+  int fd = -1;
+  bool loopback = true;
+  for (auto *ai = addrs; ai; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                ai->ai_protocol);
+    if (fd < 0)
+      continue;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 50) == 0) {
+      if (ai->ai_family == AF_INET) {
+        auto *in = reinterpret_cast<struct sockaddr_in *>(ai->ai_addr);
+        loopback = (ntohl(in->sin_addr.s_addr) >> 24) == 127;
+      } else {
+        auto *in6 = reinterpret_cast<struct sockaddr_in6 *>(ai->ai_addr);
+        loopback = IN6_IS_ADDR_LOOPBACK(&in6->sin6_addr);
+      }
+      break;
+    }
+    ::close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(addrs);
+  if (fd < 0) {
+    SI_LOG_ERROR("RPC: Failed to listen on {}:{}: {}", host, port,
+                 std::strerror(errno));
+    return false;
+  }
+  // Whoever can connect can run commands
+  if (token.empty() && !loopback) {
+    SI_LOG_ERROR("RPC: Refusing to listen on {} without a token", host);
+    ::close(fd);
+    return false;
+  }
 
+  struct sockaddr_storage bound;
+  socklen_t len = sizeof(bound);
+  getsockname(fd, reinterpret_cast<struct sockaddr *>(&bound), &len);
+  tcp_port_ = ntohs(bound.ss_family == AF_INET
+                        ? reinterpret_cast<sockaddr_in *>(&bound)->sin_port
+                        : reinterpret_cast<sockaddr_in6 *>(&bound)->sin6_port);
+  tcp_token_ = token;
+  tcp_fd_ = fd;
+  if (!loop_->add(tcp_fd_, EPOLLIN,
+                  [this](uint32_t) { on_accept(tcp_fd_, true); })) {
+    ::close(tcp_fd_);
+    tcp_fd_ = -1;
+    return false;
+  }
+  SI_LOG_INFO("RPC: Listening for controllers on {}:{}", host, tcp_port_);
   return true;
 }
 
 void RpcServer::stop() {
-  running_ = false;
+  if (!running_.exchange(false))
+    return;
+
+  // Let in-flight handlers finish and queue their replies, then stop the loop
+  for (auto &pool : pools_) {
+    if (pool)
+      pool->stop();
+  }
+  loop_->stop();
+  if (loop_thread_.joinable())
+    loop_thread_.join();
+
+  {
+    std::lock_guard<std::mutex> lock(clients_mutex_);
+    for (auto &[id, conn] : clients_) {
+      {
+        std::lock_guard<std::mutex> out_lock(conn->out_mutex);
+        conn->closed = true;
+        conn->out.clear();
+        if (!conn->stream)
+          ::close(conn->fd);
+      }
+      conn->out_ready.notify_all();
+    }
+    clients_.clear();
+  }
+
   if (server_fd_ >= 0) {
     ::close(server_fd_);
     server_fd_ = -1;
+    unlink(socket_path_.c_str());
   }
+  if (tcp_fd_ >= 0) {
+    ::close(tcp_fd_);
+    tcp_fd_ = -1;
+  }
+
+  for (auto &pool : pools_)
+    pool.reset();
+  loop_.reset();
+  SI_LOG_INFO("RPC: Server stopped");
 }
 
-void RpcServer::accept_loop() {
-  while (running_) {
-    int client_fd = accept(server_fd_, nullptr, nullptr);
-    if (client_fd < 0) {
-      if (running_)
-        SI_LOG_WARN("RPC: Accept failed");
+nlohmann::json RpcServer::detach(std::vector<int> &fds) {
+  if (!running_.exchange(false))
+    return nullptr;
+
+  // Cancelled requests reply at once; the rest finish as on stop()
+  {
+    std::lock_guard<std::mutex> lock(active_calls_mutex_);
+    for (auto &[key, token] : active_calls_)
+      token->cancel();
+  }
+  for (auto &pool : pools_) {
+    if (pool)
+      pool->stop();
+  }
+  loop_->stop();
+  if (loop_thread_.joinable())
+    loop_thread_.join();
+
+  std::vector<std::shared_ptr<Connection>> connections;
+  {
+    std::lock_guard<std::mutex> lock(clients_mutex_);
+    for (auto &[id, conn] : clients_)
+      connections.push_back(conn);
+  }
+
+  // Everything still queued, whatever the budget, goes to the new image
+  OutboundOptions unlimited = outbound_options_;
+  unlimited.max_queue_bytes = std::numeric_limits<size_t>::max();
+  auto clients = nlohmann::json::array();
+  for (auto &conn : connections) {
+    if (conn->stream) {
+      // HttpTransport is stopped: its clients reconnect
+      close_client(conn);
       continue;
     }
+    std::lock_guard<std::mutex> lock(conn->out_mutex);
+    if (conn->closed)
+      continue;
+    auto encode = [&conn](const std::string &method,
+                          const nlohmann::json &params) {
+      return encode_notification(method, params, conn->format);
+    };
+    conn->out.refill(unlimited, encode);
+    std::string unread = conn->decoder.take_unread();
+    std::string unsent = conn->out.take_bytes();
+    std::string window =
+        conn->decompressor ? conn->decompressor->window() : "";
+    auto passed = nlohmann::json::array();
+    for (int fd : conn->pending_fds) {
+      passed.push_back(fds.size());
+      fds.push_back(fd);
+    }
+    conn->pending_fds.clear();
+    clients.push_back(
+        {{"id", conn->id},
+         {"fd", fds.size()},
+         {"tcp", conn->tcp},
+         {"authenticated", conn->authenticated},
+         {"weight", conn->weight.load()},
+         {"encoding", static_cast<int>(conn->format.encoding)},
+         {"framing", static_cast<int>(conn->format.framing)},
+         {"compression", static_cast<int>(conn->compression)},
+         {"read_closed", conn->read_closed.load()},
+         {"unread", nlohmann::json::binary({unread.begin(), unread.end()})},
+         {"unsent", nlohmann::json::binary({unsent.begin(), unsent.end()})},
+         {"window", nlohmann::json::binary({window.begin(), window.end()})},
+         {"pass_fds", std::move(passed)}});
+    fds.push_back(conn->fd);
+    conn->closed = true;
+  }
+
+  nlohmann::json state = {{"socket_path", socket_path_},
+                          {"listen_fd", nullptr},
+                          {"tcp_fd", nullptr},
+                          {"tcp_port", tcp_port_},
+                          {"tcp_token", tcp_token_},
+                          {"clients", std::move(clients)},
+                          {"subscriptions", subscriptions_.snapshot()},
+                          {"shm_channels", shm_channels_.snapshot(fds)}};
+  if (server_fd_ >= 0) {
+    state["listen_fd"] = fds.size();
+    fds.push_back(server_fd_);
+    server_fd_ = -1;
+  }
+  if (tcp_fd_ >= 0) {
+    state["tcp_fd"] = fds.size();
+    fds.push_back(tcp_fd_);
+    tcp_fd_ = -1;
+  }
+  {
+    std::lock_guard<std::mutex> lock(clients_mutex_);
+    state["next_client_id"] = next_client_id_;
+    for (auto &conn : connections) {
+      subscriptions_.remove_client(conn->id);
+      shm_channels_.remove_client(conn->id);
+    }
+    clients_.clear();
+  }
+
+  for (auto &pool : pools_)
+    pool.reset();
+  loop_.reset();
+  SI_LOG_INFO("RPC: Server detached ({} clients)", state["clients"].size());
+  return state;
+}
+
+bool RpcServer::start_inherited(const nlohmann::json &state,
+                                const std::vector<int> &fds) {
+  if (running_)
+    return false;
+  auto fd_at = [&fds](const nlohmann::json &index) {
+    return index.is_number() ? fds.at(index.get<size_t>()) : -1;
+  };
+  auto bytes = [](const nlohmann::json &value) {
+    const auto &binary = value.get_binary();
+    return std::string(binary.begin(), binary.end());
+  };
+
+  socket_path_ = state.value("socket_path", "");
+  server_fd_ = fd_at(state["listen_fd"]);
+  tcp_fd_ = fd_at(state["tcp_fd"]);
+  tcp_port_ = state.value("tcp_port", 0);
+  tcp_token_ = state.value("tcp_token", "");
+  next_client_id_ = std::max(next_client_id_,
+                             state.value("next_client_id", uint64_t{1}));
+  if (!start_loop())
+    return false;
 
-    SI_LOG_INFO("RPC: New client connection accepted");
+  for (const auto &entry : state["clients"]) {
+    auto conn = std::make_shared<Connection>();
+    conn->id = entry["id"];
+    conn->fd = fd_at(entry["fd"]);
+    conn->tcp = entry["tcp"];
+    conn->authenticated = entry["authenticated"];
+    conn->weight = entry["weight"].get<unsigned>();
+    init_admission(*conn);
 
+    WireFormat format{static_cast<WireEncoding>(entry["encoding"].get<int>()),
+                      static_cast<Framing>(entry["framing"].get<int>())};
+    auto compression =
+        static_cast<Compression>(entry["compression"].get<int>());
+    conn->in_encoding = format.encoding;
+    conn->decoder.set_max_frame_bytes(max_frame_bytes_);
+    conn->decoder.set_framing(format.framing);
+    conn->decoder.set_compressed_frames(compression != Compression::None);
+    conn->decoder.restore(bytes(entry["unread"]));
+    conn->decompressor = Decompressor::create(compression);
+    if (conn->decompressor)
+      conn->decompressor->set_window(bytes(entry["window"]));
+    conn->read_closed = entry["read_closed"].get<bool>();
     {
-      std::lock_guard<std::mutex> lock(mutex_);
-      clients_.push_back(client_fd);
+      std::lock_guard<std::mutex> lock(conn->out_mutex);
+      conn->format = format;
+      conn->compression = compression;
+      // Already compressed by the old context: it goes out first, as is.
+      // A new compressor starts over, which the client's decoder follows.
+      std::string unsent = bytes(entry["unsent"]);
+      if (!unsent.empty())
+        conn->out.push_response(
+            std::make_shared<const std::string>(std::move(unsent)));
+      compress_output(*conn, compression);
+      for (const auto &index : entry["pass_fds"])
+        conn->pending_fds.push_back(fd_at(index));
     }
+    add_client(conn);
 
-    // Handle client in a new thread
-    std::thread([this, client_fd]() {
-      char buffer[65536];
-      std::string accumulated;
+    // Frames that arrived complete before the handoff
+    loop_->post([this, conn]() {
+      if (dispatch_frames(conn)) {
+        close_client(conn);
+        return;
+      }
+      flush_client(conn);
+    });
+  }
+  subscriptions_.restore(state["subscriptions"]);
+  shm_channels_.restore(state["shm_channels"], fds);
 
-      while (true) {
-        ssize_t n = recv(client_fd, buffer, sizeof(buffer) - 1, 0);
-        if (n <= 0) {
-          if (n < 0 && errno == EINTR) {
-            continue;
-          }
-          if (n == 0) {
-            SI_LOG_INFO("RPC: Client disconnected cleanly");
-          } else {
-            SI_LOG_ERROR("RPC: Recv failed: {}", std::strerror(errno));
-          }
-          break;
-        }
+  SI_LOG_INFO("RPC: Server resumed on {} ({} clients)", socket_path_,
+              state["clients"].size());
+  return true;
+}
 
-        buffer[n] = 0;
-        accumulated += buffer;
+void RpcServer::on_accept(int listen_fd, bool tcp) {
+  while (true) {
+    int client_fd =
+        accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_fd < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        SI_LOG_WARN("RPC: Accept failed: {}", std::strerror(errno));
+      return;
+    }
 
-        // Simple newline-delimited messages
-        size_t pos;
-        while ((pos = accumulated.find('\n')) != std::string::npos) {
-          std::string line = accumulated.substr(0, pos);
-          accumulated.erase(0, pos + 1);
+    auto conn = std::make_shared<Connection>();
+    conn->fd = client_fd;
+    conn->tcp = tcp;
+    conn->decoder.set_max_frame_bytes(max_frame_bytes_);
+    init_admission(*conn);
+    if (tcp) {
+      // Replies and keystrokes are small; do not hold them back
+      int one = 1;
+      setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
 
-          if (!line.empty()) {
-            std::string response = handle_request(line);
-            response += "\n";
-            send(client_fd, response.c_str(), response.size(), MSG_NOSIGNAL);
-          }
+    add_client(conn);
+    SI_LOG_INFO("RPC: New {} connection accepted (client {})",
+                tcp ? "TCP" : "client", conn->id);
+  }
+}
+
+void RpcServer::add_client(const std::shared_ptr<Connection> &conn) {
+  {
+    std::lock_guard<std::mutex> lock(clients_mutex_);
+    if (conn->id == 0)
+      conn->id = next_client_id_++;
+    clients_[conn->id] = conn;
+  }
+  loop_->add(conn->fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+             [this, conn](uint32_t events) { on_client_event(conn, events); });
+}
+
+void RpcServer::on_client_event(const std::shared_ptr<Connection> &conn,
+                                uint32_t events) {
+  if (events & EPOLLIN) {
+    if (!read_client(conn)) {
+      close_client(conn);
+      return;
+    }
+  }
+
+  if (events & (EPOLLERR | EPOLLHUP)) {
+    close_client(conn);
+    return;
+  }
+
+  if (events & EPOLLOUT)
+    flush_client(conn);
+}
+
+bool RpcServer::read_client(const std::shared_ptr<Connection> &conn) {
+  // Edge-triggered: drain the socket completely. Frames are dispatched after
+  // every read so a large payload never has to sit in the buffer twice.
+  auto &buffer = conn->decoder.buffer();
+  bool peer_closed = false;
+  while (!conn->read_closed) {
+    struct iovec iov[2];
+    size_t count = buffer.write_regions(iov, kReadChunk);
+    ssize_t n = readv(conn->fd, iov, static_cast<int>(count));
+    if (n > 0) {
+      buffer.commit(static_cast<size_t>(n));
+      if (const char *error = dispatch_frames(conn)) {
+        // Oversized or corrupt frame: the stream cannot be resynchronised.
+        // Answer with an error, stop reading and close once the reply is
+        // flushed.
+        SI_LOG_WARN("RPC: Client {} sent a bad frame: {} (limit {} bytes)",
+                    conn->id, error, conn->decoder.max_frame_bytes());
+        conn->inflight++;
+        finish_request(conn, make_error(-32600, error, nullptr));
+        shutdown(conn->fd, SHUT_RD);
+        peer_closed = true;
+        break;
+      }
+      continue;
+    }
+    if (n == 0) {
+      SI_LOG_INFO("RPC: Client {} disconnected cleanly", conn->id);
+      peer_closed = true;
+      break;
+    }
+    if (errno == EINTR)
+      continue;
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      break;
+    SI_LOG_ERROR("RPC: Recv failed: {}", std::strerror(errno));
+    return false;
+  }
+
+  if (peer_closed) {
+    // Half-close: answer what was already sent, then close (see flush_client)
+    conn->read_closed = true;
+    flush_client(conn);
+  }
+  return true;
+}
+
+const char *
+RpcServer::dispatch_frames(const std::shared_ptr<Connection> &conn) {
+  // A message may change the framing (session.init), which the decoder
+  // applies from the next frame on
+  const char *data;
+  size_t size;
+  while (true) {
+    switch (conn->decoder.next(data, size)) {
+    case FrameDecoder::Status::Frame:
+      if (conn->decoder.compressed()) {
+        size_t limit = conn->decoder.max_frame_bytes();
+        conn->inflated.clear();
+        if (!conn->decompressor->decompress(data, size, conn->inflated,
+                                            limit)) {
+          return conn->inflated.size() > limit ? "Frame too large"
+                                               : "Bad compressed frame";
         }
+        dispatch(conn, conn->inflated.data(), conn->inflated.size());
+        // Do not hold on to the largest message ever received
+        if (conn->inflated.capacity() > kReadChunk * 16)
+          std::string().swap(conn->inflated);
+      } else {
+        dispatch(conn, data, size);
       }
+      break;
+    case FrameDecoder::Status::NeedMore:
+      return nullptr;
+    case FrameDecoder::Status::TooLarge:
+      return "Frame too large";
+    }
+  }
+}
+
+size_t RpcServer::finish_request(const std::shared_ptr<Connection> &conn,
+                                 const nlohmann::json &response,
+                                 const Call *direct) {
+  size_t sent = 0;
+  if (!response.is_null() || (direct && direct->reply_direct))
+    sent = queue_send(conn, response, direct);
+  if (conn->inflight.fetch_sub(1) == 1 && conn->read_closed)
+    loop_->post([this, conn]() { flush_client(conn); });
+  return sent;
+}
+
+void RpcServer::switch_format(const std::shared_ptr<Connection> &conn,
+                              WireFormat format, Compression compression) {
+  conn->in_encoding = format.encoding;
+  conn->decoder.set_framing(format.framing);
+  conn->decoder.set_compressed_frames(compression != Compression::None);
+  conn->decompressor = Decompressor::create(compression);
+  std::lock_guard<std::mutex> lock(conn->out_mutex);
+  conn->format = format;
+  conn->compression = compression;
+  compress_output(*conn, compression);
+  SI_LOG_INFO("RPC: Client {} switched to {} ({}, compression {})", conn->id,
+              to_string(format.encoding), to_string(format.framing),
+              to_string(compression));
+}
+
+void RpcServer::compress_output(Connection &conn, Compression compression) {
+  if (auto compressor = Compressor::create(compression)) {
+    // Frames are compressed as they are queued, so the stream context sees
+    // them in wire order. Replies that jump the queue go out as they are;
+    // they are small.
+    conn.out.set_filter(
+        [compressor = std::shared_ptr<Compressor>(std::move(compressor)),
+         min_size = compress_min_bytes_ + kFrameHeaderSize](Frame frame) {
+          if (frame->size() < min_size)
+            return frame;
+          return Frame(std::make_shared<const std::string>(
+              compress_frame(*compressor, *frame)));
+        });
+  }
+}
 
-      remove_client(client_fd);
-      ::close(client_fd);
-    }).detach();
+size_t RpcServer::queue_send(const std::shared_ptr<Connection> &conn,
+                             const nlohmann::json &message,
+                             const Call *direct) {
+  size_t size;
+  {
+    std::lock_guard<std::mutex> lock(conn->out_mutex);
+    if (conn->closed)
+      return 0;
+    const auto &format = conn->format;
+    Frame frame;
+    if (!direct || !direct->reply_direct) {
+      frame = std::make_shared<const std::string>(
+          encode_message(message, format));
+    } else if (const auto &cached = direct->context.cached_reply) {
+      frame = std::make_shared<const std::string>(splice_response(
+          direct->id, cached.result->encoded(format.encoding, cached.versioned),
+          format));
+    } else {
+      frame = std::make_shared<const std::string>(
+          encode_response(direct->id, direct->result, format));
+    }
+    size = frame->size();
+    if (direct && direct->entry->method_class == MethodClass::Control)
+      conn->out.push_priority(std::move(frame));
+    else
+      conn->out.push_response(std::move(frame));
+    if (conn->flush_pending)
+      return size;
+    conn->flush_pending = true;
   }
+  schedule_flush(conn);
+  return size;
 }
 
-void RpcServer::remove_client(int fd) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  clients_.erase(std::remove(clients_.begin(), clients_.end(), fd),
-                 clients_.end());
+const Frame &RpcServer::NotificationFrames::get(WireFormat format) {
+  auto &frame = frames[format.index()];
+  if (!frame)
+    frame = encode_notification(method, params, format);
+  return frame;
+}
+
+void RpcServer::queue_notification(const std::shared_ptr<Connection> &conn,
+                                   NotificationFrames &notification) {
+  OutboundQueue::Admit admit;
+  {
+    std::lock_guard<std::mutex> lock(conn->out_mutex);
+    if (conn->closed)
+      return;
+    admit = conn->out.push_notification(
+        notification.method, notification.params,
+        notification.get(conn->format), outbound_options_);
+    if (admit == OutboundQueue::Admit::Queued) {
+      if (conn->flush_pending)
+        return;
+      conn->flush_pending = true;
+    }
+  }
+
+  if (admit == OutboundQueue::Admit::Queued) {
+    schedule_flush(conn);
+  } else if (admit == OutboundQueue::Admit::Disconnect) {
+    SI_LOG_WARN("RPC: Disconnecting slow client {}", conn->id);
+    slow_client_disconnects_++;
+    loop_->post([this, conn]() { close_client(conn); });
+  }
+}
+
+Frame RpcServer::encode_notification(const std::string &method,
+                                     const nlohmann::json &params,
+                                     WireFormat format) {
+  // Binary encodings carry terminal output as raw bytes, no escaping
+  return std::make_shared<const std::string>(rpc::encode_notification(
+      method, params, format, method == "block.output"));
+}
+
+void RpcServer::schedule_flush(const std::shared_ptr<Connection> &conn) {
+  if (conn->stream)
+    conn->out_ready.notify_all();
+  else
+    loop_->post([this, conn]() { flush_client(conn); });
+}
+
+void RpcServer::flush_client(const std::shared_ptr<Connection> &conn) {
+  bool finished = false;
+  bool failed = false;
+  {
+    std::lock_guard<std::mutex> lock(conn->out_mutex);
+    if (write_pending(conn, failed))
+      finished = conn->read_closed && conn->inflight == 0 && conn->out.empty();
+  }
+  // A broken connection is dropped now, not when epoll reports it
+  if (finished || failed)
+    close_client(conn);
+}
+
+bool RpcServer::write_pending(const std::shared_ptr<Connection> &conn,
+                              bool &failed) {
+  conn->flush_pending = false;
+
+  while (!conn->closed) {
+    auto encode = [&conn](const std::string &method,
+                          const nlohmann::json &params) {
+      return encode_notification(method, params, conn->format);
+    };
+    if (conn->out.refill(outbound_options_, encode))
+      resyncs_++;
+    if (conn->out.empty())
+      break;
+
+    struct iovec iov[kMaxIov];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = conn->out.fill_iov(iov, kMaxIov);
+
+    // Descriptors ride along with the first bytes written after they were
+    // queued, which come no later than the reply that announced them
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * kMaxFds)];
+    size_t fd_count = std::min(conn->pending_fds.size(), kMaxFds);
+    if (fd_count > 0) {
+      msg.msg_control = control;
+      msg.msg_controllen = CMSG_SPACE(sizeof(int) * fd_count);
+      struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_count);
+      memcpy(CMSG_DATA(cmsg), conn->pending_fds.data(),
+             sizeof(int) * fd_count);
+    }
+
+    ssize_t n = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        SI_LOG_WARN("RPC: Send to client {} failed: {}", conn->id,
+                    std::strerror(errno));
+        failed = true;
+      }
+      // EAGAIN: the next EPOLLOUT edge resumes the flush
+      return false;
+    }
+    for (size_t i = 0; i < fd_count; i++)
+      ::close(conn->pending_fds[i]);
+    conn->pending_fds.erase(conn->pending_fds.begin(),
+                            conn->pending_fds.begin() + fd_count);
+    conn->out.consume(static_cast<size_t>(n));
+  }
+  return true;
+}
+
+void RpcServer::close_client(const std::shared_ptr<Connection> &conn) {
+  ClientQueueStats stats;
+  {
+    std::lock_guard<std::mutex> lock(conn->out_mutex);
+    if (conn->closed)
+      return;
+    conn->closed = true;
+    stats = conn->out.stats();
+    conn->out.clear();
+    for (int fd : conn->pending_fds)
+      ::close(fd);
+    conn->pending_fds.clear();
+  }
+  conn->out_ready.notify_all();
+
+  if (!conn->stream)
+    loop_->remove(conn->fd);
+  {
+    std::lock_guard<std::mutex> lock(clients_mutex_);
+    clients_.erase(conn->id);
+    subscriptions_.remove_client(conn->id);
+    shm_channels_.remove_client(conn->id);
+    retired_stats_.dropped_bytes += stats.dropped_bytes;
+    retired_stats_.dropped_frames += stats.dropped_frames;
+    retired_stats_.coalesced_frames += stats.coalesced_frames;
+  }
+  if (!conn->stream)
+    ::close(conn->fd);
+
+  // Nobody is left to read the replies: stop the client's pending work
+  std::vector<std::shared_ptr<foundation::CancellationToken>> abandoned;
+  {
+    std::lock_guard<std::mutex> lock(active_calls_mutex_);
+    for (auto it = active_calls_.lower_bound({conn->id, ""});
+         it != active_calls_.end() && it->first.first == conn->id; ++it)
+      abandoned.push_back(it->second);
+  }
+  for (auto &token : abandoned)
+    token->cancel();
+
+  SI_LOG_INFO("RPC: Client {} closed", conn->id);
 }
 
 void RpcServer::broadcast(const std::string &method,
                           const nlohmann::json &params) {
-  nlohmann::json msg{
-      {"jsonrpc", "2.0"}, {"method", method}, {"params", params}};
-  std::string msg_str = msg.dump() + "\n";
+  std::lock_guard<std::mutex> lock(clients_mutex_);
+  if (clients_.empty())
+    return;
+
+  // Serialized once per format and shared by every client's queue
+  NotificationFrames notification{method, params, {}};
+  for (auto &[id, conn] : clients_) {
+    queue_notification(conn, notification);
+  }
+}
+
+void RpcServer::publish(const std::string &method,
+                        const nlohmann::json &params,
+                        const EventScope &scope) {
+  std::lock_guard<std::mutex> lock(clients_mutex_);
+  if (clients_.empty())
+    return;
 
-  std::lock_guard<std::mutex> lock(mutex_);
-  for (int fd : clients_) {
-    send(fd, msg_str.c_str(), msg_str.size(), MSG_NOSIGNAL);
+  auto route = subscriptions_.route(scope);
+  NotificationFrames notification{method, params, {}};
+  for (auto &[id, conn] : clients_) {
+    if (route.wants(conn->id))
+      queue_notification(conn, notification);
   }
 }
+
+bool RpcServer::notify(uint64_t client_id, const std::string &method,
+                       const nlohmann::json &params) {
+  std::lock_guard<std::mutex> lock(clients_mutex_);
+  auto it = clients_.find(client_id);
+  if (it == clients_.end())
+    return false;
+  NotificationFrames notification{method, params, {}};
+  queue_notification(it->second, notification);
+  return true;
+}
 } // namespace si::rpc
@@ -0,0 +1,343 @@
+#include "si/rpc/shm_channel.hpp"
+#include "si/foundation/logging.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace si::rpc {
+
+namespace {
+constexpr size_t kMinCapacity = 4096;
+constexpr size_t kMaxCapacity = 256 * 1024 * 1024;
+
+size_t align8(size_t n) { return (n + 7) & ~size_t{7}; }
+
+size_t round_up_pow2(size_t n) {
+  size_t capacity = kMinCapacity;
+  while (capacity < n && capacity < kMaxCapacity)
+    capacity <<= 1;
+  return capacity;
+}
+
+ShmRingHeader *header_of(char *base) {
+  return reinterpret_cast<ShmRingHeader *>(base);
+}
+
+const ShmRingHeader *header_of(const char *base) {
+  return reinterpret_cast<const ShmRingHeader *>(base);
+}
+} // anonymous namespace
+
+std::unique_ptr<ShmRing> ShmRing::create(size_t capacity) {
+  capacity = round_up_pow2(capacity);
+  size_t total = kShmDataOffset + capacity;
+
+  int fd = memfd_create("si-block-output", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0) {
+    SI_LOG_WARN("RPC: memfd_create failed: {}", std::strerror(errno));
+    return nullptr;
+  }
+  if (ftruncate(fd, static_cast<off_t>(total)) < 0) {
+    SI_LOG_WARN("RPC: Failed to size shared ring: {}", std::strerror(errno));
+    ::close(fd);
+    return nullptr;
+  }
+  // Clients cannot resize the file under us (which would SIGBUS the writer)
+  fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+
+  void *mem = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mem == MAP_FAILED) {
+    SI_LOG_WARN("RPC: Failed to map shared ring: {}", std::strerror(errno));
+    ::close(fd);
+    return nullptr;
+  }
+
+  auto *base = static_cast<char *>(mem);
+  auto *header = new (base) ShmRingHeader;
+  header->magic = kShmMagic;
+  header->version = 1;
+  header->capacity = capacity;
+  header->head.store(0, std::memory_order_relaxed);
+  header->reserve.store(0, std::memory_order_relaxed);
+  return std::unique_ptr<ShmRing>(new ShmRing(fd, base, capacity));
+}
+
+std::unique_ptr<ShmRing> ShmRing::adopt(int fd) {
+  struct stat st;
+  if (fstat(fd, &st) < 0 ||
+      static_cast<size_t>(st.st_size) < kShmDataOffset + kMinCapacity) {
+    ::close(fd);
+    return nullptr;
+  }
+  size_t total = static_cast<size_t>(st.st_size);
+  void *mem = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mem == MAP_FAILED) {
+    ::close(fd);
+    return nullptr;
+  }
+  auto *base = static_cast<char *>(mem);
+  const auto *header = header_of(base);
+  if (header->magic != kShmMagic ||
+      header->capacity != total - kShmDataOffset) {
+    munmap(mem, total);
+    ::close(fd);
+    return nullptr;
+  }
+  return std::unique_ptr<ShmRing>(new ShmRing(fd, base, header->capacity));
+}
+
+ShmRing::ShmRing(int fd, char *base, size_t capacity)
+    : fd_(fd), base_(base), capacity_(capacity) {}
+
+ShmRing::~ShmRing() {
+  munmap(base_, kShmDataOffset + capacity_);
+  ::close(fd_);
+}
+
+uint64_t ShmRing::head() const {
+  return header_of(base_)->head.load(std::memory_order_acquire);
+}
+
+void ShmRing::write(const std::string &block_id, const std::string &type,
+                    const std::string &data, uint64_t seq) {
+  auto *header = header_of(base_);
+  char *data_area = base_ + kShmDataOffset;
+
+  ShmRecordHeader record{};
+  record.kind = kShmRecordOutput;
+  record.block_id_len =
+      static_cast<uint8_t>(std::min<size_t>(block_id.size(), UINT8_MAX));
+  record.type_len =
+      static_cast<uint8_t>(std::min<size_t>(type.size(), UINT8_MAX));
+  record.seq = seq;
+  size_t fixed = sizeof(record) + record.block_id_len + record.type_len;
+  size_t need = align8(fixed + data.size());
+  if (need > capacity_ / 2) {
+    // Would evict most of the ring: leave a marker instead
+    record.kind = kShmRecordSkipped;
+    need = align8(fixed);
+  } else {
+    record.data_len = static_cast<uint32_t>(data.size());
+  }
+  record.size = static_cast<uint32_t>(need);
+
+  uint64_t head = header->head.load(std::memory_order_relaxed);
+  size_t offset = head & (capacity_ - 1);
+  size_t room = capacity_ - offset;
+  uint64_t end = head + need + (need > room ? room : 0);
+
+  header->reserve.store(end, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  if (need > room) {
+    if (room >= sizeof(ShmRecordHeader)) {
+      ShmRecordHeader padding{};
+      padding.size = static_cast<uint32_t>(room);
+      padding.kind = kShmRecordPadding;
+      memcpy(data_area + offset, &padding, sizeof(padding));
+    }
+    offset = 0;
+  }
+
+  char *out = data_area + offset;
+  memcpy(out, &record, sizeof(record));
+  out += sizeof(record);
+  memcpy(out, block_id.data(), record.block_id_len);
+  out += record.block_id_len;
+  memcpy(out, type.data(), record.type_len);
+  out += record.type_len;
+  memcpy(out, data.data(), record.data_len);
+
+  header->head.store(end, std::memory_order_release);
+}
+
+int ShmRing::dup_reader_fd() const {
+  // Reopening through /proc gives a read-only description of the same file
+  std::string path = "/proc/self/fd/" + std::to_string(fd_);
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    fd = fcntl(fd_, F_DUPFD_CLOEXEC, 0);
+  return fd;
+}
+
+ShmRingReader::ShmRingReader(int fd) {
+  struct stat st;
+  if (fstat(fd, &st) < 0 ||
+      static_cast<size_t>(st.st_size) < kShmDataOffset + kMinCapacity)
+    return;
+  void *mem = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (mem == MAP_FAILED)
+    return;
+
+  const auto *header = header_of(static_cast<const char *>(mem));
+  if (header->magic != kShmMagic || header->version != 1 ||
+      kShmDataOffset + header->capacity > static_cast<size_t>(st.st_size)) {
+    munmap(mem, st.st_size);
+    return;
+  }
+  base_ = static_cast<const char *>(mem);
+  mapped_ = st.st_size;
+  capacity_ = header->capacity;
+  tail_ = header->head.load(std::memory_order_acquire);
+}
+
+ShmRingReader::~ShmRingReader() {
+  if (base_)
+    munmap(const_cast<char *>(base_), mapped_);
+}
+
+ShmRingReader::Status ShmRingReader::next(Record &record) {
+  const auto *header = header_of(base_);
+  const char *data_area = base_ + kShmDataOffset;
+
+  while (true) {
+    uint64_t head = header->head.load(std::memory_order_acquire);
+    if (tail_ == head)
+      return Status::Empty;
+    if (head - tail_ > capacity_) {
+      tail_ = head;
+      return Status::Overrun;
+    }
+
+    size_t offset = tail_ & (capacity_ - 1);
+    size_t room = capacity_ - offset;
+    if (room < sizeof(ShmRecordHeader)) {
+      tail_ += room;
+      continue;
+    }
+
+    ShmRecordHeader h;
+    memcpy(&h, data_area + offset, sizeof(h));
+    size_t strings = size_t{h.block_id_len} + h.type_len;
+    bool sane = h.size >= sizeof(h) && h.size <= room &&
+                sizeof(h) + strings + h.data_len <= h.size;
+    if (sane && h.kind == kShmRecordPadding) {
+      tail_ += h.size;
+      continue;
+    }
+    if (sane) {
+      const char *in = data_area + offset + sizeof(h);
+      record.kind = static_cast<ShmRecordKind>(h.kind);
+      record.block_id.assign(in, h.block_id_len);
+      in += h.block_id_len;
+      record.type.assign(in, h.type_len);
+      in += h.type_len;
+      record.data.assign(in, h.data_len);
+      record.seq = h.seq;
+    }
+
+    // Did the writer start overwriting the record while we copied it?
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t reserve = header->reserve.load(std::memory_order_relaxed);
+    if (!sane || reserve - tail_ > capacity_) {
+      tail_ = header->head.load(std::memory_order_acquire);
+      return Status::Overrun;
+    }
+    tail_ += h.size;
+    return Status::Record;
+  }
+}
+
+std::shared_ptr<ShmChannelTable::Channel>
+ShmChannelTable::open(uint64_t client_id, const std::string &session_id,
+                      const std::string &block_id, size_t capacity) {
+  auto ring = ShmRing::create(capacity);
+  if (!ring)
+    return nullptr;
+
+  auto channel = std::make_shared<Channel>();
+  channel->client_id = client_id;
+  channel->session_id = session_id;
+  channel->block_id = block_id;
+  channel->ring = std::move(ring);
+
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  channel->id = next_id_++;
+  channels_[channel->id] = channel;
+  count_.store(channels_.size(), std::memory_order_relaxed);
+  return channel;
+}
+
+std::shared_ptr<ShmChannelTable::Channel>
+ShmChannelTable::close(uint64_t client_id, uint64_t channel_id) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  auto it = channels_.find(channel_id);
+  if (it == channels_.end() || it->second->client_id != client_id)
+    return nullptr;
+  auto channel = std::move(it->second);
+  channels_.erase(it);
+  count_.store(channels_.size(), std::memory_order_relaxed);
+  return channel;
+}
+
+void ShmChannelTable::remove_client(uint64_t client_id) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  for (auto it = channels_.begin(); it != channels_.end();) {
+    if (it->second->client_id == client_id)
+      it = channels_.erase(it);
+    else
+      ++it;
+  }
+  count_.store(channels_.size(), std::memory_order_relaxed);
+}
+
+void ShmChannelTable::write(const std::string &session_id,
+                            const std::string &block_id,
+                            const std::string &type, const std::string &data,
+                            uint64_t seq) {
+  if (empty())
+    return;
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  for (auto &[id, channel] : channels_) {
+    bool match = channel->block_id.empty()
+                     ? channel->session_id == session_id
+                     : channel->block_id == block_id;
+    if (!match)
+      continue;
+    std::lock_guard<std::mutex> write_lock(channel->write_mutex);
+    channel->ring->write(block_id, type, data, seq);
+  }
+}
+
+nlohmann::json ShmChannelTable::snapshot(std::vector<int> &fds) const {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  auto all = nlohmann::json::array();
+  for (const auto &[id, channel] : channels_) {
+    int fd = fcntl(channel->ring->fd(), F_DUPFD_CLOEXEC, 0);
+    if (fd < 0)
+      continue;
+    all.push_back({{"id", id},
+                   {"client_id", channel->client_id},
+                   {"session_id", channel->session_id},
+                   {"block_id", channel->block_id},
+                   {"fd", fds.size()}});
+    fds.push_back(fd);
+  }
+  return all;
+}
+
+void ShmChannelTable::restore(const nlohmann::json &snapshot,
+                              const std::vector<int> &fds) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  for (const auto &entry : snapshot) {
+    auto ring = ShmRing::adopt(fds.at(entry["fd"].get<size_t>()));
+    if (!ring)
+      continue;
+    auto channel = std::make_shared<Channel>();
+    channel->id = entry["id"];
+    channel->client_id = entry["client_id"];
+    channel->session_id = entry["session_id"];
+    channel->block_id = entry["block_id"];
+    channel->ring = std::move(ring);
+    next_id_ = std::max(next_id_, channel->id + 1);
+    channels_[channel->id] = std::move(channel);
+  }
+  count_.store(channels_.size(), std::memory_order_relaxed);
+}
+
+} // namespace si::rpc
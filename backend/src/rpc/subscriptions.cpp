@@ -0,0 +1,201 @@
+#include "si/rpc/subscriptions.hpp"
+#include <mutex>
+#include <stdexcept>
+
+namespace si::rpc {
+
+uint8_t parse_topics(const std::vector<std::string> &names) {
+  uint8_t topics = 0;
+  for (const auto &name : names) {
+    if (name == "output") {
+      topics |= kTopicOutput;
+    } else if (name == "complete") {
+      topics |= kTopicComplete;
+    } else if (name == "output_ready") {
+      topics |= kTopicOutputReady;
+    } else {
+      throw std::invalid_argument("Unknown event: " + name);
+    }
+  }
+  return topics;
+}
+
+void SubscriptionTable::subscribe_session(uint64_t client_id,
+                                          const std::string &session_id,
+                                          uint8_t topics) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  bool added = entries_.count(client_id) == 0;
+  if (!sessions_[session_id].count(client_id))
+    entries_[client_id]++;
+  add(sessions_, session_id, client_id, topics);
+  if (added)
+    update_filtered();
+}
+
+void SubscriptionTable::subscribe_block(uint64_t client_id,
+                                        const std::string &block_id,
+                                        uint8_t topics) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  bool added = entries_.count(client_id) == 0;
+  if (!blocks_[block_id].count(client_id))
+    entries_[client_id]++;
+  add(blocks_, block_id, client_id, topics);
+  if (added)
+    update_filtered();
+}
+
+void SubscriptionTable::unsubscribe_session(uint64_t client_id,
+                                            const std::string &session_id,
+                                            uint8_t topics) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  auto it = sessions_.find(session_id);
+  if (it == sessions_.end() || !it->second.count(client_id))
+    return;
+  remove(sessions_, session_id, client_id, topics);
+  it = sessions_.find(session_id);
+  if (it == sessions_.end() || !it->second.count(client_id))
+    entries_[client_id]--;
+}
+
+void SubscriptionTable::unsubscribe_block(uint64_t client_id,
+                                          const std::string &block_id,
+                                          uint8_t topics) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  auto it = blocks_.find(block_id);
+  if (it == blocks_.end() || !it->second.count(client_id))
+    return;
+  remove(blocks_, block_id, client_id, topics);
+  it = blocks_.find(block_id);
+  if (it == blocks_.end() || !it->second.count(client_id))
+    entries_[client_id]--;
+}
+
+void SubscriptionTable::remove_client(uint64_t client_id) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  for (auto *map : {&sessions_, &blocks_}) {
+    for (auto it = map->begin(); it != map->end();) {
+      it->second.erase(client_id);
+      it = it->second.empty() ? map->erase(it) : std::next(it);
+    }
+  }
+  for (auto it = held_.begin(); it != held_.end();) {
+    it->second.erase(client_id);
+    it = it->second.empty() ? held_.erase(it) : std::next(it);
+  }
+  if (entries_.erase(client_id))
+    update_filtered();
+}
+
+void SubscriptionTable::hold_output(uint64_t client_id,
+                                    const std::string &block_id) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  held_[block_id][client_id]++;
+}
+
+void SubscriptionTable::release_output(uint64_t client_id,
+                                       const std::string &block_id) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  auto it = held_.find(block_id);
+  if (it == held_.end())
+    return;
+  auto client_it = it->second.find(client_id);
+  if (client_it != it->second.end() && --client_it->second == 0)
+    it->second.erase(client_it);
+  if (it->second.empty())
+    held_.erase(it);
+}
+
+nlohmann::json SubscriptionTable::snapshot() const {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  auto all = nlohmann::json::array();
+  for (const auto &[kind, map] :
+       {std::make_pair("session", &sessions_), {"block", &blocks_}}) {
+    for (const auto &[key, clients] : *map) {
+      for (const auto &[client_id, topics] : clients)
+        all.push_back({client_id, kind, key, topics});
+    }
+  }
+  return all;
+}
+
+void SubscriptionTable::restore(const nlohmann::json &snapshot) {
+  for (const auto &entry : snapshot) {
+    auto client_id = entry[0].get<uint64_t>();
+    auto key = entry[2].get<std::string>();
+    auto topics = entry[3].get<uint8_t>();
+    if (entry[1] == "session")
+      subscribe_session(client_id, key, topics);
+    else
+      subscribe_block(client_id, key, topics);
+  }
+}
+
+SubscriptionTable::Route
+SubscriptionTable::route(const EventScope &scope) const {
+  Route route;
+  route.opt_in = (scope.topic & kTopicAll) == 0;
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  if (!held_.empty() && (scope.topic & kTopicOutput)) {
+    auto it = held_.find(scope.block_id);
+    if (it != held_.end()) {
+      for (const auto &[client_id, count] : it->second)
+        route.held.insert(client_id);
+    }
+  }
+  // Nobody subscribed: every client gets the event, or none if opt-in
+  if (entries_.empty())
+    return route;
+
+  // A client that unsubscribed from everything stays filtered: it opted in
+  // to routing and asked for nothing.
+  route.filtered = filtered_;
+  collect(sessions_, scope.session_id, scope.topic, route.recipients);
+  collect(blocks_, scope.block_id, scope.topic, route.recipients);
+  return route;
+}
+
+void SubscriptionTable::update_filtered() {
+  if (entries_.empty()) {
+    filtered_.reset();
+    return;
+  }
+  auto filtered = std::make_shared<ClientSet>();
+  for (const auto &[client_id, count] : entries_)
+    filtered->insert(client_id);
+  filtered_ = std::move(filtered);
+}
+
+void SubscriptionTable::add(TopicMap &map, const std::string &key,
+                            uint64_t client_id, uint8_t topics) {
+  map[key][client_id] |= topics;
+}
+
+void SubscriptionTable::remove(TopicMap &map, const std::string &key,
+                               uint64_t client_id, uint8_t topics) {
+  auto it = map.find(key);
+  if (it == map.end())
+    return;
+  auto client_it = it->second.find(client_id);
+  if (client_it == it->second.end())
+    return;
+  client_it->second &= static_cast<uint8_t>(~topics);
+  if (client_it->second == 0)
+    it->second.erase(client_it);
+  if (it->second.empty())
+    map.erase(it);
+}
+
+void SubscriptionTable::collect(const TopicMap &map, const std::string &key,
+                                EventTopic topic, ClientSet &out) {
+  if (key.empty())
+    return;
+  auto it = map.find(key);
+  if (it == map.end())
+    return;
+  for (const auto &[client_id, topics] : it->second) {
+    if (topics & topic)
+      out.insert(client_id);
+  }
+}
+
+} // namespace si::rpc
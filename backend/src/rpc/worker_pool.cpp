@@ -0,0 +1,153 @@
+#include "si/rpc/worker_pool.hpp"
+#include "si/foundation/logging.hpp"
+#include <algorithm>
+#include <tuple>
+
+namespace si::rpc {
+
+WorkerPool::WorkerPool(std::string name, size_t threads, bool serial)
+    : name_(std::move(name)), thread_count_(threads > 0 ? threads : 1),
+      serial_(serial) {}
+
+WorkerPool::~WorkerPool() { stop(); }
+
+void WorkerPool::start() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!threads_.empty())
+    return;
+  stopping_ = false;
+  for (size_t i = 0; i < thread_count_; ++i) {
+    threads_.emplace_back([this]() { worker_loop(); });
+  }
+  SI_LOG_DEBUG("WorkerPool '{}': started {} threads", name_, thread_count_);
+}
+
+void WorkerPool::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (threads_.empty())
+      return;
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  for (auto &t : threads_) {
+    if (t.joinable())
+      t.join();
+  }
+  threads_.clear();
+}
+
+bool WorkerPool::submit(Task task, uint64_t flow, unsigned weight) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_ || threads_.empty())
+      return false;
+    auto &f = flows_[flow];
+    weight = std::max(weight, 1u);
+    if (f.tasks.empty())
+      f.weight = 0; // new flow: idle ones are erased, running ones reset
+    weights_ = weights_ - f.weight + weight;
+    f.weight = weight;
+    // A flow that was idle starts from now, not from its old backlog
+    double start = std::max(virtual_time_, f.finish);
+    f.finish = start + 1.0 / weight;
+    f.tasks.emplace_back(start, std::move(task));
+    if (f.tasks.size() == 1 && !f.running)
+      ready_.emplace(start, flow);
+    queued_++;
+  }
+  cv_.notify_one();
+  return true;
+}
+
+size_t WorkerPool::queued() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return queued_;
+}
+
+size_t WorkerPool::queued(uint64_t flow) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = flows_.find(flow);
+  return it != flows_.end() ? it->second.tasks.size() : 0;
+}
+
+size_t WorkerPool::flows() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t count = 0;
+  for (const auto &[id, f] : flows_)
+    count += f.tasks.empty() ? 0 : 1;
+  return count;
+}
+
+bool WorkerPool::over_share(uint64_t flow, size_t limit) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (queued_ < limit)
+    return false;
+  auto it = flows_.find(flow);
+  if (it == flows_.end() || it->second.tasks.empty())
+    return false;
+  // queued(flow) / queued_ >= weight / weights_
+  return it->second.tasks.size() * weights_ >= queued_ * it->second.weight;
+}
+
+void WorkerPool::worker_loop() {
+  while (true) {
+    Task task;
+    uint64_t flow;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this]() { return stopping_ || !ready_.empty(); });
+      // Stopping and drained, or what is left waits for a running task
+      // whose thread picks it up next
+      if (ready_.empty())
+        return;
+      // The flow whose next task has the smallest start tag
+      double start;
+      std::tie(start, flow) = *ready_.begin();
+      ready_.erase(ready_.begin());
+      auto it = flows_.find(flow);
+      auto &f = it->second;
+      task = std::move(f.tasks.front().second);
+      f.tasks.pop_front();
+      queued_--;
+      virtual_time_ = start;
+      f.running = serial_;
+      if (f.tasks.empty()) {
+        weights_ -= f.weight;
+        f.weight = 0;
+      }
+      // An idle flow is forgotten; when it comes back it starts from the
+      // current virtual time anyway
+      if (!f.running && !f.tasks.empty())
+        ready_.emplace(f.tasks.front().first, flow);
+      else if (!f.running)
+        flows_.erase(it);
+    }
+
+    try {
+      task();
+    } catch (const std::exception &e) {
+      SI_LOG_ERROR("WorkerPool '{}': task threw: {}", name_, e.what());
+    }
+
+    if (serial_)
+      finish(flow);
+  }
+}
+
+void WorkerPool::finish(uint64_t flow) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = flows_.find(flow);
+    auto &f = it->second;
+    f.running = false;
+    if (f.tasks.empty()) {
+      flows_.erase(it);
+      return;
+    }
+    ready_.emplace(f.tasks.front().first, flow);
+  }
+  cv_.notify_one();
+}
+
+} // namespace si::rpc
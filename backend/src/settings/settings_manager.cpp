@@ -67,6 +67,7 @@ void SettingsManager::set_category(const std::string &category,
 
   // Update cache
   cache_[category] = data;
+  version_.fetch_add(1, std::memory_order_release);
 
   // Save to disk
   auto path = get_file_path(category);
@@ -82,6 +83,7 @@ void SettingsManager::set_category(const std::string &category,
 void SettingsManager::reset_category(const std::string &category) {
   std::lock_guard<std::mutex> lock(mutex_);
   cache_.erase(category);
+  version_.fetch_add(1, std::memory_order_release);
 
   auto path = get_file_path(category);
   if (std::filesystem::exists(path)) {
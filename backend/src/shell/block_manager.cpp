@@ -1,8 +1,10 @@
 #include "si/shell/block_manager.hpp"
+#include "si/foundation/config.hpp"
 #include "si/foundation/logging.hpp"
 #include "si/foundation/platform.hpp"
+#include "si/foundation/utf8.hpp"
+#include <algorithm>
 #include <filesystem>
-#include <fstream>
 #include <iomanip>
 #include <si/nlohmann/json.hpp>
 #include <random>
@@ -21,6 +23,27 @@ std::filesystem::path get_sessions_file_path() {
   }
   return data_dir / "sessions.json";
 }
+
+// Changes made since sessions.json was written
+std::filesystem::path get_log_file_path() {
+  return get_sessions_file_path().parent_path() / "sessions.wal";
+}
+
+std::filesystem::path get_store_file_path() {
+  return get_sessions_file_path().parent_path() / "blocks.db";
+}
+
+// Versions are handed out in order but may be stored out of order: keep the
+// highest, so a reader that sees a version sees every change numbered
+// up to it
+void raise_version(std::atomic<uint64_t> &version, uint64_t to) {
+  uint64_t current = version.load(std::memory_order_relaxed);
+  while (current < to &&
+         !version.compare_exchange_weak(current, to,
+                                        std::memory_order_release,
+                                        std::memory_order_relaxed)) {
+  }
+}
 } // anonymous namespace
 
 BlockManager &BlockManager::instance() {
@@ -30,7 +53,25 @@ BlockManager &BlockManager::instance() {
   return inst;
 }
 
-BlockManager::BlockManager() { load_sessions(); }
+BlockManager::BlockManager() {
+  auto backend = si::foundation::Config::instance().get_blocks_store();
+  if (backend == "sqlite") {
+    auto store = std::make_unique<BlockStore>(get_store_file_path());
+    if (store->open()) {
+      store_ = std::move(store);
+      // Carry over what was kept before the store was switched on
+      if (store_->created())
+        import_into_store();
+    } else
+      SI_LOG_ERROR("Could not open the block store, using the session log");
+  } else if (backend != "log") {
+    SI_LOG_WARN("Unknown blocks.store '{}', using the session log", backend);
+  }
+  if (!store_)
+    log_ = std::make_unique<SessionLog>(get_log_file_path(),
+                                        get_sessions_file_path());
+  load_sessions();
+}
 
 // ... uuid gen ...
 
@@ -69,32 +110,38 @@ std::string BlockManager::generate_uuid() {
 
 BlockManager::SessionContext &
 BlockManager::get_session_context(const std::string &session_id) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  return sessions_[session_id];
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  return session_entry(session_id);
 }
 
 void BlockManager::set_session_cwd(const std::string &session_id,
                                    const std::string &cwd) {
-  std::lock_guard<std::mutex> lock(mutex_);
+  std::unique_lock<std::shared_mutex> lock(mutex_);
   // SI_LOG_INFO("[set_session_cwd] Updating CWD: {}", cwd);
-  sessions_[session_id].cwd = cwd;
+  session_entry(session_id).cwd = cwd;
+  log_session(session_id);
 }
 
 std::pair<std::string, std::string>
 BlockManager::get_session_config_copy(const std::string &session_id) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  auto &ctx = sessions_[session_id];
-  return {ctx.cwd, ctx.shell};
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  auto it = sessions_.find(session_id);
+  if (it == sessions_.end()) {
+    SessionContext defaults;
+    return {defaults.cwd, defaults.shell};
+  }
+  return {it->second.cwd, it->second.shell};
 }
 
 void BlockManager::set_session_shell(const std::string &session_id,
                                      const std::string &shell) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  sessions_[session_id].shell = shell;
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  session_entry(session_id).shell = shell;
+  log_session(session_id);
 }
 
 std::string BlockManager::create_session(const std::string &name) {
-  std::lock_guard<std::mutex> lock(mutex_);
+  std::unique_lock<std::shared_mutex> lock(mutex_);
   std::string id = generate_uuid();
   sessions_[id].name = name;
   try {
@@ -103,23 +150,18 @@ std::string BlockManager::create_session(const std::string &name) {
     sessions_[id].cwd = "/";
   }
   sessions_[id].shell = "/bin/bash"; // Default shell
+  bump_sessions_version();
   SI_LOG_INFO("Created Session: {} [{}]", id, name);
-  save_sessions_internal();
+  log_session(id);
   return id;
 }
 
 std::vector<std::pair<std::string, std::string>> BlockManager::list_sessions() {
-  std::lock_guard<std::mutex> lock(mutex_);
-
-  // Identify which sessions have blocks
-  std::set<std::string> session_with_blocks;
-  for (const auto &[id, b] : blocks_) {
-    session_with_blocks.insert(b.session_id);
-  }
+  std::shared_lock<std::shared_mutex> lock(mutex_);
 
   std::vector<std::pair<std::string, std::string>> result;
   for (const auto &[id, ctx] : sessions_) {
-    bool has_blocks = session_with_blocks.count(id) > 0;
+    bool has_blocks = sessions_with_blocks_.count(id) > 0;
     bool is_renamed = ctx.name != "New Session";
 
     if (has_blocks || is_renamed) {
@@ -130,27 +172,30 @@ std::vector<std::pair<std::string, std::string>> BlockManager::list_sessions() {
 }
 
 void BlockManager::delete_session(const std::string &session_id) {
-  std::lock_guard<std::mutex> lock(mutex_);
+  std::unique_lock<std::shared_mutex> lock(mutex_);
   sessions_.erase(session_id);
+  bump_sessions_version();
   // Optional: delete blocks associated with session?
   // blocks_.erase_if... but for now keeping history might be safer or separate
   // cleanup
-  save_sessions_internal();
+  log_internal({{"op", "session_deleted"}, {"id", session_id}});
 }
 
 void BlockManager::rename_session(const std::string &session_id,
                                   const std::string &name) {
-  std::lock_guard<std::mutex> lock(mutex_);
+  std::unique_lock<std::shared_mutex> lock(mutex_);
   if (sessions_.count(session_id)) {
     sessions_[session_id].name = name;
-    save_sessions_internal();
+    bump_sessions_version();
+    log_session(session_id);
   }
 }
 
 std::string BlockManager::create_block(const std::string &session_id,
                                        const std::string &command,
                                        const std::string &cwd) {
-  std::lock_guard<std::mutex> lock(mutex_);
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  retire_committed();
 
   std::string id = generate_uuid();
   Block b;
@@ -158,9 +203,11 @@ std::string BlockManager::create_block(const std::string &session_id,
   b.session_id = session_id;
   b.command = command;
 
-  // Use session's CWD if none provided
+  // Use session's CWD if none provided. The session is created here if
+  // it is new: reading its config does not create it.
+  auto &context = session_entry(session_id);
   if (cwd.empty()) {
-    b.cwd = sessions_[session_id].cwd;
+    b.cwd = context.cwd;
   } else {
     b.cwd = cwd;
     // CRITICAL FIX: Do NOT overwrite session CWD with block CWD.
@@ -176,26 +223,34 @@ std::string BlockManager::create_block(const std::string &session_id,
                      now.time_since_epoch())
                      .count();
 
-  blocks_[id] = b;
-
   SI_LOG_INFO("Created Block: {} [{}] in {}", id, command, b.cwd);
-  save_sessions_internal();
+  nlohmann::json record = {{"op", "block"}, {"block", b}};
+  auto entry = add_entry(std::move(b));
+  sessions_with_blocks_.insert(session_id);
+  auto &session = session_blocks_[session_id];
+  if (!store_) {
+    // Copy and replace: readers keep the list they took
+    auto list = std::make_shared<BlockList>(*session.blocks);
+    auto pos = std::upper_bound(
+        list->begin(), list->end(), entry->info->start_time,
+        [](int64_t t, const auto &e) { return t < e->info->start_time; });
+    list->insert(pos, entry);
+    session.blocks = std::move(list);
+  }
+  // The session may now have its first block, which makes it listed
+  bump_sessions_version();
+  bump_blocks_version(session_id);
+  log_internal(std::move(record));
   return id;
 }
 
 void BlockManager::append_output(const std::string &block_id,
                                  const std::string &data,
                                  const std::string &type) {
-  std::lock_guard<std::mutex> lock(mutex_);
-
-  std::string safe_data = data;
-  try {
-    // Validate UTF-8 by attempting to create AND serialize a JSON string.
-    nlohmann::json j = data;
-    j.dump();
-  } catch (const nlohmann::json::exception &) {
-    // If validation fails (e.g., binary output from 'cat pdf'), sanitize it.
-    std::string filtered;
+  // Output must serialize as a JSON string. If it is not valid UTF-8
+  // (e.g., binary output from 'cat pdf'), sanitize it.
+  std::string filtered;
+  if (!si::foundation::is_valid_utf8(data)) {
     filtered.reserve(data.size());
     for (unsigned char c : data) {
       if (c < 128) {
@@ -205,169 +260,484 @@ void BlockManager::append_output(const std::string &block_id,
         filtered += "?";
       }
     }
-    safe_data = filtered;
-  }
-
-  if (blocks_.count(block_id)) {
-    blocks_[block_id].add_output(safe_data, type);
-
-    // Notify
-    if (update_cb_) {
-      try {
-        // Need to construct chunk with timestamp we just made.
-        // Ideally add_output returns the chunk or we make it here.
-        auto &chunks = blocks_[block_id].output_chunks;
-        if (!chunks.empty())
-          update_cb_(block_id, chunks.back());
-      } catch (const std::exception &e) {
-        SI_LOG_ERROR("Failed to dispatch update callback: {}", e.what());
+  }
+  const std::string &safe_data = filtered.empty() ? data : filtered;
+
+  OutputChunk chunk;
+  chunk.data = safe_data;
+  chunk.type = type;
+  chunk.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::system_clock::now().time_since_epoch())
+                        .count();
+  std::string session_id;
+  BlockUpdateCallback cb;
+  {
+    // Shared: output of other blocks and readers go on meanwhile
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = blocks_.find(block_id);
+    if (it == blocks_.end())
+      return;
+    auto &entry = *it->second;
+    session_id = entry.info->session_id;
+    {
+      std::lock_guard<std::mutex> write_lock(entry.write_mutex);
+      chunk.seq = entry.output.size();
+      // In the log in the order of seq, like in the list
+      record_change({{"op", "output"},
+                     {"block_id", block_id},
+                     {"type", type},
+                     {"data", safe_data},
+                     {"ts", chunk.timestamp},
+                     {"seq", chunk.seq}});
+      if (update_cb_) {
+        cb = update_cb_;
+        entry.output.push_back(chunk);
+      } else {
+        entry.output.push_back(std::move(chunk));
       }
     }
+    bump_blocks_version(session_id);
+  }
+  compact_log();
+  if (!cb)
+    return;
+
+  // Notify without holding the lock so a slow subscriber cannot stall other
+  // blocks' output or readers
+  try {
+    cb(block_id, session_id, chunk);
+  } catch (const std::exception &e) {
+    SI_LOG_ERROR("Failed to dispatch update callback: {}", e.what());
   }
 }
 
 void BlockManager::complete_block(const std::string &block_id, int exit_code) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  if (blocks_.count(block_id)) {
-    auto &b = blocks_[block_id];
-    b.exit_code = exit_code;
-    b.state = (exit_code == 0) ? BlockState::COMPLETED : BlockState::FAILED;
+  std::string session_id;
+  BlockCompleteCallback cb;
+  {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    retire_committed();
+    auto it = blocks_.find(block_id);
+    if (it == blocks_.end())
+      return;
+    auto b = std::make_shared<Block>(*it->second->info);
+    b->exit_code = exit_code;
+    b->state = (exit_code == 0) ? BlockState::COMPLETED : BlockState::FAILED;
 
     auto now = std::chrono::system_clock::now();
-    b.end_time = std::chrono::duration_cast<std::chrono::milliseconds>(
-                     now.time_since_epoch())
-                     .count();
+    b->end_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      now.time_since_epoch())
+                      .count();
 
     SI_LOG_INFO("Block Complete: {} [Code: {}]", block_id, exit_code);
-    save_sessions_internal();
+    nlohmann::json record = {{"op", "complete"},
+                             {"block_id", block_id},
+                             {"exit_code", exit_code},
+                             {"end_time", b->end_time}};
+    // Readers that hold the entry see it complete, with all its output
+    session_id = b->session_id;
+    std::atomic_store(&it->second->info,
+                      std::shared_ptr<const Block>(std::move(b)));
+    bump_blocks_version(session_id);
+    log_internal(std::move(record));
+
+    cb = complete_cb_;
+    // Read back from the store once the completion is committed
+    if (store_)
+      retiring_.emplace_back(store_->queued(), block_id);
+  }
 
-    if (complete_cb_) {
-      complete_cb_(block_id, b.session_id, exit_code);
-    }
+  if (cb) {
+    cb(block_id, session_id, exit_code);
   }
 }
 
+Block BlockManager::copy_block(const Entry &entry) {
+  // State first: a completed block has all its output in the list
+  Block b = *std::atomic_load(&entry.info);
+  b.output_chunks = entry.output.copy(0, entry.output.size());
+  return b;
+}
+
 std::optional<Block> BlockManager::get_block(const std::string &block_id) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  if (blocks_.count(block_id)) {
-    return blocks_[block_id];
+  std::shared_ptr<const Entry> entry;
+  {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = blocks_.find(block_id);
+    if (it != blocks_.end())
+      entry = it->second;
+    else if (!store_)
+      return std::nullopt;
   }
-  return std::nullopt;
+  if (entry)
+    return copy_block(*entry);
+  // Finished: its completion was committed before it left blocks_
+  return store_->block(block_id);
+}
+
+std::optional<BlockManager::OutputTail>
+BlockManager::get_output_since(const std::string &block_id,
+                               uint64_t since_seq) {
+  std::shared_ptr<const Entry> entry;
+  {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = blocks_.find(block_id);
+    if (it != blocks_.end())
+      entry = it->second;
+    else if (!store_)
+      return std::nullopt;
+  }
+  if (entry) {
+    auto info = std::atomic_load(&entry->info);
+    uint64_t next_seq = entry->output.size();
+    // Chunk seq is its index in the list
+    return OutputTail{info->session_id, info->state, info->exit_code,
+                      next_seq, entry->output.copy(since_seq, next_seq)};
+  }
+  auto b = store_->block(block_id, since_seq);
+  if (!b)
+    return std::nullopt;
+  return OutputTail{b->session_id, b->state, b->exit_code,
+                    store_->output_count(block_id),
+                    std::move(b->output_chunks)};
+}
+
+void BlockManager::retire_committed() {
+  if (retiring_.empty())
+    return;
+  uint64_t written = store_->written();
+  while (!retiring_.empty() && retiring_.front().first <= written) {
+    blocks_.erase(retiring_.front().second);
+    retiring_.pop_front();
+  }
+}
+
+uint64_t BlockManager::blocks_version(const std::string &session_id) {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  auto it = session_blocks_.find(session_id);
+  return it == session_blocks_.end()
+             ? 0
+             : it->second.version.load(std::memory_order_acquire);
+}
+
+void BlockManager::bump_sessions_version() {
+  raise_version(sessions_version_, next_version_++);
+}
+
+void BlockManager::bump_blocks_version(const std::string &session_id) {
+  auto it = session_blocks_.find(session_id);
+  if (it != session_blocks_.end())
+    raise_version(it->second.version, next_version_++);
+}
+
+BlockManager::SessionContext &
+BlockManager::session_entry(const std::string &session_id) {
+  auto [it, inserted] = sessions_.try_emplace(session_id);
+  if (inserted) {
+    bump_sessions_version();
+    log_session(session_id);
+  }
+  return it->second;
+}
+
+std::shared_ptr<BlockManager::Entry> BlockManager::add_entry(Block block) {
+  auto entry = std::make_shared<Entry>();
+  for (auto &chunk : block.output_chunks)
+    entry->output.push_back(std::move(chunk));
+  block.output_chunks.clear();
+  entry->info = std::make_shared<const Block>(std::move(block));
+  blocks_[entry->info->id] = entry;
+  return entry;
 }
 
 std::vector<Block> BlockManager::list_blocks(const std::string &session_id) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  std::vector<Block> result;
-  for (const auto &[id, block] : blocks_) {
-    if (block.session_id == session_id) {
-      result.push_back(block);
+  if (store_) {
+    // The committed rows, with the blocks still in memory (running, or
+    // finished but not committed) taken from memory instead. Memory is
+    // looked at first: a block that leaves it meanwhile is committed.
+    std::vector<std::shared_ptr<const Entry>> live;
+    {
+      std::shared_lock<std::shared_mutex> lock(mutex_);
+      for (const auto &[id, entry] : blocks_) {
+        if (entry->info->session_id == session_id)
+          live.push_back(entry);
+      }
+    }
+    auto result = store_->session_blocks(session_id);
+    if (live.empty())
+      return result;
+    std::map<std::string, size_t> rows;
+    for (size_t i = 0; i < result.size(); i++)
+      rows[result[i].id] = i;
+    for (const auto &entry : live) {
+      auto it = rows.find(entry->info->id);
+      if (it != rows.end())
+        result[it->second] = copy_block(*entry);
+      else
+        result.push_back(copy_block(*entry));
     }
+    std::stable_sort(result.begin(), result.end(),
+                     [](const Block &a, const Block &b) {
+                       return a.start_time < b.start_time;
+                     });
+    return result;
   }
-  // Sorting by start_time? Map is vaguely ordered by ID not time.
-  // Should sort.
-  std::sort(result.begin(), result.end(), [](const Block &a, const Block &b) {
-    return a.start_time < b.start_time;
-  });
+  std::shared_ptr<const BlockList> list;
+  {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = session_blocks_.find(session_id);
+    if (it == session_blocks_.end())
+      return {};
+    list = it->second.blocks;
+  }
+  std::vector<Block> result;
+  result.reserve(list->size());
+  for (const auto &entry : *list)
+    result.push_back(copy_block(*entry));
   return result;
 }
 
 void BlockManager::save_sessions() {
-  std::lock_guard<std::mutex> lock(mutex_);
-  save_sessions_internal();
-}
-
-void BlockManager::save_sessions_internal() {
-  nlohmann::json j;
-  j["sessions"] = nlohmann::json::array();
-  j["blocks"] = nlohmann::json::array();
-
-  // 1. Identify which sessions have blocks
-  std::set<std::string> session_with_blocks;
-  for (const auto &[id, b] : blocks_) {
-    session_with_blocks.insert(b.session_id);
+  if (store_) {
+    store_->flush();
+    return;
   }
+  {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    log_->snapshot(snapshot_internal());
+  }
+  log_->flush();
+}
 
-  // 2. Only save sessions that are non-empty or have been renamed (Spec
+SessionLog::Builder BlockManager::snapshot_internal() {
+  // Only what is cheap to take is taken here: the sessions and their
+  // immutable block lists. The blocks are serialized on the log's writer
+  // thread, as of then; replaying records they already hold does nothing.
+  struct SavedSession {
+    std::string id;
+    SessionContext ctx;
+    std::shared_ptr<const BlockList> blocks;
+  };
+  auto saved = std::make_shared<std::vector<SavedSession>>();
+
+  // 1. Only save sessions that are non-empty or have been renamed (Spec
   // requirement)
-  std::set<std::string> saved_session_ids;
   for (const auto &[id, ctx] : sessions_) {
-    bool has_blocks = session_with_blocks.count(id) > 0;
+    bool has_blocks = sessions_with_blocks_.count(id) > 0;
     bool is_renamed = ctx.name != "New Session";
 
     if (has_blocks || is_renamed) {
-      nlohmann::json s;
-      s["id"] = id;
-      s["name"] = ctx.name;
-      s["cwd"] = ctx.cwd;
-      s["shell"] = ctx.shell;
-      j["sessions"].push_back(s);
-      saved_session_ids.insert(id);
+      auto it = session_blocks_.find(id);
+      saved->push_back({id, ctx,
+                        it != session_blocks_.end()
+                            ? it->second.blocks
+                            : std::make_shared<const BlockList>()});
     }
   }
 
-  // 3. Only save blocks belonging to saved sessions
-  for (const auto &[id, b] : blocks_) {
-    if (saved_session_ids.count(b.session_id) > 0) {
-      nlohmann::json blk;
-      blk = b; // Uses to_json from block.hpp
-      j["blocks"].push_back(blk);
+  return [saved]() {
+    nlohmann::json j;
+    j["sessions"] = nlohmann::json::array();
+    j["blocks"] = nlohmann::json::array();
+    for (const auto &session : *saved) {
+      j["sessions"].push_back({{"id", session.id},
+                               {"name", session.ctx.name},
+                               {"cwd", session.ctx.cwd},
+                               {"shell", session.ctx.shell}});
+      // 2. Only save blocks belonging to saved sessions
+      for (const auto &entry : *session.blocks)
+        j["blocks"].push_back(copy_block(*entry)); // to_json from block.hpp
     }
-  }
+    return j;
+  };
+}
 
-  auto sessions_path = get_sessions_file_path();
-  std::ofstream o(sessions_path);
-  o << j.dump(2) << std::endl;
+void BlockManager::log_internal(nlohmann::json record) {
+  record_change(std::move(record));
+  // Snapshots get rarer as the state grows, so this stays O(1) amortized
+  if (log_ && log_->wants_snapshot())
+    log_->snapshot(snapshot_internal());
 }
 
-void BlockManager::load_sessions() {
-  std::lock_guard<std::mutex> lock(mutex_);
-  auto sessions_path = get_sessions_file_path();
-  if (!std::filesystem::exists(sessions_path))
+void BlockManager::record_change(nlohmann::json record) {
+  if (store_)
+    store_->append(std::move(record));
+  else
+    log_->append(std::move(record));
+}
+
+void BlockManager::compact_log() {
+  if (!log_ || !log_->wants_snapshot())
     return;
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  if (log_->wants_snapshot())
+    log_->snapshot(snapshot_internal());
+}
 
-  try {
-    std::ifstream i(sessions_path);
-    if (!i.is_open())
-      return;
+void BlockManager::log_session(const std::string &session_id) {
+  const auto &ctx = sessions_[session_id];
+  log_internal({{"op", "session"},
+                {"id", session_id},
+                {"name", ctx.name},
+                {"cwd", ctx.cwd},
+                {"shell", ctx.shell}});
+}
 
-    nlohmann::json j;
-    i >> j;
-
-    sessions_.clear();
-    if (j.contains("sessions")) {
-      for (const auto &s : j["sessions"]) {
-        SessionContext ctx;
-        std::string id = s.value("id", "");
-        if (id.empty())
-          continue;
-        ctx.name = s.value("name", "Default");
-        ctx.cwd = s.value("cwd", ".");
-        ctx.shell = s.value("shell", "/bin/bash");
-        sessions_[id] = ctx;
-      }
+void BlockManager::load_sessions() {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  sessions_.clear();
+  blocks_.clear();
+  retiring_.clear();
+  sessions_with_blocks_.clear();
+
+  bool fold = false;
+  if (store_) {
+    // Whatever is still queued belongs in what is read back
+    store_->flush();
+    for (auto &session : store_->sessions())
+      sessions_[session.id] = {session.cwd, session.shell, session.name};
+    for (auto &id : store_->sessions_with_blocks()) {
+      if (sessions_.count(id))
+        sessions_with_blocks_.insert(id);
     }
-
-    blocks_.clear();
-    if (j.contains("blocks")) {
-      for (const auto &blk : j["blocks"]) {
-        Block b = blk.get<Block>(); // Uses from_json
-        blocks_[b.id] = b;
+    for (auto &b : store_->blocks_in_state(BlockState::RUNNING))
+      add_entry(std::move(b));
+  } else {
+    log_->flush();
+    size_t replayed = log_->recover(
+        [this](const nlohmann::json &j) { restore_snapshot(j); },
+        [this](const nlohmann::json &record) { apply_record(record); });
+    // Like a snapshot would, forget the blocks of sessions never recorded
+    for (auto it = blocks_.begin(); it != blocks_.end();) {
+      if (sessions_.count(it->second->info->session_id)) {
+        sessions_with_blocks_.insert(it->second->info->session_id);
+        ++it;
+      } else {
+        it = blocks_.erase(it);
       }
     }
+    fold = replayed > 0;
+  }
+
+  // Lists of the sessions' blocks, in the order create_block keeps them
+  std::map<std::string, BlockList> lists;
+  if (!store_) {
+    for (const auto &[id, entry] : blocks_)
+      lists[entry->info->session_id].push_back(entry);
+  }
+  for (auto &[id, list] : lists) {
+    std::stable_sort(list.begin(), list.end(),
+                     [](const auto &a, const auto &b) {
+                       return a->info->start_time < b->info->start_time;
+                     });
+  }
+  for (const auto &id : sessions_with_blocks_)
+    session_blocks_.try_emplace(id);
+  // Everything may have changed: move every version past what clients
+  // have seen
+  for (auto &[id, session] : session_blocks_) {
+    auto it = lists.find(id);
+    session.blocks = std::make_shared<BlockList>(
+        it == lists.end() ? BlockList{} : std::move(it->second));
+    raise_version(session.version, next_version_++);
+  }
+  bump_sessions_version();
+  // Start the next run from a snapshot again (of the lists above)
+  if (fold)
+    log_->snapshot(snapshot_internal());
+  if (store_)
+    SI_LOG_INFO("Loaded {} sessions and {} running blocks from the store",
+                sessions_.size(), blocks_.size());
+  else
     SI_LOG_INFO("Loaded {} sessions and {} blocks", sessions_.size(),
                 blocks_.size());
-  } catch (const std::exception &e) {
-    SI_LOG_ERROR("Failed to load sessions: {}", e.what());
+}
+
+void BlockManager::import_into_store() {
+  std::error_code ec;
+  if (!std::filesystem::exists(get_sessions_file_path(), ec) &&
+      !std::filesystem::exists(get_log_file_path(), ec))
+    return;
+  SessionLog log(get_log_file_path(), get_sessions_file_path());
+  log.recover([this](const nlohmann::json &j) { restore_snapshot(j); },
+              [this](const nlohmann::json &record) { apply_record(record); });
+  for (const auto &[id, ctx] : sessions_)
+    log_session(id);
+  for (const auto &[id, entry] : blocks_)
+    store_->append({{"op", "block"}, {"block", copy_block(*entry)}});
+  store_->flush();
+  SI_LOG_INFO("Imported {} sessions and {} blocks into the block store",
+              sessions_.size(), blocks_.size());
+  sessions_.clear();
+  blocks_.clear();
+}
+
+void BlockManager::restore_snapshot(const nlohmann::json &j) {
+  if (j.contains("sessions")) {
+    for (const auto &s : j["sessions"]) {
+      SessionContext ctx;
+      std::string id = s.value("id", "");
+      if (id.empty())
+        continue;
+      ctx.name = s.value("name", "Default");
+      ctx.cwd = s.value("cwd", ".");
+      ctx.shell = s.value("shell", "/bin/bash");
+      sessions_[id] = ctx;
+    }
+  }
+
+  if (j.contains("blocks")) {
+    for (const auto &blk : j["blocks"]) {
+      add_entry(blk.get<Block>()); // Uses from_json
+    }
+  }
+}
+
+void BlockManager::apply_record(const nlohmann::json &record) {
+  auto op = record.at("op").get<std::string>();
+  if (op == "session") {
+    auto &ctx = sessions_[record.at("id").get<std::string>()];
+    record.at("name").get_to(ctx.name);
+    record.at("cwd").get_to(ctx.cwd);
+    record.at("shell").get_to(ctx.shell);
+  } else if (op == "session_deleted") {
+    sessions_.erase(record.at("id").get<std::string>());
+  } else if (op == "block") {
+    add_entry(record.at("block").get<Block>());
+  } else if (op == "output") {
+    auto it = blocks_.find(record.at("block_id").get<std::string>());
+    if (it == blocks_.end())
+      return;
+    // A snapshot built after the record was logged has the chunk already
+    if (record.contains("seq") &&
+        record["seq"].get<uint64_t>() < it->second->output.size())
+      return;
+    OutputChunk chunk;
+    record.at("data").get_to(chunk.data);
+    record.at("type").get_to(chunk.type);
+    record.at("ts").get_to(chunk.timestamp);
+    it->second->output.push_back(std::move(chunk));
+  } else if (op == "complete") {
+    auto it = blocks_.find(record.at("block_id").get<std::string>());
+    if (it == blocks_.end())
+      return;
+    auto b = std::make_shared<Block>(*it->second->info);
+    record.at("exit_code").get_to(b->exit_code);
+    b->state =
+        (b->exit_code == 0) ? BlockState::COMPLETED : BlockState::FAILED;
+    record.at("end_time").get_to(b->end_time);
+    std::atomic_store(&it->second->info,
+                      std::shared_ptr<const Block>(std::move(b)));
   }
 }
 
 void BlockManager::set_update_callback(BlockUpdateCallback cb) {
-  std::lock_guard<std::mutex> lock(mutex_);
+  std::unique_lock<std::shared_mutex> lock(mutex_);
   update_cb_ = cb;
 }
 
 void BlockManager::set_complete_callback(BlockCompleteCallback cb) {
-  std::lock_guard<std::mutex> lock(mutex_);
+  std::unique_lock<std::shared_mutex> lock(mutex_);
   complete_cb_ = cb;
 }
 
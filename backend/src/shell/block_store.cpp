@@ -0,0 +1,433 @@
+#include "si/shell/block_store.hpp"
+#include "si/foundation/logging.hpp"
+#include <sqlite3.h>
+
+namespace si::shell {
+
+namespace {
+constexpr const char *kSchema = R"(
+CREATE TABLE IF NOT EXISTS sessions (
+  id TEXT PRIMARY KEY,
+  name TEXT NOT NULL,
+  cwd TEXT NOT NULL,
+  shell TEXT NOT NULL
+);
+CREATE TABLE IF NOT EXISTS blocks (
+  id TEXT PRIMARY KEY,
+  session_id TEXT NOT NULL,
+  command TEXT NOT NULL,
+  cwd TEXT NOT NULL,
+  env TEXT NOT NULL,
+  start_time INTEGER NOT NULL,
+  end_time INTEGER NOT NULL,
+  exit_code INTEGER NOT NULL,
+  state INTEGER NOT NULL,
+  metadata TEXT NOT NULL
+);
+CREATE INDEX IF NOT EXISTS blocks_by_session
+  ON blocks (session_id, start_time);
+CREATE INDEX IF NOT EXISTS blocks_by_state ON blocks (state);
+CREATE TABLE IF NOT EXISTS output_segments (
+  block_id TEXT NOT NULL,
+  seq INTEGER NOT NULL,
+  type TEXT NOT NULL,
+  ts INTEGER NOT NULL,
+  data BLOB NOT NULL,
+  PRIMARY KEY (block_id, seq)
+) WITHOUT ROWID;
+)";
+
+constexpr const char *kBlockColumns =
+    "id, session_id, command, cwd, env, start_time, end_time, exit_code, "
+    "state, metadata";
+
+void bind_text(sqlite3_stmt *stmt, int index, const std::string &value) {
+  sqlite3_bind_text(stmt, index, value.data(), static_cast<int>(value.size()),
+                    SQLITE_TRANSIENT);
+}
+
+void bind_int(sqlite3_stmt *stmt, int index, int64_t value) {
+  sqlite3_bind_int64(stmt, index, value);
+}
+
+std::string column_text(sqlite3_stmt *stmt, int index) {
+  const auto *text = sqlite3_column_blob(stmt, index);
+  int size = sqlite3_column_bytes(stmt, index);
+  return text ? std::string(static_cast<const char *>(text), size) : "";
+}
+
+// Run a statement that returns no rows and make it ready for the next use
+bool run(sqlite3_stmt *stmt) {
+  int rc = sqlite3_step(stmt);
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+  return rc == SQLITE_DONE;
+}
+
+bool exec(sqlite3 *db, const char *sql) {
+  char *error = nullptr;
+  if (sqlite3_exec(db, sql, nullptr, nullptr, &error) == SQLITE_OK)
+    return true;
+  SI_LOG_ERROR("Block store: {}", error ? error : "unknown error");
+  sqlite3_free(error);
+  return false;
+}
+
+// A row of SELECT kBlockColumns, without its output
+Block block_from_row(sqlite3_stmt *stmt) {
+  Block b;
+  b.id = column_text(stmt, 0);
+  b.session_id = column_text(stmt, 1);
+  b.command = column_text(stmt, 2);
+  b.cwd = column_text(stmt, 3);
+  nlohmann::json::parse(column_text(stmt, 4)).get_to(b.env);
+  b.start_time = sqlite3_column_int64(stmt, 5);
+  b.end_time = sqlite3_column_int64(stmt, 6);
+  b.exit_code = sqlite3_column_int(stmt, 7);
+  b.state = static_cast<BlockState>(sqlite3_column_int(stmt, 8));
+  b.metadata = nlohmann::json::parse(column_text(stmt, 9));
+  return b;
+}
+
+// Resets the statement when leaving the scope of a read
+struct ResetOnExit {
+  sqlite3_stmt *stmt;
+  ~ResetOnExit() {
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+  }
+};
+} // anonymous namespace
+
+struct BlockStore::Impl {
+  sqlite3 *writer = nullptr;
+  sqlite3 *reader = nullptr;
+
+  // On the writer
+  sqlite3_stmt *begin = nullptr;
+  sqlite3_stmt *commit = nullptr;
+  sqlite3_stmt *put_session = nullptr;
+  sqlite3_stmt *delete_session = nullptr;
+  sqlite3_stmt *put_block = nullptr;
+  sqlite3_stmt *put_output = nullptr;
+  sqlite3_stmt *complete_block = nullptr;
+
+  // On the reader
+  sqlite3_stmt *sessions = nullptr;
+  sqlite3_stmt *sessions_with_blocks = nullptr;
+  sqlite3_stmt *blocks_in_state = nullptr;
+  sqlite3_stmt *session_blocks = nullptr;
+  sqlite3_stmt *block = nullptr;
+  sqlite3_stmt *output_since = nullptr;
+  sqlite3_stmt *output_count = nullptr;
+
+  bool prepare(sqlite3 *db, sqlite3_stmt *&stmt, const std::string &sql) {
+    if (sqlite3_prepare_v3(db, sql.c_str(), -1, SQLITE_PREPARE_PERSISTENT,
+                           &stmt, nullptr) == SQLITE_OK)
+      return true;
+    SI_LOG_ERROR("Block store: {}", sqlite3_errmsg(db));
+    return false;
+  }
+
+  ~Impl() {
+    for (auto *stmt :
+         {begin, commit, put_session, delete_session, put_block, put_output,
+          complete_block, sessions, sessions_with_blocks, blocks_in_state,
+          session_blocks, block, output_since, output_count})
+      sqlite3_finalize(stmt);
+    sqlite3_close(reader);
+    sqlite3_close(writer);
+  }
+};
+
+BlockStore::BlockStore(std::filesystem::path db_path)
+    : db_path_(std::move(db_path)) {}
+
+BlockStore::~BlockStore() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  queued_cv_.notify_all();
+  if (writer_.joinable())
+    writer_.join();
+}
+
+bool BlockStore::open() {
+  auto impl = std::make_unique<Impl>();
+  std::error_code ec;
+  bool existed = std::filesystem::exists(db_path_, ec);
+  int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX;
+  if (sqlite3_open_v2(db_path_.c_str(), &impl->writer, flags, nullptr) !=
+      SQLITE_OK) {
+    SI_LOG_ERROR("Block store: cannot open {}: {}", db_path_.string(),
+                 sqlite3_errmsg(impl->writer));
+    return false;
+  }
+  // One fsync per checkpoint rather than per commit; the WAL keeps
+  // committed transactions across a crash of the process
+  if (!exec(impl->writer, "PRAGMA journal_mode = WAL;"
+                          "PRAGMA synchronous = NORMAL;") ||
+      !exec(impl->writer, kSchema))
+    return false;
+  sqlite3_busy_timeout(impl->writer, 5000);
+
+  if (sqlite3_open_v2(db_path_.c_str(), &impl->reader,
+                      SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX,
+                      nullptr) != SQLITE_OK) {
+    SI_LOG_ERROR("Block store: cannot open {} for reading: {}",
+                 db_path_.string(), sqlite3_errmsg(impl->reader));
+    return false;
+  }
+  sqlite3_busy_timeout(impl->reader, 5000);
+
+  std::string columns = kBlockColumns;
+  bool prepared =
+      impl->prepare(impl->writer, impl->begin, "BEGIN") &&
+      impl->prepare(impl->writer, impl->commit, "COMMIT") &&
+      impl->prepare(impl->writer, impl->put_session,
+                    "INSERT OR REPLACE INTO sessions (id, name, cwd, shell) "
+                    "VALUES (?, ?, ?, ?)") &&
+      impl->prepare(impl->writer, impl->delete_session,
+                    "DELETE FROM sessions WHERE id = ?") &&
+      impl->prepare(impl->writer, impl->put_block,
+                    "INSERT OR REPLACE INTO blocks (" + columns +
+                        ") VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)") &&
+      impl->prepare(impl->writer, impl->put_output,
+                    "INSERT OR REPLACE INTO output_segments "
+                    "(block_id, seq, type, ts, data) VALUES (?, ?, ?, ?, ?)") &&
+      impl->prepare(impl->writer, impl->complete_block,
+                    "UPDATE blocks SET exit_code = ?, state = ?, end_time = ? "
+                    "WHERE id = ?") &&
+      impl->prepare(impl->reader, impl->sessions,
+                    "SELECT id, name, cwd, shell FROM sessions") &&
+      impl->prepare(impl->reader, impl->sessions_with_blocks,
+                    "SELECT DISTINCT session_id FROM blocks") &&
+      impl->prepare(impl->reader, impl->blocks_in_state,
+                    "SELECT " + columns + " FROM blocks WHERE state = ?") &&
+      impl->prepare(impl->reader, impl->session_blocks,
+                    "SELECT " + columns +
+                        " FROM blocks WHERE session_id = ? "
+                        "ORDER BY start_time") &&
+      impl->prepare(impl->reader, impl->block,
+                    "SELECT " + columns + " FROM blocks WHERE id = ?") &&
+      impl->prepare(impl->reader, impl->output_since,
+                    "SELECT seq, type, ts, data FROM output_segments "
+                    "WHERE block_id = ? AND seq >= ? ORDER BY seq") &&
+      impl->prepare(impl->reader, impl->output_count,
+                    "SELECT MAX(seq) + 1 FROM output_segments "
+                    "WHERE block_id = ?");
+  if (!prepared)
+    return false;
+
+  impl_ = std::move(impl);
+  created_ = !existed;
+  writer_ = std::thread([this]() { writer_loop(); });
+  SI_LOG_INFO("Block store: {}", db_path_.string());
+  return true;
+}
+
+void BlockStore::append(nlohmann::json record) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  queue_.push_back(std::move(record));
+  queued_++;
+  queued_cv_.notify_one();
+}
+
+void BlockStore::flush() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  uint64_t target = queued_;
+  written_cv_.wait(lock, [this, target]() { return written_ >= target; });
+}
+
+uint64_t BlockStore::queued() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return queued_;
+}
+
+uint64_t BlockStore::written() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return written_;
+}
+
+void BlockStore::writer_loop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    queued_cv_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+    if (queue_.empty())
+      return; // stopping, with everything written
+    std::deque<nlohmann::json> batch;
+    batch.swap(queue_);
+    lock.unlock();
+
+    // Everything that queued up meanwhile goes into one transaction
+    run(impl_->begin);
+    for (const auto &record : batch) {
+      try {
+        apply(record);
+      } catch (const std::exception &e) {
+        SI_LOG_ERROR("Block store: bad record: {}", e.what());
+      }
+    }
+    if (!run(impl_->commit))
+      SI_LOG_ERROR("Block store: commit failed: {}",
+                   sqlite3_errmsg(impl_->writer));
+
+    lock.lock();
+    written_ += batch.size();
+    written_cv_.notify_all();
+  }
+}
+
+void BlockStore::apply(const nlohmann::json &record) {
+  auto op = record.at("op").get<std::string>();
+  bool ok = true;
+  if (op == "session") {
+    auto *stmt = impl_->put_session;
+    bind_text(stmt, 1, record.at("id").get<std::string>());
+    bind_text(stmt, 2, record.at("name").get<std::string>());
+    bind_text(stmt, 3, record.at("cwd").get<std::string>());
+    bind_text(stmt, 4, record.at("shell").get<std::string>());
+    ok = run(stmt);
+  } else if (op == "session_deleted") {
+    bind_text(impl_->delete_session, 1, record.at("id").get<std::string>());
+    ok = run(impl_->delete_session);
+  } else if (op == "block") {
+    Block b = record.at("block").get<Block>();
+    auto *stmt = impl_->put_block;
+    bind_text(stmt, 1, b.id);
+    bind_text(stmt, 2, b.session_id);
+    bind_text(stmt, 3, b.command);
+    bind_text(stmt, 4, b.cwd);
+    bind_text(stmt, 5, nlohmann::json(b.env).dump());
+    bind_int(stmt, 6, b.start_time);
+    bind_int(stmt, 7, b.end_time);
+    bind_int(stmt, 8, static_cast<int64_t>(b.exit_code));
+    bind_int(stmt, 9, static_cast<int64_t>(b.state));
+    bind_text(stmt, 10, b.metadata.dump());
+    ok = run(stmt);
+    // Imported blocks come with their output
+    for (const auto &chunk : b.output_chunks) {
+      stmt = impl_->put_output;
+      bind_text(stmt, 1, b.id);
+      bind_int(stmt, 2, static_cast<int64_t>(chunk.seq));
+      bind_text(stmt, 3, chunk.type);
+      bind_int(stmt, 4, chunk.timestamp);
+      sqlite3_bind_blob(stmt, 5, chunk.data.data(),
+                        static_cast<int>(chunk.data.size()), SQLITE_TRANSIENT);
+      ok = run(stmt) && ok;
+    }
+  } else if (op == "output") {
+    const auto &data = record.at("data").get_ref<const std::string &>();
+    auto *stmt = impl_->put_output;
+    bind_text(stmt, 1, record.at("block_id").get<std::string>());
+    bind_int(stmt, 2, record.at("seq").get<int64_t>());
+    bind_text(stmt, 3, record.at("type").get<std::string>());
+    bind_int(stmt, 4, record.at("ts").get<int64_t>());
+    sqlite3_bind_blob(stmt, 5, data.data(), static_cast<int>(data.size()),
+                      SQLITE_STATIC);
+    ok = run(stmt);
+  } else if (op == "complete") {
+    int exit_code = record.at("exit_code");
+    auto state = exit_code == 0 ? BlockState::COMPLETED : BlockState::FAILED;
+    auto *stmt = impl_->complete_block;
+    bind_int(stmt, 1, static_cast<int64_t>(exit_code));
+    bind_int(stmt, 2, static_cast<int64_t>(state));
+    bind_int(stmt, 3, record.at("end_time").get<int64_t>());
+    bind_text(stmt, 4, record.at("block_id").get<std::string>());
+    ok = run(stmt);
+  }
+  if (!ok)
+    SI_LOG_ERROR("Block store: {} failed: {}", op,
+                 sqlite3_errmsg(impl_->writer));
+}
+
+std::vector<BlockStore::SessionRow> BlockStore::sessions() {
+  std::lock_guard<std::mutex> lock(read_mutex_);
+  auto *stmt = impl_->sessions;
+  ResetOnExit reset{stmt};
+  std::vector<SessionRow> rows;
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    rows.push_back({column_text(stmt, 0), column_text(stmt, 1),
+                    column_text(stmt, 2), column_text(stmt, 3)});
+  }
+  return rows;
+}
+
+std::vector<std::string> BlockStore::sessions_with_blocks() {
+  std::lock_guard<std::mutex> lock(read_mutex_);
+  auto *stmt = impl_->sessions_with_blocks;
+  ResetOnExit reset{stmt};
+  std::vector<std::string> ids;
+  while (sqlite3_step(stmt) == SQLITE_ROW)
+    ids.push_back(column_text(stmt, 0));
+  return ids;
+}
+
+std::vector<Block> BlockStore::blocks_in_state(BlockState state) {
+  std::lock_guard<std::mutex> lock(read_mutex_);
+  bind_int(impl_->blocks_in_state, 1, static_cast<int64_t>(state));
+  return read_blocks(impl_->blocks_in_state);
+}
+
+std::vector<Block> BlockStore::session_blocks(const std::string &session_id) {
+  std::lock_guard<std::mutex> lock(read_mutex_);
+  bind_text(impl_->session_blocks, 1, session_id);
+  return read_blocks(impl_->session_blocks);
+}
+
+std::optional<Block> BlockStore::block(const std::string &block_id,
+                                       uint64_t since_seq) {
+  std::lock_guard<std::mutex> lock(read_mutex_);
+  auto *stmt = impl_->block;
+  std::optional<Block> found;
+  {
+    ResetOnExit reset{stmt};
+    bind_text(stmt, 1, block_id);
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+      found = block_from_row(stmt);
+  }
+  if (found)
+    read_output(*found, since_seq);
+  return found;
+}
+
+uint64_t BlockStore::output_count(const std::string &block_id) {
+  std::lock_guard<std::mutex> lock(read_mutex_);
+  auto *stmt = impl_->output_count;
+  ResetOnExit reset{stmt};
+  bind_text(stmt, 1, block_id);
+  if (sqlite3_step(stmt) != SQLITE_ROW)
+    return 0;
+  return static_cast<uint64_t>(sqlite3_column_int64(stmt, 0)); // NULL: 0
+}
+
+std::vector<Block> BlockStore::read_blocks(sqlite3_stmt *stmt) {
+  std::vector<Block> blocks;
+  {
+    ResetOnExit reset{stmt};
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+      blocks.push_back(block_from_row(stmt));
+    }
+  }
+  for (auto &b : blocks)
+    read_output(b, 0);
+  return blocks;
+}
+
+void BlockStore::read_output(Block &block, uint64_t since_seq) {
+  auto *stmt = impl_->output_since;
+  ResetOnExit reset{stmt};
+  bind_text(stmt, 1, block.id);
+  bind_int(stmt, 2, static_cast<int64_t>(since_seq));
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    OutputChunk chunk;
+    chunk.seq = static_cast<uint64_t>(sqlite3_column_int64(stmt, 0));
+    chunk.type = column_text(stmt, 1);
+    chunk.timestamp = sqlite3_column_int64(stmt, 2);
+    chunk.data = column_text(stmt, 3);
+    block.output_chunks.push_back(std::move(chunk));
+  }
+}
+
+} // namespace si::shell
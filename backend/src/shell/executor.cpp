@@ -2,13 +2,218 @@
 #include "si/foundation/logging.hpp"
 #include "si/shell/block_manager.hpp"
 #include <array>
+#include <cerrno>
+#include <csignal>
 #include <cstring>
+#include <fcntl.h>
 #include <iostream>
+#include <poll.h>
+#include <stdexcept>
+#include <pty.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
 #include <sys/wait.h>
+#include <termios.h>
 #include <unistd.h>
+#include <utmp.h>
 
 namespace si::shell {
 
+namespace {
+// Write the front of `data` until done or the fd would block, erasing what
+// was written; false on an error
+bool write_available(int fd, std::string &data) {
+  size_t written = 0;
+  bool ok = true;
+  while (written < data.size()) {
+    ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    if (n <= 0) {
+      ok = false;
+      break;
+    }
+    written += static_cast<size_t>(n);
+  }
+  data.erase(0, written);
+  return ok;
+}
+} // namespace
+
+BlockProcesses::Process::~Process() {
+  if (input_fd >= 0)
+    ::close(input_fd);
+}
+
+BlockProcesses &BlockProcesses::instance() {
+  static BlockProcesses processes;
+  return processes;
+}
+
+BlockProcesses::BlockProcesses()
+    : wake_fd_(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) {}
+
+bool BlockProcesses::begin(const std::string &block_id,
+                           const nlohmann::json &launch) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (detaching_) {
+    deferred_.push_back(launch);
+    deferred_.back()["block_id"] = block_id;
+    return false;
+  }
+  readers_++;
+  return true;
+}
+
+void BlockProcesses::end() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  readers_--;
+  parked_cv_.notify_all();
+}
+
+bool BlockProcesses::detaching() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return detaching_;
+}
+
+nlohmann::json BlockProcesses::detach(std::vector<int> &fds) {
+  std::map<std::string, std::shared_ptr<Process>> processes;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    detaching_ = true;
+    uint64_t one = 1;
+    if (::write(wake_fd_, &one, sizeof(one)) < 0)
+      SI_LOG_WARN("EXECUTOR: Could not wake block readers");
+    parked_cv_.wait(lock, [this]() { return readers_ == 0; });
+    processes.swap(processes_);
+  }
+
+  auto running = nlohmann::json::array();
+  for (auto &[block_id, process] : processes) {
+    std::lock_guard<std::mutex> lock(process->mutex);
+    process->closed = true;
+    if (!process->input.empty())
+      SI_LOG_WARN("EXECUTOR: Dropping {} bytes of input queued for block {}",
+                  process->input.size(), block_id);
+    running.push_back(
+        {{"block_id", block_id}, {"pid", process->pid}, {"fd", fds.size()}});
+    fds.push_back(process->master_fd);
+  }
+  return running;
+}
+
+nlohmann::json BlockProcesses::take_deferred() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto deferred = std::move(deferred_);
+  deferred_ = nlohmann::json::array();
+  return deferred;
+}
+
+void BlockProcesses::resume() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  detaching_ = false;
+  uint64_t count;
+  while (::read(wake_fd_, &count, sizeof(count)) > 0) {
+  }
+}
+
+std::shared_ptr<BlockProcesses::Process>
+BlockProcesses::add(const std::string &block_id, pid_t pid, int master_fd) {
+  auto process = std::make_shared<Process>();
+  process->pid = pid;
+  process->master_fd = master_fd;
+  process->input_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  // A child that stops reading must not hold up whoever types into it
+  int flags = fcntl(master_fd, F_GETFL);
+  if (flags < 0 || fcntl(master_fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    SI_LOG_WARN("EXECUTOR: Could not make the terminal of {} non-blocking",
+                block_id);
+  std::lock_guard<std::mutex> lock(mutex_);
+  processes_[block_id] = process;
+  return process;
+}
+
+void BlockProcesses::remove(const std::string &block_id) {
+  std::shared_ptr<Process> process;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = processes_.find(block_id);
+    if (it == processes_.end())
+      return;
+    process = std::move(it->second);
+    processes_.erase(it);
+  }
+  // Wait out a write or signal in progress
+  std::lock_guard<std::mutex> lock(process->mutex);
+  process->closed = true;
+}
+
+std::shared_ptr<BlockProcesses::Process>
+BlockProcesses::find(const std::string &block_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = processes_.find(block_id);
+  return it != processes_.end() ? it->second : nullptr;
+}
+
+bool BlockProcesses::write_input(const std::string &block_id,
+                                 const std::string &data) {
+  auto process = find(block_id);
+  if (!process)
+    return false;
+  std::lock_guard<std::mutex> lock(process->mutex);
+  if (process->closed)
+    return false;
+  if (process->input.size() + data.size() > kMaxQueuedInput)
+    throw std::runtime_error("Block is not reading its input");
+  // Behind input already queued, which the reader is writing
+  bool idle = process->input.empty();
+  process->input += data;
+  if (!idle)
+    return true;
+  if (!write_available(process->master_fd, process->input))
+    return false;
+  if (!process->input.empty()) {
+    uint64_t one = 1;
+    if (::write(process->input_fd, &one, sizeof(one)) < 0)
+      SI_LOG_WARN("EXECUTOR: Could not wake the reader of {}", block_id);
+  }
+  return true;
+}
+
+void BlockProcesses::flush_input(Process &process) {
+  std::lock_guard<std::mutex> lock(process.mutex);
+  if (!process.closed && !write_available(process.master_fd, process.input))
+    process.input.clear(); // the terminal is gone; the reader sees it too
+}
+
+bool BlockProcesses::send_signal(const std::string &block_id, int signal) {
+  auto process = find(block_id);
+  if (!process)
+    return false;
+  std::lock_guard<std::mutex> lock(process->mutex);
+  // forkpty made the child a session (and group) leader
+  return !process->closed && ::kill(-process->pid, signal) == 0;
+}
+
+bool BlockProcesses::resize(const std::string &block_id, int cols,
+                            int rows) {
+  auto process = find(block_id);
+  if (!process)
+    return false;
+  struct winsize ws {};
+  ws.ws_col = static_cast<unsigned short>(cols);
+  ws.ws_row = static_cast<unsigned short>(rows);
+  std::lock_guard<std::mutex> lock(process->mutex);
+  // The kernel sends SIGWINCH to the foreground job
+  return !process->closed && ioctl(process->master_fd, TIOCSWINSZ, &ws) == 0;
+}
+
+bool BlockProcesses::is_running(const std::string &block_id) {
+  return find(block_id) != nullptr;
+}
+
 CommandExecutor::CommandExecutor() {}
 CommandExecutor::~CommandExecutor() {}
 
@@ -82,15 +287,12 @@ ExecutionResult CommandExecutor::execute(const std::string &command) {
   return result;
 }
 
-#include <pty.h>
-#include <termios.h>
-#include <utmp.h>
-
 int CommandExecutor::execute_stream(
     const std::string &command, const std::string &cwd,
     const std::string &shell,
     std::function<void(const std::string &)> on_stdout,
-    std::function<void(const std::string &)> on_stderr, int cols, int rows) {
+    std::function<void(const std::string &)> on_stderr, int cols, int rows,
+    const std::string &block_id) {
 
   SI_LOG_INFO("EXECUTOR: execute_stream called: {} in {} ({}x{})", command, cwd,
               cols, rows);
@@ -137,18 +339,62 @@ int CommandExecutor::execute_stream(
     _exit(127);
   }
 
-  // Parent process
-  std::array<char, 4096> buffer;
-  ssize_t n;
+  // Parent process. With PTY, stdout and stderr are merged into the
+  // master_fd. We prioritize on_stdout for all terminal output.
+  return follow(pid, master_fd, on_stdout, block_id);
+}
 
-  // With PTY, stdout and stderr are merged into the master_fd.
-  // We prioritize on_stdout for all terminal output.
-  while ((n = read(master_fd, buffer.data(), buffer.size())) > 0) {
-    if (on_stdout) {
-      on_stdout(std::string(buffer.data(), n));
+int CommandExecutor::follow(
+    pid_t pid, int master_fd,
+    const std::function<void(const std::string &)> &on_output,
+    const std::string &block_id) {
+  auto &processes = BlockProcesses::instance();
+  std::shared_ptr<BlockProcesses::Process> process;
+  if (!block_id.empty())
+    process = processes.add(block_id, pid, master_fd);
+
+  // A block's reader also wakes up for a hot upgrade, and to write input
+  // its terminal could not take at once
+  struct pollfd fds[3] = {{master_fd, POLLIN, 0},
+                          {processes.wake_fd(), POLLIN, 0},
+                          {process ? process->input_fd : -1, POLLIN, 0}};
+  nfds_t nfds = process ? 3 : 1;
+  std::array<char, 4096> buffer;
+  while (true) {
+    if (process) {
+      std::lock_guard<std::mutex> lock(process->mutex);
+      fds[0].events = process->input.empty() ? POLLIN : POLLIN | POLLOUT;
+    }
+    if (poll(fds, nfds, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (nfds == 3 && (fds[1].revents & POLLIN) && processes.detaching()) {
+      // The terminal and the process now belong to the new image
+      SI_LOG_INFO("EXECUTOR: Handing off block {}", block_id);
+      return kHandedOff;
     }
+    if (nfds == 3 && (fds[2].revents & POLLIN)) {
+      uint64_t count;
+      while (::read(process->input_fd, &count, sizeof(count)) > 0) {
+      }
+    }
+    if (fds[0].revents & POLLOUT)
+      processes.flush_input(*process);
+    if (!(fds[0].revents & ~POLLOUT))
+      continue;
+    ssize_t n = read(master_fd, buffer.data(), buffer.size());
+    if (n < 0 && (errno == EINTR || errno == EAGAIN))
+      continue;
+    if (n <= 0)
+      break;
+    if (on_output)
+      on_output(std::string(buffer.data(), n));
   }
 
+  if (!block_id.empty())
+    processes.remove(block_id);
   close(master_fd);
 
   int status;
@@ -177,6 +423,13 @@ int CommandExecutor::execute_to_block(const std::string &block_id,
               command, cols, rows);
 
   auto &bm = BlockManager::instance();
+  auto &processes = BlockProcesses::instance();
+  if (!processes.begin(block_id, {{"command", command},
+                                  {"cwd", cwd},
+                                  {"shell", shell},
+                                  {"cols", cols},
+                                  {"rows", rows}}))
+    return kHandedOff; // launched by the new image instead
 
   int exit_code = execute_stream(
       command, cwd, shell,
@@ -186,9 +439,34 @@ int CommandExecutor::execute_to_block(const std::string &block_id,
       [&bm, &block_id](const std::string &s) {
         bm.append_output(block_id, s, "stderr");
       },
-      cols, rows);
+      cols, rows, block_id);
+
+  if (exit_code != kHandedOff)
+    bm.complete_block(block_id, exit_code);
+  processes.end();
+  return exit_code;
+}
+
+int CommandExecutor::resume_to_block(const std::string &block_id, pid_t pid,
+                                     int master_fd) {
+  SI_LOG_INFO("EXECUTOR: resume_to_block called: {} pid {}", block_id, pid);
+
+  auto &bm = BlockManager::instance();
+  auto &processes = BlockProcesses::instance();
+  {
+    std::lock_guard<std::mutex> lock(processes.mutex_);
+    processes.readers_++;
+  }
+  int exit_code = follow(
+      pid, master_fd,
+      [&bm, &block_id](const std::string &s) {
+        bm.append_output(block_id, s, "stdout");
+      },
+      block_id);
 
-  bm.complete_block(block_id, exit_code);
+  if (exit_code != kHandedOff)
+    bm.complete_block(block_id, exit_code);
+  processes.end();
   return exit_code;
 }
 
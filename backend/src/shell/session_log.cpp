@@ -0,0 +1,313 @@
+#include "si/shell/session_log.hpp"
+#include "si/foundation/logging.hpp"
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace si::shell {
+
+namespace {
+constexpr size_t kHeaderBytes = 8; // length, CRC-32
+
+uint32_t crc32(const uint8_t *data, size_t size) {
+  static const auto table = []() {
+    std::array<uint32_t, 256> t{};
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++)
+        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      t[i] = c;
+    }
+    return t;
+  }();
+  uint32_t c = 0xFFFFFFFFu;
+  for (size_t i = 0; i < size; i++)
+    c = table[(c ^ data[i]) & 0xFF] ^ (c >> 8);
+  return c ^ 0xFFFFFFFFu;
+}
+
+void put_le32(std::string &out, uint32_t v) {
+  for (int i = 0; i < 4; i++)
+    out.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+}
+
+uint32_t get_le32(const uint8_t *p) {
+  return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 |
+         uint32_t(p[3]) << 24;
+}
+
+void encode_record(std::string &out, const nlohmann::json &record) {
+  auto payload = nlohmann::json::to_cbor(record);
+  put_le32(out, static_cast<uint32_t>(payload.size()));
+  put_le32(out, crc32(payload.data(), payload.size()));
+  out.append(payload.begin(), payload.end());
+}
+
+bool write_all(int fd, const std::string &bytes) {
+  size_t written = 0;
+  while (written < bytes.size()) {
+    ssize_t n = ::write(fd, bytes.data() + written, bytes.size() - written);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    written += static_cast<size_t>(n);
+  }
+  return true;
+}
+} // anonymous namespace
+
+SessionLog::SessionLog(std::filesystem::path log_path,
+                       std::filesystem::path snapshot_path,
+                       SessionLogOptions options)
+    : log_path_(std::move(log_path)), snapshot_path_(std::move(snapshot_path)),
+      options_(options) {
+  open_log();
+  writer_ = std::thread([this]() { writer_loop(); });
+}
+
+SessionLog::~SessionLog() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  queued_cv_.notify_all();
+  if (writer_.joinable())
+    writer_.join();
+  if (fd_ >= 0)
+    ::close(fd_);
+}
+
+void SessionLog::open_log() {
+  std::error_code ec;
+  std::filesystem::create_directories(log_path_.parent_path(), ec);
+  fd_ = ::open(log_path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+               0644);
+  if (fd_ < 0) {
+    SI_LOG_ERROR("Failed to open session log {}: {}", log_path_.string(),
+                 std::strerror(errno));
+    return;
+  }
+  // Another sicore (a server, or the instance being upgraded) owns it
+  if (::flock(fd_, LOCK_EX | LOCK_NB) == 0)
+    owner_ = true;
+  else
+    SI_LOG_WARN("Session log {} is in use by another process; not writing "
+                "to it",
+                log_path_.string());
+  struct stat st;
+  if (fstat(fd_, &st) == 0)
+    log_bytes_ = static_cast<uint64_t>(st.st_size);
+}
+
+size_t SessionLog::recover(
+    const std::function<void(const nlohmann::json &snapshot)> &restore,
+    const std::function<void(const nlohmann::json &record)> &apply) {
+  uint64_t last = 0;
+  std::error_code ec;
+  if (std::filesystem::exists(snapshot_path_, ec)) {
+    try {
+      nlohmann::json snapshot;
+      std::ifstream i(snapshot_path_);
+      i >> snapshot;
+      last = snapshot.value("log_seq", uint64_t{0});
+      snapshot_bytes_ = std::filesystem::file_size(snapshot_path_, ec);
+      restore(snapshot);
+    } catch (const std::exception &e) {
+      SI_LOG_ERROR("Failed to read session snapshot: {}", e.what());
+    }
+  }
+
+  std::ifstream in(log_path_, std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(in)),
+                   std::istreambuf_iterator<char>());
+  const auto *bytes = reinterpret_cast<const uint8_t *>(data.data());
+  size_t good = 0;
+  uint64_t highest = last;
+  size_t replayed = 0;
+  while (good + kHeaderBytes <= data.size()) {
+    uint32_t size = get_le32(bytes + good);
+    const uint8_t *payload = bytes + good + kHeaderBytes;
+    if (size > data.size() - good - kHeaderBytes ||
+        crc32(payload, size) != get_le32(bytes + good + 4))
+      break;
+    auto record = nlohmann::json::from_cbor(payload, payload + size, true,
+                                            false);
+    if (!record.is_object())
+      break;
+    good += kHeaderBytes + size;
+
+    uint64_t n = record.value("n", uint64_t{0});
+    highest = std::max(highest, n);
+    // Older records are in the snapshot already
+    if (n <= last)
+      continue;
+    try {
+      apply(record);
+      replayed++;
+    } catch (const std::exception &e) {
+      SI_LOG_ERROR("Skipping session log record {}: {}", n, e.what());
+    }
+  }
+
+  // Without the lock the "torn" tail may be a commit still being written
+  if (good < data.size() && owner_) {
+    SI_LOG_WARN("Dropping {} bytes of torn records from the session log",
+                data.size() - good);
+    if (::ftruncate(fd_, static_cast<off_t>(good)) != 0)
+      SI_LOG_ERROR("Failed to truncate session log: {}", std::strerror(errno));
+  }
+  log_bytes_ = good;
+  if (replayed > 0)
+    SI_LOG_INFO("Replayed {} session log records", replayed);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  next_record_ = highest + 1;
+  return replayed;
+}
+
+void SessionLog::append(nlohmann::json record) {
+  if (!owner_)
+    return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  record["n"] = next_record_++;
+  queue_.push_back({std::move(record), nullptr, false});
+  queued_++;
+  stats_.records++;
+  queued_cv_.notify_one();
+}
+
+void SessionLog::snapshot(nlohmann::json state) {
+  snapshot([state = std::move(state)]() mutable { return std::move(state); });
+}
+
+void SessionLog::snapshot(Builder build) {
+  if (!owner_)
+    return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  // The builder runs later; the records it must cover are those up to now
+  nlohmann::json log_seq = next_record_ - 1;
+  queue_.push_back({std::move(log_seq), std::move(build), true});
+  queued_++;
+  snapshot_queued_ = true;
+  queued_cv_.notify_one();
+}
+
+bool SessionLog::wants_snapshot() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (snapshot_queued_ || !owner_)
+    return false;
+  uint64_t limit =
+      std::max<uint64_t>(options_.compact_bytes, snapshot_bytes_.load());
+  return log_bytes_ >= limit;
+}
+
+void SessionLog::flush() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  uint64_t target = queued_;
+  written_cv_.wait(lock, [this, target]() { return written_ >= target; });
+}
+
+SessionLog::Stats SessionLog::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Stats stats = stats_;
+  stats.log_bytes = log_bytes_;
+  return stats;
+}
+
+void SessionLog::writer_loop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    queued_cv_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+    if (queue_.empty())
+      return; // stopping, with everything written
+    std::deque<Entry> batch;
+    batch.swap(queue_);
+    lock.unlock();
+
+    // Everything that queued up meanwhile goes out in one commit
+    std::string bytes;
+    uint64_t commits = 0;
+    uint64_t snapshots = 0;
+    bool snapshot_done = false;
+    for (auto &entry : batch) {
+      if (!entry.snapshot) {
+        encode_record(bytes, entry.value);
+        continue;
+      }
+      // The log must hold what came before, should the snapshot fail
+      if (!bytes.empty() && commit(bytes))
+        commits++;
+      bytes.clear();
+      try {
+        auto state = entry.build();
+        state["log_seq"] = entry.value;
+        write_snapshot(state);
+      } catch (const std::exception &e) {
+        SI_LOG_ERROR("Failed to build session snapshot: {}", e.what());
+      }
+      snapshots++;
+      snapshot_done = true;
+    }
+    if (!bytes.empty() && commit(bytes))
+      commits++;
+
+    lock.lock();
+    written_ += batch.size();
+    stats_.commits += commits;
+    stats_.snapshots += snapshots;
+    if (snapshot_done)
+      snapshot_queued_ = false;
+    written_cv_.notify_all();
+  }
+}
+
+bool SessionLog::commit(const std::string &bytes) {
+  if (fd_ < 0)
+    return false;
+  if (!write_all(fd_, bytes) || (options_.sync && ::fdatasync(fd_) != 0)) {
+    SI_LOG_ERROR("Failed to write session log: {}", std::strerror(errno));
+    return false;
+  }
+  log_bytes_ += bytes.size();
+  return true;
+}
+
+void SessionLog::write_snapshot(const nlohmann::json &state) {
+  std::string text = state.dump();
+  auto tmp_path = snapshot_path_;
+  tmp_path += ".tmp";
+  int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+  bool ok = fd >= 0 && write_all(fd, text) &&
+            (!options_.sync || ::fsync(fd) == 0);
+  int error = errno;
+  if (fd >= 0)
+    ::close(fd);
+  std::error_code ec;
+  if (ok)
+    std::filesystem::rename(tmp_path, snapshot_path_, ec);
+  if (!ok || ec) {
+    // The log still has everything: try again at the next snapshot
+    SI_LOG_ERROR("Failed to write session snapshot {}: {}",
+                 snapshot_path_.string(),
+                 ok ? ec.message() : std::strerror(error));
+    return;
+  }
+  snapshot_bytes_ = text.size();
+
+  // Records left behind by a failed truncation are skipped on recovery
+  if (fd_ >= 0 && ::ftruncate(fd_, 0) != 0) {
+    SI_LOG_ERROR("Failed to truncate session log: {}", std::strerror(errno));
+    return;
+  }
+  log_bytes_ = 0;
+}
+
+} // namespace si::shell
@@ -11,13 +11,17 @@ WorkflowEngine &WorkflowEngine::instance() {
 }
 
 std::string WorkflowEngine::save_workflow(const Workflow &workflow) {
-  std::lock_guard<std::mutex> lock(mutex_);
   // If ID empty, generate? For now assume provided or use name hash
   std::string id = workflow.id;
   if (id.empty())
     id = workflow.name; // Simplification
 
-  workflows_[id] = workflow;
+  {
+    // Readers take this on the event loop: nothing slow under it
+    std::lock_guard<std::mutex> lock(mutex_);
+    workflows_[id] = workflow;
+    version_.fetch_add(1, std::memory_order_release);
+  }
   SI_LOG_INFO("Saved Workflow: {}", workflow.name);
   return id;
 }
@@ -1,6 +1,7 @@
 import sys
 import json
 import os
+import time
 
 def log(msg):
     sys.stderr.write(f"[DummyServer] {msg}\n")
@@ -49,6 +50,9 @@ while True:
                         }
                     }]
                 }
+            elif method == "tools/call" and req["params"].get("name") == "sleep":
+                time.sleep(req["params"].get("arguments", {}).get("seconds", 1))
+                resp["result"] = {"content": [{"type": "text", "text": "done"}]}
             elif method == "tools/call":
                 params = req.get("params", {})
                 args = params.get("arguments", {})
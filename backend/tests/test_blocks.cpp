@@ -1,6 +1,14 @@
 #include "si/foundation/logging.hpp"
 #include "si/shell/block_manager.hpp"
+#include "si/shell/block_store.hpp"
+#include "si/shell/chunk_list.hpp"
+#include "si/shell/session_log.hpp"
 #include <catch2/catch_all.hpp>
+#include <filesystem>
+#include <atomic>
+#include <fstream>
+#include <thread>
+#include <unistd.h>
 
 using namespace si::shell;
 
@@ -19,6 +27,9 @@ TEST_CASE("Block Manager Basics", "[blocks]") {
 
   auto &bm = BlockManager::instance();
   std::string session_id = "test-session-1";
+  // Earlier sections leave callbacks capturing their locals
+  bm.set_update_callback(nullptr);
+  bm.set_complete_callback(nullptr);
 
   SECTION("Create and Get") {
     std::string id = bm.create_block(session_id, "echo hello", "/tmp");
@@ -34,13 +45,16 @@ TEST_CASE("Block Manager Basics", "[blocks]") {
     std::string id = bm.create_block(session_id, "ls", "/");
 
     bool callback_fired = false;
-    bm.set_update_callback(
-        [&](const std::string &bidirectional_id, const OutputChunk &chunk) {
-          if (bidirectional_id == id) {
-            callback_fired = true;
-            REQUIRE(chunk.data == "file1.txt");
-          }
-        });
+    bm.set_update_callback([&](const std::string &bidirectional_id,
+                               const std::string &chunk_session_id,
+                               const OutputChunk &chunk) {
+      if (bidirectional_id == id) {
+        callback_fired = true;
+        REQUIRE(chunk_session_id == session_id);
+        REQUIRE(chunk.data == "file1.txt");
+        REQUIRE(chunk.seq == 0);
+      }
+    });
 
     bm.append_output(id, "file1.txt");
     REQUIRE(callback_fired);
@@ -70,8 +84,391 @@ TEST_CASE("Block Manager Basics", "[blocks]") {
     REQUIRE(block->end_time > 0);
   }
 
+  SECTION("Versions move with changes") {
+    std::string session = "test-session-versions";
+    REQUIRE(bm.blocks_version(session) == 0);
+
+    uint64_t sessions = bm.sessions_version();
+    std::string id = bm.create_block(session, "true", "/");
+    uint64_t created = bm.blocks_version(session);
+    REQUIRE(created > 0);
+    REQUIRE(bm.sessions_version() > sessions);
+
+    bm.append_output(id, "out");
+    uint64_t appended = bm.blocks_version(session);
+    REQUIRE(appended > created);
+    bm.complete_block(id, 0);
+    REQUIRE(bm.blocks_version(session) > appended);
+
+    // Other sessions are unaffected
+    uint64_t other = bm.blocks_version(session_id);
+    bm.append_output(id, "more");
+    REQUIRE(bm.blocks_version(session_id) == other);
+
+    std::string named = bm.create_session("New Session");
+    sessions = bm.sessions_version();
+    bm.rename_session(named, "Renamed");
+    REQUIRE(bm.sessions_version() > sessions);
+  }
+
+  SECTION("Reading the config of an unknown session") {
+    uint64_t sessions = bm.sessions_version();
+    auto [cwd, shell] = bm.get_session_config_copy("test-session-unknown");
+    REQUIRE(cwd == ".");
+    REQUIRE(shell == "/bin/bash");
+    REQUIRE(bm.sessions_version() == sessions);
+    REQUIRE(bm.list_blocks("test-session-unknown").empty());
+  }
+
+  SECTION("Output tail") {
+    std::string id = bm.create_block(session_id, "seq 3", "/");
+    for (const char *line : {"1\n", "2\n", "3\n"})
+      bm.append_output(id, line);
+
+    auto tail = bm.get_output_since(id, 1);
+    REQUIRE(tail.has_value());
+    REQUIRE(tail->next_seq == 3);
+    REQUIRE(tail->state == BlockState::RUNNING);
+    REQUIRE(tail->chunks.size() == 2);
+    REQUIRE(tail->chunks[0].seq == 1);
+    REQUIRE(tail->chunks[1].data == "3\n");
+
+    REQUIRE(bm.get_output_since(id, 3)->chunks.empty());
+    REQUIRE(bm.get_output_since(id, 99)->chunks.empty());
+    REQUIRE_FALSE(bm.get_output_since("no-such-block", 0).has_value());
+  }
+
   SECTION("List Blocks") {
     auto list = bm.list_blocks(session_id);
     REQUIRE(list.size() >= 3); // From previous sections
   }
+
+  SECTION("Readers alongside output") {
+    std::string session = "test-session-readers";
+    std::vector<std::string> ids;
+    for (int i = 0; i < 4; i++)
+      ids.push_back(bm.create_block(session, "yes", "/"));
+
+    constexpr int kChunks = 300;
+    std::atomic<bool> done{false};
+    std::atomic<int> bad{0};
+    std::thread reader([&]() {
+      while (!done) {
+        // Output is always whole and in order, whatever else is going on
+        for (const auto &b : bm.list_blocks(session)) {
+          for (size_t i = 0; i < b.output_chunks.size(); i++) {
+            if (b.output_chunks[i].seq != i)
+              bad++;
+          }
+        }
+        auto tail = bm.get_output_since(ids[0], 10);
+        if (!tail || (tail->next_seq > 10 &&
+                      tail->chunks.size() != tail->next_seq - 10))
+          bad++;
+      }
+    });
+    std::vector<std::thread> writers;
+    for (const auto &id : ids) {
+      writers.emplace_back([&bm, id]() {
+        for (int i = 0; i < kChunks; i++)
+          bm.append_output(id, std::to_string(i) + "\n");
+        bm.complete_block(id, 0);
+      });
+    }
+    for (auto &t : writers)
+      t.join();
+    done = true;
+    reader.join();
+
+    REQUIRE(bad == 0);
+    for (const auto &id : ids) {
+      auto block = bm.get_block(id);
+      REQUIRE(block.has_value());
+      REQUIRE(block->state == BlockState::COMPLETED);
+      REQUIRE(block->output_chunks.size() == kChunks);
+      REQUIRE(block->output_chunks.back().data == "299\n");
+    }
+  }
+
+  SECTION("Reload from the log and the snapshot") {
+    std::string session = "test-session-reload";
+    std::string id = bm.create_block(session, "echo hi");
+    bm.append_output(id, "hi\n");
+    bm.append_output(id, "oops\n", "stderr");
+    bm.complete_block(id, 3);
+
+    auto check = [&]() {
+      auto block = bm.get_block(id);
+      REQUIRE(block.has_value());
+      REQUIRE(block->command == "echo hi");
+      REQUIRE(block->state == BlockState::FAILED);
+      REQUIRE(block->exit_code == 3);
+      REQUIRE(block->output_chunks.size() == 2);
+      REQUIRE(block->output_chunks[1].data == "oops\n");
+      REQUIRE(block->output_chunks[1].type == "stderr");
+      REQUIRE(block->output_chunks[1].seq == 1);
+    };
+    // Replayed from the log
+    bm.load_sessions();
+    check();
+    // Then from a snapshot alone
+    bm.save_sessions();
+    bm.load_sessions();
+    check();
+  }
+}
+
+TEST_CASE("Chunk list", "[blocks]") {
+  ChunkList list;
+  REQUIRE(list.size() == 0);
+  REQUIRE(list.copy(0, 0).empty());
+
+  // Across several segments (8, 16, 32, ...)
+  for (int i = 0; i < 100; i++)
+    REQUIRE(list.push_back({std::to_string(i), "stdout", 0}) == uint64_t(i));
+  REQUIRE(list.size() == 100);
+
+  auto all = list.copy(0, list.size());
+  REQUIRE(all.size() == 100);
+  for (size_t i = 0; i < all.size(); i++) {
+    REQUIRE(all[i].seq == i);
+    REQUIRE(all[i].data == std::to_string(i));
+  }
+
+  auto middle = list.copy(7, 25);
+  REQUIRE(middle.size() == 18);
+  REQUIRE(middle.front().data == "7");
+  REQUIRE(middle.back().data == "24");
+  REQUIRE(list.copy(99, 100).front().data == "99");
+  REQUIRE(list.copy(100, 100).empty());
+}
+
+TEST_CASE("Session log", "[blocks]") {
+  auto dir = std::filesystem::temp_directory_path() /
+             ("si_test_session_log_" + std::to_string(getpid()));
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  auto log_path = dir / "sessions.wal";
+  auto snapshot_path = dir / "sessions.json";
+
+  std::vector<nlohmann::json> records;
+  nlohmann::json snapshot;
+  auto recover = [&](SessionLog &log) {
+    records.clear();
+    snapshot = nullptr;
+    return log.recover([&](const nlohmann::json &j) { snapshot = j; },
+                       [&](const nlohmann::json &r) { records.push_back(r); });
+  };
+
+  SECTION("Records come back in order after the snapshot") {
+    {
+      SessionLog log(log_path, snapshot_path);
+      REQUIRE(recover(log) == 0);
+      for (int i = 0; i < 3; i++)
+        log.append({{"op", "test"}, {"i", i}});
+    } // the destructor commits what is queued
+    {
+      SessionLog log(log_path, snapshot_path);
+      REQUIRE(recover(log) == 3);
+      REQUIRE(snapshot.is_null());
+      REQUIRE(records[0]["i"] == 0);
+      REQUIRE(records[2]["i"] == 2);
+
+      log.snapshot({{"state", "after 3"}});
+      log.append({{"op", "test"}, {"i", 3}});
+      log.flush();
+      REQUIRE(log.stats().snapshots == 1);
+    }
+    SessionLog log(log_path, snapshot_path);
+    REQUIRE(recover(log) == 1);
+    REQUIRE(snapshot["state"] == "after 3");
+    REQUIRE(records[0]["i"] == 3);
+  }
+
+  SECTION("Records already in the snapshot are skipped") {
+    {
+      SessionLog log(log_path, snapshot_path);
+      recover(log);
+      log.append({{"op", "test"}, {"i", 0}});
+      log.append({{"op", "test"}, {"i", 1}});
+    }
+    // As if the log was not truncated after this snapshot was written
+    std::ofstream(snapshot_path) << R"({"log_seq": 1})";
+    SessionLog log(log_path, snapshot_path);
+    REQUIRE(recover(log) == 1);
+    REQUIRE(records[0]["i"] == 1);
+  }
+
+  SECTION("A torn record is cut off") {
+    {
+      SessionLog log(log_path, snapshot_path);
+      recover(log);
+      log.append({{"op", "test"}, {"i", 0}});
+      log.append({{"op", "test"}, {"i", 1}});
+    }
+    auto good = std::filesystem::file_size(log_path);
+    std::filesystem::resize_file(log_path, good - 3);
+    {
+      SessionLog log(log_path, snapshot_path);
+      REQUIRE(recover(log) == 1);
+      REQUIRE(std::filesystem::file_size(log_path) < good - 3);
+      // Appends continue after the last whole record
+      log.append({{"op", "test"}, {"i", 2}});
+    }
+    SessionLog log(log_path, snapshot_path);
+    REQUIRE(recover(log) == 2);
+    REQUIRE(records[1]["i"] == 2);
+  }
+
+  SECTION("A second process only reads a log that is in use") {
+    SessionLog owner(log_path, snapshot_path);
+    recover(owner);
+    REQUIRE(owner.owner());
+    owner.append({{"op", "test"}, {"i", 0}});
+    owner.flush();
+    // A commit the owner is halfway through writing
+    std::ofstream(log_path, std::ios::app | std::ios::binary) << "torn";
+    auto size = std::filesystem::file_size(log_path);
+
+    SessionLog other(log_path, snapshot_path);
+    REQUIRE_FALSE(other.owner());
+    REQUIRE(recover(other) == 1);
+    REQUIRE(std::filesystem::file_size(log_path) == size);
+    other.append({{"op", "test"}, {"i", 1}});
+    other.snapshot({{"state", "not written"}});
+    other.flush();
+    REQUIRE(std::filesystem::file_size(log_path) == size);
+    REQUIRE_FALSE(std::filesystem::exists(snapshot_path));
+  }
+
+  SECTION("A snapshot can be built on the writer thread") {
+    std::thread::id built_on;
+    {
+      SessionLog log(log_path, snapshot_path);
+      recover(log);
+      log.append({{"op", "test"}, {"i", 0}});
+      log.snapshot([&]() {
+        built_on = std::this_thread::get_id();
+        return nlohmann::json{{"state", "built"}};
+      });
+      log.append({{"op", "test"}, {"i", 1}});
+      log.flush();
+    }
+    REQUIRE(built_on != std::thread::id());
+    REQUIRE(built_on != std::this_thread::get_id());
+
+    // The snapshot covers the records appended before it was asked for
+    SessionLog log(log_path, snapshot_path);
+    REQUIRE(recover(log) == 1);
+    REQUIRE(snapshot["state"] == "built");
+    REQUIRE(snapshot["log_seq"] == 1);
+    REQUIRE(records[0]["i"] == 1);
+  }
+
+  SECTION("A growing log asks for a snapshot") {
+    SessionLogOptions options;
+    options.compact_bytes = 256;
+    SessionLog log(log_path, snapshot_path, options);
+    recover(log);
+    REQUIRE_FALSE(log.wants_snapshot());
+    while (!log.wants_snapshot()) {
+      log.append({{"op", "test"}, {"data", std::string(32, 'x')}});
+      log.flush();
+    }
+    REQUIRE(log.stats().log_bytes >= 256);
+
+    log.snapshot({{"state", "folded"}});
+    REQUIRE_FALSE(log.wants_snapshot()); // one is queued already
+    log.flush();
+    auto stats = log.stats();
+    REQUIRE(stats.log_bytes == 0);
+    REQUIRE(stats.snapshots == 1);
+    REQUIRE(stats.commits <= stats.records);
+    REQUIRE_FALSE(log.wants_snapshot());
+  }
+
+  std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("Block store", "[blocks]") {
+  auto dir = std::filesystem::temp_directory_path() /
+             ("si_test_block_store_" + std::to_string(getpid()));
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  auto db_path = dir / "blocks.db";
+
+  auto block = [](const std::string &id, const std::string &session,
+                  int64_t start_time) {
+    Block b;
+    b.id = id;
+    b.session_id = session;
+    b.command = "cmd " + id;
+    b.cwd = "/";
+    b.start_time = start_time;
+    return nlohmann::json{{"op", "block"}, {"block", b}};
+  };
+  auto output = [](const std::string &id, uint64_t seq,
+                   const std::string &data) {
+    return nlohmann::json{{"op", "output"}, {"block_id", id}, {"seq", seq},
+                          {"type", "stdout"}, {"data", data}, {"ts", 1}};
+  };
+
+  {
+    BlockStore store(db_path);
+    REQUIRE(store.open());
+    REQUIRE(store.created());
+    store.append({{"op", "session"},
+                  {"id", "s1"},
+                  {"name", "Build"},
+                  {"cwd", "/src"},
+                  {"shell", "/bin/zsh"}});
+    store.append(block("late", "s1", 20));
+    store.append(block("early", "s1", 10));
+    store.append(block("other", "s2", 15));
+    for (uint64_t seq = 0; seq < 3; seq++)
+      store.append(output("early", seq, "line " + std::to_string(seq)));
+    store.append(
+        {{"op", "complete"}, {"block_id", "early"}, {"exit_code", 2},
+         {"end_time", 30}});
+    store.flush();
+    REQUIRE(store.queued() == 8);
+    REQUIRE(store.written() == 8);
+    REQUIRE(std::filesystem::exists(dir / "blocks.db-wal"));
+
+    auto blocks = store.session_blocks("s1");
+    REQUIRE(blocks.size() == 2);
+    REQUIRE(blocks[0].id == "early"); // by start time
+    REQUIRE(blocks[0].state == BlockState::FAILED);
+    REQUIRE(blocks[0].exit_code == 2);
+    REQUIRE(blocks[0].end_time == 30);
+    REQUIRE(blocks[0].output_chunks.size() == 3);
+    REQUIRE(blocks[1].id == "late");
+
+    auto running = store.blocks_in_state(BlockState::RUNNING);
+    REQUIRE(running.size() == 2);
+
+    auto tail = store.block("early", 1);
+    REQUIRE(tail.has_value());
+    REQUIRE(tail->command == "cmd early");
+    REQUIRE(tail->output_chunks.size() == 2);
+    REQUIRE(tail->output_chunks[0].seq == 1);
+    REQUIRE(tail->output_chunks[1].data == "line 2");
+    REQUIRE(store.output_count("early") == 3);
+    REQUIRE(store.output_count("late") == 0);
+    REQUIRE_FALSE(store.block("missing").has_value());
+
+    store.append(output("late", 0, "pending"));
+  } // the destructor commits what is queued
+
+  BlockStore store(db_path);
+  REQUIRE(store.open());
+  REQUIRE_FALSE(store.created());
+  auto sessions = store.sessions();
+  REQUIRE(sessions.size() == 1);
+  REQUIRE(sessions[0].name == "Build");
+  REQUIRE(sessions[0].shell == "/bin/zsh");
+  REQUIRE(store.sessions_with_blocks().size() == 2);
+  REQUIRE(store.block("late")->output_chunks[0].data == "pending");
+
+  std::filesystem::remove_all(dir);
 }
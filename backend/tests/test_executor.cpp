@@ -1,8 +1,14 @@
 #include "si/foundation/logging.hpp"
 #include "si/foundation/platform.hpp"
+#include "si/shell/block_manager.hpp"
 #include "si/shell/executor.hpp"
 #include <catch2/catch_all.hpp>
+#include <chrono>
+#include <csignal>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
 
 using namespace si::shell;
 
@@ -39,3 +45,129 @@ TEST_CASE("CommandExecutor basics", "[shell]") {
     REQUIRE_THAT(captured_out, Catch::Matchers::ContainsSubstring("part 2"));
   }
 }
+
+TEST_CASE("Running blocks take input, signals and resizes", "[shell]") {
+  CommandExecutor executor;
+  auto &processes = BlockProcesses::instance();
+  std::mutex mutex;
+  std::string captured_out;
+  auto on_out = [&](const std::string &s) {
+    std::lock_guard<std::mutex> lock(mutex);
+    captured_out += s;
+  };
+  auto wait_for = [&](const std::string &text) {
+    for (int i = 0; i < 300; ++i) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (captured_out.find(text) != std::string::npos)
+          return true;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+  };
+  auto wait_running = [&](const std::string &block_id) {
+    for (int i = 0; i < 300 && !processes.is_running(block_id); ++i)
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    return processes.is_running(block_id);
+  };
+
+  SECTION("Input reaches the foreground process") {
+    int status = -1;
+    std::thread runner([&] {
+      status = executor.execute_stream("read a; echo got:$a", ".", "/bin/sh",
+                                       on_out, nullptr, 80, 24, "blk-input");
+    });
+    REQUIRE(wait_running("blk-input"));
+    REQUIRE(processes.write_input("blk-input", "hello\n"));
+    runner.join();
+    REQUIRE(status == 0);
+    REQUIRE_THAT(captured_out, Catch::Matchers::ContainsSubstring("got:hello"));
+    REQUIRE_FALSE(processes.is_running("blk-input"));
+    REQUIRE_FALSE(processes.write_input("blk-input", "late\n"));
+  }
+
+  SECTION("Resize is visible to the terminal") {
+    std::thread runner([&] {
+      executor.execute_stream("read a; stty size", ".", "/bin/sh", on_out,
+                              nullptr, 80, 24, "blk-resize");
+    });
+    REQUIRE(wait_running("blk-resize"));
+    REQUIRE(processes.resize("blk-resize", 132, 50));
+    REQUIRE(processes.write_input("blk-resize", "\n"));
+    runner.join();
+    REQUIRE(wait_for("50 132"));
+  }
+
+  SECTION("Signals reach the process group") {
+    int status = 0;
+    std::thread runner([&] {
+      status = executor.execute_stream("sleep 30", ".", "/bin/sh", on_out,
+                                       nullptr, 80, 24, "blk-kill");
+    });
+    REQUIRE(wait_running("blk-kill"));
+    auto started = std::chrono::steady_clock::now();
+    REQUIRE(processes.send_signal("blk-kill", SIGTERM));
+    runner.join();
+    REQUIRE(std::chrono::steady_clock::now() - started <
+            std::chrono::seconds(10));
+    REQUIRE(status != 0);
+    REQUIRE_FALSE(processes.send_signal("blk-kill", SIGTERM));
+  }
+}
+
+TEST_CASE("Running blocks can be handed to a new image", "[shell]") {
+  CommandExecutor executor;
+  auto &blocks = BlockManager::instance();
+  auto &processes = BlockProcesses::instance();
+  auto output = [&](const std::string &block_id) {
+    std::string text;
+    if (auto block = blocks.get_block(block_id)) {
+      for (const auto &chunk : block->output_chunks)
+        text += chunk.data;
+    }
+    return text;
+  };
+
+  std::string command = "echo before; read a; echo after:$a";
+  std::string block_id = blocks.create_block("handoff", command, ".");
+  int status = 0;
+  std::thread runner([&] {
+    status = executor.execute_to_block(block_id, command, ".", "/bin/sh");
+  });
+  for (int i = 0; i < 300 && output(block_id).find("before") ==
+                                 std::string::npos;
+       ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  REQUIRE_THAT(output(block_id), Catch::Matchers::ContainsSubstring("before"));
+
+  // The reader stops and leaves the process and its terminal running
+  std::vector<int> fds;
+  auto running = processes.detach(fds);
+  runner.join();
+  REQUIRE(status == CommandExecutor::kHandedOff);
+  REQUIRE(running.size() == 1);
+  REQUIRE(running[0]["block_id"] == block_id);
+  REQUIRE(fds.size() == 1);
+  REQUIRE_FALSE(processes.is_running(block_id));
+  REQUIRE(blocks.get_block(block_id)->state == BlockState::RUNNING);
+
+  // Blocks launched meanwhile are left to the new image
+  REQUIRE(executor.execute_to_block("handoff-later", "true") ==
+          CommandExecutor::kHandedOff);
+  auto deferred = processes.take_deferred();
+  REQUIRE(deferred.size() == 1);
+  REQUIRE(deferred[0]["block_id"] == "handoff-later");
+  REQUIRE(deferred[0]["command"] == "true");
+
+  // Typed while nobody reads: it waits in the terminal
+  REQUIRE(::write(fds[0], "x\n", 2) == 2);
+  processes.resume();
+  status = executor.resume_to_block(block_id, running[0]["pid"], fds[0]);
+  REQUIRE(status == 0);
+  auto block = blocks.get_block(block_id);
+  REQUIRE(block->state == BlockState::COMPLETED);
+  REQUIRE_THAT(output(block_id), Catch::Matchers::ContainsSubstring("after:x"));
+  for (size_t i = 0; i < block->output_chunks.size(); i++)
+    REQUIRE(block->output_chunks[i].seq == i);
+}
@@ -1,10 +1,14 @@
 #define CATCH_CONFIG_MAIN
 #include <catch2/catch_test_macros.hpp>
 
+#include "si/foundation/cancellation.hpp"
 #include "si/foundation/config.hpp"
 #include "si/foundation/logging.hpp"
 #include "si/foundation/platform.hpp"
 #include "si/foundation/signals.hpp"
+#include "si/foundation/utf8.hpp"
+#include <atomic>
+#include <thread>
 
 using namespace si::foundation;
 
@@ -114,3 +118,83 @@ TEST_CASE("SignalHandler works", "[signals]") {
     REQUIRE(handler.shutdown_requested());
   }
 }
+
+TEST_CASE("CancellationToken works", "[cancellation]") {
+  using namespace std::chrono_literals;
+
+  SECTION("Callbacks run once on cancel") {
+    CancellationToken token;
+    int calls = 0;
+    token.on_cancel([&calls]() { calls++; });
+    REQUIRE(!token.is_cancelled());
+
+    token.cancel();
+    token.cancel();
+    REQUIRE(token.is_cancelled());
+    REQUIRE(calls == 1);
+
+    // Registering after the fact runs the callback right away
+    token.on_cancel([&calls]() { calls++; });
+    REQUIRE(calls == 2);
+  }
+
+  SECTION("Removed callbacks do not run") {
+    CancellationToken token;
+    bool called = false;
+    {
+      CancellationCallback scoped(&token, [&called]() { called = true; });
+    }
+    token.cancel();
+    REQUIRE(!called);
+  }
+
+  SECTION("Deadline") {
+    CancellationToken token(CancellationToken::Clock::now() + 20ms);
+    REQUIRE(!token.is_cancelled());
+    REQUIRE(token.remaining(1000ms) <= 20ms);
+    REQUIRE(token.remaining(5ms) == 5ms);
+
+    std::this_thread::sleep_for(30ms);
+    REQUIRE(token.is_cancelled());
+    REQUIRE(token.deadline_exceeded());
+    REQUIRE(token.remaining(1000ms) == 0ms);
+    REQUIRE(time_left(nullptr, 1000ms) == 1000ms);
+  }
+
+  SECTION("Removing waits for a running callback") {
+    CancellationToken token;
+    std::atomic<bool> inside{false};
+    std::atomic<bool> finished{false};
+    size_t id = token.on_cancel([&]() {
+      inside = true;
+      std::this_thread::sleep_for(50ms);
+      finished = true;
+    });
+
+    std::thread canceller([&token]() { token.cancel(); });
+    while (!inside)
+      std::this_thread::yield();
+    token.remove_callback(id);
+    REQUIRE(finished);
+    canceller.join();
+  }
+}
+
+TEST_CASE("UTF-8 validation", "[utf8]") {
+  SECTION("Well-formed text") {
+    REQUIRE(is_valid_utf8(""));
+    REQUIRE(is_valid_utf8("plain ascii, longer than one word\n"));
+    REQUIRE(is_valid_utf8("caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80"));
+    REQUIRE(is_valid_utf8("\xf4\x8f\xbf\xbf")); // U+10FFFF
+  }
+
+  SECTION("Malformed text") {
+    REQUIRE(!is_valid_utf8("\xff"));
+    REQUIRE(!is_valid_utf8("ascii before a cut \xe2\x82"));
+    REQUIRE(!is_valid_utf8("\xc0\xaf"));         // overlong
+    REQUIRE(!is_valid_utf8("\xe0\x80\xaf"));     // overlong
+    REQUIRE(!is_valid_utf8("\xed\xa0\x80"));     // surrogate
+    REQUIRE(!is_valid_utf8("\xf4\x90\x80\x80")); // past U+10FFFF
+    REQUIRE(!is_valid_utf8("\xc3\x28"));
+  }
+}
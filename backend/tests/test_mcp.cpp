@@ -2,7 +2,9 @@
 #include "si/mcp/client.hpp"
 #include "si/mcp/stdio_transport.hpp"
 #include <catch2/catch_all.hpp>
+#include <chrono>
 #include <filesystem>
+#include <thread>
 
 using namespace si::mcp;
 
@@ -53,4 +55,27 @@ TEST_CASE("MCP Client Integration", "[mcp]") {
     REQUIRE(result.content.size() == 1);
     REQUIRE(result.content[0]["text"] == "Echo: Hello MCP");
   }
+
+  SECTION("Cancel and deadline abandon a slow call") {
+    nlohmann::json args = {{"seconds", 3}};
+    auto started = std::chrono::steady_clock::now();
+
+    si::foundation::CancellationToken token;
+    std::thread canceller([&token]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      token.cancel();
+    });
+    auto result = client.call_tool("sleep", args, &token);
+    canceller.join();
+    REQUIRE(result.is_error);
+    REQUIRE(result.content[0]["text"] == "Request cancelled");
+
+    si::foundation::CancellationToken deadline(
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(100));
+    result = client.call_tool("sleep", args, &deadline);
+    REQUIRE(result.is_error);
+
+    REQUIRE(std::chrono::steady_clock::now() - started <
+            std::chrono::seconds(2));
+  }
 }
@@ -1,6 +1,35 @@
 #include "si/foundation/logging.hpp"
+#include "si/rpc/admission.hpp"
+#include "si/rpc/api_bindings.hpp"
+#include "si/rpc/frame_decoder.hpp"
+#include "si/rpc/handoff.hpp"
+#include "si/rpc/http_transport.hpp"
+#include "si/rpc/method_stats.hpp"
+#include "si/rpc/output_coalescer.hpp"
+#include "si/rpc/remote_nodes.hpp"
+#include "si/rpc/response_cache.hpp"
 #include "si/rpc/server.hpp"
+#include "si/rpc/shm_channel.hpp"
+#include "si/rpc/worker_pool.hpp"
+#include "si/shell/block_manager.hpp"
+#include <algorithm>
+#include <atomic>
 #include <catch2/catch_all.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <httplib.h>
+#include <map>
+#include <mutex>
+#include <netinet/in.h>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
 
 using namespace si::rpc;
 
@@ -59,4 +88,2307 @@ TEST_CASE("RPC Server Request Handling", "[rpc]") {
     auto j = nlohmann::json::parse(response);
     REQUIRE(j["error"]["code"] == -32600);
   }
+
+  SECTION("Batch Request") {
+    std::string request =
+        R"([{"jsonrpc":"2.0","method":"test.echo","params":{"message":"a"},"id":1},)"
+        R"({"jsonrpc":"2.0","method":"test.echo","params":{"message":"n"}},)"
+        R"({"jsonrpc":"2.0","method":"unknown","id":2},)"
+        R"(1])";
+    auto j = nlohmann::json::parse(rpc.handle_request(request));
+
+    REQUIRE(j.is_array());
+    REQUIRE(j.size() == 3); // the notification gets no reply
+    REQUIRE(j[0]["result"]["echo"] == "a");
+    REQUIRE(j[1]["error"]["code"] == -32601);
+    REQUIRE(j[2]["error"]["code"] == -32600);
+  }
+
+  SECTION("Batch of notifications and empty batch") {
+    REQUIRE(rpc.handle_request(
+                R"([{"jsonrpc":"2.0","method":"test.echo"},)"
+                R"({"jsonrpc":"2.0","method":"test.echo"}])") == "");
+
+    auto j = nlohmann::json::parse(rpc.handle_request("[]"));
+    REQUIRE(j["error"]["code"] == -32600);
+  }
+
+  SECTION("rpc.stats counts calls and errors per method") {
+    rpc.register_method("test.fail",
+                        [](const nlohmann::json &) -> nlohmann::json {
+                          throw std::runtime_error("boom");
+                        });
+    auto before = rpc.method_stats("test.fail")["test.fail"];
+
+    rpc.handle_request(R"({"jsonrpc":"2.0","method":"test.fail","id":1})");
+    rpc.handle_request(R"({"jsonrpc":"2.0","method":"test.fail","id":2})");
+
+    auto j = nlohmann::json::parse(rpc.handle_request(
+        R"({"jsonrpc":"2.0","method":"rpc.stats",)"
+        R"("params":{"method":"test.fail"},"id":3})"));
+    auto stats = j["result"]["methods"]["test.fail"];
+    REQUIRE(j["result"]["methods"].size() == 1);
+    REQUIRE(stats["calls"].get<uint64_t>() ==
+            before["calls"].get<uint64_t>() + 2);
+    REQUIRE(stats["errors"].get<uint64_t>() ==
+            before["errors"].get<uint64_t>() + 2);
+    REQUIRE(stats["in_flight"] == 0);
+    REQUIRE(stats["handler"]["count"] == stats["calls"]);
+    REQUIRE(j["result"].contains("outbound"));
+  }
+}
+
+namespace {
+int connect_unix(const std::string &path) {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Read newline-delimited messages until `count` lines arrived or EOF
+std::vector<nlohmann::json> read_lines(int fd, size_t count) {
+  std::vector<nlohmann::json> out;
+  std::string buf;
+  char tmp[4096];
+  while (out.size() < count) {
+    ssize_t n = recv(fd, tmp, sizeof(tmp), 0);
+    if (n <= 0)
+      break;
+    buf.append(tmp, n);
+    size_t pos;
+    while ((pos = buf.find('\n')) != std::string::npos) {
+      out.push_back(nlohmann::json::parse(buf.substr(0, pos)));
+      buf.erase(0, pos + 1);
+    }
+  }
+  return out;
+}
+
+// read_lines() that also collects descriptors passed with SCM_RIGHTS
+std::vector<nlohmann::json> read_lines_with_fds(int fd, size_t count,
+                                                std::vector<int> &fds) {
+  std::vector<nlohmann::json> out;
+  std::string buf;
+  char tmp[4096];
+  while (out.size() < count) {
+    struct iovec iov = {tmp, sizeof(tmp)};
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * 8)];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    if (n <= 0)
+      break;
+    for (auto *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        continue;
+      size_t count_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      const int *passed = reinterpret_cast<const int *>(CMSG_DATA(cmsg));
+      fds.insert(fds.end(), passed, passed + count_fds);
+    }
+    buf.append(tmp, n);
+    size_t pos;
+    while ((pos = buf.find('\n')) != std::string::npos) {
+      out.push_back(nlohmann::json::parse(buf.substr(0, pos)));
+      buf.erase(0, pos + 1);
+    }
+  }
+  return out;
+}
+
+// Read length-prefixed binary frames until `count` arrived or EOF
+std::vector<nlohmann::json> read_frames(int fd, size_t count,
+                                        WireEncoding encoding) {
+  std::vector<nlohmann::json> out;
+  std::string buf;
+  char tmp[4096];
+  while (out.size() < count) {
+    ssize_t n = recv(fd, tmp, sizeof(tmp), 0);
+    if (n <= 0)
+      break;
+    buf.append(tmp, n);
+    while (buf.size() >= kFrameHeaderSize &&
+           buf.size() - kFrameHeaderSize >= read_frame_length(buf.data())) {
+      size_t length = read_frame_length(buf.data());
+      out.push_back(
+          decode_message(buf.data() + kFrameHeaderSize, length, encoding));
+      buf.erase(0, kFrameHeaderSize + length);
+    }
+  }
+  return out;
+}
+
+// Read length-prefixed frames as they are, with the compression flag
+std::vector<std::pair<bool, std::string>> read_raw_frames(int fd,
+                                                          size_t count) {
+  std::vector<std::pair<bool, std::string>> out;
+  std::string buf;
+  char tmp[4096];
+  while (out.size() < count) {
+    ssize_t n = recv(fd, tmp, sizeof(tmp), 0);
+    if (n <= 0)
+      break;
+    buf.append(tmp, n);
+    while (buf.size() >= kFrameHeaderSize) {
+      uint32_t header = read_frame_length(buf.data());
+      size_t length = header & ~kCompressedFrameFlag;
+      if (buf.size() - kFrameHeaderSize < length)
+        break;
+      out.emplace_back((header & kCompressedFrameFlag) != 0,
+                       buf.substr(kFrameHeaderSize, length));
+      buf.erase(0, kFrameHeaderSize + length);
+    }
+  }
+  return out;
+}
+} // anonymous namespace
+
+TEST_CASE("RPC Server Socket Transport", "[rpc]") {
+  auto &rpc = RpcServer::instance();
+  rpc.register_method("test.echo", [](const nlohmann::json &p) {
+    return nlohmann::json{{"echo", p.value("message", "")}};
+  });
+
+  rpc.register_method(
+      "test.slow",
+      [](const nlohmann::json &p) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        return nlohmann::json{{"slow", true}};
+      },
+      MethodClass::AI);
+  rpc.register_method(
+      "test.fast",
+      [](const nlohmann::json &p) { return nlohmann::json{{"fast", true}}; },
+      MethodClass::Inline);
+  // Waits up to 5 s for its cancellation token
+  rpc.register_method(
+      "test.wait",
+      [](const nlohmann::json &p, CallContext &ctx) {
+        for (int i = 0; i < 1000 && !ctx.cancel->is_cancelled(); i++)
+          std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        return nlohmann::json{{"waited", true}};
+      },
+      MethodClass::Blocking);
+
+  std::string path = "/tmp/si_test_rpc_" + std::to_string(getpid()) + ".sock";
+  rpc.set_max_frame_bytes(1024 * 1024);
+  REQUIRE(rpc.start(path));
+
+  SECTION("Pipelined requests and half-close") {
+    int fd = connect_unix(path);
+    REQUIRE(fd >= 0);
+
+    // Two requests and a notification in one write, split mid-message
+    std::string part1 =
+        R"({"jsonrpc":"2.0","method":"test.echo","params":{"message":"a"},"id":1})"
+        "\n"
+        R"({"jsonrpc":"2.0","method":"test.echo",)";
+    std::string part2 =
+        R"("params":{"message":"b"},"id":2})"
+        "\n"
+        R"({"jsonrpc":"2.0","method":"test.echo","params":{}})"
+        "\n";
+    REQUIRE(send(fd, part1.data(), part1.size(), 0) ==
+            (ssize_t)part1.size());
+    REQUIRE(send(fd, part2.data(), part2.size(), 0) ==
+            (ssize_t)part2.size());
+    shutdown(fd, SHUT_WR);
+
+    auto replies = read_lines(fd, 3);
+    REQUIRE(replies.size() == 2); // notification gets no reply
+    std::set<std::string> echoes;
+    for (auto &r : replies)
+      echoes.insert(r["result"]["echo"].get<std::string>());
+    REQUIRE(echoes == std::set<std::string>{"a", "b"});
+    close(fd);
+  }
+
+  SECTION("Slow handler does not block fast methods") {
+    int fd = connect_unix(path);
+    REQUIRE(fd >= 0);
+
+    std::string reqs =
+        R"({"jsonrpc":"2.0","method":"test.slow","params":{},"id":1})"
+        "\n"
+        R"({"jsonrpc":"2.0","method":"test.fast","params":{},"id":2})"
+        "\n";
+    send(fd, reqs.data(), reqs.size(), 0);
+
+    auto replies = read_lines(fd, 2);
+    REQUIRE(replies.size() == 2);
+    REQUIRE(replies[0]["id"] == 2);
+    REQUIRE(replies[1]["id"] == 1);
+    close(fd);
+  }
+
+  SECTION("Batch runs its calls concurrently") {
+    int fd = connect_unix(path);
+    REQUIRE(fd >= 0);
+
+    // Three slow AI calls share a two-thread pool: about two handler
+    // durations in parallel instead of three in sequence
+    std::string batch =
+        R"([{"jsonrpc":"2.0","method":"test.slow","id":1},)"
+        R"({"jsonrpc":"2.0","method":"test.slow","id":2},)"
+        R"({"jsonrpc":"2.0","method":"test.fast","id":3},)"
+        R"({"jsonrpc":"2.0","method":"test.slow","id":4}])"
+        "\n";
+    auto begin = std::chrono::steady_clock::now();
+    send(fd, batch.data(), batch.size(), 0);
+    auto replies = read_lines(fd, 1);
+    auto elapsed = std::chrono::steady_clock::now() - begin;
+
+    REQUIRE(replies.size() == 1);
+    REQUIRE(replies[0].is_array());
+    REQUIRE(replies[0].size() == 4);
+    for (size_t i = 0; i < 4; i++)
+      REQUIRE(replies[0][i]["id"] == i + 1);
+    REQUIRE(elapsed < std::chrono::milliseconds(850));
+    close(fd);
+  }
+
+  SECTION("Cancellation and deadlines") {
+    int fd = connect_unix(path);
+    REQUIRE(fd >= 0);
+    auto started = std::chrono::steady_clock::now();
+
+    std::string reqs =
+        R"({"jsonrpc":"2.0","method":"test.wait","id":"w1"})"
+        "\n"
+        R"({"jsonrpc":"2.0","method":"test.wait","id":2,"deadline_ms":50})"
+        "\n"
+        R"({"jsonrpc":"2.0","method":"test.wait","id":3,"deadline_ms":"x"})"
+        "\n"
+        R"({"jsonrpc":"2.0","method":"$/cancelRequest","params":{"id":"w1"}})"
+        "\n"
+        R"({"jsonrpc":"2.0","method":"$/cancelRequest","params":{"id":9},)"
+        R"("id":4})"
+        "\n";
+    send(fd, reqs.data(), reqs.size(), 0);
+
+    auto replies = read_lines(fd, 4);
+    REQUIRE(replies.size() == 4);
+    std::map<std::string, nlohmann::json> by_id;
+    for (auto &r : replies)
+      by_id[r["id"].dump()] = r;
+    REQUIRE(by_id[R"("w1")"]["error"]["code"] == -32800);
+    REQUIRE(by_id["2"]["error"]["code"] == -32001);
+    REQUIRE(by_id["3"]["error"]["code"] == -32600);
+    REQUIRE(by_id["4"]["result"]["success"] == false); // unknown id
+
+    // Neither handler ran its full 5 s
+    REQUIRE(std::chrono::steady_clock::now() - started <
+            std::chrono::seconds(2));
+    auto stats = rpc.method_stats("test.wait")["test.wait"];
+    REQUIRE(stats["in_flight"] == 0);
+    close(fd);
+  }
+
+  SECTION("Control methods are not stuck behind a busy pool") {
+    rpc.register_method(
+        "test.control",
+        [](const nlohmann::json &p) { return nlohmann::json{{"ok", true}}; },
+        MethodClass::Control);
+    int fd = connect_unix(path);
+    REQUIRE(fd >= 0);
+
+    // More waits than the blocking pool has threads
+    std::string reqs;
+    for (int i = 1; i <= 9; i++)
+      reqs += R"({"jsonrpc":"2.0","method":"test.wait","id":)" +
+              std::to_string(i) + "}\n";
+    reqs += R"({"jsonrpc":"2.0","method":"test.control","id":"c"})"
+            "\n";
+    send(fd, reqs.data(), reqs.size(), 0);
+
+    auto replies = read_lines(fd, 1);
+    REQUIRE(replies.size() == 1);
+    REQUIRE(replies[0]["id"] == "c");
+
+    std::string cancels;
+    for (int i = 1; i <= 9; i++)
+      cancels += R"({"jsonrpc":"2.0","method":"$/cancelRequest",)"
+                 R"("params":{"id":)" +
+                 std::to_string(i) + "}}\n";
+    send(fd, cancels.data(), cancels.size(), 0);
+    REQUIRE(read_lines(fd, 9).size() == 9);
+    close(fd);
+  }
+
+  SECTION("Broadcast reaches connected clients") {
+    int fd = connect_unix(path);
+    REQUIRE(fd >= 0);
+
+    // Round trip once so the server has registered the connection
+    std::string req =
+        R"({"jsonrpc":"2.0","method":"test.echo","params":{},"id":7})"
+        "\n";
+    send(fd, req.data(), req.size(), 0);
+    REQUIRE(read_lines(fd, 1).size() == 1);
+
+    rpc.broadcast("test.event", {{"value", 42}});
+    auto notes = read_lines(fd, 1);
+    REQUIRE(notes.size() == 1);
+    REQUIRE(notes[0]["method"] == "test.event");
+    REQUIRE(notes[0]["params"]["value"] == 42);
+    close(fd);
+  }
+
+  SECTION("session.init switches to a binary encoding") {
+    int fd = connect_unix(path);
+    REQUIRE(fd >= 0);
+
+    std::string init =
+        R"({"jsonrpc":"2.0","method":"session.init","params":{"encodings":["msgpack","json"]},"id":1})"
+        "\n";
+    send(fd, init.data(), init.size(), 0);
+    auto reply = read_lines(fd, 1);
+    REQUIRE(reply.size() == 1);
+    REQUIRE(reply[0]["result"]["encoding"] == "msgpack");
+
+    // Requests and replies are now length-prefixed MessagePack
+    std::string req = encode_message(
+        {{"jsonrpc", "2.0"}, {"method", "test.echo"},
+         {"params", {{"message", "bin"}}}, {"id", 2}},
+        {WireEncoding::MsgPack, Framing::LengthPrefixed});
+    send(fd, req.data(), req.size(), 0);
+    auto echo = read_frames(fd, 1, WireEncoding::MsgPack);
+    REQUIRE(echo.size() == 1);
+    REQUIRE(echo[0]["result"]["echo"] == "bin");
+
+    // block.output data arrives as a raw byte string
+    rpc.publish("block.output", {{"block_id", "b1"}, {"data", "ls\n"}},
+                {"s1", "b1", kTopicOutput});
+    auto notes = read_frames(fd, 1, WireEncoding::MsgPack);
+    REQUIRE(notes.size() == 1);
+    REQUIRE(notes[0]["params"]["data"].is_binary());
+    auto &bytes = notes[0]["params"]["data"].get_binary();
+    REQUIRE(std::string(bytes.begin(), bytes.end()) == "ls\n");
+    close(fd);
+  }
+
+  SECTION("Length-prefixed JSON carries large payloads") {
+    int fd = connect_unix(path);
+    REQUIRE(fd >= 0);
+
+    std::string init =
+        R"({"jsonrpc":"2.0","method":"session.init","params":{"framing":"length-prefixed"},"id":1})"
+        "\n";
+    send(fd, init.data(), init.size(), 0);
+    auto reply = read_lines(fd, 1);
+    REQUIRE(reply.size() == 1);
+    REQUIRE(reply[0]["result"]["encoding"] == "json");
+    REQUIRE(reply[0]["result"]["framing"] == "length-prefixed");
+
+    std::string payload(512 * 1024, 'p');
+    std::string req = encode_message({{"jsonrpc", "2.0"},
+                                      {"method", "test.echo"},
+                                      {"params", {{"message", payload}}},
+                                      {"id", 2}},
+                                     {WireEncoding::Json,
+                                      Framing::LengthPrefixed});
+    // Dribble it in so the frame spans many reads
+    for (size_t off = 0; off < req.size(); off += 100 * 1024)
+      send(fd, req.data() + off, std::min<size_t>(100 * 1024, req.size() - off),
+           0);
+    auto echo = read_frames(fd, 1, WireEncoding::Json);
+    REQUIRE(echo.size() == 1);
+    REQUIRE(echo[0]["result"]["echo"] == payload);
+    close(fd);
+  }
+
+  SECTION("Negotiated compression shrinks large frames") {
+    for (const auto &name : available_compressions()) {
+      Compression compression;
+      REQUIRE(parse_compression(name, compression));
+      int fd = connect_unix(path);
+      REQUIRE(fd >= 0);
+
+      std::string init =
+          nlohmann::json{{"jsonrpc", "2.0"},
+                         {"method", "session.init"},
+                         {"params", {{"compression", {"zstd", name}}}},
+                         {"id", 1}}
+              .dump() +
+          "\n";
+      send(fd, init.data(), init.size(), 0);
+      auto reply = read_lines(fd, 1);
+      REQUIRE(reply.size() == 1);
+      REQUIRE(reply[0]["result"]["compression"] == name);
+      REQUIRE(reply[0]["result"]["framing"] == "length-prefixed");
+      REQUIRE(reply[0]["result"]["compress_min_bytes"] == 1024);
+
+      // The client compresses too, with a stream of its own
+      auto compressor = Compressor::create(compression);
+      auto decompressor = Decompressor::create(compression);
+      std::string payload;
+      for (int i = 0; i < 5000; i++)
+        payload += "line " + std::to_string(i % 100) + " of some output\n";
+      WireFormat format{WireEncoding::Json, Framing::LengthPrefixed};
+      std::string reqs =
+          compress_frame(*compressor,
+                         encode_message({{"jsonrpc", "2.0"},
+                                         {"method", "test.echo"},
+                                         {"params", {{"message", payload}}},
+                                         {"id", 2}},
+                                        format)) +
+          encode_message({{"jsonrpc", "2.0"},
+                          {"method", "test.echo"},
+                          {"params", {{"message", "small"}}},
+                          {"id", 3}},
+                         format);
+      send(fd, reqs.data(), reqs.size(), 0);
+      auto frames = read_raw_frames(fd, 2);
+      REQUIRE(frames.size() == 2);
+
+      std::map<int, nlohmann::json> replies;
+      size_t big_frame = 0;
+      for (auto &[compressed, bytes] : frames) {
+        std::string message = bytes;
+        if (compressed) {
+          big_frame = bytes.size();
+          message.clear();
+          REQUIRE(decompressor->decompress(bytes.data(), bytes.size(),
+                                           message, 1 << 24));
+        }
+        auto json = nlohmann::json::parse(message);
+        replies[json["id"].get<int>()] = json;
+      }
+      REQUIRE(replies[2]["result"]["echo"] == payload);
+      REQUIRE(replies[3]["result"]["echo"] == "small");
+      REQUIRE(big_frame > 0);
+      REQUIRE(big_frame < payload.size() / 4);
+
+      // Notifications share the stream; a repeat costs next to nothing
+      std::string hex;
+      for (int i = 0; i < 1000; i++)
+        hex += std::to_string(i * 2654435761u % 100000);
+      auto note = nlohmann::json{{"block_id", "b1"}, {"data", hex}};
+      rpc.broadcast("block.output", note);
+      rpc.broadcast("block.output", note);
+      frames = read_raw_frames(fd, 2);
+      REQUIRE(frames.size() == 2);
+      REQUIRE(frames[0].first);
+      REQUIRE(frames[1].first);
+      REQUIRE(frames[1].second.size() < frames[0].second.size() / 4);
+      for (auto &[compressed, bytes] : frames) {
+        std::string message;
+        REQUIRE(decompressor->decompress(bytes.data(), bytes.size(), message,
+                                         1 << 24));
+        REQUIRE(nlohmann::json::parse(message)["params"]["data"] == hex);
+      }
+
+      // A corrupt frame ends the connection
+      std::string bad("\x80\0\0\x04garb", 8);
+      send(fd, bad.data(), bad.size(), 0);
+      frames = read_raw_frames(fd, 1);
+      REQUIRE(frames.size() == 1);
+      REQUIRE_FALSE(frames[0].first);
+      REQUIRE(nlohmann::json::parse(frames[0].second)["error"]["code"] ==
+              -32600);
+      char byte;
+      REQUIRE(recv(fd, &byte, 1, 0) == 0);
+      close(fd);
+    }
+  }
+
+  SECTION("Cached results are spliced into replies") {
+    auto cache = std::make_shared<ResponseCache>();
+    auto builds = std::make_shared<std::atomic<int>>(0);
+    rpc.register_method(
+        "test.cached",
+        [cache, builds](const nlohmann::json &p, CallContext &ctx) {
+          auto result = cache->get("key", 7, [&builds]() {
+            (*builds)++;
+            return nlohmann::json{{"items", {1, 2, 3}}, {"name", "a\"b\n"}};
+          });
+          ctx.cached_reply = {result, p.value("versioned", false)};
+          return nlohmann::json{{"ignored", true}};
+        },
+        MethodClass::Inline);
+    nlohmann::json expected{{"items", {1, 2, 3}}, {"name", "a\"b\n"}};
+
+    int fd = connect_unix(path);
+    REQUIRE(fd >= 0);
+    std::string reqs =
+        R"({"jsonrpc":"2.0","method":"test.cached","id":1})"
+        "\n"
+        R"({"jsonrpc":"2.0","method":"test.cached","params":{"versioned":true},"id":"two"})"
+        "\n"
+        R"([{"jsonrpc":"2.0","method":"test.cached","id":3}])"
+        "\n";
+    send(fd, reqs.data(), reqs.size(), 0);
+    auto replies = read_lines(fd, 3);
+    REQUIRE(replies.size() == 3);
+    REQUIRE(replies[0]["id"] == 1);
+    REQUIRE(replies[0]["result"] == expected);
+    REQUIRE(replies[1]["id"] == "two");
+    REQUIRE(replies[1]["result"]["data"] == expected);
+    REQUIRE(replies[1]["result"]["version"] == 7);
+    REQUIRE(replies[2][0]["result"] == expected);
+    close(fd);
+
+    auto direct = nlohmann::json::parse(rpc.handle_request(
+        R"({"jsonrpc":"2.0","method":"test.cached","params":{"versioned":true},"id":4})"));
+    REQUIRE(direct["result"]["data"] == expected);
+
+    // Binary encodings splice their own serialization of the result
+    for (const char *encoding : {"cbor", "msgpack"}) {
+      int bin = connect_unix(path);
+      REQUIRE(bin >= 0);
+      std::string init =
+          R"({"jsonrpc":"2.0","method":"session.init","params":{"encodings":[")" +
+          std::string(encoding) + R"("]},"id":1})" + "\n";
+      send(bin, init.data(), init.size(), 0);
+      REQUIRE(read_lines(bin, 1).size() == 1);
+
+      WireEncoding wire;
+      REQUIRE(parse_wire_encoding(encoding, wire));
+      std::string req = encode_message({{"jsonrpc", "2.0"},
+                                        {"method", "test.cached"},
+                                        {"params", {{"versioned", true}}},
+                                        {"id", 5}},
+                                       {wire, Framing::LengthPrefixed});
+      send(bin, req.data(), req.size(), 0);
+      auto reply = read_frames(bin, 1, wire);
+      REQUIRE(reply.size() == 1);
+      REQUIRE(reply[0]["jsonrpc"] == "2.0");
+      REQUIRE(reply[0]["id"] == 5);
+      REQUIRE(reply[0]["result"]["data"] == expected);
+      REQUIRE(reply[0]["result"]["version"] == 7);
+      close(bin);
+    }
+    REQUIRE(*builds == 1);
+  }
+
+  SECTION("Notifications to a single client") {
+    rpc.register_method(
+        "test.whoami",
+        [](const nlohmann::json &p, CallContext &ctx) {
+          return nlohmann::json{{"client_id", ctx.client_id}};
+        },
+        MethodClass::Inline);
+    int first = connect_unix(path);
+    int second = connect_unix(path);
+    REQUIRE(first >= 0);
+    REQUIRE(second >= 0);
+
+    std::string whoami =
+        R"({"jsonrpc":"2.0","method":"test.whoami","id":1})"
+        "\n";
+    send(first, whoami.data(), whoami.size(), 0);
+    auto reply = read_lines(first, 1);
+    REQUIRE(reply.size() == 1);
+    uint64_t id = reply[0]["result"]["client_id"];
+    send(second, whoami.data(), whoami.size(), 0);
+    REQUIRE(read_lines(second, 1).size() == 1);
+
+    REQUIRE(rpc.notify(id, "test.direct", {{"n", 1}}));
+    REQUIRE_FALSE(rpc.notify(id + 1000, "test.direct", {{"n", 2}}));
+    rpc.broadcast("test.event", {{"value", 1}});
+
+    auto notes = read_lines(first, 2);
+    REQUIRE(notes.size() == 2);
+    REQUIRE(notes[0]["method"] == "test.direct");
+    notes = read_lines(second, 1);
+    REQUIRE(notes.size() == 1);
+    REQUIRE(notes[0]["method"] == "test.event");
+    close(first);
+    close(second);
+  }
+
+  SECTION("HTTP transport shares methods and subscriptions") {
+    HttpTransport http(rpc);
+    REQUIRE(http.start({}));
+    httplib::Client client("127.0.0.1", http.port());
+
+    auto res = client.Post(
+        "/rpc", R"({"jsonrpc":"2.0","method":"test.echo","params":{"message":"hi"},"id":1})",
+        "application/json");
+    REQUIRE(res);
+    REQUIRE(res->status == 200);
+    REQUIRE(nlohmann::json::parse(res->body)["result"]["echo"] == "hi");
+
+    // Notifications only: no content
+    res = client.Post("/rpc", R"({"jsonrpc":"2.0","method":"test.echo"})",
+                      "application/json");
+    REQUIRE(res);
+    REQUIRE(res->status == 204);
+
+    // Cross-site pages and rebound host names are refused
+    res = client.Post("/rpc", {{"Origin", "http://evil.example"}},
+                      R"({"jsonrpc":"2.0","method":"test.echo","id":2})",
+                      "application/json");
+    REQUIRE(res);
+    REQUIRE(res->status == 403);
+    res = client.Post("/rpc", {{"Host", "evil.example"}},
+                      R"({"jsonrpc":"2.0","method":"test.echo","id":3})",
+                      "application/json");
+    REQUIRE(res);
+    REQUIRE(res->status == 403);
+
+    // An event stream is a client: subscribe through it and get pushes
+    std::mutex stream_mutex;
+    std::condition_variable stream_cv;
+    std::string client_header;
+    std::vector<nlohmann::json> events;
+    std::thread reader([&]() {
+      httplib::Client stream("127.0.0.1", http.port());
+      std::string buffer;
+      stream.Get(
+          "/events",
+          [&](const httplib::Response &response) {
+            std::lock_guard<std::mutex> lock(stream_mutex);
+            client_header = response.get_header_value("X-SI-Client");
+            stream_cv.notify_all();
+            return true;
+          },
+          [&](const char *data, size_t size) {
+            buffer.append(data, size);
+            size_t newline;
+            std::lock_guard<std::mutex> lock(stream_mutex);
+            while ((newline = buffer.find('\n')) != std::string::npos) {
+              std::string line = buffer.substr(0, newline);
+              buffer.erase(0, newline + 1);
+              if (!line.empty())
+                events.push_back(nlohmann::json::parse(line));
+            }
+            stream_cv.notify_all();
+            return events.empty();
+          });
+    });
+
+    {
+      std::unique_lock<std::mutex> lock(stream_mutex);
+      REQUIRE(stream_cv.wait_for(lock, std::chrono::seconds(5),
+                                 [&]() { return !client_header.empty(); }));
+    }
+    httplib::Headers as_stream{{"X-SI-Client", client_header}};
+    res = client.Post(
+        "/rpc", as_stream,
+        R"({"jsonrpc":"2.0","method":"rpc.subscribe","params":{"block_id":"hb"},"id":4})",
+        "application/json");
+    REQUIRE(res);
+    REQUIRE(nlohmann::json::parse(res->body)["result"]["success"] == true);
+
+    rpc.publish("block.output", {{"block_id", "other"}, {"data", "no"}},
+                {"s1", "other", kTopicOutput});
+    rpc.publish("block.output", {{"block_id", "hb"}, {"data", "yes"}},
+                {"s1", "hb", kTopicOutput});
+    {
+      std::unique_lock<std::mutex> lock(stream_mutex);
+      REQUIRE(stream_cv.wait_for(lock, std::chrono::seconds(5),
+                                 [&]() { return !events.empty(); }));
+      REQUIRE(events[0]["params"]["data"] == "yes");
+    }
+    reader.join();
+
+    // The stream is gone once its reader hangs up
+    uint64_t stream_id = std::stoull(client_header);
+    for (int i = 0; i < 300 && rpc.is_connected(stream_id); i++)
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    REQUIRE_FALSE(rpc.is_connected(stream_id));
+    res = client.Post("/rpc", as_stream,
+                      R"({"jsonrpc":"2.0","method":"test.echo","id":5})",
+                      "application/json");
+    REQUIRE(res);
+    REQUIRE(res->status == 404);
+    http.stop();
+  }
+
+  SECTION("Oversized frame is rejected") {
+    int fd = connect_unix(path);
+    REQUIRE(fd >= 0);
+
+    std::string junk(2 * 1024 * 1024, 'x'); // no newline, over 1 MiB
+    send(fd, junk.data(), junk.size(), MSG_NOSIGNAL);
+    auto replies = read_lines(fd, 2);
+    REQUIRE(replies.size() == 1); // then EOF
+    REQUIRE(replies[0]["error"]["code"] == -32600);
+    close(fd);
+  }
+
+  SECTION("Subscriptions route block events") {
+    auto call = [](int fd, const std::string &req) {
+      std::string line = req + "\n";
+      send(fd, line.data(), line.size(), 0);
+      return read_lines(fd, 1);
+    };
+
+    int legacy = connect_unix(path);
+    int by_session = connect_unix(path);
+    int by_block = connect_unix(path);
+    REQUIRE(legacy >= 0);
+    REQUIRE(by_session >= 0);
+    REQUIRE(by_block >= 0);
+
+    REQUIRE(call(legacy, R"({"jsonrpc":"2.0","method":"test.echo","id":1})")
+                .size() == 1);
+    auto reply = call(
+        by_session,
+        R"({"jsonrpc":"2.0","method":"rpc.subscribe","params":{"session_id":"s1","events":["complete"]},"id":1})");
+    REQUIRE(reply.size() == 1);
+    REQUIRE(reply[0]["result"]["success"] == true);
+    reply = call(
+        by_block,
+        R"({"jsonrpc":"2.0","method":"rpc.subscribe","params":{"block_id":"b2"},"id":1})");
+    REQUIRE(reply.size() == 1);
+    reply = call(
+        by_block,
+        R"({"jsonrpc":"2.0","method":"rpc.subscribe","params":{"events":["output"]},"id":2})");
+    REQUIRE(reply.size() == 1);
+    REQUIRE(reply[0].contains("error"));
+
+    rpc.publish("block.output", {{"block_id", "b1"}, {"data", "x"}},
+                {"s1", "b1", kTopicOutput});
+    rpc.publish("block.output", {{"block_id", "b2"}, {"data", "y"}},
+                {"s2", "b2", kTopicOutput});
+    rpc.publish("block.complete", {{"block_id", "b1"}},
+                {"s1", "b1", kTopicComplete});
+    rpc.broadcast("test.marker", {});
+
+    auto all = read_lines(legacy, 4);
+    REQUIRE(all.size() == 4);
+    REQUIRE(all[3]["method"] == "test.marker");
+
+    auto completions = read_lines(by_session, 2);
+    REQUIRE(completions.size() == 2);
+    REQUIRE(completions[0]["method"] == "block.complete");
+    REQUIRE(completions[1]["method"] == "test.marker");
+
+    auto outputs = read_lines(by_block, 2);
+    REQUIRE(outputs.size() == 2);
+    REQUIRE(outputs[0]["method"] == "block.output");
+    REQUIRE(outputs[0]["params"]["data"] == "y");
+    REQUIRE(outputs[1]["method"] == "test.marker");
+
+    // Unsubscribing from everything leaves only broadcasts
+    REQUIRE(call(by_block,
+                 R"({"jsonrpc":"2.0","method":"rpc.unsubscribe","params":{"block_id":"b2"},"id":3})")
+                .size() == 1);
+    rpc.publish("block.output", {{"block_id", "b2"}, {"data", "z"}},
+                {"s2", "b2", kTopicOutput});
+    rpc.broadcast("test.marker", {});
+    outputs = read_lines(by_block, 1);
+    REQUIRE(outputs.size() == 1);
+    REQUIRE(outputs[0]["method"] == "test.marker");
+
+    close(legacy);
+    close(by_session);
+    close(by_block);
+  }
+
+  SECTION("Shared-memory channel replaces block.output with doorbells") {
+    int fd = connect_unix(path);
+    REQUIRE(fd >= 0);
+    std::string req =
+        R"({"jsonrpc":"2.0","method":"rpc.shm.open",)"
+        R"("params":{"session_id":"shm","size_kb":64},"id":1})"
+        "\n";
+    send(fd, req.data(), req.size(), 0);
+
+    std::vector<int> fds;
+    auto reply = read_lines_with_fds(fd, 1, fds);
+    REQUIRE(reply.size() == 1);
+    REQUIRE(reply[0]["result"]["size"] == 64 * 1024);
+    REQUIRE(fds.size() == 1);
+
+    ShmRingReader reader(fds[0]);
+    REQUIRE(reader.valid());
+
+    rpc.shm_channels().write("shm", "b1", "stdout", "hello", 0);
+    rpc.shm_channels().write("other", "b9", "stdout", "nope", 0);
+    rpc.publish("block.output", {{"block_id", "b1"}, {"data", "hello"}},
+                {"shm", "b1", kTopicOutput});
+    rpc.publish("block.output_ready", {{"block_id", "b1"}, {"seq_end", 0}},
+                {"shm", "b1", kTopicOutputReady});
+    rpc.broadcast("test.marker", {});
+
+    auto events = read_lines_with_fds(fd, 2, fds);
+    REQUIRE(events.size() == 2);
+    REQUIRE(events[0]["method"] == "block.output_ready");
+    REQUIRE(events[1]["method"] == "test.marker");
+
+    ShmRingReader::Record record;
+    REQUIRE(reader.next(record) == ShmRingReader::Status::Record);
+    REQUIRE(record.block_id == "b1");
+    REQUIRE(record.type == "stdout");
+    REQUIRE(record.data == "hello");
+    REQUIRE(reader.next(record) == ShmRingReader::Status::Empty);
+
+    // Closing the channel brings block.output back
+    req = R"({"jsonrpc":"2.0","method":"rpc.shm.close",)"
+          R"("params":{"channel_id":)" +
+          reply[0]["result"]["channel_id"].dump() + R"(},"id":2})" + "\n";
+    send(fd, req.data(), req.size(), 0);
+    REQUIRE(read_lines_with_fds(fd, 1, fds)[0]["result"]["success"] == true);
+    rpc.publish("block.output", {{"block_id", "b1"}, {"data", "again"}},
+                {"shm", "b1", kTopicOutput});
+    events = read_lines_with_fds(fd, 1, fds);
+    REQUIRE(events.size() == 1);
+    REQUIRE(events[0]["method"] == "block.output");
+
+    REQUIRE(rpc.shm_channels().empty());
+    for (int f : fds)
+      close(f);
+    close(fd);
+  }
+
+  SECTION("Clients keep their connection state across a hot upgrade") {
+    // A compressed, length-prefixed client subscribed to a block
+    int packed = connect_unix(path);
+    REQUIRE(packed >= 0);
+    std::string init =
+        R"({"jsonrpc":"2.0","method":"session.init","params":)"
+        R"({"compression":["lz"]},"id":1})"
+        "\n";
+    send(packed, init.data(), init.size(), 0);
+    REQUIRE(read_lines(packed, 1)[0]["result"]["compression"] == "lz");
+    WireFormat format{WireEncoding::Json, Framing::LengthPrefixed};
+    auto compressor = Compressor::create(Compression::Lz);
+    auto decompressor = Decompressor::create(Compression::Lz);
+    auto call = [&](const nlohmann::json &request) {
+      std::string frame =
+          compress_frame(*compressor, encode_message(request, format));
+      send(packed, frame.data(), frame.size(), 0);
+    };
+    auto receive = [&]() {
+      auto frames = read_raw_frames(packed, 1);
+      REQUIRE(frames.size() == 1);
+      std::string message = frames[0].second;
+      if (frames[0].first) {
+        message.clear();
+        REQUIRE(decompressor->decompress(frames[0].second.data(),
+                                         frames[0].second.size(), message,
+                                         1 << 24));
+      }
+      return nlohmann::json::parse(message);
+    };
+    std::string payload;
+    for (int i = 0; i < 2000; i++)
+      payload += "output line " + std::to_string(i % 50) + "\n";
+    call({{"jsonrpc", "2.0"},
+          {"method", "rpc.subscribe"},
+          {"params", {{"block_id", "b1"}}},
+          {"id", 2}});
+    REQUIRE(receive()["result"]["success"] == true);
+    call({{"jsonrpc", "2.0"},
+          {"method", "test.echo"},
+          {"params", {{"message", payload}}},
+          {"id", 3}});
+    REQUIRE(receive()["result"]["echo"] == payload);
+    rpc.publish("block.output", {{"block_id", "b1"}, {"data", "early"}},
+                {"s1", "b1", kTopicOutput});
+
+    // A plain client with a request running and half of the next one sent
+    int plain = connect_unix(path);
+    REQUIRE(plain >= 0);
+    std::string wait = R"({"jsonrpc":"2.0","method":"test.wait","id":1})"
+                       "\n";
+    std::string half = R"({"jsonrpc":"2.0","method":"test.e)";
+    send(plain, wait.data(), wait.size(), 0);
+    send(plain, half.data(), half.size(), 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    auto &handoff = Handoff::instance();
+    int upgrades = handoff.upgrades();
+    int fd = handoff.pack();
+    REQUIRE(fd >= 0);
+    REQUIRE(handoff.resume(fd));
+    REQUIRE(handoff.upgrades() == upgrades + 1);
+
+    // The running request was cancelled; the rest of the line completes
+    auto lines = read_lines(plain, 1);
+    REQUIRE(lines.size() == 1);
+    REQUIRE(lines[0]["error"]["code"] == -32800);
+    std::string rest = R"(cho","params":{"message":"after"},"id":2})"
+                       "\n";
+    send(plain, rest.data(), rest.size(), 0);
+    lines = read_lines(plain, 1);
+    REQUIRE(lines.size() == 1);
+    REQUIRE(lines[0]["result"]["echo"] == "after");
+
+    // Both compression streams carry on, and so does the subscription
+    REQUIRE(receive()["params"]["data"] == "early");
+    call({{"jsonrpc", "2.0"},
+          {"method", "test.echo"},
+          {"params", {{"message", payload}}},
+          {"id", 4}});
+    auto reply = receive();
+    REQUIRE(reply["id"] == 4);
+    REQUIRE(reply["result"]["echo"] == payload);
+    rpc.publish("block.output", {{"block_id", "b2"}, {"data", "other"}},
+                {"s1", "b2", kTopicOutput});
+    rpc.publish("block.output", {{"block_id", "b1"}, {"data", "late"}},
+                {"s1", "b1", kTopicOutput});
+    REQUIRE(receive()["params"]["data"] == "late");
+
+    // New clients are accepted on the inherited socket
+    int fresh = connect_unix(path);
+    REQUIRE(fresh >= 0);
+    std::string echo =
+        R"({"jsonrpc":"2.0","method":"test.echo","params":{"message":"new"},"id":1})"
+        "\n";
+    send(fresh, echo.data(), echo.size(), 0);
+    lines = read_lines(fresh, 1);
+    REQUIRE(lines.size() == 1);
+    REQUIRE(lines[0]["result"]["echo"] == "new");
+
+    close(packed);
+    close(plain);
+    close(fresh);
+  }
+
+  rpc.stop();
+}
+
+TEST_CASE("RPC Remote Nodes", "[rpc]") {
+  auto &rpc = RpcServer::instance();
+  auto &blocks = si::shell::BlockManager::instance();
+
+  // A stand-in agent on this same server: block.execute starts a remote
+  // block whose output the test drives
+  struct Agent {
+    std::mutex mutex;
+    std::map<std::string, std::string> by_command; // command -> remote id
+    std::map<std::string, std::string> sessions;   // remote id -> session
+    std::map<std::string, std::vector<std::string>> chunks;
+    std::vector<std::pair<std::string, uint64_t>> resumed;
+    std::vector<nlohmann::json> inputs;
+  };
+  auto agent = std::make_shared<Agent>();
+
+  rpc.register_method("block.execute", [agent](const nlohmann::json &p) {
+    std::lock_guard<std::mutex> lock(agent->mutex);
+    std::string id = "remote-" + std::to_string(agent->by_command.size());
+    agent->by_command[p.at("command").get<std::string>()] = id;
+    agent->sessions[id] = p.at("session_id").get<std::string>();
+    agent->chunks[id];
+    return nlohmann::json{{"block_id", id}};
+  });
+  rpc.register_method(
+      "block.subscribe",
+      [agent, &rpc](const nlohmann::json &p, CallContext &ctx) {
+        std::string id = p.at("block_id").get<std::string>();
+        uint64_t since = p.value("since_seq", uint64_t{0});
+        std::lock_guard<std::mutex> lock(agent->mutex);
+        agent->resumed.emplace_back(id, since);
+        auto &chunks = agent->chunks[id];
+        for (uint64_t seq = since; seq < chunks.size(); seq++)
+          rpc.notify(ctx.client_id, "block.output",
+                     {{"block_id", id},
+                      {"data", chunks[seq]},
+                      {"type", "stdout"},
+                      {"seq_start", seq},
+                      {"seq_end", seq}});
+        rpc.subscriptions().subscribe_block(ctx.client_id, id, kTopicAll);
+        return nlohmann::json{{"block_id", id},
+                              {"next_seq", chunks.size()},
+                              {"state", 0},
+                              {"exit_code", 0}};
+      });
+  rpc.register_method(
+      "block.input",
+      [agent](const nlohmann::json &p) {
+        std::lock_guard<std::mutex> lock(agent->mutex);
+        agent->inputs.push_back(p);
+        return nlohmann::json{{"success", true}};
+      },
+      MethodClass::Control);
+
+  auto remote_id = [agent](const std::string &command) {
+    std::lock_guard<std::mutex> lock(agent->mutex);
+    auto it = agent->by_command.find(command);
+    return it != agent->by_command.end() ? it->second : std::string();
+  };
+  // Output published while the server is down is only kept for replay
+  auto emit = [agent, &rpc](const std::string &id, const std::string &data) {
+    std::lock_guard<std::mutex> lock(agent->mutex);
+    auto &chunks = agent->chunks[id];
+    uint64_t seq = chunks.size();
+    chunks.push_back(data);
+    rpc.publish("block.output",
+                {{"block_id", id},
+                 {"data", data},
+                 {"type", "stdout"},
+                 {"seq_start", seq},
+                 {"seq_end", seq}},
+                {agent->sessions[id], id, kTopicOutput});
+  };
+  auto complete = [agent, &rpc](const std::string &id, int exit_code) {
+    std::lock_guard<std::mutex> lock(agent->mutex);
+    rpc.publish("block.complete", {{"block_id", id}, {"exit_code", exit_code}},
+                {agent->sessions[id], id, kTopicComplete});
+  };
+  auto output_of = [&blocks](const std::string &block_id) {
+    std::string out;
+    if (auto block = blocks.get_block(block_id)) {
+      for (auto &chunk : block->output_chunks)
+        out += chunk.data;
+    }
+    return out;
+  };
+  auto wait_until = [](const std::function<bool()> &done) {
+    for (int i = 0; i < 500 && !done(); i++)
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    return done();
+  };
+
+  std::string path =
+      "/tmp/si_test_agent_" + std::to_string(getpid()) + ".sock";
+  REQUIRE(rpc.start(path));
+  REQUIRE(rpc.listen_tcp("127.0.0.1", 0, "secret"));
+  int port = rpc.tcp_port();
+  REQUIRE(port > 0);
+
+  SECTION("TCP clients must authenticate first") {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    REQUIRE(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+
+    std::string reqs =
+        R"({"jsonrpc":"2.0","method":"rpc.stats","id":1})"
+        "\n"
+        R"({"jsonrpc":"2.0","method":"rpc.auth","params":{"token":"nope"},"id":2})"
+        "\n"
+        R"({"jsonrpc":"2.0","method":"rpc.auth","params":{"token":"secret"},"id":3})"
+        "\n"
+        R"({"jsonrpc":"2.0","method":"rpc.shm.open","params":{"session_id":"s"},"id":4})"
+        "\n";
+    send(fd, reqs.data(), reqs.size(), 0);
+    auto replies = read_lines(fd, 4);
+    REQUIRE(replies.size() == 4);
+    REQUIRE(replies[0]["error"]["code"] == -32002);
+    REQUIRE(replies[1]["error"]["code"] == -32002);
+    REQUIRE(replies[2]["result"]["success"] == true);
+    REQUIRE(replies[3]["error"]["message"].get<std::string>().find(
+                "local socket") != std::string::npos);
+    close(fd);
+  }
+
+  SECTION("Blocks run on two nodes, within limits, across a reconnect") {
+    NodeOptions a;
+    a.name = "a";
+    a.host = "127.0.0.1";
+    a.port = port;
+    a.token = "secret";
+    a.max_concurrent = 1;
+    a.max_backoff = std::chrono::milliseconds(200);
+    NodeOptions b = a;
+    b.name = "b";
+    b.max_concurrent = 2;
+    auto &nodes = RemoteNodes::instance();
+    nodes.add(a);
+    nodes.add(b);
+
+    std::string first = blocks.create_block("nodes", "first", "");
+    std::string second = blocks.create_block("nodes", "second", "");
+    std::string third = blocks.create_block("nodes", "third", "");
+    nodes.find("a")->execute(first, "first", "", 80, 24);
+    nodes.find("a")->execute(second, "second", "", 80, 24);
+    nodes.find("b")->execute(third, "third", "", 80, 24);
+
+    // Node a runs one command at a time
+    REQUIRE(wait_until([&] {
+      return !remote_id("first").empty() && !remote_id("third").empty();
+    }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    REQUIRE(remote_id("second").empty());
+    REQUIRE(nodes.find("a")->status()["queued"] == 1);
+
+    std::string r1 = remote_id("first");
+    emit(r1, "one ");
+    REQUIRE(wait_until([&] { return output_of(first) == "one "; }));
+
+    // Output produced while disconnected is replayed on reconnect
+    rpc.stop();
+    emit(r1, "two ");
+    REQUIRE(rpc.start(path));
+    REQUIRE(rpc.listen_tcp("127.0.0.1", port, "secret"));
+    REQUIRE(wait_until([&] {
+      std::lock_guard<std::mutex> lock(agent->mutex);
+      return agent->resumed.size() == 2;
+    }));
+    {
+      std::lock_guard<std::mutex> lock(agent->mutex);
+      auto &resumed = agent->resumed;
+      REQUIRE(std::find(resumed.begin(), resumed.end(),
+                        std::make_pair(r1, uint64_t{1})) != resumed.end());
+    }
+    REQUIRE(wait_until([&] { return output_of(first) == "one two "; }));
+    emit(r1, "three");
+    complete(r1, 3);
+    REQUIRE(wait_until([&] {
+      auto block = blocks.get_block(first);
+      return block && block->state != si::shell::BlockState::RUNNING;
+    }));
+    REQUIRE(output_of(first) == "one two three");
+    REQUIRE(blocks.get_block(first)->exit_code == 3);
+
+    // The freed slot goes to the queued command
+    REQUIRE(wait_until([&] { return !remote_id("second").empty(); }));
+
+    // Control calls reach the agent with its block id
+    std::string r3 = remote_id("third");
+    auto node = nodes.owner(third);
+    REQUIRE(node == nodes.find("b"));
+    node->control(third, "block.input", {{"block_id", third}, {"data", "x"}});
+    {
+      std::lock_guard<std::mutex> lock(agent->mutex);
+      REQUIRE(agent->inputs.size() == 1);
+      REQUIRE(agent->inputs[0]["block_id"] == r3);
+    }
+
+    // Removing a node fails what still runs there
+    node.reset();
+    nodes.clear();
+    REQUIRE(blocks.get_block(second)->exit_code == -1);
+    REQUIRE(blocks.get_block(third)->exit_code == -1);
+  }
+
+  RemoteNodes::instance().clear();
+  rpc.stop();
+}
+
+TEST_CASE("RPC Admission Control", "[rpc]") {
+  SECTION("Token bucket") {
+    auto t0 = TokenBucket::Clock::now();
+    TokenBucket bucket(RateLimit{10, 2}, t0);
+    std::chrono::milliseconds retry_after{0};
+    REQUIRE(bucket.take(t0, retry_after));
+    REQUIRE(bucket.take(t0, retry_after));
+    REQUIRE_FALSE(bucket.take(t0, retry_after));
+    REQUIRE(retry_after.count() == 100);
+
+    // Refilled at 10/s, never above the burst
+    auto later = t0 + std::chrono::milliseconds(150);
+    REQUIRE(bucket.take(later, retry_after));
+    REQUIRE_FALSE(bucket.take(later, retry_after));
+    REQUIRE(retry_after.count() == 50);
+    later += std::chrono::seconds(10);
+    REQUIRE(bucket.take(later, retry_after));
+    REQUIRE(bucket.take(later, retry_after));
+    REQUIRE_FALSE(bucket.take(later, retry_after));
+
+    TokenBucket unlimited(RateLimit{}, t0);
+    for (int i = 0; i < 1000; i++)
+      REQUIRE(unlimited.take(t0, retry_after));
+  }
+
+  SECTION("Fair queuing between flows") {
+    WorkerPool pool("fair", 1);
+    pool.start();
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool open = false;
+    std::vector<int> order;
+    auto gate = [&] {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [&] { return open; });
+    };
+    auto record = [&](int flow) {
+      return [&, flow] {
+        std::lock_guard<std::mutex> lock(mutex);
+        order.push_back(flow);
+      };
+    };
+
+    // Hold the only thread while the queues fill up
+    REQUIRE(pool.submit(gate, 9));
+    while (pool.queued() != 0)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    for (int i = 0; i < 6; i++)
+      REQUIRE(pool.submit(record(1), 1, 2));
+    for (int i = 0; i < 6; i++)
+      REQUIRE(pool.submit(record(2), 2));
+    REQUIRE(pool.submit(record(3), 3));
+    REQUIRE(pool.queued() == 13);
+    REQUIRE(pool.queued(1) == 6);
+    REQUIRE(pool.flows() == 3);
+    // Shares of the 13 by weight: 6.5, 3.25 and 3.25
+    REQUIRE_FALSE(pool.over_share(1, 13));
+    REQUIRE(pool.over_share(2, 13));
+    REQUIRE_FALSE(pool.over_share(3, 13));
+    REQUIRE_FALSE(pool.over_share(2, 14));
+    REQUIRE_FALSE(pool.over_share(4, 13));
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      open = true;
+    }
+    cv.notify_all();
+    pool.stop();
+
+    // The late flow 3 is not stuck behind the others' backlogs, and flow 1
+    // (weight 2) runs its six tasks in the time flow 2 runs three
+    REQUIRE(order.size() == 13);
+    REQUIRE(std::find(order.begin(), order.end(), 3) - order.begin() < 3);
+    std::vector<int> first(order.begin(), order.begin() + 10);
+    REQUIRE(std::count(first.begin(), first.end(), 1) == 6);
+    REQUIRE(std::count(first.begin(), first.end(), 2) == 3);
+  }
+
+  SECTION("A serial pool runs a flow's tasks one at a time") {
+    WorkerPool pool("serial", 4, true);
+    pool.start();
+    std::mutex mutex;
+    std::map<int, std::vector<int>> order;
+    std::atomic<int> active[2] = {{0}, {0}};
+    std::atomic<int> overlaps{0};
+    std::atomic<int> most{0};
+    std::atomic<int> running{0};
+    for (int i = 0; i < 200; i++) {
+      for (int flow : {0, 1}) {
+        REQUIRE(pool.submit(
+            [&, flow, i] {
+              if (active[flow]++ > 0)
+                overlaps++;
+              int now = ++running;
+              for (int seen = most; now > seen;)
+                most.compare_exchange_weak(seen, now);
+              std::this_thread::sleep_for(std::chrono::microseconds(50));
+              {
+                std::lock_guard<std::mutex> lock(mutex);
+                order[flow].push_back(i);
+              }
+              running--;
+              active[flow]--;
+            },
+            static_cast<uint64_t>(flow + 1)));
+      }
+    }
+    pool.stop();
+
+    REQUIRE(overlaps == 0);
+    REQUIRE(most <= 2); // one per flow, however many threads
+    for (int flow : {0, 1}) {
+      REQUIRE(order[flow].size() == 200);
+      REQUIRE(std::is_sorted(order[flow].begin(), order[flow].end()));
+    }
+    REQUIRE(pool.queued() == 0);
+  }
+
+  auto &rpc = RpcServer::instance();
+  rpc.register_method("test.counted", [](const nlohmann::json &) {
+    return nlohmann::json{{"ok", true}};
+  });
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool open = false;
+  std::atomic<bool> entered{false};
+  rpc.register_method("test.gate", [&](const nlohmann::json &) {
+    entered = true;
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&] { return open; });
+    return nlohmann::json{{"ok", true}};
+  });
+  auto release = [&] {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      open = true;
+    }
+    cv.notify_all();
+  };
+  auto call = [](const std::string &method, int id) {
+    return R"({"jsonrpc":"2.0","method":")" + method + R"(","id":)" +
+           std::to_string(id) + "}";
+  };
+  auto request = [&](const std::string &method, int id) {
+    return call(method, id) + "\n";
+  };
+  auto by_id = [](const std::vector<nlohmann::json> &replies) {
+    std::map<int, nlohmann::json> map;
+    for (const auto &reply : replies)
+      map[reply["id"].get<int>()] = reply;
+    return map;
+  };
+  auto admission = [&] {
+    auto stats =
+        nlohmann::json::parse(rpc.handle_request(
+            R"({"jsonrpc":"2.0","method":"rpc.stats","id":1})"))["result"];
+    return stats["admission"];
+  };
+
+  std::string path =
+      "/tmp/si_test_admission_" + std::to_string(getpid()) + ".sock";
+
+  SECTION("Rate limit per client and class") {
+    AdmissionOptions options;
+    options.rates[static_cast<size_t>(MethodClass::Blocking)] = {1, 2};
+    rpc.set_admission_options(options);
+    REQUIRE(rpc.start(path));
+    uint64_t throttled = admission()["throttled"]["blocking"];
+
+    int fd = connect_unix(path);
+    REQUIRE(fd >= 0);
+    std::string reqs;
+    for (int i = 1; i <= 3; i++)
+      reqs += request("test.counted", i);
+    // Other classes have their own buckets
+    reqs += R"({"jsonrpc":"2.0","method":"rpc.stats","id":4})"
+            "\n";
+    send(fd, reqs.data(), reqs.size(), 0);
+    auto replies = by_id(read_lines(fd, 4));
+    REQUIRE(replies.size() == 4);
+    REQUIRE(replies[1]["result"]["ok"] == true);
+    REQUIRE(replies[2]["result"]["ok"] == true);
+    REQUIRE(replies[3]["error"]["code"] == -32005);
+    int retry_after = replies[3]["error"]["data"]["retry_after_ms"];
+    REQUIRE(retry_after > 0);
+    REQUIRE(retry_after <= 1000);
+    REQUIRE(replies[4].contains("result"));
+    REQUIRE(admission()["throttled"]["blocking"] == throttled + 1);
+    auto stats = rpc.method_stats("test.counted")["test.counted"];
+    REQUIRE(stats["rejected"] >= 1);
+
+    // A batch is charged call by call; a new client has a full bucket
+    int other = connect_unix(path);
+    std::string batch = "[" + call("test.counted", 5) + "," +
+                        call("test.counted", 6) + "," +
+                        call("test.counted", 7) + "]\n";
+    send(other, batch.data(), batch.size(), 0);
+    auto reply = read_lines(other, 1);
+    REQUIRE(reply.size() == 1);
+    auto batch_replies = by_id(reply[0].get<std::vector<nlohmann::json>>());
+    REQUIRE(batch_replies[5].contains("result"));
+    REQUIRE(batch_replies[6].contains("result"));
+    REQUIRE(batch_replies[7]["error"]["code"] == -32005);
+    close(other);
+    close(fd);
+  }
+
+  SECTION("Shedding the client behind the backlog") {
+    AdmissionOptions options;
+    options.shed_queue_per_thread = 1;
+    rpc.set_admission_options(options);
+    rpc.set_class_concurrency(MethodClass::Blocking, 1);
+    REQUIRE(rpc.start(path));
+    uint64_t shed = admission()["shed"]["blocking"];
+
+    int heavy = connect_unix(path);
+    int light = connect_unix(path);
+    REQUIRE(heavy >= 0);
+    REQUIRE(light >= 0);
+    std::string first = request("test.gate", 1);
+    send(heavy, first.data(), first.size(), 0);
+    while (!entered)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    // One more fits in the queue; past that the heavy client is refused
+    std::string reqs = request("test.counted", 2) +
+                       request("test.counted", 3) +
+                       request("test.counted", 4);
+    send(heavy, reqs.data(), reqs.size(), 0);
+    auto refused = by_id(read_lines(heavy, 2));
+    REQUIRE(refused.size() == 2);
+    REQUIRE(refused[3]["error"]["code"] == -32005);
+    REQUIRE(refused[3]["error"]["data"]["retry_after_ms"] > 0);
+    REQUIRE(refused[4]["error"]["code"] == -32005);
+    REQUIRE(admission()["shed"]["blocking"] == shed + 2);
+    REQUIRE(admission()["queued"]["blocking"] == 1);
+
+    // ...while a client with nothing queued still gets in
+    std::string mine = request("test.counted", 5);
+    send(light, mine.data(), mine.size(), 0);
+    for (int i = 0; i < 500 && admission()["queued"]["blocking"] != 2; i++)
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    REQUIRE(admission()["queued"]["blocking"] == 2);
+    release();
+    auto served = read_lines(light, 1);
+    REQUIRE(served.size() == 1);
+    REQUIRE(served[0]["result"]["ok"] == true);
+    auto rest = by_id(read_lines(heavy, 2));
+    REQUIRE(rest[1]["result"]["ok"] == true);
+    REQUIRE(rest[2]["result"]["ok"] == true);
+    close(light);
+    close(heavy);
+    rpc.set_class_concurrency(MethodClass::Blocking, 8);
+  }
+
+  release();
+  rpc.stop();
+  rpc.set_admission_options(AdmissionOptions{});
+}
+
+TEST_CASE("RPC Outbound Queue Slow-Client Policies", "[rpc]") {
+  auto encode = [](const std::string &method, const nlohmann::json &params) {
+    nlohmann::json msg{{"method", method}, {"params", params}};
+    return std::make_shared<const std::string>(msg.dump() + "\n");
+  };
+  auto output = [&](const std::string &block, const std::string &data,
+                    const std::string &type = "stdout") {
+    nlohmann::json params{{"block_id", block}, {"data", data}, {"type", type}};
+    return std::make_pair(params, encode("block.output", params));
+  };
+  // Write out everything currently queued, returning the frames' text
+  auto drain = [](OutboundQueue &q) {
+    std::string out;
+    struct iovec iov[64];
+    while (!q.empty()) {
+      size_t n = q.fill_iov(iov, 64);
+      size_t total = 0;
+      for (size_t i = 0; i < n; ++i) {
+        out.append(static_cast<char *>(iov[i].iov_base), iov[i].iov_len);
+        total += iov[i].iov_len;
+      }
+      q.consume(total);
+    }
+    return out;
+  };
+
+  OutboundOptions options;
+  options.max_queue_bytes = 200;
+
+  SECTION("Drop and resync") {
+    options.slow_client_policy = SlowClientPolicy::DropAndResync;
+    OutboundQueue q;
+    auto [p1, f1] = output("b1", std::string(120, 'x'));
+    auto [p2, f2] = output("b1", "tail");
+    REQUIRE(q.push_notification("block.output", p1, f1, options) ==
+            OutboundQueue::Admit::Queued);
+    REQUIRE(q.push_notification("block.output", p2, f2, options) ==
+            OutboundQueue::Admit::Dropped);
+    REQUIRE(q.stats().dropped_frames == 1);
+    REQUIRE(q.stats().dropped_bytes == f2->size());
+
+    // Replies still go through
+    q.push_response(encode("reply", {}));
+
+    drain(q);
+    REQUIRE(q.refill(options, encode));
+    REQUIRE(drain(q).find("rpc.resync") != std::string::npos);
+  }
+
+  SECTION("Coalesce merges held-back output per block") {
+    options.slow_client_policy = SlowClientPolicy::Coalesce;
+    OutboundQueue q;
+    auto [p1, f1] = output("b1", std::string(120, 'x'));
+    auto [p2, f2] = output("b1", "AB");
+    auto [p3, f3] = output("b2", "other");
+    auto [p4, f4] = output("b1", "CD");
+    REQUIRE(q.push_notification("block.output", p1, f1, options) ==
+            OutboundQueue::Admit::Queued);
+    REQUIRE(q.push_notification("block.output", p2, f2, options) ==
+            OutboundQueue::Admit::Parked);
+    REQUIRE(q.push_notification("block.output", p3, f3, options) ==
+            OutboundQueue::Admit::Parked);
+    REQUIRE(q.push_notification("block.output", p4, f4, options) ==
+            OutboundQueue::Admit::Coalesced);
+    REQUIRE(q.stats().coalesced_frames == 1);
+
+    drain(q);
+    REQUIRE_FALSE(q.refill(options, encode));
+    std::string released = drain(q);
+    REQUIRE(released.find("\"ABCD\"") != std::string::npos);
+    REQUIRE(released.find("\"ABCD\"") < released.find("other"));
+  }
+
+  SECTION("Coalesce keeps stdout and stderr apart") {
+    options.slow_client_policy = SlowClientPolicy::Coalesce;
+    options.max_queue_bytes = 400; // room for three parked frames
+    OutboundQueue q;
+    auto [p1, f1] = output("b1", std::string(300, 'x'));
+    auto [p2, f2] = output("b1", "out1");
+    auto [p3, f3] = output("b1", "err1", "stderr");
+    auto [p4, f4] = output("b1", "err2", "stderr");
+    auto [p5, f5] = output("b1", "out2");
+    REQUIRE(q.push_notification("block.output", p1, f1, options) ==
+            OutboundQueue::Admit::Queued);
+    REQUIRE(q.push_notification("block.output", p2, f2, options) ==
+            OutboundQueue::Admit::Parked);
+    REQUIRE(q.push_notification("block.output", p3, f3, options) ==
+            OutboundQueue::Admit::Parked);
+    REQUIRE(q.push_notification("block.output", p4, f4, options) ==
+            OutboundQueue::Admit::Coalesced);
+    REQUIRE(q.push_notification("block.output", p5, f5, options) ==
+            OutboundQueue::Admit::Parked);
+
+    drain(q);
+    q.refill(options, encode);
+    std::string released = drain(q);
+    REQUIRE(released.find("\"out1\"") != std::string::npos);
+    REQUIRE(released.find("\"err1err2\"") != std::string::npos);
+    REQUIRE(released.find("\"out1\"") < released.find("err1err2"));
+    REQUIRE(released.find("err1err2") < released.find("\"out2\""));
+  }
+
+  SECTION("Control replies jump ahead of queued frames") {
+    OutboundQueue q;
+    q.push_response(encode("first", {}));
+    q.push_response(encode("second", {}));
+
+    // Part of the first frame is already on the wire
+    struct iovec iov[4];
+    REQUIRE(q.fill_iov(iov, 4) == 2);
+    q.consume(3);
+    q.push_priority(encode("control1", {}));
+    q.push_priority(encode("control2", {}));
+
+    std::string out = drain(q);
+    REQUIRE(out.find("first") < out.find("control1"));
+    REQUIRE(out.find("control1") < out.find("control2"));
+    REQUIRE(out.find("control2") < out.find("second"));
+  }
+
+  SECTION("Disconnect") {
+    options.slow_client_policy = SlowClientPolicy::Disconnect;
+    OutboundQueue q;
+    auto [p1, f1] = output("b1", std::string(250, 'x'));
+    REQUIRE(q.push_notification("block.output", p1, f1, options) ==
+            OutboundQueue::Admit::Disconnect);
+  }
+}
+
+TEST_CASE("RPC Frame Decoder", "[rpc]") {
+  auto feed = [](FrameDecoder &decoder, const std::string &bytes) {
+    size_t off = 0;
+    while (off < bytes.size()) {
+      struct iovec iov[2];
+      size_t count = decoder.buffer().write_regions(iov, 1);
+      for (size_t i = 0; i < count && off < bytes.size(); i++) {
+        size_t n = std::min(iov[i].iov_len, bytes.size() - off);
+        memcpy(iov[i].iov_base, bytes.data() + off, n);
+        decoder.buffer().commit(n);
+        off += n;
+      }
+    }
+  };
+  auto next = [](FrameDecoder &decoder, std::string &frame) {
+    const char *data;
+    size_t size;
+    auto status = decoder.next(data, size);
+    if (status == FrameDecoder::Status::Frame)
+      frame.assign(data, size);
+    return status;
+  };
+
+  SECTION("Newline frames across the ring's wrap point") {
+    FrameDecoder decoder;
+    std::string frame;
+    // Small lines keep the 16 KiB ring from growing, so it wraps
+    for (int i = 0; i < 2000; i++) {
+      std::string line = "message-" + std::to_string(i);
+      feed(decoder, line + "\n");
+      REQUIRE(next(decoder, frame) == FrameDecoder::Status::Frame);
+      REQUIRE(frame == line);
+      REQUIRE(next(decoder, frame) == FrameDecoder::Status::NeedMore);
+    }
+    REQUIRE(decoder.buffer().capacity() == 16 * 1024);
+  }
+
+  SECTION("Partial lines and blank lines") {
+    FrameDecoder decoder;
+    std::string frame;
+    feed(decoder, "\n\nab");
+    REQUIRE(next(decoder, frame) == FrameDecoder::Status::NeedMore);
+    feed(decoder, "c\nd");
+    REQUIRE(next(decoder, frame) == FrameDecoder::Status::Frame);
+    REQUIRE(frame == "abc");
+    REQUIRE(next(decoder, frame) == FrameDecoder::Status::NeedMore);
+  }
+
+  SECTION("Length-prefixed frames keep embedded NULs") {
+    FrameDecoder decoder;
+    decoder.set_framing(Framing::LengthPrefixed);
+    std::string payload("a\0b\0c", 5);
+    std::string bytes = std::string("\0\0\0\x05", 4) + payload;
+    feed(decoder, bytes.substr(0, 3));
+    std::string frame;
+    REQUIRE(next(decoder, frame) == FrameDecoder::Status::NeedMore);
+    feed(decoder, bytes.substr(3) + bytes);
+    REQUIRE(next(decoder, frame) == FrameDecoder::Status::Frame);
+    REQUIRE(frame == payload);
+    REQUIRE(next(decoder, frame) == FrameDecoder::Status::Frame);
+    REQUIRE(frame == payload);
+    REQUIRE(next(decoder, frame) == FrameDecoder::Status::NeedMore);
+  }
+
+  SECTION("Large frames grow the buffer, which shrinks afterwards") {
+    FrameDecoder decoder;
+    decoder.set_framing(Framing::LengthPrefixed);
+    std::string payload(1024 * 1024, 'z');
+    feed(decoder, encode_message(payload, {WireEncoding::Json,
+                                           Framing::LengthPrefixed}));
+    std::string frame;
+    REQUIRE(next(decoder, frame) == FrameDecoder::Status::Frame);
+    REQUIRE(frame.size() == payload.size() + 2); // JSON string quotes
+    REQUIRE(next(decoder, frame) == FrameDecoder::Status::NeedMore);
+    REQUIRE(decoder.buffer().capacity() == 16 * 1024);
+  }
+
+  SECTION("Size limit") {
+    FrameDecoder decoder(1024);
+    std::string frame;
+    feed(decoder, std::string(2000, 'x'));
+    REQUIRE(next(decoder, frame) == FrameDecoder::Status::TooLarge);
+
+    FrameDecoder prefixed(1024);
+    prefixed.set_framing(Framing::LengthPrefixed);
+    feed(prefixed, std::string("\0\x01\0\0", 4));
+    REQUIRE(next(prefixed, frame) == FrameDecoder::Status::TooLarge);
+  }
+}
+
+TEST_CASE("RPC Compression", "[rpc]") {
+  // Text, repeats of earlier messages, runs, binary noise and empties
+  std::vector<std::string> messages;
+  std::string text;
+  for (int i = 0; i < 3000; i++)
+    text += "{\"path\":\"src/file_" + std::to_string(i * 7919 % 1000) +
+            ".cpp\",\"size\":" + std::to_string(i * 31) + "}\n";
+  uint32_t seed = 1;
+  std::string noise;
+  for (int i = 0; i < 100000; i++) {
+    seed = seed * 1103515245 + 12345;
+    noise.push_back(static_cast<char>(seed >> 16));
+  }
+  // The first two fit in either codec's window
+  messages = {text.substr(0, 20000),
+              text.substr(0, 20000),
+              text,
+              "",
+              std::string(200000, 'a'),
+              noise,
+              text.substr(1000, 5000),
+              std::string("\0\xff\0", 3),
+              noise.substr(0, 70000) + text};
+
+  for (const auto &name : available_compressions()) {
+    DYNAMIC_SECTION("Round trips through " << name) {
+      Compression compression;
+      REQUIRE(parse_compression(name, compression));
+      auto compressor = Compressor::create(compression);
+      auto decompressor = Decompressor::create(compression);
+      REQUIRE(compressor);
+      REQUIRE(decompressor);
+
+      std::vector<std::string> compressed;
+      for (const auto &message : messages) {
+        std::string out;
+        compressor->compress(message.data(), message.size(), out);
+        compressed.push_back(out);
+      }
+      for (size_t i = 0; i < messages.size(); i++) {
+        std::string out;
+        REQUIRE(decompressor->decompress(compressed[i].data(),
+                                         compressed[i].size(), out,
+                                         1 << 20));
+        REQUIRE(out == messages[i]);
+      }
+      REQUIRE(compressed[2].size() < text.size() / 3);
+      // The second copy is found in the stream's window
+      REQUIRE(compressed[1].size() < compressed[0].size() / 4);
+      REQUIRE(compressed[4].size() < 2000);
+      REQUIRE(compressed[5].size() < noise.size() + noise.size() / 50);
+    }
+
+    DYNAMIC_SECTION("Bad input through " << name) {
+      Compression compression;
+      REQUIRE(parse_compression(name, compression));
+      auto compressor = Compressor::create(compression);
+      std::string big(100000, 'b');
+      std::string out;
+      compressor->compress(big.data(), big.size(), out);
+
+      std::string inflated;
+      REQUIRE_FALSE(Decompressor::create(compression)->decompress(
+          out.data(), out.size(), inflated, 50000));
+      std::string truncated = out.substr(0, out.size() / 2);
+      inflated.clear();
+      auto decompressor = Decompressor::create(compression);
+      bool ok = decompressor->decompress(truncated.data(), truncated.size(),
+                                         inflated, 1 << 20);
+      REQUIRE((!ok || inflated != big));
+    }
+  }
+
+  SECTION("Lz is always available") {
+    REQUIRE(compression_available(Compression::Lz));
+    REQUIRE_FALSE(Compressor::create(Compression::None));
+    Compression compression;
+    REQUIRE_FALSE(parse_compression("brotli", compression));
+  }
+
+  SECTION("The decoder strips the flag once compression is negotiated") {
+    std::string frame = std::string("\x80\0\0\x03", 4) + "abc";
+    FrameDecoder plain(1024);
+    plain.set_framing(Framing::LengthPrefixed);
+    struct iovec iov[2];
+    size_t count = plain.buffer().write_regions(iov, frame.size());
+    REQUIRE(count >= 1);
+    memcpy(iov[0].iov_base, frame.data(), frame.size());
+    plain.buffer().commit(frame.size());
+    const char *data;
+    size_t size;
+    REQUIRE(plain.next(data, size) == FrameDecoder::Status::TooLarge);
+
+    FrameDecoder flagged(1024);
+    flagged.set_framing(Framing::LengthPrefixed);
+    flagged.set_compressed_frames(true);
+    count = flagged.buffer().write_regions(iov, frame.size());
+    memcpy(iov[0].iov_base, frame.data(), frame.size());
+    flagged.buffer().commit(frame.size());
+    REQUIRE(flagged.next(data, size) == FrameDecoder::Status::Frame);
+    REQUIRE(flagged.compressed());
+    REQUIRE(std::string(data, size) == "abc");
+  }
+}
+
+TEST_CASE("RPC Output Coalescer", "[rpc]") {
+  std::mutex mutex;
+  std::vector<OutputCoalescer::Output> sent;
+  auto sink = [&](const OutputCoalescer::Output &out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    sent.push_back(out);
+  };
+  auto sent_count = [&]() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return sent.size();
+  };
+
+  CoalescerOptions options;
+  options.window = std::chrono::milliseconds(20);
+  options.max_bytes = 64 * 1024;
+  OutputCoalescer coalescer(sink, options);
+
+  SECTION("First chunk after idle is sent at once") {
+    coalescer.append("s1", "b1", "stdout", "$ ", 0);
+    REQUIRE(sent_count() == 1);
+    REQUIRE(sent[0].data == "$ ");
+
+    // Echo within the window waits for it, then the block goes idle
+    coalescer.append("s1", "b1", "stdout", "l", 1);
+    REQUIRE(sent_count() == 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    REQUIRE(sent_count() == 2);
+    REQUIRE(sent[1].data == "l");
+    coalescer.append("s1", "b1", "stdout", "s", 2);
+    REQUIRE(sent_count() == 3);
+  }
+
+  SECTION("Floods collapse into few notifications in order") {
+    std::string chunk(4096, 'f');
+    std::string expected;
+    for (uint64_t seq = 0; seq < 1000; seq++) {
+      std::string data = chunk + std::to_string(seq);
+      expected += data;
+      coalescer.append("s1", "b1", "stdout", data, seq);
+    }
+    coalescer.finish("b1");
+
+    std::lock_guard<std::mutex> lock(mutex);
+    REQUIRE(sent.size() <= 100);
+    std::string received;
+    uint64_t next_seq = 0;
+    for (const auto &out : sent) {
+      REQUIRE(out.seq_start == next_seq);
+      REQUIRE(out.seq_end >= out.seq_start);
+      next_seq = out.seq_end + 1;
+      received += out.data;
+    }
+    REQUIRE(next_seq == 1000);
+    REQUIRE(received == expected);
+  }
+
+  SECTION("Only adjacent chunks of the same type merge") {
+    coalescer.append("s1", "b1", "stdout", "a", 0);
+    coalescer.append("s1", "b1", "stdout", "b", 1);
+    coalescer.append("s1", "b1", "stderr", "c", 2);
+    coalescer.append("s1", "b1", "stderr", "d", 3);
+    coalescer.finish("b1");
+
+    std::lock_guard<std::mutex> lock(mutex);
+    REQUIRE(sent.size() == 3);
+    REQUIRE(sent[1].data == "b");
+    REQUIRE(sent[2].type == "stderr");
+    REQUIRE(sent[2].data == "cd");
+    REQUIRE(sent[2].seq_start == 2);
+    REQUIRE(sent[2].seq_end == 3);
+  }
+
+  SECTION("A barrier flushes, then holds back later output") {
+    coalescer.append("s1", "b1", "stdout", "a", 0); // sent at once
+    coalescer.append("s1", "b1", "stdout", "b", 1); // waits for the window
+
+    std::optional<uint64_t> seen;
+    std::thread writer;
+    coalescer.barrier("b1", [&](std::optional<uint64_t> next_seq) {
+      seen = next_seq;
+      REQUIRE(sent_count() == 2);
+      writer = std::thread([&coalescer]() {
+        coalescer.append("s1", "b1", "stdout", "c", 2);
+        coalescer.finish("b1");
+      });
+      std::this_thread::sleep_for(std::chrono::milliseconds(60));
+      REQUIRE(sent_count() == 2);
+    });
+    writer.join();
+    REQUIRE(seen == 2);
+    REQUIRE(sent_count() == 3);
+    REQUIRE(sent[2].data == "c");
+  }
+
+  SECTION("A barrier on a block without output leaves nothing behind") {
+    std::optional<uint64_t> seen = 5;
+    coalescer.barrier("b2", [&](std::optional<uint64_t> next_seq) {
+      seen = next_seq;
+    });
+    REQUIRE(!seen);
+    // Still idle: the next chunk goes out at once
+    coalescer.append("s1", "b2", "stdout", "x", 0);
+    REQUIRE(sent_count() == 1);
+  }
+}
+
+TEST_CASE("RPC Latency Histogram", "[rpc]") {
+  SECTION("Buckets cover values with bounded relative error") {
+    for (uint64_t v : {0ull, 1ull, 15ull, 16ull, 17ull, 1000ull, 123456ull,
+                       999999999ull}) {
+      size_t bucket = LatencyHistogram::bucket_for(v);
+      REQUIRE(bucket < LatencyHistogram::kBuckets);
+      uint64_t upper = LatencyHistogram::bucket_upper_bound(bucket);
+      REQUIRE(upper >= v);
+      REQUIRE(upper - v <= v / 16);
+      if (bucket > 0)
+        REQUIRE(LatencyHistogram::bucket_upper_bound(bucket - 1) < v);
+    }
+    // Huge values clamp into the last bucket
+    REQUIRE(LatencyHistogram::bucket_for(UINT64_MAX) ==
+            LatencyHistogram::kBuckets - 1);
+  }
+
+  SECTION("Percentiles") {
+    LatencyHistogram histogram;
+    for (uint64_t us = 1; us <= 1000; us++)
+      histogram.record(us * 1000);
+
+    auto s = histogram.snapshot();
+    REQUIRE(s.count == 1000);
+    REQUIRE(s.max_ns == 1000000);
+    auto near = [](uint64_t got, uint64_t want) {
+      return got >= want && got <= want + want / 16;
+    };
+    REQUIRE(near(s.percentile(50), 500000));
+    REQUIRE(near(s.percentile(99), 990000));
+    REQUIRE(s.percentile(100) == 1000000);
+    REQUIRE(LatencyHistogram().snapshot().percentile(50) == 0);
+  }
+
+  SECTION("Concurrent recording loses nothing") {
+    LatencyHistogram histogram;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+      threads.emplace_back([&histogram, t]() {
+        for (int i = 0; i < 10000; i++)
+          histogram.record(static_cast<uint64_t>(t * 1000 + i));
+      });
+    }
+    for (auto &thread : threads)
+      thread.join();
+    REQUIRE(histogram.snapshot().count == 40000);
+  }
+}
+
+TEST_CASE("RPC Shared-Memory Ring", "[rpc]") {
+  auto ring = ShmRing::create(4096);
+  REQUIRE(ring);
+  REQUIRE(ring->capacity() == 4096);
+  int fd = ring->dup_reader_fd();
+  REQUIRE(fd >= 0);
+  ShmRingReader reader(fd);
+  close(fd);
+  REQUIRE(reader.valid());
+
+  ShmRingReader::Record record;
+  SECTION("Records survive wrapping") {
+    std::string chunk(300, 'x');
+    for (uint64_t seq = 0; seq < 100; seq++) {
+      chunk[0] = static_cast<char>('a' + seq % 26);
+      ring->write("block", seq % 2 ? "stderr" : "stdout", chunk, seq);
+      REQUIRE(reader.next(record) == ShmRingReader::Status::Record);
+      REQUIRE(record.kind == kShmRecordOutput);
+      REQUIRE(record.seq == seq);
+      REQUIRE(record.data == chunk);
+      REQUIRE(record.type == (seq % 2 ? "stderr" : "stdout"));
+    }
+    REQUIRE(reader.next(record) == ShmRingReader::Status::Empty);
+  }
+
+  SECTION("Huge chunks become skip markers") {
+    ring->write("block", "stdout", std::string(3000, 'y'), 7);
+    REQUIRE(reader.next(record) == ShmRingReader::Status::Record);
+    REQUIRE(record.kind == kShmRecordSkipped);
+    REQUIRE(record.seq == 7);
+    REQUIRE(record.data.empty());
+  }
+
+  SECTION("A reader that falls behind sees an overrun") {
+    for (uint64_t seq = 0; seq < 40; seq++)
+      ring->write("block", "stdout", std::string(200, 'z'), seq);
+    REQUIRE(reader.next(record) == ShmRingReader::Status::Overrun);
+    REQUIRE(reader.next(record) == ShmRingReader::Status::Empty);
+    ring->write("block", "stdout", "after", 40);
+    REQUIRE(reader.next(record) == ShmRingReader::Status::Record);
+    REQUIRE(record.seq == 40);
+  }
+}
+
+TEST_CASE("RPC Response Cache", "[rpc]") {
+  ResponseCache cache(2);
+  int builds = 0;
+  auto build = [&builds]() {
+    builds++;
+    return nlohmann::json::array({builds});
+  };
+
+  SECTION("Entries are rebuilt when the version moves") {
+    auto first = cache.get("a", 1, build);
+    REQUIRE(cache.get("a", 1, build) == first);
+    REQUIRE(builds == 1);
+
+    auto second = cache.get("a", 2, build);
+    REQUIRE(second != first);
+    REQUIRE(second->version() == 2);
+    REQUIRE(second->value() == nlohmann::json::array({2}));
+    REQUIRE(builds == 2);
+  }
+
+  SECTION("The entry count is bounded") {
+    cache.get("a", 1, build);
+    cache.get("b", 1, build);
+    cache.get("c", 1, build);
+    REQUIRE(cache.size() == 2);
+  }
+
+  SECTION("Encodings match a full serialization") {
+    CachedResult result(9, {{"x", {true, nullptr, 1.5}}, {"y", "text"}});
+    for (auto encoding :
+         {WireEncoding::Json, WireEncoding::Cbor, WireEncoding::MsgPack}) {
+      auto bare = result.encoded(encoding, false);
+      REQUIRE(decode_message(bare.data(), bare.size(), encoding) ==
+              result.value());
+      auto versioned = result.encoded(encoding, true);
+      REQUIRE(decode_message(versioned.data(), versioned.size(), encoding) ==
+              result.to_json(true));
+    }
+  }
+}
+
+TEST_CASE("RPC Direct Encoding", "[rpc]") {
+  nlohmann::json result = {{"blocks", {{{"id", "b1"}, {"exit_code", -1}}}},
+                           {"text", "caf\xc3\xa9 \"quoted\"\n"}};
+  const WireFormat formats[] = {
+      {WireEncoding::Json, Framing::Newline},
+      {WireEncoding::Json, Framing::LengthPrefixed},
+      {WireEncoding::Cbor, Framing::LengthPrefixed},
+      {WireEncoding::MsgPack, Framing::LengthPrefixed}};
+
+  SECTION("Direct replies match a serialized response object") {
+    const nlohmann::json ids[] = {7, "a"};
+    for (const auto &format : formats) {
+      for (const auto &id : ids) {
+        auto expected = encode_message(
+            {{"jsonrpc", "2.0"}, {"result", result}, {"id", id}}, format);
+        REQUIRE(encode_response(id, result, format) == expected);
+        REQUIRE(splice_response(id, encode_value(result, format.encoding),
+                                format) == expected);
+      }
+    }
+  }
+
+  SECTION("Notifications match a serialized message object") {
+    // Sizes around each length form of strings, byte strings and maps
+    const std::string pattern = "ls \"a\\b\"\x1b[0m\r\n\t\x01\x7f caf\xc3\xa9 "
+                                "\xe2\x82\xac\xf0\x9f\x98\x80";
+    for (size_t size : {0, 23, 24, 31, 255, 256, 65535, 65536, 100000}) {
+      std::string data;
+      while (data.size() + pattern.size() <= size)
+        data += pattern;
+      data.append(size - data.size(), 'x');
+      nlohmann::json params = {{"block_id", "b1"},
+                               {"data", data},
+                               {"seq_end", 4},
+                               {"seq_start", 3},
+                               {std::string(40, 'k'), "long key"}};
+      for (int i = 0; i < 20; i++)
+        params["extra" + std::to_string(i)] = i;
+      for (const auto &format : formats) {
+        nlohmann::json message = {
+            {"jsonrpc", "2.0"}, {"method", "block.output"}, {"params", params}};
+        REQUIRE(encode_notification("block.output", params, format) ==
+                encode_message(message, format));
+
+        // Output data goes to the binary encodings as a byte string
+        if (format.encoding != WireEncoding::Json) {
+          const auto &data = params["data"].get_ref<const std::string &>();
+          message["params"]["data"] = nlohmann::json::binary(
+              std::vector<std::uint8_t>(data.begin(), data.end()));
+        }
+        REQUIRE(encode_notification("block.output", params, format, true) ==
+                encode_message(message, format));
+      }
+    }
+
+    // Invalid UTF-8 cannot go out as JSON
+    REQUIRE_THROWS(encode_notification("block.output", {{"data", "\xff"}},
+                                       formats[0], true));
+
+    std::string method(40, 'm');
+    for (const auto &format : formats) {
+      REQUIRE(encode_notification(method, {1, 2}, format) ==
+              encode_message(
+                  {{"jsonrpc", "2.0"}, {"method", method}, {"params", {1, 2}}},
+                  format));
+    }
+  }
+
+  SECTION("Large messages do not disturb later ones") {
+    nlohmann::json big = {{"data", std::string(3 * 1024 * 1024, 'x')}};
+    for (const auto &format : formats) {
+      auto frame = encode_response(1, big, format);
+      REQUIRE(frame.size() > 3 * 1024 * 1024);
+      REQUIRE(encode_response(2, true, format) ==
+              encode_message(
+                  {{"jsonrpc", "2.0"}, {"result", true}, {"id", 2}}, format));
+    }
+  }
+}
+
+TEST_CASE("RPC Block Subscribe", "[rpc]") {
+  auto &rpc = RpcServer::instance();
+  auto &blocks = si::shell::BlockManager::instance();
+
+  // Reads messages until a block.complete for block_id, keeping the rest
+  auto read_until_complete = [](int fd, const std::string &block_id) {
+    std::vector<nlohmann::json> out;
+    std::string buf;
+    char tmp[4096];
+    while (true) {
+      ssize_t n = recv(fd, tmp, sizeof(tmp), 0);
+      if (n <= 0)
+        return out;
+      buf.append(tmp, n);
+      size_t pos;
+      while ((pos = buf.find('\n')) != std::string::npos) {
+        out.push_back(nlohmann::json::parse(buf.substr(0, pos)));
+        buf.erase(0, pos + 1);
+        if (out.back().value("method", "") == "block.complete" &&
+            out.back()["params"]["block_id"] == block_id)
+          return out;
+      }
+    }
+  };
+  // Each chunk from since_seq on arrives once, in order
+  auto check_output = [](const std::vector<nlohmann::json> &messages,
+                         uint64_t since_seq, uint64_t chunks) {
+    uint64_t next = since_seq;
+    std::string data, expected;
+    for (const auto &message : messages) {
+      if (message.value("method", "") != "block.output")
+        continue;
+      const auto &params = message["params"];
+      REQUIRE(params["seq_start"] == next);
+      next = params["seq_end"].get<uint64_t>() + 1;
+      data += params["data"].get<std::string>();
+    }
+    REQUIRE(next == chunks);
+    for (uint64_t seq = since_seq; seq < chunks; seq++)
+      expected += "c" + std::to_string(seq) + " ";
+    REQUIRE(data == expected);
+  };
+
+  // Output written before the bindings are in place never reaches the
+  // coalescer, as after a hot upgrade
+  blocks.set_update_callback({});
+  std::string block_id = blocks.create_block("subscribe", "producer", "");
+  for (int seq = 0; seq < 20; seq++)
+    blocks.append_output(block_id, "c" + std::to_string(seq) + " ");
+  register_api_bindings();
+
+  std::string path =
+      "/tmp/si_test_subscribe_" + std::to_string(getpid()) + ".sock";
+  REQUIRE(rpc.start(path));
+  int fd = connect_unix(path);
+  REQUIRE(fd >= 0);
+  // Only completions until block.subscribe asks for the output
+  std::string req =
+      R"({"jsonrpc":"2.0","method":"rpc.subscribe","params":{"session_id":"subscribe","events":["complete"]},"id":1})"
+      "\n";
+  send(fd, req.data(), req.size(), 0);
+  REQUIRE(read_lines(fd, 1)[0]["result"]["success"] == true);
+
+  auto subscribe = [&](uint64_t since_seq) {
+    nlohmann::json call = {{"jsonrpc", "2.0"},
+                           {"method", "block.subscribe"},
+                           {"params",
+                            {{"block_id", block_id}, {"since_seq", since_seq}}},
+                           {"id", 2}};
+    std::string line = call.dump() + "\n";
+    send(fd, line.data(), line.size(), 0);
+  };
+
+  SECTION("Replay of output the coalescer never saw") {
+    subscribe(5);
+    auto replies = read_lines(fd, 2);
+    REQUIRE(replies.size() == 2);
+    REQUIRE(replies[0]["method"] == "block.output");
+    REQUIRE(replies[1]["result"]["replayed"] == 15);
+    REQUIRE(replies[1]["result"]["next_seq"] == 20);
+
+    blocks.append_output(block_id, "c20 ");
+    blocks.complete_block(block_id, 0);
+    auto messages = replies;
+    auto rest = read_until_complete(fd, block_id);
+    messages.insert(messages.end(), rest.begin(), rest.end());
+    check_output(messages, 5, 21);
+  }
+
+  SECTION("Replay while output keeps coming") {
+    constexpr int kChunks = 2000;
+    std::thread producer([&] {
+      for (int seq = 20; seq < kChunks; seq++) {
+        blocks.append_output(block_id, "c" + std::to_string(seq) + " ");
+        if (seq % 50 == 0)
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      blocks.complete_block(block_id, 0);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    subscribe(10);
+    auto messages = read_until_complete(fd, block_id);
+    producer.join();
+
+    auto reply = std::find_if(messages.begin(), messages.end(),
+                              [](const nlohmann::json &m) {
+                                return m.value("id", 0) == 2;
+                              });
+    REQUIRE(reply != messages.end());
+    REQUIRE((*reply)["result"]["block_id"] == block_id);
+    check_output(messages, 10, kChunks);
+  }
+
+  close(fd);
+  rpc.stop();
+}
+
+TEST_CASE("RPC Control Lane", "[rpc]") {
+  auto &rpc = RpcServer::instance();
+  auto &blocks = si::shell::BlockManager::instance();
+  register_api_bindings();
+
+  std::string path =
+      "/tmp/si_test_control_" + std::to_string(getpid()) + ".sock";
+  REQUIRE(rpc.start(path));
+  int fd = connect_unix(path);
+  REQUIRE(fd >= 0);
+  auto call = [&](int id, const std::string &method, nlohmann::json params) {
+    return nlohmann::json{{"jsonrpc", "2.0"},
+                          {"method", method},
+                          {"params", std::move(params)},
+                          {"id", id}}
+               .dump() +
+           "\n";
+  };
+  // Replies only: the blocks' notifications go to another session's
+  // subscribers
+  std::string req = call(1, "rpc.subscribe",
+                         {{"session_id", "control-lane-idle"},
+                          {"events", {"complete"}}});
+  send(fd, req.data(), req.size(), 0);
+  REQUIRE(read_lines(fd, 1)[0]["result"]["success"] == true);
+
+  auto execute = [&](const std::string &command) {
+    std::string line = call(2, "block.execute",
+                            {{"session_id", "control-lane"},
+                             {"command", command},
+                             {"cwd", "/tmp"}});
+    send(fd, line.data(), line.size(), 0);
+    auto reply = read_lines(fd, 1);
+    REQUIRE(reply.size() == 1);
+    std::string block_id = reply[0]["result"]["block_id"];
+    auto &processes = si::shell::BlockProcesses::instance();
+    for (int i = 0; i < 500 && !processes.is_running(block_id); i++)
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    REQUIRE(processes.is_running(block_id));
+    return block_id;
+  };
+  auto wait_finished = [&](const std::string &block_id) {
+    for (int i = 0; i < 1000; i++) {
+      auto block = blocks.get_block(block_id);
+      if (block && block->state != si::shell::BlockState::RUNNING)
+        return true;
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+  };
+
+  SECTION("Pipelined keystrokes reach the terminal in order") {
+    std::string file =
+        "/tmp/si_test_control_" + std::to_string(getpid()) + ".txt";
+    std::string block_id = execute("stty -echo; cat > " + file);
+
+    constexpr int kCalls = 500;
+    std::string reqs, expected;
+    for (int i = 0; i < kCalls; i++) {
+      std::string data = "line " + std::to_string(i) + "\n";
+      expected += data;
+      reqs += call(100 + i, "block.input",
+                   {{"block_id", block_id}, {"data", data}});
+    }
+    // End of input: cat exits
+    reqs += call(100 + kCalls, "block.input",
+                 {{"block_id", block_id}, {"data", "\x04"}});
+    send(fd, reqs.data(), reqs.size(), 0);
+
+    auto replies = read_lines(fd, kCalls + 1);
+    REQUIRE(replies.size() == kCalls + 1);
+    for (const auto &reply : replies)
+      REQUIRE(reply["result"]["success"] == true);
+    REQUIRE(wait_finished(block_id));
+
+    std::ifstream in(file);
+    std::stringstream content;
+    content << in.rdbuf();
+    REQUIRE(content.str() == expected);
+    unlink(file.c_str());
+  }
+
+  SECTION("A child that does not read holds up no Control call") {
+    std::string block_id = execute("stty raw -echo; sleep 30");
+
+    // Far more than the terminal buffers; every call still returns at once
+    std::string chunk(64 * 1024, 'x');
+    std::string reqs;
+    for (int i = 0; i < 8; i++)
+      reqs += call(100 + i, "block.input",
+                   {{"block_id", block_id}, {"data", chunk}});
+    reqs += call(200, "block.kill",
+                 {{"block_id", block_id}, {"signal", "KILL"}});
+    auto start = std::chrono::steady_clock::now();
+    send(fd, reqs.data(), reqs.size(), 0);
+
+    auto replies = read_lines(fd, 9);
+    REQUIRE(replies.size() == 9);
+    for (const auto &reply : replies)
+      REQUIRE(reply["result"]["success"] == true);
+    REQUIRE(wait_finished(block_id));
+    REQUIRE(std::chrono::steady_clock::now() - start <
+            std::chrono::seconds(10));
+  }
+
+  close(fd);
+  rpc.stop();
 }